@@ -4,6 +4,12 @@
 
 .globl _start
 .globl exit
+.globl __phantom_bounds_fail
+
+# defined by programs built with `-fprofile-generate`, zero otherwise
+.weak __phantom_profile_path
+.weak __phantom_profile_header, __phantom_profile_header_end
+.weak __phantom_profile_counters, __phantom_profile_counters_end
 
 _start:
     xor %rbp, %rbp
@@ -16,7 +22,59 @@ _start:
     mov %rax, %rdi
     call exit
 
+# called by `-fbounds-check` code on an out of bounds index
+__phantom_bounds_fail:
+    mov $1, %rax
+    mov $2, %rdi
+    lea bounds_message(%rip), %rsi
+    mov $bounds_message_end - bounds_message, %rdx
+    syscall
+
+    mov $134, %rdi
+    call exit
+
 exit:
+    mov %rdi, %r12
+
+    # write the profile: open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644),
+    # the header, the counters, close
+    movabs $__phantom_profile_path, %rdi
+    test %rdi, %rdi
+    jz 1f
+
+    mov $2, %rax
+    mov $0x241, %rsi
+    mov $0644, %rdx
+    syscall
+    test %rax, %rax
+    js 1f
+    mov %rax, %r13
+
+    mov $1, %rax
+    mov %r13, %rdi
+    movabs $__phantom_profile_header, %rsi
+    movabs $__phantom_profile_header_end, %rdx
+    sub %rsi, %rdx
+    syscall
+
+    mov $1, %rax
+    mov %r13, %rdi
+    movabs $__phantom_profile_counters, %rsi
+    movabs $__phantom_profile_counters_end, %rdx
+    sub %rsi, %rdx
+    syscall
+
+    mov $3, %rax
+    mov %r13, %rdi
+    syscall
+
+1:
+    mov %r12, %rdi
     mov $60, %rax
     syscall
     hlt
+
+.section .rodata
+bounds_message:
+    .ascii "array index out of bounds\n"
+bounds_message_end:
@@ -0,0 +1,53 @@
+#!/bin/bash
+# Pass throughput benchmark: generates a program of many functions with
+# loops, branches, arrays and calls, then reports the -O2 pipeline timings
+# and the size of the IR it ends up with.
+#
+# usage: bench/passes.sh [phantom] [functions] [extra phantom flags...]
+
+PHANTOM=${1:-./build/phantom}
+FUNCTIONS=${2:-2000}
+shift $(($# < 2 ? $# : 2))
+
+SOURCE=$(mktemp --suffix=.ph)
+trap 'rm -f "$SOURCE"' EXIT
+
+{
+  echo "fn work0(n: i32, x: f64) -> i32 {"
+  echo "  return n;"
+  echo "}"
+
+  for ((i = 1; i < FUNCTIONS; i++)); do
+    cat <<PH
+
+fn work$i(n: i32, x: f64) -> i32 {
+  let a: i32[8] = [1, 2, 3, 4, 5, 6, 7, $i];
+  let s: i32 = $i;
+  let t: f64 = x;
+
+  for (let k: i32 = 0; k < n; k = k + 1) {
+    s = s + a[k % 8] * 3 + k / 2;
+    if s > 1000 {
+      s = s - 999;
+    } else {
+      t = t * 1.5 + 2.0;
+    }
+  }
+
+  let u: i32 = n * 8 + s * 2 - (n * 8);
+  while u > 100 {
+    u = u / 2 + s - s;
+  }
+
+  return u + work$((i - 1))(n - 1, t);
+}
+PH
+  done
+
+  echo
+  echo "fn main() -> i32 {"
+  echo "  return work$((FUNCTIONS - 1))(8, 1.0);"
+  echo "}"
+} >"$SOURCE"
+
+"$PHANTOM" "$@" --time-passes "$SOURCE" >/dev/null
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Profile-guided optimization round: builds a program with
+# -fprofile-generate, runs it to collect the profile, rebuilds it with
+# -fprofile-use and reports the run time of the plain and the PGO builds.
+#
+# usage: bench/pgo.sh <program.ph> [phantom] [extra phantom flags...]
+
+SOURCE=$1
+PHANTOM=${2:-./build/phantom}
+shift $(($# < 2 ? $# : 2))
+
+RT=$(dirname "$0")/../arch/x86_64/phrt0.s
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# build <name> [phantom flags...]
+build() {
+  local name=$1
+  shift
+  "$PHANTOM" "$@" "$SOURCE" >"$WORK/$name.s" &&
+    as "$WORK/$name.s" -o "$WORK/$name.o" &&
+    ld "$WORK/rt.o" "$WORK/$name.o" -o "$WORK/$name" || exit 1
+}
+
+as "$RT" -o "$WORK/rt.o" || exit 1
+
+build plain "$@"
+build instrumented "$@" -fprofile-generate="$WORK/profile"
+"$WORK/instrumented"
+build pgo "$@" -fprofile-use="$WORK/profile" --remarks 2>"$WORK/remarks"
+
+grep -E "^  (profile|inline):" "$WORK/remarks"
+echo "cold blocks: $(grep -c "^\.section \.text\.unlikely" "$WORK/pgo.s") functions split"
+
+for name in plain pgo; do
+  start=$(date +%s%N)
+  "$WORK/$name"
+  status=$?
+  end=$(date +%s%N)
+  echo "$name: exit $status, $(((end - start) / 1000000)) ms"
+done
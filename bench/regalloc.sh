@@ -0,0 +1,31 @@
+#!/bin/bash
+# Register allocator comparison: builds a program with linear scan and
+# with graph coloring, reports the scalars each one leaves in memory, the
+# moves in the code and the run time.
+#
+# usage: bench/regalloc.sh <program.ph> [phantom] [extra phantom flags...]
+
+SOURCE=$1
+PHANTOM=${2:-./build/phantom}
+shift $(($# < 2 ? $# : 2))
+
+RT=$(dirname "$0")/../arch/x86_64/phrt0.s
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+as "$RT" -o "$WORK/rt.o" || exit 1
+
+for allocator in linear graph; do
+  "$PHANTOM" "$@" -fregalloc=$allocator "$SOURCE" >"$WORK/$allocator.s" &&
+    as "$WORK/$allocator.s" -o "$WORK/$allocator.o" &&
+    ld "$WORK/rt.o" "$WORK/$allocator.o" -o "$WORK/$allocator" || exit 1
+
+  spilled=$(grep -oE "[0-9]+ spilled" "$WORK/$allocator.s" | awk '{ total += $1 } END { print total + 0 }')
+  moves=$(grep -cE "^  (mov|movs|movz)[a-z]* " "$WORK/$allocator.s")
+
+  start=$(date +%s%N)
+  "$WORK/$allocator"
+  status=$?
+  end=$(date +%s%N)
+  echo "$allocator: $spilled spilled, $moves moves, exit $status, $(((end - start) / 1000000)) ms"
+done
@@ -4,21 +4,89 @@
 #include <vector>
 
 namespace phantom {
+  enum class OptLevel {
+    O0,
+    O1,
+    O2,
+    Os
+  };
+
+  enum class RegAlloc {
+    LinearScan,
+    GraphColoring
+  };
+
   struct Options {
     std::string program_name;
     std::string source_file;
     std::string output_file = "a.out";
 
     // avialable types
-    // {"llvm-ir", "asm", "obj"}
+    // {"ir", "llvm-ir", "asm", "obj"}
     std::string out_type = "";
 
     // avialable options:
     // {tokens}
     std::string print = "";
 
-    // optimize or not
-    bool opitimize = true;
+    // optimization level, `-O ON|OFF` maps to O2/O0
+    OptLevel opt_level = OptLevel::O2;
+
+    // functions called from outside of the program besides `main`
+    // (--export=a,b,c), the others may be removed or specialized
+    std::vector<std::string> exported;
+
+    // explicit pass pipeline (--passes=a,b,c), overrides `opt_level`
+    std::vector<std::string> passes;
+    bool passes_specified = false;
+
+    // report per-pass timing/statistics to stderr
+    bool time_passes = false;
+    bool print_stats = false;
+
+    // report the decisions of passes that weigh costs (`--remarks`)
+    bool print_remarks = false;
+
+    // overrides the inliner's threshold of the `-O` level, -1 when unset
+    int inline_threshold = -1;
+
+    // vector code may use the 32 bytes AVX2 registers (`-mavx2`), SSE2 otherwise
+    bool avx2 = false;
+    // the FMA3 instructions are available (`-mfma`)
+    bool fma = false;
+
+    // floating point rewrites that don't keep the IEEE results exactly,
+    // `-ffast-math` allows them all: reassociating sums and products
+    // (`-fassociative-math`), dividing by multiplying by the reciprocal
+    // (`-freciprocal-math`) and fusing a * b + c into one multiply-add
+    // (`-ffp-contract=fast`, with `-mfma`)
+    bool fp_reassociate = false;
+    bool fp_reciprocal = false;
+    bool fp_contract = false;
+
+    // array indices that aren't constants are checked at runtime
+    // (`-fbounds-check`), the program stops when one is out of bounds
+    bool bounds_check = false;
+
+    // profile-guided optimization: `-fprofile-generate` counts the executions
+    // of every block and call into the file, `-fprofile-use` reads them back
+    // (empty when unset)
+    std::string profile_generate;
+    std::string profile_use;
+
+    // threads optimizing and compiling functions (`--jobs=n`), one per core
+    // when 0, the output doesn't depend on it
+    unsigned jobs = 0;
+
+    // register allocator (`-fregalloc=linear|graph`), graph coloring at -O2
+    // and linear scan at the other levels unless specified
+    RegAlloc regalloc = RegAlloc::GraphColoring;
+    bool regalloc_specified = false;
+
+    // functions address their frame from "rsp" and "rbp" is free, unless
+    // `-fno-omit-frame-pointer`
+    bool omit_frame_pointer = true;
+
     bool log_color = true;
   };
   class Driver {
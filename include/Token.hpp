@@ -161,11 +161,20 @@ public:
       switch (kind) {
         case Token::Kind::Eq:
           return 5;
+        case Token::Kind::EqEq:
+        case Token::Kind::NotEq:
+          return 7;
+        case Token::Kind::Less:
+        case Token::Kind::LessEq:
+        case Token::Kind::Greater:
+        case Token::Kind::GreaterEq:
+          return 8;
         case Token::Kind::Plus:
         case Token::Kind::Minus:
           return 10;
         case Token::Kind::Mul:
         case Token::Kind::Div:
+        case Token::Kind::Mod:
           return 20;
         default:
           return 0;
@@ -16,10 +16,12 @@ namespace phantom {
     struct UnOp;
     struct VarDecl;
     struct FnCall;
+    struct Index;
 
     using Expr = std::variant<std::unique_ptr<IntLit>, std::unique_ptr<FloatLit>, std::unique_ptr<StrLit>,
                               std::unique_ptr<ArrLit>, std::unique_ptr<Identifier>, std::unique_ptr<BinOp>,
-                              std::unique_ptr<UnOp>, std::unique_ptr<VarDecl>, std::unique_ptr<FnCall>>;
+                              std::unique_ptr<UnOp>, std::unique_ptr<VarDecl>, std::unique_ptr<FnCall>,
+                              std::unique_ptr<Index>>;
 
     struct IntLit {
       uint64_t value;
@@ -54,5 +56,10 @@ namespace phantom {
       std::string name;
       std::vector<std::unique_ptr<Expr>> args;
     };
+    // `name[index]`, an element of an array variable
+    struct Index {
+      std::string name;
+      std::unique_ptr<Expr> index;
+    };
   } // namespace ast
 } // namespace phantom
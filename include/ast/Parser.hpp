@@ -28,8 +28,13 @@ namespace phantom {
       std::unique_ptr<Stmt> parse_function();
       std::unique_ptr<Stmt> parse_return();
       std::unique_ptr<Stmt> parse_expmt();
+      std::unique_ptr<Stmt> parse_if();
+      std::unique_ptr<Stmt> parse_while();
+      std::unique_ptr<Stmt> parse_for();
       std::unique_ptr<Stmt> parse_stmt();
 
+      std::vector<std::unique_ptr<Stmt>> parse_block();
+
       std::unique_ptr<Expr> parse_expr(const int min_prec = 0);
       std::unique_ptr<Expr> parse_prim();
 
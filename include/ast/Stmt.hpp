@@ -9,9 +9,14 @@ namespace phantom {
     struct Expmt;
     struct FnDecl;
     struct FnDef;
+    struct If;
+    struct While;
+    struct For;
 
     using Stmt = std::variant<std::unique_ptr<Return>, std::unique_ptr<Expmt>,
-                              std::unique_ptr<FnDecl>, std::unique_ptr<FnDef>>;
+                              std::unique_ptr<FnDecl>, std::unique_ptr<FnDef>,
+                              std::unique_ptr<If>, std::unique_ptr<While>,
+                              std::unique_ptr<For>>;
 
     struct Return {
       std::unique_ptr<Expr> expr;
@@ -28,5 +33,22 @@ namespace phantom {
       std::unique_ptr<FnDecl> decl;
       std::vector<std::unique_ptr<Stmt>> body;
     };
+    struct If {
+      std::unique_ptr<Expr> cond;
+      std::vector<std::unique_ptr<Stmt>> then;
+      // `else if` is an `else` holding a single `If`
+      std::vector<std::unique_ptr<Stmt>> otherwise;
+    };
+    struct While {
+      std::unique_ptr<Expr> cond;
+      std::vector<std::unique_ptr<Stmt>> body;
+    };
+    struct For {
+      // any of the three may be null
+      std::unique_ptr<Expr> init;
+      std::unique_ptr<Expr> cond;
+      std::unique_ptr<Expr> step;
+      std::vector<std::unique_ptr<Stmt>> body;
+    };
   } // namespace ast
 } // namespace phantom
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "Driver.hpp"
+#include "codegen/Frame.hpp"
+#include "data/Register.hpp"
 #include "data/Variable.hpp"
 #include "irgen/Program.hpp"
 #include <array>
+#include <map>
 #include <unordered_map>
 #include <utils/str.hpp>
 
@@ -23,78 +27,184 @@ namespace phantom {
       std::vector<Directive> dirs;
     };
 
+    // Functions are compiled independently, on `jobs` threads: each one into
+    // its own `Gen` with its own output and constants, appended to the
+    // program's in program order, so the assembly is the same on any number
+    // of threads.
     class Gen {
   public:
-      Gen(ir::Program& program)
-          : program(program) {}
+      Gen(ir::Program& program, unsigned jobs = 1, RegAlloc regalloc = RegAlloc::LinearScan,
+          bool frame_pointer = false)
+          : program(program), jobs(jobs), regalloc(regalloc), frame_pointer(frame_pointer) {}
 
       const char* gen();
 
   private:
       ir::Program& program;
+      unsigned jobs;
+      RegAlloc regalloc;
+      // keep "rbp" pointing at the frame (`-fno-omit-frame-pointer`)
+      bool frame_pointer;
       utils::Str output;
 
       std::unordered_map<uint, Variable> scope_vars;
-      std::unordered_map<float, DataLabel> floats_data;
-      std::unordered_map<double, DataLabel> doubles_data;
-
-      // NOTE: the first "two" registers are used as a mirror of the IR three
-      // physical registers, the third and the fourth ones are used in case we
-      // need a temporary register that we should use only in one instruction
-      // generation so it won't get overrided from other instructions.
+      std::unordered_map<uint, ir::VirtReg> phi_incoming; // phi id -> the slot its predecessors write
+      // the pieces of spilled scalars held in a register, by block
+      std::vector<std::vector<Frame::Split>> splits;
+      // floating point constants by their bits (so -0.0 isn't 0.0), their
+      // labels are named after the bits too and don't depend on the order
+      // the functions using them are compiled in
+      std::map<uint32_t, DataLabel> floats_data;
+      std::map<uint64_t, DataLabel> doubles_data;
+
+      // NOTE: virtual registers live in a stack slot or in a register
+      // `Frame` allocated to them, the first two registers are scratch
+      // registers an instruction computes its result in, the third and the
+      // fourth ones are used in case we need a temporary register that we
+      // should use only inside one helper.
       std::array<const char*, 4> integer_registers = { "rax", "rcx", "rdx", "rsi" };
       std::array<const char*, 4> float_registers = { "xmm0", "xmm1", "xmm2", "xmm3" };
+      // vectors of 32 bytes (AVX), narrower ones use `float_registers`
+      std::array<const char*, 4> vector_registers = { "ymm0", "ymm1", "ymm2", "ymm3" };
       const size_t TR_INDEX = 2; // the temporary register index
 
-      size_t constants_size = 0;
-      // to track stack size
-      size_t offset = 0;
+      // bytes below the frame base, see `Frame`
+      size_t frame_size = 0;
+      // Without a frame pointer the slots are addressed from "rsp", the
+      // "rbp" the function would have (the return address is right above
+      // it) is `frame_base` bytes above "rsp", plus what the call being
+      // set up pushed. The prologue moves "rsp" down `frame_adjust` bytes,
+      // leaving it 16 bytes aligned for calls. A leaf function whose frame
+      // fits in the red zone (128 bytes below "rsp") doesn't move it.
+      int64_t frame_base = 0;
+      size_t frame_adjust = 0;
+      size_t pushed = 0;
+      // callee-saved registers the function uses and where they are saved
+      std::vector<std::pair<const char*, size_t>> saved_registers;
+      // the function uses ymm registers, their upper halves are cleared
+      // ("vzeroupper") before leaving it so SSE code isn't slowed down
+      bool wide_vectors = false;
+
+      ir::Function* current_function = nullptr;
+      uint current_block = 0;
+      // the block emitted right after the current one, jumps to it fall
+      // through, `NO_BLOCK` at the end of a section
+      static constexpr uint NO_BLOCK = ~0u;
+      uint next_block = NO_BLOCK;
 
   private:
       void generate_function(ir::Function& fn);
+      // the order the blocks are emitted in, the entry first. With a
+      // profile every block is followed by its hottest successor not placed
+      // yet, so the likely path falls through, and the blocks that never ran
+      // go last (into ".text.unlikely", see `is_cold`), the IR order otherwise
+      std::vector<uint> block_layout(ir::Function& fn);
+      bool is_cold(ir::Function& fn, uint block);
+      void generate_block(ir::Block& block);
       void generate_instruction(ir::Instruction& inst);
+      // around the instruction `index` of the current block: load the
+      // pieces starting there into their register, and send the reads of
+      // the ones ending there back to the slot
+      void enter_splits(size_t index);
+      void leave_splits(size_t index);
+      // fill the incoming slots of the successors' phis
+      void generate_phi_copies(ir::Block& block);
+      // integer `Div`/`Rem` and `MulHi`, they need "rax"/"rdx"
+      void generate_division(ir::BinOp& binop);
+      void generate_high_multiply(ir::BinOp& binop);
+      void generate_byte_multiply(ir::BinOp& binop);
+
+      // Instruction selection for scalar `BinOp`s, see Select.cpp. The
+      // operands computed by the single use `BinOp`s right before one are
+      // folded into its tree, which is covered by the cheapest tiling of the
+      // patterns in `rules` ("lea" for additions and small multiplications,
+      // three operand "imul", memory and immediate operands, "inc"/"neg").
+      struct Node;
+      struct Place;
+      // folded `BinOp`s by the register they define, the tree using it
+      // computes them
+      std::unordered_map<uint, ir::BinOp*> folded;
+      // the uses of each register in the function
+      std::unordered_map<uint, uint> uses;
+      // the scratch registers (by `rid`) holding a part of the tree
+      unsigned scratch_busy = 0;
+
+      bool selectable(ir::BinOp& binop);
+      void plan_trees(ir::Block& block);
+      // `flags`: a branch uses the flags of the result (see `sets_zero_flag`)
+      void select_binop(ir::BinOp& binop, bool flags = false);
+      void build_tree(Node& node, std::vector<Node>& nodes);
+      bool applies(Node& node, size_t rule);
+      uint rule_cost(Node& node, size_t rule);
+      void label(Node& node);
+      Place reduce(Node& node, uint goal);
+      Place reduce_leaf(Node& node, uint goal);
+      // `target`: the result is written to its register
+      Place apply(Node& node, size_t rule, ir::VirtReg* target);
+      const char* take_scratch(Place& place, ir::Type& type);
+      // frees the scratch registers of `place` but `keep`
+      void release(Place& place, const char* keep);
+      // whether a leaf of the tree is in `reg`
+      bool reads(Node& node, const char* reg);
+      std::string address_form(Place& place);
+
+      // System V calling convention: the register each argument is passed
+      // in, null for the ones passed on the stack
+      std::vector<const char*> argument_registers(std::vector<ir::Type>& types);
+      // a call ending a block that returns its result, with every argument
+      // in a register, reuses the caller's frame: it is a "jmp" to the callee
+      // once the frame is gone, so the stack doesn't grow
+      bool is_tail_call(ir::Block& block);
+      void generate_call(ir::Call& call, bool tail = false);
+
+      // array elements are addressed from the array's slot, with the index
+      // (sign extended) in "rcx" unless it is a constant
+      std::string element_address(ir::VirtReg& array, ir::Value& index);
+      void generate_element_load(ir::ElemLoad& load);
+      void generate_element_store(ir::ElemStore& store);
+
+      // packed SSE/AVX operations, vectors live in 16 bytes aligned slots
+      void generate_vector_binop(ir::BinOp& binop);
+      void generate_splat(ir::Splat& splat);
+      void generate_reduction(ir::ReduceAdd& reduce);
+      void generate_fma(ir::Fma& fma);
 
       void generate_terminator(ir::Terminator& term, ir::Type& return_type);
       void generate_default_terminator(ir::Type& type);
+      void generate_epilogue();
+      // takes the frame down, the epilogue without the "ret"
+      void generate_frame_exit();
+
+      // whether `inst`, right before `cmp`, leaves the flags `cmp` would set
+      bool sets_zero_flag(ir::Instruction& inst, ir::Cmp& cmp);
+      // compares the operands of `cmp` and returns the condition code
+      // (as in `j<cc>`/`set<cc>`) that holds when the comparison is true
+      const char* generate_compare(ir::Cmp& cmp);
+      void generate_jump(uint target);
+      const char* negate_condition(const char* cc);
+      void generate_conditional_jump(const char* cc, bool parity, uint then_block, uint else_block);
+      std::string block_label(uint block);
 
       void generate_data();
+      // the counters of `-fprofile-generate` and the header the runtime
+      // writes before them, see `opt::profile`
+      void generate_profile_data();
       DataLabel constant_label(std::variant<double, std::string> value, Directive::Kind kind);
 
-      void push_register(ir::PhysReg& reg);
-      void pop_register(ir::PhysReg& reg);
+      void push_register(PhysReg& reg);
+      void pop_register(PhysReg& reg);
 
-      void store_constant_in_memory(ir::Constant& constant, ir::VirtReg& memory);
-      void store_register_in_memory(ir::PhysReg& reg, ir::VirtReg& memory);
+      void store_constant_in_memory(const ir::Constant& constant, ir::VirtReg& memory);
+      void store_register_in_memory(PhysReg& reg, ir::VirtReg& memory);
       void store_memory_in_memory(ir::VirtReg& src, ir::VirtReg& dst);
-      void store_constant_in_register(ir::Constant& constant, ir::PhysReg& reg);
-      void store_register_in_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void store_memory_in_register(ir::VirtReg& memory, ir::PhysReg& reg);
-
-      void add_constant_to_register(ir::Constant& constant, ir::PhysReg& reg);
-      void add_register_to_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void add_memory_to_register(ir::VirtReg& memory, ir::PhysReg& reg);
-
-      void sub_constant_from_register(ir::Constant& constant, ir::PhysReg& reg);
-      void sub_register_from_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void sub_memory_from_register(ir::VirtReg& memory, ir::PhysReg& reg);
-
-      void imul_constant_with_memory(ir::Constant& constant, ir::VirtReg& memory, ir::PhysReg& dst);
-      void imul_constant_with_register(ir::Constant& constant, ir::PhysReg& reg, ir::PhysReg& dst);
-      void imul_register_with_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void imul_memory_with_register(ir::VirtReg& memory, ir::PhysReg& reg);
+      void store_constant_in_register(const ir::Constant& constant, PhysReg& reg);
+      void store_register_in_register(PhysReg& src, PhysReg& dst);
+      void store_memory_in_register(const ir::VirtReg& memory, PhysReg& reg);
+      // a single move when either side is in a register
+      void copy_variable(const ir::VirtReg& src, ir::VirtReg& dst);
+      void load_value(ir::Value& value, PhysReg& reg);
 
-      void mul_constant_with_register(ir::Constant& constant, ir::PhysReg& reg);
-      void mul_register_with_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void mul_memory_with_register(ir::VirtReg& memory, ir::PhysReg& reg);
-
-      void idiv_by_register(ir::PhysReg& reg);
-      void idiv_by_memory(ir::VirtReg& memory);
-
-      // NOTE: those are just for floating points, since we don't have unsigned
-      // integers yet.
-      void div_register_by_register(ir::PhysReg& src, ir::PhysReg& dst);
-      void div_constant_by_register(ir::Constant& constant, ir::PhysReg& reg);
-      void div_memory_by_register(ir::VirtReg& memory, ir::PhysReg& reg);
+      void idiv_by_register(PhysReg& reg);
 
       // helper function that does "cltd" or "cqto"
       void division_conversion(ir::Type& type);
@@ -104,8 +214,19 @@ namespace phantom {
       char floating_point_suffix(unsigned int size);
 
       char* type_default_register(ir::Type& type);
-      char* physical_register_name(ir::PhysReg& pr);
-      char* constant_form(ir::Constant& constant);
+      char* physical_register_name(PhysReg& pr);
+      // integer immediates are sign extended from 32 bits
+      bool fits_immediate(const ir::Constant& constant);
+      char* constant_form(const ir::Constant& constant);
+
+      // AT&T form of any value as a source operand, remember to free the returned value
+      char* value_form(ir::Value& value);
+      // where a variable is: its stack slot or its register, named for
+      // accesses of `size` bytes
+      std::string variable_form(Variable& var, size_t size);
+      // the address `displacement` bytes from where "rbp" points (or would),
+      // `index` is appended to the base register (",%rcx,8")
+      std::string frame_address(int64_t displacement, const std::string& index = "");
 
       void generate_float_sign_mask_label();
       void generate_double_sign_mask_label();
@@ -117,8 +238,15 @@ namespace phantom {
       // remember to free the returned value
       char* generate_floating_point_move(ir::Type& type);
 
+      // the unaligned move of a whole vector
+      const char* vector_move(ir::Type& type);
+      // the packed form of a vector `BinOp`
+      const char* vector_operation(ir::BinOp::Op op, ir::Type& type);
+      size_t vector_bytes(ir::Type& type);
+
       bool is_integer(ir::Type& type);
       bool is_float(ir::Type& type);
+      bool is_vector(ir::Type& type);
     };
   } // namespace codegen
 } // namespace phantom
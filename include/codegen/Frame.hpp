@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Driver.hpp"
+#include "data/Variable.hpp"
+#include "irgen/Program.hpp"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace phantom {
+  namespace codegen {
+    // The stack frame of a function: every virtual register, alloca and
+    // phi incoming slot gets a slot at a negative offset from the frame
+    // base, the 16 bytes aligned address right below the return address.
+    // Slots whose live ranges don't overlap share memory (stack slot
+    // coloring), the shared slots are laid out largest first so each one is
+    // naturally aligned.
+    //
+    // `Gen` addresses the base from "rsp": the prologue moves "rsp" down
+    // past the frame, or not at all in a leaf function whose frame fits in
+    // the 128 bytes red zone below it. Only `-fno-omit-frame-pointer` sets
+    // up "rbp", which then points at the base.
+    //
+    // Scalars get a machine register instead when one is free over their
+    // whole live range (linear scan register allocation). The scratch
+    // registers `Gen` computes in ("rax", "rcx", "rdx", "rsi", "xmm0" to
+    // "xmm3") are never allocated. When there are more live scalars than
+    // registers, the ones with the lowest spill weight (their uses and
+    // definitions, 10 times heavier per loop level, over the length of their
+    // range) stay in memory. A range crossing a call only gets a callee-saved
+    // register, those the function uses are saved below the slots.
+    //
+    // The ranges left in memory are then split at their uses: the uses of
+    // one block with no call between them become a piece loaded into a
+    // register that is free over it (see `Split`), so a spilled scalar read
+    // several times in a row is read from memory once.
+    //
+    // With `RegAlloc::GraphColoring` the registers are given out by iterated
+    // register coalescing (George and Appel) instead: two scalars interfere
+    // when one is defined where the other is live, the copies of phis and
+    // integer casts are coalesced when Briggs' test shows it can't make the
+    // graph uncolorable, and the scalars the coloring can't fit are the ones
+    // with the lowest spill weight per interference. Constants are never
+    // held in a register, the instructions using them materialize them.
+    //
+    // Live ranges are intervals over the instructions numbered in block
+    // order, a slot is live from its first definition to its last use,
+    // stretched over the blocks it's live through. A definition and a use by
+    // the same instruction overlap, the code of one instruction may write
+    // its result before it's done reading its operands.
+    class Frame {
+  public:
+      explicit Frame(ir::Function& fn, RegAlloc regalloc = RegAlloc::LinearScan);
+
+      std::unordered_map<uint, Variable> slots;
+      // phi id -> the slot its predecessors write, ids start at `fn.nregs`
+      std::unordered_map<uint, ir::VirtReg> phi_incoming;
+
+      // bytes below the frame base, a multiple of 16
+      size_t size = 0;
+      // what the frame would take without sharing
+      size_t unshared_size = 0;
+
+      // the callee-saved registers the function uses and the offsets they
+      // are saved at
+      std::vector<std::pair<const char*, size_t>> saved;
+      // Part of a spilled range held in a register: it's loaded from its
+      // slot before the instruction `first` of the block, the instructions
+      // up to `last` read the register. Only ranges defined once and never
+      // stored to are split, the slot stays up to date.
+      struct Split {
+        uint id;
+        size_t first, last;
+        const char* reg;
+      };
+      // by block
+      std::vector<std::vector<Split>> splits;
+
+      // the slots allocated a register, the scalars left in memory and the
+      // pieces of them given a register
+      size_t in_registers = 0;
+      size_t spilled = 0;
+      size_t pieces = 0;
+
+  private:
+      struct Slot {
+        uint id;
+        ir::Type type;
+        size_t bytes;
+        bool array = false;
+        size_t start = (size_t)-1;
+        size_t end = 0;
+        double weight = 0;
+        // the registers of its class it may get, by their bit (see Frame.cpp)
+        uint32_t usable = 0;
+        const char* reg = nullptr;
+        // the positions of its uses in the blocks' bodies, and its
+        // definitions. Stores write an alloca's slot outside of them
+        std::vector<size_t> uses = {};
+        uint defs = 0;
+        bool stored = false;
+
+        // a scalar a register may hold
+        bool allocatable() const { return type.lanes == 1 && !array && bytes != 0; }
+      };
+      struct Event;
+
+      RegAlloc regalloc;
+      std::vector<Slot> candidates;
+      std::unordered_map<uint, uint> index; // id -> candidate
+      // the positions of the calls, in order
+      std::vector<size_t> calls;
+      // where each block's instructions start (its first one is at
+      // `block_start + 1`) and where its terminator is, and how much its
+      // uses weigh
+      std::vector<size_t> block_start, block_end;
+      std::vector<double> block_weight;
+
+      // graph coloring: the candidates each candidate interferes with, the
+      // pairs of them as `(low << 32) | high`, and the (destination, source)
+      // copies between candidates
+      std::vector<std::vector<uint>> interference;
+      std::unordered_set<uint64_t> interfering;
+      std::vector<std::pair<uint, uint>> copies;
+
+      // `count` elements for arrays, 0 for a single value
+      void add(uint id, const ir::Type& type, uint count = 0);
+      void compute_ranges(ir::Function& fn);
+      // `live_out` holds candidates by block
+      void build_interference(const std::vector<std::vector<Event>>& events,
+                              const std::vector<std::vector<uint>>& live_out);
+      bool crosses_call(const Slot& slot, bool ends) const;
+      void allocate_registers();
+      void linear_scan(std::vector<Slot*>& order);
+      void color_registers(std::vector<Slot*>& order);
+      void split_ranges();
+      void assign_offsets();
+    };
+  } // namespace codegen
+} // namespace phantom
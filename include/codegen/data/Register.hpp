@@ -0,0 +1,14 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+
+namespace phantom {
+  namespace codegen {
+    // a machine register, `rid` indexes `Gen::integer_registers` or
+    // `Gen::float_registers` depending on the type.
+    struct PhysReg {
+      uint rid;
+      ir::Type type;
+    };
+  } // namespace codegen
+} // namespace phantom
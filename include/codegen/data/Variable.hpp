@@ -9,6 +9,10 @@ namespace phantom {
       ir::Type type;
       // stack index
       size_t offset;
+      // the machine register holding it for its whole life (its 64-bit
+      // name), null when it lives in its stack slot. `Gen` sets it while a
+      // piece of a spilled range is in a register (`Frame::Split`)
+      const char* reg = nullptr;
     };
   } // namespace codegen
 } // namespace phantom
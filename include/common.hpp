@@ -43,6 +43,7 @@ namespace phantom {
       FP
     } kind;
     uint8_t bitwidth;
+    uint32_t length; // elements of an array type, 0 for scalars
   };
 
   [[noreturn]] void __unreachable__impl(const char* file, int line, const char* func);
@@ -4,6 +4,8 @@
 #include <vector>
 
 namespace phantom {
+  class Logger;
+
   struct FileInfo {
     std::string path;
     std::string content;
@@ -20,4 +22,7 @@ namespace phantom {
 
     Location(const size_t line = 0, const size_t column = 0) : line(line), column(column) {}
   };
+
+  // the content of `file_path`, failing to read it is fatal
+  FileInfo read_file(const std::string& file_path, Logger& logger);
 } // namespace phantom
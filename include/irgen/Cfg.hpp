@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Program.hpp"
+
+namespace phantom {
+  namespace ir {
+    // the blocks a terminator may transfer control to
+    std::vector<uint> successors(Terminator& term);
+
+    // recompute `preds`/`succs` of every block from the terminators,
+    // unterminated blocks fall off the end of the function.
+    void rebuild_cfg(Function& fn);
+
+    // whether the function returns `reg` as soon as `block` ends, either
+    // there or from a block it branches to that only holds phis, void
+    // functions don't care about the value
+    bool returns_register(Function& fn, uint block, const VirtReg& reg);
+
+    // blocks reachable from the entry, in reverse post-order
+    std::vector<uint> reverse_post_order(Function& fn);
+
+    // drop blocks that can't be reached from the entry, renumber the rest and
+    // rebuild the CFG, returns true if anything was removed.
+    bool remove_unreachable_blocks(Function& fn);
+  } // namespace ir
+} // namespace phantom
@@ -3,52 +3,77 @@
 #include "Program.hpp"
 #include "ast/Stmt.hpp"
 #include <unordered_map>
-#include <array>
 
 namespace phantom {
   namespace ir {
     class Gen {
   public:
-      Gen(std::vector<std::unique_ptr<ast::Stmt>>& ast)
-          : ast(ast) {}
+      Gen(std::vector<std::unique_ptr<ast::Stmt>>& ast, bool bounds_check = false)
+          : ast(ast), bounds_check(bounds_check) {}
 
       Program gen();
 
   private:
       std::vector<std::unique_ptr<ast::Stmt>>& ast;
+      bool bounds_check;
       Program program; // output
 
       std::unordered_map<std::string, VirtReg> scope_vars;
-      std::unordered_map<std::string, Function> funcs_table;
-
-      // used to track reserved physical registers.
-      // see include/codegen/Codegen.hpp:45 to line 50
-      std::array<bool, 2> integer_registers = {false, false};
-      std::array<bool, 2> float_registers = {false, false};
+      std::unordered_map<std::string, Function> funcs_table; // signatures, filled before lowering
+      std::unordered_map<uint, uint> arrays;                 // alloca id -> length of array variables
 
       uint nrid = 0; // next register id
       Function* current_function = nullptr;
+      uint current_block = 0;
+      uint allocas = 0; // allocas already placed at the top of the entry block
+      uint bounds_trap = NO_BLOCK; // the block calling the runtime on a bad index
+      static constexpr uint NO_BLOCK = ~0u;
 
+      void declare_signature(std::unique_ptr<ast::FnDecl>& ast_decl);
       void define_function(std::unique_ptr<ast::FnDef>& ast_fn);
       void declare_function(std::unique_ptr<ast::FnDecl>& ast_fn);
       void generate_stmt(std::unique_ptr<ast::Stmt>& stmt);
+      void generate_body(std::vector<std::unique_ptr<ast::Stmt>>& body);
       void generate_return(std::unique_ptr<ast::Return>& ast_rt);
+      void generate_if(std::unique_ptr<ast::If>& ast_if);
+      void generate_while(std::unique_ptr<ast::While>& ast_while);
+      void generate_for(std::unique_ptr<ast::For>& ast_for);
       Value generate_expr(std::unique_ptr<ast::Expr>& expr);
 
+      // branch on `cond` to `then_block` or `else_block`
+      void generate_condition(std::unique_ptr<ast::Expr>& cond, uint then_block, uint else_block);
+
+      void emit(Instruction inst);
+      uint create_block();
+      void terminate(Terminator term);
+
       void generate_assignment(Value& value, VirtReg& dst);
-      void generate_store(std::variant<VirtReg, PhysReg> dst, Value src);
-      void generate_cast(Value& src, PhysReg dst, Type& src_type, Type& target);
+      void generate_store(VirtReg dst, Value src);
+      VirtReg generate_load(VirtReg src);
+      void generate_cast(Value& src, VirtReg dst, Type& src_type, Type& target);
 
       VirtReg allocate_vritual_register(Type& type);
-      PhysReg allocate_physical_register(Type& type);
-      void free_register(PhysReg reg);
+
+      // the array variable `name` and the index of `array[index]`,
+      // constant indices are checked against its length, the other ones at
+      // runtime with `-fbounds-check`
+      VirtReg resolve_array(const std::string& name);
+      Value generate_index(VirtReg array, std::unique_ptr<ast::Expr>& index);
+      void generate_bounds_check(Value index, uint length);
+      void generate_array_init(VirtReg array, std::unique_ptr<ast::Expr>& init);
 
       double extract_double_constant(std::variant<int64_t, double>& v);
       int64_t extract_integer_constant(std::variant<int64_t, double>& v);
       double calculate_double_constant(Token::Kind op, double lv, double rv);
       int64_t calculate_integer_constant(Token::Kind op, int64_t lv, int64_t rv);
+      bool calculate_comparison(Token::Kind op, double lv, double rv);
+      bool calculate_comparison(Token::Kind op, int64_t lv, int64_t rv);
+      bool is_comparison(Token::Kind op);
 
       void cast_if_needed(Value& v, Type& vtype, Type& target);
+      // `v` with the exact type `target`: `cast_if_needed`, then integers
+      // wider than `target` are truncated (constants wrap)
+      void convert(Value& v, Type& vtype, Type& target);
       bool need_cast(Type& type, Type& target, bool constant);
 
       Type extract_value_type(Value& value);
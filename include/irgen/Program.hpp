@@ -1,25 +1,32 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 using uint = unsigned int;
 
 namespace phantom {
   namespace ir {
+    // NOTE: types are copied into every operand, they're packed into 4
+    // bytes to keep instructions small.
     struct Type {
-      enum class Kind {
+      enum class Kind : uint8_t {
         Int,
         Float
-      } kind;
-      uint size;
-      bool is_void;
+      } kind = Kind::Int;
+      uint8_t size = 0;
+      bool is_void = false;
+      uint8_t lanes = 1; // vectors hold `lanes` elements of `size` bytes
     };
 
-    struct PhysReg {
-      uint rid;
-      Type type;
-    };
+    // SSA-style virtual value, there's no limit on how many a function uses,
+    // mapping them onto machine registers is up to the backend.
+    // allocas also define one, holding the address of the stack slot.
     struct VirtReg {
       uint id;
       Type type;
@@ -29,90 +36,357 @@ namespace phantom {
       std::variant<int64_t, double> value;
     };
 
-    using Value = std::variant<Constant, VirtReg, PhysReg>;
+    // An operand: a virtual register or a constant, with the type it's used
+    // with. Constants are kept in the function's pool (`Function::intern()`
+    // and `Function::constant()`), the operand only refers to them, so every
+    // operand is 8 bytes.
+    struct Value {
+      static constexpr uint32_t CONSTANT = 1u << 31;
+
+      uint32_t ref = 0; // a register id, or `CONSTANT` | its index in the pool
+      Type type;
+
+      Value() = default;
+      Value(const VirtReg& reg) : ref(reg.id), type(reg.type) {}
+
+      // 0 for constants and 1 for registers
+      size_t index() const { return (ref & CONSTANT) ? 0 : 1; }
+      VirtReg reg() const { return VirtReg{ .id = ref, .type = type }; }
+    };
+
+    inline Type type_of(const Value& value) {
+      return value.type;
+    }
 
     struct Return {
       Value value;
     };
-    using Terminator = std::variant<Return>;
+    struct Branch {
+      uint target;
+    };
+    struct CondBranch {
+      Value cond;
+      uint then_block, else_block;
+    };
+    using Terminator = std::variant<Return, Branch, CondBranch>;
 
     struct Alloca {
       Type type;
       VirtReg reg;
+      uint count = 0; // elements of an array, 0 for a scalar
     };
     struct Store {
       Value src;
-      std::variant<VirtReg, PhysReg> dst;
+      VirtReg dst; // an alloca
+    };
+    struct Load {
+      VirtReg src; // an alloca
+      VirtReg dst;
     };
     struct BinOp {
       // clang-format off
-      enum class Op { Add, Sub, Mul, Div } op;
+      // Rem is the remainder of a signed division, Sar/Shr are the
+      // arithmetic/logical right shifts and MulHi gives the high half of a
+      // signed full width product (only 32/64-bit), they don't come from the
+      // source language except for Rem.
+      enum class Op : uint8_t { Add, Sub, Mul, Div, Rem, Shl, Sar, Shr, MulHi } op;
       Value lhs, rhs;
-      PhysReg dst;
+      VirtReg dst;
       // clang-format on
     };
     struct UnOp {
       // clang-format off
-      enum class Op { Neg, Not } op;
+      enum class Op : uint8_t { Neg, Not } op;
       Value operand;
-      PhysReg dst;
+      VirtReg dst;
       // clang-format on
     };
 
     // i32 -> f32
     struct Int2Float {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     // i32 -> f64
     struct Int2Double {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     // f32 -> i32
     struct Float2Int {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     // f32 -> f64
     struct Float2Double {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     // f64 -> i32
     struct Double2Int {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     // f64 -> f32
     struct Double2Float {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
     };
 
     struct IntExtend {
       Value value;
-      PhysReg dst;
+      VirtReg dst;
+    };
+
+    // both operands have the same type, the result is an `i8` holding 0 or 1
+    struct Cmp {
+      // clang-format off
+      enum class Pred : uint8_t { Eq, Ne, Lt, Le, Gt, Ge } pred;
+      Value lhs, rhs;
+      VirtReg dst;
+      // clang-format on
+    };
+
+    // merges the values flowing in from each predecessor, phis are always
+    // at the start of a block and have one entry per predecessor.
+    struct Phi {
+      std::vector<std::pair<uint, Value>> incoming; // (predecessor, value)
+      VirtReg dst;
+    };
+
+    // executions of a block or a call in the profile (`-fprofile-use`)
+    constexpr uint64_t NO_COUNT = ~(uint64_t)0;
+
+    // `name` interned, calls name their callee with it. The names are
+    // never freed and never move, comparing them compares the strings.
+    inline const std::string* symbol(const std::string& name) {
+      static std::mutex mutex;
+      static std::unordered_set<std::string> names;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      return &*names.insert(name).first;
+    }
+
+    // arguments already have the parameter types of the callee, `dst` is
+    // void for functions that don't return anything.
+    struct Call {
+      const std::string* callee; // see `symbol()`
+      std::vector<Value> args;
+      VirtReg dst;
+      uint64_t count = NO_COUNT;
+    };
+
+    // element `index` of an array alloca, vector types access `lanes`
+    // consecutive elements starting there
+    struct ElemLoad {
+      VirtReg array;
+      Value index;
+      VirtReg dst;
+    };
+    struct ElemStore {
+      Value src;
+      VirtReg array;
+      Value index;
+    };
+
+    // every lane of the vector `dst` set to `value`
+    struct Splat {
+      Value value;
+      VirtReg dst;
+    };
+
+    // the sum of the lanes of a vector
+    struct ReduceAdd {
+      Value value;
+      VirtReg dst;
+    };
+
+    // a * b + c rounded once (floating point scalars or vectors), only
+    // formed under `-ffp-contract=fast` for targets with FMA. The operands
+    // are kept out of line, three inline values would make it the largest
+    // instruction
+    struct Fma {
+      std::vector<Value> operands; // a, b, c
+      VirtReg dst;
+
+      Value& a() { return operands[0]; }
+      Value& b() { return operands[1]; }
+      Value& c() { return operands[2]; }
+      const Value& a() const { return operands[0]; }
+      const Value& b() const { return operands[1]; }
+      const Value& c() const { return operands[2]; }
+    };
+
+    // increments profile counter `counter` (`-fprofile-generate`)
+    struct Count {
+      uint counter;
     };
 
     using Instruction = std::variant<Alloca, Store, BinOp, UnOp,
                                      Int2Float, Int2Double, Float2Int,
                                      Float2Double, Double2Int, Double2Float,
-                                     IntExtend>;
+                                     IntExtend, Cmp, Load, Phi, Call,
+                                     ElemLoad, ElemStore, Splat, ReduceAdd,
+                                     Fma, Count>;
+
+    // the register an instruction defines, null for stores and counters
+    inline VirtReg* defined_register(Instruction& inst) {
+      return std::visit([](auto& i) -> VirtReg* {
+        using T = std::decay_t<decltype(i)>;
+
+        if constexpr (std::is_same_v<T, Alloca>)
+          return &i.reg;
+        else if constexpr (std::is_same_v<T, Store> || std::is_same_v<T, ElemStore> || std::is_same_v<T, Count>)
+          return nullptr;
+        else
+          return &i.dst;
+      }, inst);
+    }
+
+    // operand lists, passes ask for them all the time so the usual case of
+    // at most three operands doesn't allocate, only phis and calls may need
+    // more.
+    class Operands {
+  public:
+      Operands() = default;
+      Operands(std::initializer_list<Value*> values) {
+        for (Value* value : values)
+          push_back(value);
+      }
+
+      void push_back(Value* value) {
+        if (spilled.empty() && count < INLINE) {
+          values[count++] = value;
+          return;
+        }
+
+        if (spilled.empty())
+          spilled.assign(values, values + count);
+
+        spilled.push_back(value);
+        count++;
+      }
+
+      Value** begin() { return spilled.empty() ? values : spilled.data(); }
+      Value** end() { return begin() + count; }
+      Value* operator[](size_t i) { return begin()[i]; }
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+
+  private:
+      static constexpr size_t INLINE = 3;
+      Value* values[INLINE];
+      size_t count = 0;
+      std::vector<Value*> spilled;
+    };
+
+    // the value operands of an instruction, the addresses of loads and
+    // stores (and the arrays of element accesses) aren't included since
+    // they always name an alloca
+    inline Operands operands(Instruction& inst) {
+      return std::visit([](auto& i) -> Operands {
+        using T = std::decay_t<decltype(i)>;
+
+        if constexpr (std::is_same_v<T, Alloca> || std::is_same_v<T, Load> || std::is_same_v<T, Count>)
+          return {};
+        else if constexpr (std::is_same_v<T, Store>)
+          return { &i.src };
+        else if constexpr (std::is_same_v<T, BinOp> || std::is_same_v<T, Cmp>)
+          return { &i.lhs, &i.rhs };
+        else if constexpr (std::is_same_v<T, UnOp>)
+          return { &i.operand };
+        else if constexpr (std::is_same_v<T, ElemLoad>)
+          return { &i.index };
+        else if constexpr (std::is_same_v<T, ElemStore>)
+          return { &i.src, &i.index };
+        else if constexpr (std::is_same_v<T, Fma>)
+          return { &i.a(), &i.b(), &i.c() };
+        else if constexpr (std::is_same_v<T, Phi>) {
+          Operands values;
+          for (auto& [block, value] : i.incoming)
+            values.push_back(&value);
+
+          return values;
+        } else if constexpr (std::is_same_v<T, Call>) {
+          Operands values;
+          for (Value& arg : i.args)
+            values.push_back(&arg);
+
+          return values;
+        } else
+          return { &i.value };
+      }, inst);
+    }
+    // stores, calls and counters can't be removed even if nothing uses
+    // their result
+    inline bool has_side_effects(Instruction& inst) {
+      return std::holds_alternative<Store>(inst) || std::holds_alternative<ElemStore>(inst) ||
+             std::holds_alternative<Call>(inst) || std::holds_alternative<Count>(inst);
+    }
+    inline Operands operands(Terminator& term) {
+      // clang-format off
+      switch (term.index()) {
+        case 0: return { &std::get<0>(term).value };
+        case 2: return { &std::get<2>(term).cond };
+        default: return {};
+      }
+      // clang-format on
+    }
+
+    // blocks are identified by their index in `Function::blocks`
+    struct Block {
+      std::vector<Instruction> body;
+      Terminator terminator;
+      bool terminated = false;
+      uint64_t count = NO_COUNT; // executions, from the profile
+
+      // filled by `rebuild_cfg()`
+      std::vector<uint> preds;
+      std::vector<uint> succs;
+    };
 
     struct Function {
       std::string name;
       Type return_type;
       std::vector<VirtReg> params;
-      std::vector<Instruction> body;
-      Terminator terminator;
-      bool terminated = false;
+      std::vector<Block> blocks; // blocks[0] is the entry
+      uint nregs = 0;            // virtual register ids are below this
       bool defined = false;
+      bool internal = false; // only called from the program, not a global symbol
+
+      // the payloads of the constants its operands refer to, each one once:
+      // `pooled` finds integers and doubles by their bits
+      std::vector<std::variant<int64_t, double>> constants = {};
+      std::unordered_map<uint64_t, uint> pooled[2] = {};
+
+      // `constant` as an operand of this function
+      Value intern(const Constant& constant) {
+        uint64_t bits;
+        if (constant.value.index() == 0)
+          bits = (uint64_t)std::get<0>(constant.value);
+        else {
+          double value = std::get<1>(constant.value);
+          memcpy(&bits, &value, sizeof(bits));
+        }
+
+        auto [it, added] = pooled[constant.value.index()].emplace(bits, (uint)constants.size());
+        if (added)
+          constants.push_back(constant.value);
+
+        Value value;
+        value.ref = Value::CONSTANT | it->second;
+        value.type = constant.type;
+        return value;
+      }
+      // the constant `value` refers to
+      Constant constant(const Value& value) const {
+        return Constant{ .type = value.type, .value = constants[value.ref & ~Value::CONSTANT] };
+      }
     };
 
     struct GlobalVariable {
@@ -127,10 +401,37 @@ namespace phantom {
       std::string kernel;
     };
 
+    // The counters of an instrumented program (`-fprofile-generate`):
+    // every function gets a run of them, its blocks first then its calls,
+    // in order. The runtime writes them to `path` at exit, after a header
+    // the matching `-fprofile-use` build checks them with (`opt::profile`).
+    struct ProfiledFunction {
+      std::string name;
+      uint64_t checksum; // of the CFG the counters were placed in
+      uint first;
+      uint counters;
+    };
+    struct Profile {
+      std::string path;
+      std::vector<ProfiledFunction> functions;
+      uint counters = 0;
+    };
+    // FNV-1a, the profile file identifies functions by the hash of their name
+    inline uint64_t profile_name_hash(const std::string& name) {
+      uint64_t hash = 0xcbf29ce484222325;
+      for (char c : name) {
+        hash ^= (unsigned char)c;
+        hash *= 0x100000001b3;
+      }
+
+      return hash;
+    }
+
     struct Program {
       Target target;
       std::vector<Function> funcs;
       std::vector<GlobalVariable> globals;
+      Profile profile;
     };
   } // namespace ir
 } // namespace phantom
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Logger.hpp"
+#include "Program.hpp"
+#include <cstdio>
+
+namespace phantom {
+  namespace ir {
+    // The textual form of the IR (`--emit ir`, phantom-opt), one function
+    // after the other:
+    //
+    //   define @max(%0: i32, %1: i32) -> i32 {
+    //   bb0:
+    //     %2: i8 = cmp gt %0, %1
+    //     br %2, bb1, bb2
+    //   bb1:
+    //     ret %0
+    //   bb2:
+    //     ret %1
+    //   }
+    //
+    // Definitions carry their type (`%2: i8 = ...`, an alloca's register
+    // has the type it holds), uses are just `%id`. Constants are typed
+    // (`i32 5`, `f64 0.5`), blocks are numbered in order and `;` starts a
+    // comment. `define internal` marks functions only the program calls.
+    // `parse_program()` reads back exactly what `print_program()` writes.
+    std::string print_type(const Type& type);
+    void print_program(Program& program, FILE* stream);
+
+    // the IR of `text`, errors are reported (and fatal) at their location in
+    // `Location::file`. Besides the syntax it checks that every register is
+    // defined once and that the blocks and functions referred to exist, the
+    // rest is up to the verifier
+    Program parse_program(const std::string& text, Logger& logger);
+  } // namespace ir
+} // namespace phantom
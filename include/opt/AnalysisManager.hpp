@@ -0,0 +1,77 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    // Caches per-function analysis results (dominator trees, loop info, ...).
+    // An analysis is any type constructible from `ir::Function&`, results are
+    // computed lazily on first request and dropped when the function changes.
+    // Passes on different functions may ask for their analyses concurrently,
+    // the results of one function are only touched by the thread running it.
+    class AnalysisManager {
+  public:
+      template <typename Analysis>
+      Analysis& get(ir::Function& fn) {
+        std::unique_ptr<Result>* slot;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          slot = &cache[&fn][std::type_index(typeid(Analysis))];
+
+          if (*slot) {
+            hits++;
+            return static_cast<Model<Analysis>*>(slot->get())->result;
+          }
+
+          computed++;
+        }
+
+        // elements of the cache don't move when it grows
+        *slot = std::make_unique<Model<Analysis>>(fn);
+        return static_cast<Model<Analysis>*>(slot->get())->result;
+      }
+
+      void invalidate(ir::Function& fn) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(&fn);
+        if (it == cache.end())
+          return;
+
+        invalidated += it->second.size();
+        cache.erase(it);
+      }
+      void invalidate_all() {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& entry : cache)
+          invalidated += entry.second.size();
+
+        cache.clear();
+      }
+
+      // statistics
+      size_t computed = 0;
+      size_t hits = 0;
+      size_t invalidated = 0;
+
+  private:
+      struct Result {
+        virtual ~Result() = default;
+      };
+
+      template <typename Analysis>
+      struct Model : Result {
+        Analysis result;
+        explicit Model(ir::Function& fn) : result(fn) {}
+      };
+
+      std::unordered_map<const ir::Function*,
+                         std::unordered_map<std::type_index, std::unique_ptr<Result>>>
+          cache;
+      std::mutex lock;
+    };
+  } // namespace opt
+} // namespace phantom
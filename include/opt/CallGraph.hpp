@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Driver.hpp"
+#include "irgen/Program.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    // Who calls whom in a module, functions are referred to by their index
+    // in `program.funcs`. Calls name their callee, a name stands for its
+    // definition when the module has one (forward declarations come before
+    // it). The graph is a snapshot, passes that add, remove or rename
+    // functions build a new one.
+    class CallGraph {
+  public:
+      // `program.funcs[caller].blocks[block].body[index]` is the call
+      struct Site {
+        uint caller;
+        uint block;
+        size_t index;
+      };
+
+      explicit CallGraph(ir::Program& program);
+
+      static constexpr uint NONE = (uint)-1;
+
+      // the function called `name`, NONE when the module doesn't have one
+      uint lookup(const std::string& name) const;
+
+      // the functions `f` calls, each once
+      const std::vector<uint>& callees(uint f) const { return callee_lists[f]; }
+      // every call to `f`
+      const std::vector<Site>& callers(uint f) const { return sites[f]; }
+      ir::Call& call(const Site& site) const;
+
+      // callees before their callers, defined functions only
+      std::vector<uint> bottom_up() const;
+      // the functions reachable through calls from `roots`
+      std::vector<bool> reachable(const std::vector<uint>& roots) const;
+
+      // the functions code outside of the module may call: `main` and the
+      // `--export=` list. A module with neither is a library and every
+      // function of it counts.
+      std::vector<uint> entry_points(const Options& opts) const;
+
+  private:
+      ir::Program& program;
+      std::unordered_map<std::string, uint> functions;
+      std::vector<std::vector<uint>> callee_lists;
+      std::vector<std::vector<Site>> sites;
+    };
+  } // namespace opt
+} // namespace phantom
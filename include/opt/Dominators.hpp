@@ -0,0 +1,34 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+
+namespace phantom {
+  namespace opt {
+    // Dominator tree and dominance frontiers of a function, built from the
+    // `preds`/`succs` lists so the CFG has to be up to date.
+    // (Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm")
+    class Dominators {
+  public:
+      explicit Dominators(ir::Function& fn);
+
+      static constexpr uint NONE = (uint)-1;
+
+      // reachable blocks in reverse post-order, the entry comes first
+      std::vector<uint> order;
+
+      // immediate dominator of each block, NONE for the entry and for
+      // unreachable blocks
+      std::vector<uint> idom;
+      std::vector<std::vector<uint>> children;
+      std::vector<std::vector<uint>> frontier;
+
+      bool reachable(uint block) const;
+      // a block dominates itself
+      bool dominates(uint a, uint b) const;
+
+  private:
+      // pre/post numbering of the dominator tree
+      std::vector<uint> enter, leave;
+    };
+  } // namespace opt
+} // namespace phantom
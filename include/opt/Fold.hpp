@@ -0,0 +1,25 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+
+namespace phantom {
+  namespace opt {
+    // truncates an integer to `size` bytes and sign extends it back, integer
+    // constants are always kept in this form
+    int64_t wrap(int64_t value, uint size);
+
+    // rounds a floating point value to the precision of `type`
+    double round_to(double value, ir::Type& type);
+
+    // a constant of `type` holding `value`
+    ir::Constant make_constant(ir::Type type, int64_t value);
+    ir::Constant make_constant(ir::Type type, double value);
+
+    bool same_constant(const ir::Constant& a, const ir::Constant& b);
+
+    // evaluates `inst` with `args` as the values of `ir::operands(inst)`,
+    // returns false if the instruction can't be folded (phis, memory
+    // accesses, division by zero, out of range conversions...)
+    bool fold(ir::Instruction& inst, const std::vector<ir::Constant>& args, ir::Constant& result);
+  } // namespace opt
+} // namespace phantom
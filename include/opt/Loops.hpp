@@ -0,0 +1,43 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+
+namespace phantom {
+  namespace opt {
+    // A natural loop: the header and every block that reaches one of the
+    // back edges into it without going through the header.
+    struct Loop {
+      uint header;
+      std::vector<uint> blocks;  // the header first, in reverse post-order (added preheaders last)
+      std::vector<uint> latches; // sources of the back edges
+      std::vector<uint> exits;   // blocks outside the loop entered from inside
+      uint parent;               // the innermost enclosing loop, or Loops::NONE
+      uint depth = 1;
+
+      std::vector<bool> members;
+      bool contains(uint block) const {
+        return block < members.size() && members[block];
+      }
+    };
+
+    // The natural loops of a function, built from the back edges of the
+    // dominator tree (irreducible cycles aren't loops).
+    class Loops {
+  public:
+      explicit Loops(ir::Function& fn);
+
+      static constexpr uint NONE = (uint)-1;
+
+      // inner loops come before the loops containing them
+      std::vector<Loop> loops;
+      // the innermost loop of each block, NONE outside of loops
+      std::vector<uint> innermost;
+
+      // gives a loop a preheader: the only block outside of it branching to
+      // the header, with the header as its only successor. A new block is
+      // appended when needed, the CFG and this analysis are kept up to date
+      // but any other analysis of the function isn't.
+      uint preheader(ir::Function& fn, uint loop);
+    };
+  } // namespace opt
+} // namespace phantom
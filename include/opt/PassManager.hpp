@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Driver.hpp"
+#include "common.hpp"
+#include "opt/AnalysisManager.hpp"
+#include <map>
+
+namespace phantom {
+  namespace opt {
+    // Named counters bumped by passes (`--stats`), e.g.
+    // ("mem2reg", "allocas promoted") -> 12
+    struct Statistics {
+      std::map<std::pair<std::string, std::string>, size_t> counters;
+
+      void add(const char* pass, const char* what, size_t n = 1) {
+        if (n != 0)
+          counters[{ pass, what }] += n;
+      }
+    };
+
+    // Why a pass did (or didn't) transform something (`--remarks`), e.g.
+    // ("inline", "inlined @square into @main (cost 2, threshold 40)")
+    struct Remarks {
+      std::vector<std::pair<std::string, std::string>> entries;
+
+      void add(const char* pass, const std::string& message) {
+        entries.push_back({ pass, message });
+      }
+    };
+
+    // Everything a pass may need besides the IR it runs on. Function passes
+    // running in parallel get one context per function, sharing the
+    // analyses, their statistics and remarks are merged in program order.
+    struct Context {
+      const Options& opts;
+      const Logger& logger;
+      AnalysisManager& analyses;
+      Statistics stats;
+      Remarks remarks;
+
+      Context(const Options& opts, const Logger& logger, AnalysisManager& analyses)
+          : opts(opts), logger(logger), analyses(analyses) {}
+
+      // adds the statistics and remarks of `other` after its own
+      void merge(Context& other);
+    };
+
+    // A pass returns `true` when it changed the IR, in that case every cached
+    // analysis of the function (or of the whole program for module passes) is
+    // invalidated.
+    using FunctionPass = bool (*)(ir::Function& fn, Context& ctx);
+    using ModulePass = bool (*)(ir::Program& program, Context& ctx);
+
+    struct PassInfo {
+      const char* name;
+      const char* description;
+      FunctionPass function = nullptr;
+      ModulePass module = nullptr;
+    };
+
+    // per-pass bookkeeping for `--time-passes`
+    struct PassTiming {
+      const PassInfo* pass;
+      size_t runs = 0;
+      size_t changed = 0;
+      double seconds = 0;
+      long insts_delta = 0;
+    };
+
+    class PassManager {
+  public:
+      PassManager(ir::Program& program, const Options& opts, const Logger& logger)
+          : program(program), ctx(opts, logger, analyses) {}
+
+      // the pass registry, in the order `--print passes` lists them
+      static const std::vector<PassInfo>& registry();
+      static const PassInfo* lookup(const std::string& name);
+      static void print_registry(FILE* stream);
+
+      // the default pipeline of an optimization level
+      static std::vector<std::string> pipeline(OptLevel level);
+      // the passes to run: `--passes` or the `-O` level's pipeline, behind
+      // the `profile` pass with `-fprofile-generate`/`-fprofile-use`
+      static std::vector<std::string> pipeline(const Options& opts);
+
+      void add(const std::string& name);
+      void run();
+
+      void print_timings(FILE* stream) const;
+      void print_statistics(FILE* stream) const;
+      void print_remarks(FILE* stream) const;
+
+  private:
+      ir::Program& program;
+      AnalysisManager analyses;
+      Context ctx;
+      std::vector<PassTiming> passes;
+
+      bool run_pass(PassTiming& timing);
+    };
+
+    size_t instruction_count(ir::Function& fn);
+    size_t instruction_count(ir::Program& program);
+    // memory taken by the instructions and terminators, with the operand
+    // lists of phis, calls and fmas and the constant pools
+    size_t instruction_bytes(ir::Program& program);
+  } // namespace opt
+} // namespace phantom
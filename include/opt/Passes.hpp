@@ -0,0 +1,57 @@
+#pragma once
+
+#include "opt/PassManager.hpp"
+
+namespace phantom {
+  namespace opt {
+    // Verify.cpp
+    bool verify(ir::Function& fn, Context& ctx);
+
+    // Mem2Reg.cpp
+    bool mem2reg(ir::Function& fn, Context& ctx);
+
+    // SCCP.cpp
+    bool sccp(ir::Function& fn, Context& ctx);
+
+    // Simplify.cpp
+    bool simplify(ir::Function& fn, Context& ctx);
+
+    // Casts.cpp
+    bool casts(ir::Function& fn, Context& ctx);
+
+    // VRP.cpp
+    bool vrp(ir::Function& fn, Context& ctx);
+
+    // GVN.cpp
+    bool gvn(ir::Function& fn, Context& ctx);
+
+    // LICM.cpp
+    bool licm(ir::Function& fn, Context& ctx);
+
+    // Vectorize.cpp
+    bool vectorize(ir::Function& fn, Context& ctx);
+
+    // IndVars.cpp
+    bool indvars(ir::Function& fn, Context& ctx);
+
+    // Contract.cpp
+    bool contract(ir::Function& fn, Context& ctx);
+
+    // TailRec.cpp
+    bool tailrec(ir::Function& fn, Context& ctx);
+
+    // Inline.cpp
+    bool inline_calls(ir::Program& program, Context& ctx);
+
+    // Profile.cpp
+    bool profile(ir::Program& program, Context& ctx);
+
+    // IPCP.cpp
+    bool ipcp(ir::Program& program, Context& ctx);
+
+    // DeadCode.cpp
+    bool dce(ir::Function& fn, Context& ctx);
+    bool dse(ir::Function& fn, Context& ctx);
+    bool globaldce(ir::Program& program, Context& ctx);
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+#include "opt/Dominators.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    // the signed values an integer may take, `lo > hi` when none is known
+    // (the register is only defined in unreachable code)
+    struct Range {
+      int64_t lo, hi;
+
+      bool empty() const { return lo > hi; }
+      bool constant() const { return lo == hi; }
+    };
+
+    // Value ranges of the integer registers of a function: intervals found
+    // by abstract interpretation of the SSA form, widened to the limits of
+    // the type at loop phis that keep growing and narrowed back afterwards.
+    // In a block only one side of a comparison reaches, the operands of the
+    // comparison are bounded by each other, so induction variables get the
+    // bounds of their loop test.
+    class Ranges {
+  public:
+      explicit Ranges(ir::Function& fn);
+
+      static constexpr Range EMPTY = { 1, 0 };
+
+      // every value of `type`
+      static Range full(const ir::Type& type);
+      // whether `type` is a scalar integer the analysis tracks
+      static bool tracked(const ir::Type& type);
+
+      // the range of `value` wherever it is defined
+      Range range(const ir::Value& value) const;
+      // the range of `value` in `block`, narrowed by the branches taken to
+      // get there
+      Range range(const ir::Value& value, uint block) const;
+
+      // the outcome of `cmp` if it ran in `block`: 1, 0 or -1 when both
+      // are possible
+      int decide(const ir::Cmp& cmp, uint block) const;
+
+      Dominators dom;
+
+  private:
+      // `lhs pred rhs` holds in every block dominated by the one it is
+      // recorded for
+      struct Fact {
+        ir::Cmp::Pred pred;
+        ir::Value lhs, rhs;
+      };
+
+      std::vector<Range> ranges;            // by register id
+      std::vector<std::vector<Fact>> facts; // by block
+
+      // the comparison `to` is only entered through, from `from`
+      bool edge_fact(uint from, uint to, Fact& fact) const;
+      Range refine(Range range, const ir::VirtReg& reg, const Fact& fact) const;
+
+      Range evaluate(ir::Instruction& inst, uint block) const;
+      Range evaluate(ir::BinOp& binop, uint block) const;
+      Range evaluate(ir::Phi& phi, uint block) const;
+
+      // the comparisons feeding conditional branches, by register id
+      std::unordered_map<uint, const ir::Cmp*> conditions;
+      ir::Function& fn;
+    };
+  } // namespace opt
+} // namespace phantom
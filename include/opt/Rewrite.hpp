@@ -0,0 +1,25 @@
+#pragma once
+
+#include "irgen/Program.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    // Pending "replace every use of a register by a value" edits, a pass
+    // records them while walking a function and applies them at the end so
+    // uses it hasn't reached yet (phis on back edges) get rewritten too.
+    class Replacements {
+  public:
+      void add(const ir::VirtReg& reg, const ir::Value& value);
+      bool empty() const { return map.empty(); }
+
+      // rewrites `value` to what it finally stands for
+      void resolve(ir::Value& value) const;
+      // rewrites every operand in the function
+      void apply(ir::Function& fn) const;
+
+  private:
+      std::unordered_map<uint, ir::Value> map;
+    };
+  } // namespace opt
+} // namespace phantom
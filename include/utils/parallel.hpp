@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace phantom {
+  namespace utils {
+    // the threads `jobs` asks for, one per core when it is 0
+    unsigned thread_count(unsigned jobs);
+
+    // Calls `body(i)` for every `i` below `n` on up to `threads` threads
+    // (the caller's included) and returns once all of them are done. Every
+    // thread starts with an even share of the indices and steals half of
+    // what is left to another one when it runs out, so a few large functions
+    // don't hold up the rest. The calls must not depend on each other.
+    void parallel_for(size_t n, unsigned threads, const std::function<void(size_t)>& body);
+  }
+}
@@ -9,11 +9,49 @@ namespace phantom {
       " Available options:\n"
       "   -o [output_file_path]:\n"
       "       specify the output file [DEFAULT = \"a.out\"]\n"
+      "   -O0, -O1, -O2, -Os:\n"
+      "      optimization level [DEFAULT = -O2]\n"
       "   -O [ON|OFF]:\n"
-      "      turn optimization on/off [DEFAULT = on]\n\n"
-      "   --emit [llvm-ir|asm|obj]:\n"
-      "      type of the output file\n\n"
-      "   --print [tokens]:\n"
+      "      same as -O2/-O0\n\n"
+      "   --passes=[pass,...]:\n"
+      "      run the given passes instead of the -O pipeline\n"
+      "   --export=[function,...]:\n"
+      "      functions called from outside of the program besides main\n"
+      "   --time-passes:\n"
+      "      report per-pass timing and instruction count deltas\n"
+      "   --stats:\n"
+      "      report what every pass changed\n"
+      "   --remarks:\n"
+      "      explain the decisions of cost driven passes (inlining, vectorization)\n"
+      "   --jobs=[n]:\n"
+      "      optimize and compile functions on n threads [DEFAULT = one per core]\n"
+      "   --inline-threshold=[n]:\n"
+      "      inline calls whose estimated cost is at most n\n"
+      "   -mavx2:\n"
+      "      vectorize with 256-bit AVX2 instructions instead of SSE2\n"
+      "   -mfma:\n"
+      "      the target has fused multiply-add instructions\n\n"
+      "   -ffast-math:\n"
+      "      all of the floating point options below\n"
+      "   -fassociative-math:\n"
+      "      reassociate floating point sums and products, vectorize their reductions\n"
+      "   -freciprocal-math:\n"
+      "      divide by constants by multiplying with their reciprocal\n"
+      "   -ffp-contract=[fast|off]:\n"
+      "      fuse a * b + c into a multiply-add with -mfma [DEFAULT = off]\n\n"
+      "   -fbounds-check:\n"
+      "      stop the program when an array index is out of bounds\n"
+      "   -fprofile-generate[=file]:\n"
+      "      count block and call executions, the program writes them at exit\n"
+      "   -fprofile-use[=file]:\n"
+      "      lay out code and inline by the counts of a profile [DEFAULT = phantom.prof]\n"
+      "   -fregalloc=[linear|graph]:\n"
+      "      allocate registers by linear scan or by graph coloring [DEFAULT = graph at -O2]\n"
+      "   -fno-omit-frame-pointer:\n"
+      "      keep rbp pointing at the frame of every function\n\n"
+      "   --emit [ir|llvm-ir|asm|obj]:\n"
+      "      type of the output file, `ir` prints the optimized IR\n\n"
+      "   --print [tokens|passes]:\n"
       "      print the options to stdout\n\n"
       "   --color [ON|OFF]:\n"
       "      colored log output [DEFAULT = ON]\n"
@@ -52,8 +90,101 @@ namespace phantom {
         if (toggle != "ON" && toggle != "OFF")
           logger.log(Logger::Level::FATAL, "Incorrect [ON|OFF] form after \"-O\", got " + toggle, true);
 
-        opts.opitimize = (toggle == "ON");
+        opts.opt_level = (toggle == "ON") ? OptLevel::O2 : OptLevel::O0;
         i++;
+      } else if (arg == "-O0") {
+        opts.opt_level = OptLevel::O0;
+      } else if (arg == "-O1") {
+        opts.opt_level = OptLevel::O1;
+      } else if (arg == "-O2") {
+        opts.opt_level = OptLevel::O2;
+      } else if (arg == "-Os") {
+        opts.opt_level = OptLevel::Os;
+      } else if (arg.rfind("--passes=", 0) == 0) {
+        std::string list = arg.substr(9);
+        size_t start = 0;
+
+        while (start <= list.length()) {
+          size_t end = list.find(',', start);
+          if (end == std::string::npos)
+            end = list.length();
+
+          std::string name = list.substr(start, end - start);
+          if (!name.empty())
+            opts.passes.push_back(name);
+
+          start = end + 1;
+        }
+
+        opts.passes_specified = true;
+      } else if (arg.rfind("--export=", 0) == 0) {
+        std::string list = arg.substr(9);
+        size_t start = 0;
+
+        while (start <= list.length()) {
+          size_t end = list.find(',', start);
+          if (end == std::string::npos)
+            end = list.length();
+
+          std::string name = list.substr(start, end - start);
+          if (!name.empty())
+            opts.exported.push_back(name);
+
+          start = end + 1;
+        }
+      } else if (arg == "--time-passes") {
+        opts.time_passes = true;
+      } else if (arg == "--stats") {
+        opts.print_stats = true;
+      } else if (arg == "--remarks") {
+        opts.print_remarks = true;
+      } else if (arg.rfind("--jobs=", 0) == 0) {
+        std::string value = arg.substr(7);
+        if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || std::stoul(value) == 0)
+          logger.log(Logger::Level::FATAL, "Incorrect thread count after \"--jobs=\", got " + value, true);
+
+        opts.jobs = std::stoul(value);
+      } else if (arg.rfind("--inline-threshold=", 0) == 0) {
+        std::string value = arg.substr(19);
+        if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+          logger.log(Logger::Level::FATAL, "Incorrect threshold after \"--inline-threshold=\", got " + value, true);
+
+        opts.inline_threshold = std::stoi(value);
+      } else if (arg == "-mavx2") {
+        opts.avx2 = true;
+      } else if (arg == "-mfma") {
+        opts.fma = true;
+      } else if (arg == "-ffast-math") {
+        opts.fp_reassociate = opts.fp_reciprocal = opts.fp_contract = true;
+      } else if (arg == "-fassociative-math") {
+        opts.fp_reassociate = true;
+      } else if (arg == "-freciprocal-math") {
+        opts.fp_reciprocal = true;
+      } else if (arg.rfind("-ffp-contract=", 0) == 0) {
+        std::string mode = arg.substr(14);
+        if (mode != "fast" && mode != "off")
+          logger.log(Logger::Level::FATAL, "Incorrect [fast|off] form after \"-ffp-contract=\", got " + mode, true);
+
+        opts.fp_contract = (mode == "fast");
+      } else if (arg == "-fbounds-check") {
+        opts.bounds_check = true;
+      } else if (arg == "-fprofile-generate" || arg.rfind("-fprofile-generate=", 0) == 0) {
+        opts.profile_generate = (arg.size() > 18) ? arg.substr(19) : "phantom.prof";
+        if (opts.profile_generate.empty())
+          logger.log(Logger::Level::FATAL, "Expected a file after \"-fprofile-generate=\"", true);
+      } else if (arg == "-fprofile-use" || arg.rfind("-fprofile-use=", 0) == 0) {
+        opts.profile_use = (arg.size() > 13) ? arg.substr(14) : "phantom.prof";
+        if (opts.profile_use.empty())
+          logger.log(Logger::Level::FATAL, "Expected a file after \"-fprofile-use=\"", true);
+      } else if (arg.rfind("-fregalloc=", 0) == 0) {
+        std::string allocator = arg.substr(11);
+        if (allocator != "linear" && allocator != "graph")
+          logger.log(Logger::Level::FATAL, "Incorrect [linear|graph] form after \"-fregalloc=\", got " + allocator, true);
+
+        opts.regalloc = (allocator == "graph") ? RegAlloc::GraphColoring : RegAlloc::LinearScan;
+        opts.regalloc_specified = true;
+      } else if (arg == "-fomit-frame-pointer" || arg == "-fno-omit-frame-pointer") {
+        opts.omit_frame_pointer = (arg == "-fomit-frame-pointer");
       } else if (arg == "--color") {
         if (i + 1 >= argv.size())
           logger.log(Logger::Level::FATAL, "Expected [ON|OFF] after \"--color\"", true);
@@ -67,21 +198,21 @@ namespace phantom {
         i++;
       } else if (arg == "--emit") {
         if (i + 1 >= argv.size())
-          logger.log(Logger::Level::FATAL, "Expected [llvm-ir|asm|obj] after \"--emit\"", true);
+          logger.log(Logger::Level::FATAL, "Expected [ir|llvm-ir|asm|obj] after \"--emit\"", true);
 
         std::string type = argv[i + 1];
-        if (type != "llvm-ir" && type != "asm" && type != "obj")
-          logger.log(Logger::Level::FATAL, "Incorrect [llvm-ir|asm|obj] form after \"--emit\", got " + type, true);
+        if (type != "ir" && type != "llvm-ir" && type != "asm" && type != "obj")
+          logger.log(Logger::Level::FATAL, "Incorrect [ir|llvm-ir|asm|obj] form after \"--emit\", got " + type, true);
 
         opts.out_type = type;
         i++;
       } else if (arg == "--print") {
         if (i + 1 >= argv.size())
-          logger.log(Logger::Level::FATAL, "Expected [tokens] after \"--print\"", true);
+          logger.log(Logger::Level::FATAL, "Expected [tokens|passes] after \"--print\"", true);
 
         std::string option = argv[i + 1];
-        if (option != "tokens")
-          logger.log(Logger::Level::FATAL, "Incorrect [tokens] form after \"-print\", got " + option, true);
+        if (option != "tokens" && option != "passes")
+          logger.log(Logger::Level::FATAL, "Incorrect [tokens|passes] form after \"-print\", got " + option, true);
 
         opts.print = option;
         i++;
@@ -94,9 +225,12 @@ namespace phantom {
         logger.log(Logger::Level::FATAL, "Unreconized [OPTION/ARGUMENT] " + arg + "\n", true);
     }
 
-    if (opts.source_file.empty())
+    if (opts.source_file.empty() && opts.print != "passes")
       logger.log(Logger::Level::FATAL, "Source file is required for compilation", true);
 
+    if (!opts.regalloc_specified)
+      opts.regalloc = (opts.opt_level == OptLevel::O2) ? RegAlloc::GraphColoring : RegAlloc::LinearScan;
+
     return opts;
   }
 } // namespace phantom
@@ -99,7 +99,11 @@ namespace phantom {
     std::unique_ptr<Stmt> Parser::parse_return() {
       expect(Token::Kind::Return);
       auto ret = std::make_unique<Return>();
-      ret->expr = parse_expr();
+
+      // `return;` in functions that don't return anything
+      if (!match(Token::Kind::SemiColon))
+        ret->expr = parse_expr();
+
       expect(Token::Kind::SemiColon);
 
       auto stmt = std::make_unique<Stmt>();
@@ -115,17 +119,87 @@ namespace phantom {
       stmt->emplace<std::unique_ptr<Expmt>>(std::move(expmt));
       return stmt;
     }
+    std::unique_ptr<Stmt> Parser::parse_if() {
+      expect(Token::Kind::If);
+      auto branch = std::make_unique<If>();
+      branch->cond = parse_expr();
+      branch->then = parse_block();
+
+      if (match(Token::Kind::Else)) {
+        consume();
+
+        if (match(Token::Kind::If))
+          branch->otherwise.push_back(parse_if());
+        else
+          branch->otherwise = parse_block();
+      }
+
+      auto stmt = std::make_unique<Stmt>();
+      stmt->emplace<std::unique_ptr<If>>(std::move(branch));
+      return stmt;
+    }
+    std::unique_ptr<Stmt> Parser::parse_while() {
+      expect(Token::Kind::While);
+      auto loop = std::make_unique<While>();
+      loop->cond = parse_expr();
+      loop->body = parse_block();
+
+      auto stmt = std::make_unique<Stmt>();
+      stmt->emplace<std::unique_ptr<While>>(std::move(loop));
+      return stmt;
+    }
+    std::unique_ptr<Stmt> Parser::parse_for() {
+      // for (init; cond; step) { body }
+      expect(Token::Kind::For);
+      expect(Token::Kind::OpenParent);
+      auto loop = std::make_unique<For>();
+
+      if (!match(Token::Kind::SemiColon))
+        loop->init = parse_expr();
+      expect(Token::Kind::SemiColon);
+
+      if (!match(Token::Kind::SemiColon))
+        loop->cond = parse_expr();
+      expect(Token::Kind::SemiColon);
+
+      if (!match(Token::Kind::CloseParent))
+        loop->step = parse_expr();
+      expect(Token::Kind::CloseParent);
+
+      loop->body = parse_block();
+
+      auto stmt = std::make_unique<Stmt>();
+      stmt->emplace<std::unique_ptr<For>>(std::move(loop));
+      return stmt;
+    }
     std::unique_ptr<Stmt> Parser::parse_stmt() {
       switch (peek().kind) {
         case Token::Kind::Fn:
           return parse_function();
         case Token::Kind::Return:
           return parse_return();
+        case Token::Kind::If:
+          return parse_if();
+        case Token::Kind::While:
+          return parse_while();
+        case Token::Kind::For:
+          return parse_for();
         default:
           return parse_expmt();
       }
     }
 
+    std::vector<std::unique_ptr<Stmt>> Parser::parse_block() {
+      std::vector<std::unique_ptr<Stmt>> body;
+      expect(Token::Kind::OpenCurly);
+
+      while (!match(Token::Kind::CloseCurly) && !match(Token::Kind::EndOfFile))
+        body.push_back(parse_stmt());
+
+      expect(Token::Kind::CloseCurly);
+      return body;
+    }
+
     std::unique_ptr<Expr> Parser::parse_expr(const int min_prec) {
       // INFO: Pratt Parser
       std::unique_ptr<Expr> left = parse_prim();
@@ -181,6 +255,19 @@ namespace phantom {
             return expr;
           }
 
+          // array element
+          if (match(Token::Kind::OpenBracket)) {
+            consume();
+            auto index = std::make_unique<Index>();
+            index->name = name;
+            index->index = parse_expr();
+            expect(Token::Kind::CloseBracket);
+
+            auto expr = std::make_unique<Expr>();
+            expr->emplace<std::unique_ptr<Index>>(std::move(index));
+            return expr;
+          }
+
           auto ide = std::make_unique<Identifier>();
           ide->name = name;
 
@@ -247,6 +334,26 @@ namespace phantom {
           expect(Token::Kind::CloseParent);
           return expr;
         }
+        case Token::Kind::OpenBracket: {
+          consume(); // [
+          auto array = std::make_unique<ArrLit>();
+
+          do {
+            if (match(Token::Kind::CloseBracket))
+              break;
+
+            if (match(Token::Kind::Comma))
+              consume();
+
+            array->elements.push_back(parse_expr());
+          } while (match(Token::Kind::Comma));
+
+          expect(Token::Kind::CloseBracket);
+
+          auto expr = std::make_unique<Expr>();
+          expr->emplace<std::unique_ptr<ArrLit>>(std::move(array));
+          return expr;
+        }
         default:
           // Implement support for expressions that starts with `" + Token::kind_to_string(peek().kind) + "`\n"
           printf("Implement support for expressions that starts with `%s`\n", Token::kind_to_string(peek().kind).c_str());
@@ -280,6 +387,22 @@ namespace phantom {
       if (!log.empty())
         logger.log(Logger::Level::ERROR, log);
 
+      // arrays: `i32[8]`
+      if (match(Token::Kind::OpenBracket)) {
+        consume();
+        std::string length = expect(Token::Kind::IntLit);
+
+        log.clear();
+        uint64_t value = utils::parse_int(length, log);
+        if (!log.empty())
+          logger.log(Logger::Level::ERROR, log);
+        if (value == 0)
+          logger.log(Logger::Level::ERROR, "Array length must be positive", peek().location);
+
+        type->length = (uint32_t)value;
+        expect(Token::Kind::CloseBracket);
+      }
+
       return type;
     }
   } // namespace ast
@@ -1,6 +1,11 @@
 #include "codegen/Codegen.hpp"
+#include "codegen/Frame.hpp"
+#include "irgen/Cfg.hpp"
 #include "common.hpp"
+#include "utils/parallel.hpp"
 #include <cassert>
+#include <cmath>
+#include <memory>
 #include <cstring>
 
 namespace phantom {
@@ -9,12 +14,30 @@ namespace phantom {
       output = utils::init();
       utils::append(&output, ".section .text\n\n");
 
-      for (ir::Function& fn : program.funcs) {
-        generate_function(fn);
+      // declarations are resolved by the linker
+      std::vector<ir::Function*> defined;
+      for (ir::Function& fn : program.funcs)
+        if (fn.defined)
+          defined.push_back(&fn);
+
+      std::vector<std::unique_ptr<Gen>> units(defined.size());
+      utils::parallel_for(defined.size(), utils::thread_count(jobs), [&](size_t i) {
+        units[i] = std::make_unique<Gen>(program, 1, regalloc, frame_pointer);
+        units[i]->output = utils::init();
+        units[i]->generate_function(*defined[i]);
+      });
+
+      for (std::unique_ptr<Gen>& unit : units) {
+        utils::append(&output, unit->output.content);
         utils::append(&output, "\n");
+        free(unit->output.content);
+
+        floats_data.insert(unit->floats_data.begin(), unit->floats_data.end());
+        doubles_data.insert(unit->doubles_data.begin(), unit->doubles_data.end());
       }
 
       generate_data();
+      generate_profile_data();
 
       return output.content;
     }
@@ -23,873 +46,905 @@ namespace phantom {
       const char* name = fn.name.c_str();
 
       utils::appendf(&output, "# begin function @%s\n", name);
-      utils::appendf(&output, ".globl %s\n", name);
+      if (!fn.internal)
+        utils::appendf(&output, ".globl %s\n", name);
       utils::append(&output, ".p2align 4\n");
       utils::appendf(&output, ".type %s, @function\n", name);
       utils::appendf(&output, "%s:\n", name, name);
 
-      utils::append(&output, "  pushq   %rbp\n");
-      utils::append(&output, "  movq    %rsp, %rbp\n");
-      offset = 0;
+      Frame frame(fn, regalloc);
+      scope_vars = std::move(frame.slots);
+      phi_incoming = std::move(frame.phi_incoming);
+      splits = std::move(frame.splits);
+
+      wide_vectors = false;
+      for (auto& [id, var] : scope_vars)
+        wide_vectors = wide_vectors || vector_bytes(var.type) == 32;
+
+      frame_size = frame.size;
+      saved_registers = std::move(frame.saved);
+      if (frame.unshared_size != frame.size)
+        utils::appendf(&output, "  # frame: %zu bytes, %zu without sharing slots\n", frame.size, frame.unshared_size);
+      if (frame.in_registers != 0 || frame.spilled != 0)
+        utils::appendf(&output, "  # %zu values in registers, %zu spilled (%zu pieces in registers)\n",
+                       frame.in_registers, frame.spilled, frame.pieces);
+
+      bool leaf = true;
+      for (ir::Block& block : fn.blocks)
+        for (ir::Instruction& inst : block.body)
+          leaf = leaf && inst.index() != 14;
+
+      pushed = 0;
+      if (frame_pointer) {
+        utils::append(&output, "  pushq   %rbp\n");
+        utils::append(&output, "  movq    %rsp, %rbp\n");
+        if (frame_size != 0)
+          utils::appendf(&output, "  subq    $%zu, %%rsp\n", frame_size);
+      } else if (leaf && frame_size + 8 <= 128) {
+        // the return address is at 0(%rsp), the slots go below it
+        frame_base = -8;
+        frame_adjust = 0;
+      } else {
+        // "rsp" is 8 bytes off 16 bytes alignment at the entry
+        frame_base = frame_size;
+        frame_adjust = frame_size + 8;
+        utils::appendf(&output, "  subq    $%zu, %%rsp\n", frame_adjust);
+      }
 
-      const char* regs[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
-      const size_t regs_size = 6;
+      for (auto& [reg, offset] : saved_registers)
+        utils::appendf(&output, "  movq    %%%s, %s\n", reg, frame_address(-(int64_t)offset).c_str());
+
+      std::vector<ir::Type> types;
+      for (ir::VirtReg& param : fn.params)
+        types.push_back(param.type);
+
+      // parameters passed on the stack are above the return address
+      std::vector<const char*> regs = argument_registers(types);
+      size_t stack_offset = 16;
+
+      for (size_t i = 0; i < fn.params.size(); ++i) {
+        ir::VirtReg& param = fn.params[i];
+        std::string location = variable_form(scope_vars[param.id], param.type.size);
+        char* mov = is_float(param.type) ? generate_floating_point_move(param.type)
+                                         : generate_integer_move(param.type, param.type);
+
+        if (regs[i] != nullptr) {
+          const char* reg = get_register_by_size(regs[i], param.type.size);
+          utils::appendf(&output, "  %-7s %%%s, %s\n", mov, reg, location.c_str());
+        } else {
+          PhysReg tmp = { .rid = 0, .type = param.type };
+          const char* reg = physical_register_name(tmp);
+
+          utils::appendf(&output, "  %-7s %s, %%%s\n", mov, frame_address(stack_offset).c_str(), reg);
+          utils::appendf(&output, "  %-7s %%%s, %s\n", mov, reg, location.c_str());
+          stack_offset += 8;
+        }
 
-      size_t params_size = fn.params.size();
-      size_t tmp = std::min(regs_size, params_size);
-      for (size_t i = 0; i < tmp; ++i) {
-        ir::VirtReg param = fn.params.at(i);
+        free(mov);
+      }
 
-        const char suff = integer_suffix(param.type.size);
-        const char* reg = get_register_by_size(regs[i], param.type.size);
+      folded.clear();
+      uses.clear();
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body)
+          for (ir::Value* value : ir::operands(inst))
+            if (value->index() == 1)
+              uses[value->reg().id]++;
+
+        if (block.terminated)
+          for (ir::Value* value : ir::operands(block.terminator))
+            if (value->index() == 1)
+              uses[value->reg().id]++;
+      }
 
-        utils::appendf(&output, "  mov%c    %%%s, -%zu(%%rbp)\n", suff, reg, offset + param.type.size);
-        offset += param.type.size;
+      current_function = &fn;
+      std::vector<uint> layout = block_layout(fn);
+      bool cold = false;
 
-        scope_vars[param.id] = Variable{ .type = param.type, .offset = offset };
+      for (size_t i = 0; i < layout.size(); ++i) {
+        current_block = layout[i];
+        next_block = (i + 1 < layout.size() && is_cold(fn, layout[i + 1]) == is_cold(fn, current_block))
+                          ? layout[i + 1]
+                          : NO_BLOCK;
+
+        if (!cold && is_cold(fn, current_block)) {
+          utils::append(&output, ".section .text.unlikely\n");
+          cold = true;
+        }
+
+        generate_block(fn.blocks[current_block]);
       }
 
-      for (size_t i = tmp; i < params_size; ++i) {
-        ir::VirtReg param = fn.params.at(i);
+      if (cold)
+        utils::append(&output, ".section .text\n");
 
-        const char suff = integer_suffix(param.type.size);
-        const char* reg = get_register_by_size("rax", param.type.size);
+      utils::appendf(&output, "# end function @%s\n", name);
+    }
+    std::vector<uint> Gen::block_layout(ir::Function& fn) {
+      std::vector<uint> layout;
 
-        utils::appendf(&output, "  mov%c    %zu(%%rbp), %%%s\n", suff, ((i - tmp) + 2) * 8, reg);
-        utils::appendf(&output, "  mov%c    %%%s, -%zu(%%rbp)\n", suff, reg, offset + param.type.size);
-        offset += param.type.size;
+      if (fn.blocks[0].count == ir::NO_COUNT) {
+        for (uint b = 0; b < fn.blocks.size(); ++b)
+          layout.push_back(b);
 
-        scope_vars[param.id] = Variable{ .type = param.type, .offset = offset };
+        return layout;
       }
 
-      for (ir::Instruction& inst : fn.body)
-        generate_instruction(inst);
+      // blocks added after the profile was read have no count
+      auto weight = [&](uint b) { return (fn.blocks[b].count == ir::NO_COUNT) ? 0 : fn.blocks[b].count; };
 
-      if (fn.terminated)
-        generate_terminator(fn.terminator, fn.return_type);
-      else
-        generate_default_terminator(fn.return_type);
+      std::vector<bool> placed(fn.blocks.size(), false);
+      auto hottest = [&](const std::vector<uint>& candidates) {
+        uint best = NO_BLOCK;
+        for (uint b : candidates) {
+          if (placed[b] || is_cold(fn, b))
+            continue;
 
-      utils::appendf(&output, "# end function @%s\n", name);
-    }
-    void Gen::generate_instruction(ir::Instruction& inst) {
-      switch (inst.index()) {
-        case 0: // Alloca
-        {
-          ir::Alloca& alloca = std::get<0>(inst);
-          offset += alloca.type.size;
-          scope_vars[alloca.reg.id] = Variable{ .type = alloca.type, .offset = offset };
-          break;
+          if (best == NO_BLOCK || weight(b) > weight(best))
+            best = b;
         }
-        case 1: // Store
-        {
-          ir::Store& store = std::get<1>(inst);
 
-          switch (store.dst.index()) {
-            case 0: // VirtReg
-            {
-              ir::VirtReg memory = std::get<0>(store.dst);
-              switch (store.src.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(store.src);
-                  return store_constant_in_memory(constant, memory);
-                }
-                case 1: // VirtReg
-                {
-                  ir::VirtReg value = std::get<1>(store.src);
-                  return store_memory_in_memory(memory, value);
-                }
-                case 2: // PhysReg
-                {
-                  ir::PhysReg value = std::get<2>(store.src);
-                  return store_register_in_memory(value, memory);
-                }
-                default:
-                  unreachable();
-              }
-            }
-            case 1: // PhysReg
-            {
-              ir::PhysReg dst = std::get<1>(store.dst);
-              switch (store.src.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(store.src);
-                  return store_constant_in_register(constant, dst);
-                }
-                case 1: // VirtReg
-                {
-                  ir::VirtReg memory = std::get<1>(store.src);
-                  return store_memory_in_register(memory, dst);
-                }
-                case 2: // PhysReg
-                {
-                  ir::PhysReg src = std::get<2>(store.src);
-                  return store_register_in_register(dst, src);
-                }
-                default:
-                  unreachable();
-              }
-            }
-            default:
-              unreachable();
+        return best;
+      };
+
+      std::vector<uint> all;
+      for (uint b = 0; b < fn.blocks.size(); ++b)
+        all.push_back(b);
+
+      // chains of hottest successors, each started from the hottest block
+      // left (the entry first)
+      uint b = 0;
+      while (b != NO_BLOCK) {
+        placed[b] = true;
+        layout.push_back(b);
+
+        std::vector<uint> succs;
+        if (fn.blocks[b].terminated)
+          succs = ir::successors(fn.blocks[b].terminator);
+
+        b = hottest(succs);
+        if (b == NO_BLOCK)
+          b = hottest(all);
+      }
+
+      for (uint c = 0; c < fn.blocks.size(); ++c)
+        if (!placed[c])
+          layout.push_back(c);
+
+      return layout;
+    }
+    bool Gen::is_cold(ir::Function& fn, uint block) {
+      return block != 0 && fn.blocks[block].count == 0;
+    }
+    void Gen::generate_block(ir::Block& block) {
+      utils::appendf(&output, "%s:\n", block_label(current_block).c_str());
+
+      plan_trees(block);
+
+      size_t size = block.body.size();
+      auto generate = [&](size_t i) {
+        enter_splits(i);
+        generate_instruction(block.body[i]);
+        leave_splits(i);
+      };
+
+      if (is_tail_call(block)) {
+        for (size_t i = 0; i + 1 < size; ++i)
+          generate(i);
+
+        enter_splits(size - 1);
+        generate_call(std::get<14>(block.body.back()), true);
+        return leave_splits(size - 1);
+      }
+
+      if (!block.terminated) {
+        for (size_t i = 0; i < size; ++i)
+          generate(i);
+
+        return generate_default_terminator(current_function->return_type);
+      }
+
+      // a comparison that only feeds the branch right after it doesn't need
+      // to materialize its result, branch on the flags directly.
+      if (block.terminator.index() == 2 && size != 0 && block.body.back().index() == 11) {
+        ir::CondBranch& br = std::get<2>(block.terminator);
+        ir::Cmp& cmp = std::get<11>(block.body.back());
+
+        if (br.cond.index() == 1 && br.cond.reg().id == cmp.dst.id) {
+          // the flags of the addition right before are already those of
+          // comparing its result with zero (the stores in between are
+          // moves), countdown loops end with "dec" and "jnz"
+          bool flags = size >= 2 && sets_zero_flag(block.body[size - 2], cmp);
+
+          for (size_t i = 0; i + 1 < size; ++i) {
+            if (flags && i + 2 == size) {
+              enter_splits(i);
+              select_binop(std::get<2>(block.body[i]), true);
+              leave_splits(i);
+            } else
+              generate(i);
           }
+          generate_phi_copies(block);
 
-          break;
+          if (flags) {
+            const char* cc = (cmp.pred == ir::Cmp::Pred::Eq) ? "e" : "ne";
+            return generate_conditional_jump(cc, false, br.then_block, br.else_block);
+          }
+
+          bool parity = ir::type_of(cmp.lhs).kind == ir::Type::Kind::Float;
+          parity = parity && (cmp.pred == ir::Cmp::Pred::Eq || cmp.pred == ir::Cmp::Pred::Ne);
+
+          const char* cc = generate_compare(cmp);
+          return generate_conditional_jump(cc, parity, br.then_block, br.else_block);
         }
-        case 2: // BinOp
-        {
-          ir::BinOp binop = std::get<2>(inst);
+      }
 
-          // NOTE: Constant + Constant is handled in the IR generation
-          // NOTE: we still don't support unsigned integers
-          switch (binop.op) {
-            case ir::BinOp::Op::Add: // addition
-            {
-              switch (binop.lhs.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
-                      store_constant_in_register(constant, binop.dst);
-                      return add_memory_to_register(memory, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg src = std::get<2>(binop.rhs);
-                      add_constant_to_register(constant, src);
-
-                      if (src.rid != binop.dst.rid || src.type.kind != binop.dst.type.kind)
-                        store_register_in_register(src, binop.dst);
-
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-                case 1: // VirtReg
-                {
-                  ir::VirtReg memory = std::get<1>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
-                      store_memory_in_register(memory, binop.dst);
-                      return add_constant_to_register(constant, binop.dst);
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg src = std::get<1>(binop.rhs);
-                      store_memory_in_register(memory, binop.dst);
-                      return add_memory_to_register(src, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg src = std::get<2>(binop.rhs);
-                      add_memory_to_register(memory, src);
-
-                      if (src.rid != binop.dst.rid || src.type.kind != binop.dst.type.kind)
-                        store_register_in_register(src, binop.dst);
-
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-                case 2: // PhysReg
-                {
-                  ir::PhysReg left = std::get<2>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
-                      add_constant_to_register(constant, left);
-
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
-
-                      return;
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
-                      add_memory_to_register(memory, left);
-
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
-
-                      return;
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg right = std::get<2>(binop.rhs);
-                      add_register_to_register(right, left);
-
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
-
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-              }
-              unreachable();
-            }
-            case ir::BinOp::Op::Sub: // substraction
-            {
-              switch (binop.lhs.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
-                      store_constant_in_register(constant, binop.dst);
-                      return sub_memory_from_register(memory, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg right = std::get<2>(binop.rhs);
-
-                      if (right.rid != binop.dst.rid || right.type.kind != binop.dst.type.kind) {
-                        store_constant_in_register(constant, binop.dst);
-                        return sub_register_from_register(right, binop.dst);
-                      }
-
-                      // else
-                      ir::PhysReg ir = binop.dst;
-                      ir.rid = TR_INDEX; // using the temporary register
-
-                      store_constant_in_register(constant, ir);
-                      sub_register_from_register(right, ir);
-
-                      return store_register_in_register(ir, binop.dst);
-                    }
-                  }
-                  unreachable();
-                }
-                case 1: // VirtReg
-                {
-                  ir::VirtReg memory = std::get<1>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
-                      store_memory_in_register(memory, binop.dst);
-                      return sub_constant_from_register(constant, binop.dst);
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg src = std::get<1>(binop.rhs);
-                      store_memory_in_register(memory, binop.dst);
-                      return sub_memory_from_register(src, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg right = std::get<2>(binop.rhs);
-
-                      if (right.rid != binop.dst.rid || right.type.kind != binop.dst.type.kind) {
-                        store_memory_in_register(memory, binop.dst);
-                        return sub_register_from_register(right, binop.dst);
-                      }
-
-                      // else
-                      ir::PhysReg ir = binop.dst;
-                      ir.rid = TR_INDEX; // using the temporary register
-
-                      store_memory_in_register(memory, ir);
-                      sub_register_from_register(right, ir);
-
-                      return store_register_in_register(ir, binop.dst);
-                    }
-                  }
-                  unreachable();
-                }
-                case 2: // PhysReg
-                {
-                  ir::PhysReg left = std::get<2>(binop.lhs);
+      for (size_t i = 0; i < size; ++i)
+        generate(i);
 
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
+      generate_phi_copies(block);
+      generate_terminator(block.terminator, current_function->return_type);
+    }
+    void Gen::enter_splits(size_t index) {
+      for (Frame::Split& split : splits[current_block]) {
+        if (split.first != index)
+          continue;
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+        Variable& var = scope_vars[split.id];
+        std::string slot = variable_form(var, var.type.size);
+        char* mov = is_float(var.type) ? generate_floating_point_move(var.type)
+                                       : generate_integer_move(var.type, var.type);
 
-                      return sub_constant_from_register(constant, binop.dst);
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
+        utils::appendf(&output, "  %-7s %s, %%%s\n", mov, slot.c_str(), get_register_by_size(split.reg, var.type.size));
+        free(mov);
+        var.reg = split.reg;
+      }
+    }
+    void Gen::leave_splits(size_t index) {
+      for (Frame::Split& split : splits[current_block])
+        if (split.last == index)
+          scope_vars[split.id].reg = nullptr;
+    }
+    void Gen::generate_division(ir::BinOp& binop) {
+      // narrower operands are sign extended so "cltd"/"cqto" and the
+      // remainder in "rdx" work the same for every width
+      ir::Type type = binop.dst.type;
+      type.size = std::max<uint8_t>(type.size, 4);
+
+      PhysReg dividend = { .rid = 0, .type = type };
+      PhysReg divisor = { .rid = 1, .type = type };
+      load_value(binop.lhs, dividend);
+      load_value(binop.rhs, divisor);
+
+      division_conversion(type);
+      idiv_by_register(divisor);
+
+      // the quotient is in "rax", the remainder in "rdx"
+      uint rid = (binop.op == ir::BinOp::Op::Rem) ? (uint)TR_INDEX : 0;
+      PhysReg result = { .rid = rid, .type = binop.dst.type };
+      store_register_in_memory(result, binop.dst);
+    }
+    void Gen::generate_high_multiply(ir::BinOp& binop) {
+      PhysReg lhs = { .rid = 0, .type = binop.dst.type };
+      PhysReg rhs = { .rid = 1, .type = binop.dst.type };
+      load_value(binop.lhs, lhs);
+      load_value(binop.rhs, rhs);
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+      // the one operand form leaves the high half in "rdx"
+      utils::appendf(&output, "  imul%c   %%%s\n", type_suffix(rhs.type), physical_register_name(rhs));
 
-                      return sub_memory_from_register(memory, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg right = std::get<2>(binop.rhs);
-                      sub_register_from_register(right, left);
+      PhysReg result = { .rid = (uint)TR_INDEX, .type = binop.dst.type };
+      store_register_in_memory(result, binop.dst);
+    }
+    void Gen::generate_byte_multiply(ir::BinOp& binop) {
+      // "imul" has no two operand form on bytes, the low byte of the 32-bit
+      // product is the same
+      ir::Type type = binop.dst.type;
+      type.size = 4;
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+      PhysReg lhs = { .rid = 0, .type = type };
+      PhysReg rhs = { .rid = 1, .type = type };
+      load_value(binop.lhs, lhs);
+      load_value(binop.rhs, rhs);
 
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-              }
-              unreachable();
-            }
-            case ir::BinOp::Op::Mul: // multiplication
-            {
-              switch (binop.lhs.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(binop.lhs);
+      utils::appendf(&output, "  imull   %%%s, %%%s\n", physical_register_name(rhs), physical_register_name(lhs));
 
-                  switch (binop.rhs.index()) {
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
+      PhysReg result = { .rid = 0, .type = binop.dst.type };
+      store_register_in_memory(result, binop.dst);
+    }
+    std::vector<const char*> Gen::argument_registers(std::vector<ir::Type>& types) {
+      static const char* integers[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+      static const char* floats[] = { "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7" };
+
+      std::vector<const char*> regs;
+      size_t ni = 0, nf = 0;
+
+      for (ir::Type& type : types) {
+        if (is_float(type))
+          regs.push_back((nf < 8) ? floats[nf++] : nullptr);
+        else
+          regs.push_back((ni < 6) ? integers[ni++] : nullptr);
+      }
 
-                      if (!is_float(binop.dst.type))
-                        return imul_constant_with_memory(constant, memory, binop.dst);
+      return regs;
+    }
+    bool Gen::is_tail_call(ir::Block& block) {
+      if (block.body.empty() || block.body.back().index() != 14)
+        return false;
 
-                      store_constant_in_register(constant, binop.dst);
-                      return mul_memory_with_register(memory, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg src = std::get<2>(binop.rhs);
+      ir::Call& call = std::get<14>(block.body.back());
+      ir::Type& return_type = current_function->return_type;
 
-                      if (!is_float(binop.dst.type))
-                        return imul_constant_with_register(constant, src, binop.dst);
+      if (!ir::returns_register(*current_function, current_block, call.dst))
+        return false;
 
-                      // else
-                      mul_constant_with_register(constant, src);
+      // the result has to come back in the register the caller returns it in
+      bool same = call.dst.type.kind == return_type.kind && call.dst.type.size == return_type.size;
+      if (!return_type.is_void && !same)
+        return false;
 
-                      if (src.rid != binop.dst.rid || src.type.kind != binop.dst.type.kind)
-                        store_register_in_register(src, binop.dst);
+      // stack arguments would have to overwrite the caller's own
+      std::vector<ir::Type> types;
+      for (ir::Value& arg : call.args)
+        types.push_back(ir::type_of(arg));
 
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-                case 1: // VirtReg
-                {
-                  ir::VirtReg memory = std::get<1>(binop.lhs);
-
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
-
-                      if (!is_float(binop.dst.type))
-                        return imul_constant_with_memory(constant, memory, binop.dst);
-
-                      store_memory_in_register(memory, binop.dst);
-                      return mul_constant_with_register(constant, binop.dst);
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg src = std::get<1>(binop.rhs);
-                      store_memory_in_register(memory, binop.dst);
-
-                      if (!is_float(binop.dst.type))
-                        return imul_memory_with_register(memory, binop.dst);
-
-                      return mul_memory_with_register(src, binop.dst);
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg src = std::get<2>(binop.rhs);
-
-                      if (!is_float(binop.dst.type))
-                        imul_memory_with_register(memory, src);
-                      else
-                        mul_memory_with_register(memory, src);
-
-                      if (src.rid != binop.dst.rid || src.type.kind != binop.dst.type.kind)
-                        store_register_in_register(src, binop.dst);
-
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-                case 2: // PhysReg
-                {
-                  ir::PhysReg left = std::get<2>(binop.lhs);
+      for (const char* reg : argument_registers(types))
+        if (reg == nullptr)
+          return false;
 
-                  switch (binop.rhs.index()) {
-                    case 0: // Constant
-                    {
-                      ir::Constant constant = std::get<0>(binop.rhs);
+      return true;
+    }
+    void Gen::generate_call(ir::Call& call, bool tail) {
+      std::vector<ir::Type> types;
+      for (ir::Value& arg : call.args)
+        types.push_back(ir::type_of(arg));
+
+      std::vector<const char*> regs = argument_registers(types);
+
+      std::vector<size_t> stacked;
+      for (size_t i = 0; i < regs.size(); ++i)
+        if (regs[i] == nullptr)
+          stacked.push_back(i);
+
+      // "rsp" has to stay 16 bytes aligned at the call, every stack
+      // argument takes 8 bytes
+      size_t stack_size = stacked.size() * 8;
+      if (stacked.size() % 2 != 0) {
+        utils::append(&output, "  subq    $8, %rsp\n");
+        stack_size += 8;
+        pushed += 8;
+      }
 
-                      if (!is_float(binop.dst.type))
-                        return imul_constant_with_register(constant, left, binop.dst);
+      // pushed right to left, before the argument registers are filled since
+      // the scratch registers overlap them
+      for (size_t i = stacked.size(); i-- > 0;) {
+        ir::Value& arg = call.args[stacked[i]];
+        PhysReg reg = { .rid = 0, .type = types[stacked[i]] };
+        load_value(arg, reg);
+
+        if (is_float(reg.type)) {
+          utils::append(&output, "  subq    $8, %rsp\n");
+          utils::appendf(&output, "  movs%c   %%%s, (%%rsp)\n", type_suffix(reg.type), physical_register_name(reg));
+        } else
+          utils::append(&output, "  pushq   %rax\n");
+        pushed += 8;
+      }
 
-                      mul_constant_with_register(constant, left);
+      // slots and constants are read straight into the argument registers,
+      // integers narrower than 32 bits are sign extended like C does
+      for (size_t i = 0; i < regs.size(); ++i) {
+        if (regs[i] == nullptr)
+          continue;
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+        ir::Value& arg = call.args[i];
+        ir::Type type = types[i];
 
-                      return;
-                    }
-                    case 1: // VirtReg
-                    {
-                      ir::VirtReg memory = std::get<1>(binop.rhs);
+        if (is_float(type)) {
+          if (arg.index() == 0 && std::get<1>(current_function->constant(arg).value) == 0) {
+            utils::appendf(&output, "  pxor    %%%s, %%%s\n", regs[i], regs[i]);
+            continue;
+          }
 
-                      if (!is_float(binop.dst.type))
-                        imul_memory_with_register(memory, left);
-                      else
-                        mul_memory_with_register(memory, left);
+          char* src = value_form(arg);
+          utils::appendf(&output, "  movs%c   %s, %%%s\n", type_suffix(type), src, regs[i]);
+          free(src);
+          continue;
+        }
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+        ir::Type wide = type;
+        wide.size = std::max<uint8_t>(type.size, 4);
+        const char* rn = get_register_by_size(regs[i], wide.size);
 
-                      return;
-                    }
-                    case 2: // PhysReg
-                    {
-                      ir::PhysReg right = std::get<2>(binop.rhs);
+        if (arg.index() == 0) {
+          ir::Constant constant = current_function->constant(arg);
+          const char* mnemonic = fits_immediate(constant) ? ((wide.size == 8) ? "movq" : "movl") : "movabsq";
+          utils::appendf(&output, "  %-7s $%ld, %%%s\n", mnemonic, std::get<0>(constant.value), rn);
+          continue;
+        }
 
-                      if (!is_float(binop.dst.type))
-                        imul_register_with_register(right, left);
-                      else
-                        mul_register_with_register(right, left);
+        char* mov = generate_integer_move(type, wide);
+        char* src = value_form(arg);
+        utils::appendf(&output, "  %-7s %s, %%%s\n", mov, src, rn);
+        free(mov);
+        free(src);
+      }
 
-                      if (left.rid != binop.dst.rid || left.type.kind != binop.dst.type.kind)
-                        store_register_in_register(left, binop.dst);
+      if (tail) {
+        generate_frame_exit();
+        utils::appendf(&output, "  jmp     %s\n", call.callee->c_str());
+        return;
+      }
 
-                      return;
-                    }
-                  }
-                  unreachable();
-                }
-              }
-              unreachable();
-            }
-            case ir::BinOp::Op::Div: // division
-            {
-              // NOTE: "rax" register MAY BE already used so we have to save & restore it
-              // while the "rdx" register CAN'T be used.
-              switch (binop.lhs.index()) {
-                case 0: // Constant
-                {
-                  ir::Constant constant = std::get<0>(binop.lhs);
-
-                  // two helper lambdas
-                  auto div_value_by_register = [this](ir::Value& v, ir::PhysReg& dst) {
-                    if (v.index() == 1)
-                      div_memory_by_register(std::get<1>(v), dst);
-                    else if (v.index() == 2)
-                      div_register_by_register(std::get<2>(v), dst);
-                    else
-                      unreachable();
-                  };
-                  auto full_idiv_constant_by_value = [this](ir::Constant& constant, ir::Value& v, ir::PhysReg& dst) {
-                    store_constant_in_register(constant, dst);
-                    division_conversion(dst.type);
-
-                    if (v.index() == 1)
-                      idiv_by_memory(std::get<1>(v));
-                    else if (v.index() == 2)
-                      idiv_by_register(std::get<2>(v));
-                    else
-                      unreachable();
-                  };
-
-                  // in case of floating points we will explicitly specify the
-                  // destination, no need to save & restore the "rax" register
-                  if (is_float(binop.dst.type)) {
-                    store_constant_in_register(constant, binop.dst);
-                    return div_value_by_register(binop.rhs, binop.dst);
-                  }
+      if (wide_vectors)
+        utils::append(&output, "  vzeroupper\n");
 
-                  // the destination itself is "rax" so we don't need to save it
-                  // and restore it
-                  else if (binop.dst.rid == 0) {
-                    return full_idiv_constant_by_value(constant, binop.rhs, binop.dst);
-                  }
+      utils::appendf(&output, "  call    %s\n", call.callee->c_str());
+      if (stack_size != 0)
+        utils::appendf(&output, "  addq    $%zu, %%rsp\n", stack_size);
+      pushed = 0;
 
-                  // we don't need "else" since we are returning.
-                  // we need to save the "rax" register into the stack,
-                  // do the division, mov "rax" into the destination,
-                  // and then restore it from the stack.
+      // the result comes back in "rax"/"xmm0"
+      if (!call.dst.type.is_void) {
+        PhysReg result = { .rid = 0, .type = call.dst.type };
+        store_register_in_memory(result, call.dst);
+      }
+    }
+    std::string Gen::element_address(ir::VirtReg& array, ir::Value& index) {
+      Variable var = scope_vars[array.id];
+      size_t size = var.type.size;
 
-                  ir::PhysReg rax = { .rid = 0, .type = binop.dst.type };
-                  push_register(rax); // save "rax" in the stack
+      if (index.index() == 0) {
+        int64_t displacement = std::get<0>(current_function->constant(index).value) * (int64_t)size - (int64_t)var.offset;
+        return frame_address(displacement);
+      }
 
-                  // do the division
-                  full_idiv_constant_by_value(constant, binop.rhs, rax);
+      PhysReg reg = { .rid = 1, .type = ir::Type{ .kind = ir::Type::Kind::Int, .size = 8 } };
+      load_value(index, reg);
 
-                  // store the result into the destination
-                  // note that they have the same type
-                  store_register_in_register(rax, binop.dst);
+      return frame_address(-(int64_t)var.offset, ",%rcx," + std::to_string(size));
+    }
+    void Gen::generate_element_load(ir::ElemLoad& load) {
+      std::string address = element_address(load.array, load.index);
+      PhysReg reg = { .rid = 0, .type = load.dst.type };
+      const char* rn = physical_register_name(reg);
 
-                  // restore the previous state of "rax"
-                  pop_register(rax);
-                  return;
-                }
-                case 1: // VirtReg
-                {
-                  // read the comments in `Constant` case
-                  ir::VirtReg& memory = std::get<1>(binop.lhs);
-
-                  // two helper lambdas
-                  auto div_value_by_register = [this](ir::Value& v, ir::PhysReg& dst) {
-                    if (v.index() == 0)
-                      div_constant_by_register(std::get<0>(v), dst);
-                    else if (v.index() == 1)
-                      div_memory_by_register(std::get<1>(v), dst);
-                    else if (v.index() == 2)
-                      div_register_by_register(std::get<2>(v), dst);
-                    else
-                      unreachable();
-                  };
-                  auto full_idiv_memory_by_value = [this](ir::VirtReg& memory, ir::Value& v, ir::PhysReg& dst) {
-                    store_memory_in_register(memory, dst);
-                    division_conversion(dst.type);
-
-                    if (v.index() == 0) {
-                      ir::Constant constant = std::get<0>(v);
-                      ir::PhysReg tmp = { .rid = (uint)TR_INDEX, .type = constant.type };
-                      store_constant_in_register(constant, tmp);
-                      idiv_by_register(tmp);
-                    }
-
-                    if (v.index() == 1)
-                      idiv_by_memory(std::get<1>(v));
-                    else if (v.index() == 2)
-                      idiv_by_register(std::get<2>(v));
-                    else
-                      unreachable();
-                  };
-
-                  if (is_float(binop.dst.type)) {
-                    store_memory_in_register(memory, binop.dst);
-                    return div_value_by_register(binop.rhs, binop.dst);
-                  }
-                  else if (binop.dst.rid == 0) {
-                    return full_idiv_memory_by_value(memory, binop.rhs, binop.dst);
-                  }
+      if (is_vector(reg.type)) {
+        utils::appendf(&output, "  %-7s %s, %%%s\n", vector_move(reg.type), address.c_str(), rn);
+        return store_register_in_memory(reg, load.dst);
+      }
 
-                  ir::PhysReg rax = { .rid = 0, .type = binop.dst.type };
-                  push_register(rax);
+      char* mov = is_float(reg.type) ? generate_floating_point_move(reg.type)
+                                     : generate_integer_move(reg.type, reg.type);
+      utils::appendf(&output, "  %-7s %s, %%%s\n", mov, address.c_str(), rn);
+      free(mov);
 
-                  full_idiv_memory_by_value(memory, binop.rhs, rax);
-                  store_register_in_register(rax, binop.dst);
+      store_register_in_memory(reg, load.dst);
+    }
+    void Gen::generate_element_store(ir::ElemStore& store) {
+      // constants don't always have the width of the elements
+      ir::Type type = store.array.type;
+      type.lanes = ir::type_of(store.src).lanes;
 
-                  pop_register(rax);
-                  return;
-                }
-                case 2: // PhysReg
-                {
-                  // read the comments in `Constant` case
-                  ir::PhysReg reg = std::get<2>(binop.lhs);
-
-                  auto div_value_by_register = [this](ir::Value& v, ir::PhysReg& dst) {
-                    if (v.index() == 0)
-                      div_constant_by_register(std::get<0>(v), dst);
-                    else if (v.index() == 1)
-                      div_memory_by_register(std::get<1>(v), dst);
-                    else if (v.index() == 2)
-                      div_register_by_register(std::get<2>(v), dst);
-                    else
-                      unreachable();
-                  };
-                  auto full_idiv_register_by_value = [this](ir::PhysReg& reg, ir::Value& v, ir::PhysReg& dst) {
-                    store_register_in_register(reg, dst);
-                    division_conversion(dst.type);
-
-                    if (v.index() == 0) {
-                      ir::Constant constant = std::get<0>(v);
-                      ir::PhysReg tmp = { .rid = (uint)TR_INDEX, .type = constant.type };
-                      store_constant_in_register(constant, tmp);
-                      idiv_by_register(tmp);
-                    }
-
-                    if (v.index() == 1)
-                      idiv_by_memory(std::get<1>(v));
-                    else if (v.index() == 2)
-                      idiv_by_register(std::get<2>(v));
-                    else
-                      unreachable();
-                  };
-
-                  if (is_float(binop.dst.type)) {
-                    store_register_in_register(reg, binop.dst);
-                    return div_value_by_register(binop.rhs, binop.dst);
-                  }
+      // the value goes first, the address needs "rcx"
+      PhysReg reg = { .rid = 0, .type = type };
+      load_value(store.src, reg);
 
-                  // the destination itself is "rax" so we don't need to save it
-                  // and restore it
-                  else if (binop.dst.rid == 0) {
-                    return full_idiv_register_by_value(reg, binop.rhs, binop.dst);
-                  }
+      std::string address = element_address(store.array, store.index);
+      const char* rn = physical_register_name(reg);
 
-                  ir::PhysReg rax = { .rid = 0, .type = binop.dst.type };
-                  push_register(rax);
+      if (is_vector(type)) {
+        utils::appendf(&output, "  %-7s %%%s, %s\n", vector_move(type), rn, address.c_str());
+        return;
+      }
 
-                  full_idiv_register_by_value(reg, binop.rhs, rax);
-                  store_register_in_register(rax, binop.dst);
+      char* mov = is_float(type) ? generate_floating_point_move(type) : generate_integer_move(type, type);
+      utils::appendf(&output, "  %-7s %%%s, %s\n", mov, rn, address.c_str());
+      free(mov);
+    }
+    void Gen::generate_vector_binop(ir::BinOp& binop) {
+      // vectors are never constants, the right operand is read from its slot
+      PhysReg dst = { .rid = 0, .type = binop.dst.type };
+      load_value(binop.lhs, dst);
 
-                  pop_register(rax);
-                  return;
-                }
-              }
-            }
-          }
-          break;
-        }
-        case 3: // UnOp
-        {
-          todo();
-        }
-        case 4: // Int2Float
-        {
-          ir::Int2Float cvt = std::get<4>(inst);
-          const char* dst = physical_register_name(cvt.dst);
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              ir::Constant constant = std::get<0>(cvt.value);
-              if (constant.value.index() != 0) std::abort();
+      const char* mnemonic = vector_operation(binop.op, dst.type);
+      const char* rn = physical_register_name(dst);
+      std::string rhs = variable_form(scope_vars[binop.rhs.reg().id], vector_bytes(dst.type));
 
-              int64_t value = std::get<0>(constant.value);
-              if (value == 0) {
-                utils::appendf(&output, "  pxor    %%%s, %%%s\n", dst, dst);
-                break;
-              }
+      if (vector_bytes(dst.type) == 32)
+        utils::appendf(&output, "  v%-6s %s, %%%s, %%%s\n", mnemonic, rhs.c_str(), rn, rn);
+      else
+        utils::appendf(&output, "  %-7s %s, %%%s\n", mnemonic, rhs.c_str(), rn);
 
-              DataLabel label = constant_label((float)value, Directive::Kind::Float);
-              utils::appendf(&output, "  movss   %s(%%rip), %%%s\n", label.name.c_str(), dst);
-              break;
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtsi2ss -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              const char* prn = physical_register_name(pr);
+      store_register_in_memory(dst, binop.dst);
+    }
+    void Gen::generate_splat(ir::Splat& splat) {
+      ir::Type type = splat.dst.type;
+      ir::Type scalar = type;
+      scalar.lanes = 1;
 
-              if (pr.type.size < 4) {
-                const char* ir = get_register_by_size(prn, 4);
-                const char prs = type_suffix(pr.type);
+      PhysReg value = { .rid = 0, .type = scalar };
+      load_value(splat.value, value);
 
-                utils::appendf(&output, "  movs%cl  %%%s, %%%s\n", prs, prn, ir);
-                prn = ir;
-              }
+      bool wide = vector_bytes(type) == 32;
+      bool doubles = scalar.size == 8;
+
+      // integers go through the first lane of "xmm0"
+      if (!is_float(scalar))
+        utils::appendf(&output, "  mov%c    %%%s, %%xmm0\n", doubles ? 'q' : 'd', physical_register_name(value));
+
+      // clang-format off
+      if (wide) {
+        const char* mnemonic = is_float(scalar) ? (doubles ? "vbroadcastsd" : "vbroadcastss")
+                                                : (doubles ? "vpbroadcastq" : "vpbroadcastd");
+        utils::appendf(&output, "  %s %%xmm0, %%ymm0\n", mnemonic);
+      }
+      else if (is_float(scalar) && !doubles) utils::append(&output, "  shufps  $0, %xmm0, %xmm0\n");
+      else if (is_float(scalar))             utils::append(&output, "  unpcklpd %xmm0, %xmm0\n");
+      else if (!doubles)                     utils::append(&output, "  pshufd  $0, %xmm0, %xmm0\n");
+      else                                   utils::append(&output, "  punpcklqdq %xmm0, %xmm0\n");
+      // clang-format on
+
+      PhysReg dst = { .rid = 0, .type = type };
+      store_register_in_memory(dst, splat.dst);
+    }
+    void Gen::generate_reduction(ir::ReduceAdd& reduce) {
+      ir::Type type = ir::type_of(reduce.value);
+      PhysReg vector = { .rid = 0, .type = type };
+      load_value(reduce.value, vector);
+
+      ir::BinOp::Op add = ir::BinOp::Op::Add;
+      const char* mnemonic = vector_operation(add, type);
+
+      // the upper half is added to the lower one, the rest is done by SSE
+      if (vector_bytes(type) == 32) {
+        utils::append(&output, "  vextractf128 $1, %ymm0, %xmm1\n");
+        utils::appendf(&output, "  v%-6s %%xmm1, %%xmm0, %%xmm0\n", mnemonic);
+        utils::append(&output, "  vzeroupper\n");
+      }
+
+      // halving: the high 8 bytes onto the low ones, then the second
+      // element onto the first for 4 bytes elements
+      utils::append(&output, "  pshufd  $0xee, %xmm0, %xmm1\n");
+      utils::appendf(&output, "  %-7s %%xmm1, %%xmm0\n", mnemonic);
 
-              utils::appendf(&output, "  cvtsi2ss %%%s, %%%s\n", prn, dst);
+      if (type.size == 4) {
+        utils::append(&output, "  pshufd  $0x55, %xmm0, %xmm1\n");
+        utils::appendf(&output, "  %-7s %%xmm1, %%xmm0\n", mnemonic);
+      }
+
+      PhysReg result = { .rid = 0, .type = reduce.dst.type };
+      if (!is_float(result.type))
+        utils::appendf(&output, "  mov%c    %%xmm0, %%%s\n", (type.size == 8) ? 'q' : 'd', physical_register_name(result));
+
+      store_register_in_memory(result, reduce.dst);
+    }
+    void Gen::generate_fma(ir::Fma& fma) {
+      ir::Type type = fma.dst.type;
+      ir::Type scalar = type;
+      scalar.lanes = 1;
+
+      // "xmm0" = "xmm1" * b + "xmm0", b is read from where it is
+      PhysReg acc = { .rid = 0, .type = type };
+      PhysReg a = { .rid = 1, .type = type };
+      load_value(fma.c(), acc);
+      load_value(fma.a(), a);
+
+      std::string b;
+      if (fma.b().index() == 1)
+        b = variable_form(scope_vars[fma.b().reg().id], scalar.size);
+      else {
+        PhysReg reg = { .rid = 2, .type = scalar };
+        load_value(fma.b(), reg);
+        b = std::string("%") + physical_register_name(reg);
+      }
+
+      const char* suffix = is_vector(type) ? ((scalar.size == 4) ? "ps" : "pd") : ((scalar.size == 4) ? "ss" : "sd");
+      utils::appendf(&output, "  vfmadd231%s %s, %%%s, %%%s\n", suffix, b.c_str(), physical_register_name(a),
+                     physical_register_name(acc));
+
+      store_register_in_memory(acc, fma.dst);
+    }
+    bool Gen::sets_zero_flag(ir::Instruction& inst, ir::Cmp& cmp) {
+      if (cmp.pred != ir::Cmp::Pred::Eq && cmp.pred != ir::Cmp::Pred::Ne)
+        return false;
+      if (cmp.lhs.index() != 1 || cmp.rhs.index() != 0 || ir::type_of(cmp.lhs).kind != ir::Type::Kind::Int)
+        return false;
+      if (std::get<0>(current_function->constant(cmp.rhs).value) != 0 || inst.index() != 2)
+        return false;
+
+      ir::BinOp& binop = std::get<2>(inst);
+      if (binop.dst.id != cmp.lhs.reg().id)
+        return false;
+      if (binop.op != ir::BinOp::Op::Add && binop.op != ir::BinOp::Op::Sub)
+        return false;
+
+      // adding zero emits nothing, wide immediates go through another path
+      if (binop.rhs.index() != 0)
+        return true;
+
+      ir::Constant constant = current_function->constant(binop.rhs);
+      return std::get<0>(constant.value) != 0 && fits_immediate(constant);
+    }
+    void Gen::generate_phi_copies(ir::Block& block) {
+      for (uint succ : block.succs) {
+        for (ir::Instruction& inst : current_function->blocks[succ].body) {
+          if (inst.index() != 13)
+            break;
+
+          ir::Phi& phi = std::get<13>(inst);
+          ir::VirtReg& incoming = phi_incoming[phi.dst.id];
+
+          for (auto& [pred, value] : phi.incoming) {
+            if (pred != current_block)
+              continue;
+
+            if (value.index() == 0) {
+              store_constant_in_memory(current_function->constant(value), incoming);
               break;
             }
+
+            copy_variable(value.reg(), incoming);
+            break;
           }
+        }
+      }
+    }
+    void Gen::generate_instruction(ir::Instruction& inst) {
+      switch (inst.index()) {
+        case 0: // Alloca
+        {
+          // the slot is part of the `Frame`
           break;
         }
-        case 5: // Int2Double
+        case 1: // Store
         {
-          ir::Int2Double cvt = std::get<5>(inst);
-          const char* dst = physical_register_name(cvt.dst);
+          ir::Store& store = std::get<1>(inst);
 
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              ir::Constant constant = std::get<0>(cvt.value);
-              if (constant.value.index() != 0) std::abort();
+          if (store.src.index() == 0)
+            return store_constant_in_memory(current_function->constant(store.src), store.dst);
 
-              int64_t value = std::get<0>(constant.value);
-              if (value == 0) {
-                utils::appendf(&output, "  pxor    %%%s, %%%s\n", dst, dst);
+          return copy_variable(store.src.reg(), store.dst);
+        }
+        case 2: // BinOp
+        {
+          ir::BinOp& binop = std::get<2>(inst);
+
+          if (is_vector(binop.dst.type))
+            return generate_vector_binop(binop);
+
+          if (!is_float(binop.dst.type)) {
+            switch (binop.op) {
+              case ir::BinOp::Op::Div:
+              case ir::BinOp::Op::Rem:
+                return generate_division(binop);
+              case ir::BinOp::Op::MulHi:
+                return generate_high_multiply(binop);
+              case ir::BinOp::Op::Mul:
+                if (binop.dst.type.size == 1)
+                  return generate_byte_multiply(binop);
+                break;
+              default:
                 break;
-              }
-
-              DataLabel label = constant_label((double)value, Directive::Kind::Double);
-              utils::appendf(&output, "  movsd   %s(%%rip), %%%s\n", label.name.c_str(), dst);
-              break;
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtsi2sd -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
             }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              const char* prn = physical_register_name(pr);
+          }
 
-              if (pr.type.size < 4) {
-                const char* ir = get_register_by_size(prn, 4);
-                const char prs = type_suffix(pr.type);
+          if (selectable(binop)) {
+            // computed by the tree of its use
+            if (folded.count(binop.dst.id))
+              return;
 
-                utils::appendf(&output, "  movs%cl  %%%s, %%%s\n", prs, prn, ir);
-                prn = ir;
-              }
+            return select_binop(binop);
+          }
 
-              utils::appendf(&output, "  cvtsi2sd %%%s, %%%s\n", prn, dst);
-              break;
+          if (binop.op != ir::BinOp::Op::Shl && binop.op != ir::BinOp::Op::Sar && binop.op != ir::BinOp::Op::Shr)
+            unreachable();
+
+          // a variable shift count has to be in "cl"
+          const char* mnemonic = (binop.op == ir::BinOp::Op::Shl)   ? "sal"
+                                 : (binop.op == ir::BinOp::Op::Sar) ? "sar"
+                                                                    : "shr";
+          PhysReg dst = { .rid = 0, .type = binop.dst.type };
+          PhysReg count = { .rid = 1, .type = ir::type_of(binop.rhs) };
+          load_value(binop.lhs, dst);
+          load_value(binop.rhs, count);
+
+          utils::appendf(&output, "  %s%c    %%cl, %%%s\n", mnemonic, type_suffix(dst.type), physical_register_name(dst));
+          return store_register_in_memory(dst, binop.dst);
+        }
+        case 3: // UnOp
+        {
+          todo();
+        }
+        case 4: // Int2Float
+        case 5: // Int2Double
+        {
+          bool to_double = inst.index() == 5;
+          ir::Value value = to_double ? std::get<5>(inst).value : std::get<4>(inst).value;
+          ir::VirtReg target = to_double ? std::get<5>(inst).dst : std::get<4>(inst).dst;
+          PhysReg dst = { .rid = 0, .type = target.type };
+          const char* drn = physical_register_name(dst);
+
+          if (value.index() == 0) {
+            ir::Constant constant = current_function->constant(value);
+            if (constant.value.index() != 0) std::abort();
+
+            int64_t v = std::get<0>(constant.value);
+            if (v == 0) {
+              utils::appendf(&output, "  pxor    %%%s, %%%s\n", drn, drn);
+            } else if (to_double) {
+              DataLabel label = constant_label((double)v, Directive::Kind::Double);
+              utils::appendf(&output, "  movsd   %s(%%rip), %%%s\n", label.name.c_str(), drn);
+            } else {
+              DataLabel label = constant_label((float)v, Directive::Kind::Float);
+              utils::appendf(&output, "  movss   %s(%%rip), %%%s\n", label.name.c_str(), drn);
             }
+
+            return store_register_in_memory(dst, target);
           }
-          break;
+
+          // `cvtsi2s*` only takes 32/64-bit integers, narrower ones are sign
+          // extended first
+          ir::Type src_type = ir::type_of(value);
+          src_type.size = std::max<uint8_t>(src_type.size, 4);
+          PhysReg src = { .rid = 0, .type = src_type };
+          load_value(value, src);
+
+          utils::appendf(&output, "  cvtsi2s%c %%%s, %%%s\n", to_double ? 'd' : 's',
+                         physical_register_name(src), drn);
+          return store_register_in_memory(dst, target);
         }
         case 6: // Float2Int
+        case 8: // Double2Int
         {
-          ir::Float2Int cvt = std::get<6>(inst);
-          const char* dst = physical_register_name(cvt.dst);
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              torevise();
-              break;
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtss2si -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              utils::appendf(&output, "  cvtss2si %%%s, %%%s\n", physical_register_name(pr), dst);
-              break;
-            }
+          bool from_double = inst.index() == 8;
+          ir::Value value = from_double ? std::get<8>(inst).value : std::get<6>(inst).value;
+          ir::VirtReg target = from_double ? std::get<8>(inst).dst : std::get<6>(inst).dst;
+
+          if (value.index() == 0) {
+            ir::Constant constant = current_function->constant(value);
+            if (constant.value.index() != 1) std::abort();
+
+            // `cvts*2si` rounds to the nearest integer, so does `nearbyint`
+            ir::Constant result = { .type = target.type, .value = (int64_t)std::nearbyint(std::get<1>(constant.value)) };
+            return store_constant_in_memory(result, target);
           }
-          break;
+
+          PhysReg src = { .rid = 0, .type = ir::type_of(value) };
+          load_value(value, src);
+
+          // converting into a 32-bit register is enough for narrower types,
+          // the store only keeps their low part
+          ir::Type dst_type = target.type;
+          dst_type.size = std::max<uint8_t>(dst_type.size, 4);
+          PhysReg dst = { .rid = 0, .type = dst_type };
+
+          utils::appendf(&output, "  cvts%c2si %%%s, %%%s\n", from_double ? 'd' : 's',
+                         physical_register_name(src), physical_register_name(dst));
+
+          dst.type = target.type;
+          return store_register_in_memory(dst, target);
         }
         case 7: // Float2Double
+        case 9: // Double2Float
         {
-          ir::Float2Double cvt = std::get<7>(inst);
-          const char* dst = physical_register_name(cvt.dst);
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              ir::Constant constant = std::get<0>(cvt.value);
-              if (constant.value.index() != 1) std::abort();
+          bool to_double = inst.index() == 7;
+          ir::Value value = to_double ? std::get<7>(inst).value : std::get<9>(inst).value;
+          ir::VirtReg target = to_double ? std::get<7>(inst).dst : std::get<9>(inst).dst;
+
+          if (value.index() == 0) {
+            ir::Constant constant = current_function->constant(value);
+            constant.type = target.type;
+            return store_constant_in_memory(constant, target);
+          }
 
-              double value = std::get<1>(constant.value);
-              if (value == 0) {
-                utils::appendf(&output, "  pxor    %%%s, %%%s\n", dst, dst);
-                break;
-              }
+          PhysReg src = { .rid = 0, .type = ir::type_of(value) };
+          PhysReg dst = { .rid = 0, .type = target.type };
+          load_value(value, src);
 
-              DataLabel label = constant_label(value, Directive::Kind::Double);
-              utils::appendf(&output, "  movsd   %s(%%rip), %%%s\n", label.name.c_str(), dst);
-              break;
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtss2sd -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              utils::appendf(&output, "  cvtss2sd %%%s, %%%s\n", physical_register_name(pr), dst);
-              break;
-            }
-          }
-          break;
+          utils::appendf(&output, "  %s %%%s, %%%s\n", to_double ? "cvtss2sd" : "cvtsd2ss",
+                         physical_register_name(src), physical_register_name(dst));
+          return store_register_in_memory(dst, target);
         }
-        case 8: // Double2Int
+        case 10: // IntExtend
         {
-          ir::Double2Int cvt = std::get<8>(inst);
-          const char* dst = physical_register_name(cvt.dst);
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              torevise();
-              break;
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtsd2si -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              utils::appendf(&output, "  cvtsd2si %%%s, %%%s\n", physical_register_name(pr), dst);
-              break;
-            }
+          ir::IntExtend& extend = std::get<10>(inst);
+
+          if (extend.value.index() == 0) {
+            ir::Constant constant = current_function->constant(extend.value);
+            constant.type = extend.dst.type;
+            return store_constant_in_memory(constant, extend.dst);
           }
-          break;
+
+          // a register cast into a register is one move, none when the copy
+          // was coalesced and it truncates: the low bits are already there
+          Variable from = scope_vars[extend.value.reg().id];
+          Variable to = scope_vars[extend.dst.id];
+          if (from.reg && to.reg) {
+            if (from.reg == to.reg && to.type.size <= from.type.size)
+              return;
+
+            size_t size = std::min(from.type.size, to.type.size);
+            char* mov = generate_integer_move(from.type, to.type);
+            std::string source = variable_form(from, size);
+            std::string target = variable_form(to, to.type.size);
+            utils::appendf(&output, "  %-7s %s, %s\n", mov, source.c_str(), target.c_str());
+            return free(mov);
+          }
+
+          // loading into a wider register sign extends
+          PhysReg dst = { .rid = 0, .type = extend.dst.type };
+          load_value(extend.value, dst);
+          return store_register_in_memory(dst, extend.dst);
         }
-        case 9: // Double2Float
+        case 11: // Cmp
         {
-          ir::Double2Float cvt = std::get<9>(inst);
-          const char* dst = physical_register_name(cvt.dst);
-          switch (cvt.value.index()) {
-            case 0: // Constant
-            {
-              torevise();
-            }
-            case 1: // VirtReg
-            {
-              Variable var = scope_vars[std::get<1>(cvt.value).id];
-              utils::appendf(&output, "  cvtsd2ss -%zu(%%rbp), %%%s\n", var.offset, dst);
-              break;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg pr = std::get<2>(cvt.value);
-              utils::appendf(&output, "  cvtsd2ss %%%s, %%%s\n", physical_register_name(pr), dst);
-              break;
-            }
+          ir::Cmp& cmp = std::get<11>(inst);
+          const char* cc = generate_compare(cmp);
+          Variable var = scope_vars[cmp.dst.id];
+
+          bool fp = ir::type_of(cmp.lhs).kind == ir::Type::Kind::Float;
+          std::string location = variable_form(var, 1);
+
+          if (!fp || (cmp.pred != ir::Cmp::Pred::Eq && cmp.pred != ir::Cmp::Pred::Ne)) {
+            utils::appendf(&output, "  set%-5s %s\n", cc, location.c_str());
+            return;
           }
-          break;
+
+          // unordered operands (NaN) set the parity flag, they are never equal
+          utils::appendf(&output, "  set%-5s %%al\n", cc);
+          if (cmp.pred == ir::Cmp::Pred::Eq) {
+            utils::append(&output, "  setnp   %sil\n");
+            utils::append(&output, "  andb    %sil, %al\n");
+          } else {
+            utils::append(&output, "  setp    %sil\n");
+            utils::append(&output, "  orb     %sil, %al\n");
+          }
+
+          utils::appendf(&output, "  movb    %%al, %s\n", location.c_str());
+          return;
+        }
+        case 12: // Load
+        {
+          ir::Load& load = std::get<12>(inst);
+          PhysReg reg = { .rid = 0, .type = load.dst.type };
+
+          store_memory_in_register(load.src, reg);
+          return store_register_in_memory(reg, load.dst);
+        }
+        case 13: // Phi
+        {
+          ir::Phi& phi = std::get<13>(inst);
+          return copy_variable(phi_incoming[phi.dst.id], phi.dst);
+        }
+        case 14: // Call
+        {
+          return generate_call(std::get<14>(inst));
+        }
+        case 15: // ElemLoad
+        {
+          return generate_element_load(std::get<15>(inst));
+        }
+        case 16: // ElemStore
+        {
+          return generate_element_store(std::get<16>(inst));
         }
-        case 10: // IntExtend
+        case 17: // Splat
         {
-          ir::IntExtend extend = std::get<10>(inst);
-          const char* drn = physical_register_name(extend.dst);
-          const char drs = type_suffix(extend.dst.type);
-
-          switch (extend.value.index()) {
-            case 1: // VirtReg
-            {
-              Variable variable = scope_vars[std::get<1>(extend.value).id];
-              const char vs = type_suffix(variable.type);
-              const size_t vo = variable.offset;
-
-              utils::appendf(&output, "  movs%c%c  -%zu(%%rbp), %%%s\n", vs, drs, vo, drn);
-              return;
-            }
-            case 2: // PhysReg
-            {
-              ir::PhysReg reg = std::get<2>(extend.value);
-              const char* rn = physical_register_name(reg);
-              const char rs = type_suffix(reg.type);
-
-              utils::appendf(&output, "  movs%c%c  %%%s, %%%s\n", rs, drs, rn, drn);
-              return;
-            }
-          }
-          unreachable();
+          return generate_splat(std::get<17>(inst));
+        }
+        case 18: // ReduceAdd
+        {
+          return generate_reduction(std::get<18>(inst));
+        }
+        case 19: // Fma
+        {
+          return generate_fma(std::get<19>(inst));
+        }
+        case 20: // Count
+        {
+          size_t offset = 8 * std::get<20>(inst).counter;
+          utils::appendf(&output, "  incq    __phantom_profile_counters+%zu(%%rip)\n", offset);
+          return;
         }
       }
     }
@@ -903,7 +958,7 @@ namespace phantom {
 
         for (auto dir : label.dirs) {
           float value = std::get<1>(dir.data);
-          utils::appendf(&output, "  .float  %f\n", value);
+          utils::appendf(&output, "  .float  %.9g\n", value);
         }
       }
 
@@ -913,23 +968,56 @@ namespace phantom {
 
         for (auto dir : label.dirs) {
           double value = std::get<2>(dir.data);
-          utils::appendf(&output, "  .double  %lf\n", value);
+          utils::appendf(&output, "  .double  %.17g\n", value);
         }
       }
     }
+    void Gen::generate_profile_data() {
+      ir::Profile& profile = program.profile;
+      if (profile.functions.empty())
+        return;
+
+      // `exit` in phrt0.s writes the header then the counters to the path
+      utils::append(&output, "# profile\n");
+      utils::append(&output, ".section .data\n");
+      utils::append(&output, ".globl __phantom_profile_path\n");
+      utils::appendf(&output, "__phantom_profile_path:\n  .asciz  \"%s\"\n", profile.path.c_str());
+
+      utils::append(&output, ".p2align 3\n");
+      utils::append(&output, ".globl __phantom_profile_header, __phantom_profile_header_end\n");
+      utils::append(&output, "__phantom_profile_header:\n");
+      utils::append(&output, "  .ascii  \"PHPROF01\"\n");
+      utils::appendf(&output, "  .quad   %zu, %u\n", profile.functions.size(), profile.counters);
+
+      for (ir::ProfiledFunction& fn : profile.functions) {
+        utils::appendf(&output, "  .quad   %lu, %lu, %u, %u # @%s\n", ir::profile_name_hash(fn.name), fn.checksum, fn.first,
+                       fn.counters, fn.name.c_str());
+      }
+      utils::append(&output, "__phantom_profile_header_end:\n");
+
+      utils::append(&output, ".section .bss\n");
+      utils::append(&output, ".p2align 3\n");
+      utils::append(&output, ".globl __phantom_profile_counters, __phantom_profile_counters_end\n");
+      utils::append(&output, "__phantom_profile_counters:\n");
+      utils::appendf(&output, "  .zero   %zu\n", 8 * (size_t)profile.counters);
+      utils::append(&output, "__phantom_profile_counters_end:\n");
+    }
 
     void Gen::generate_terminator(ir::Terminator& term, ir::Type& return_type) {
       switch (term.index()) {
         case 0: // Return
         {
           ir::Return& ret = std::get<0>(term);
+          if (return_type.is_void)
+            return generate_epilogue();
+
           const char ret_suff = type_suffix(return_type);
           const char* ret_reg = type_default_register(return_type);
 
           switch (ret.value.index()) {
             case 0: // Constant
             {
-              ir::Constant& constant = std::get<0>(ret.value);
+              ir::Constant constant = current_function->constant(ret.value);
 
               switch (constant.value.index()) {
                 case 0: // int64_t
@@ -939,7 +1027,7 @@ namespace phantom {
                   if (value == 0)
                     utils::appendf(&output, "  xor%c    %%%s, %%%s\n", ret_suff, ret_reg, ret_reg);
                   else
-                    utils::appendf(&output, "  mov%c    $%lu, %%%s\n", ret_suff, value, ret_reg);
+                    utils::appendf(&output, "  mov%c    $%ld, %%%s\n", ret_suff, value, ret_reg);
 
                   break;
                 }
@@ -966,20 +1054,160 @@ namespace phantom {
 
               break;
             }
-            case 1: // Register
+            case 1: // VirtReg
+            {
+              PhysReg dst = { .rid = 0, .type = return_type };
+              store_memory_in_register(ret.value.reg(), dst);
+              break;
+            }
+          }
+
+          generate_epilogue();
+          break;
+        }
+        case 1: // Branch
+        {
+          generate_jump(std::get<1>(term).target);
+          break;
+        }
+        case 2: // CondBranch
+        {
+          ir::CondBranch& br = std::get<2>(term);
+          ir::Type type = ir::type_of(br.cond);
+          const char suff = type_suffix(type);
+
+          switch (br.cond.index()) {
+            case 0: // Constant
+            {
+              ir::Constant constant = current_function->constant(br.cond);
+              bool taken = (constant.value.index() == 0) ? (std::get<0>(constant.value) != 0)
+                                                         : (std::get<1>(constant.value) != 0);
+
+              return generate_jump(taken ? br.then_block : br.else_block);
+            }
+            case 1: // VirtReg
             {
-              Variable value = scope_vars[std::get<1>(ret.value).id];
-              utils::appendf(&output, "  mov%c    -%zu(%%rbp), %%%s\n", ret_suff, value.offset, ret_reg);
+              Variable var = scope_vars[br.cond.reg().id];
+              std::string location = variable_form(var, type.size);
+
+              if (var.reg)
+                utils::appendf(&output, "  test%c   %s, %s\n", suff, location.c_str(), location.c_str());
+              else
+                utils::appendf(&output, "  cmp%c    $0, %s\n", suff, location.c_str());
               break;
             }
-              // TODO: PhysReg?
           }
 
-          utils::appendf(&output, "  popq    %%rbp\n");
-          utils::appendf(&output, "  ret\n");
+          generate_conditional_jump("ne", false, br.then_block, br.else_block);
+          break;
         }
       }
     }
+    const char* Gen::generate_compare(ir::Cmp& cmp) {
+      ir::Value lhs = cmp.lhs;
+      ir::Value rhs = cmp.rhs;
+      ir::Cmp::Pred pred = cmp.pred;
+
+      // constants don't carry the width of the operation
+      ir::Type type = (lhs.index() == 0) ? ir::type_of(rhs) : ir::type_of(lhs);
+      bool fp = is_float(type);
+
+      // `ucomis` sets the flags like an unsigned compare, and "below" is
+      // also true for unordered operands, so only "above" is used.
+      if (fp && (pred == ir::Cmp::Pred::Lt || pred == ir::Cmp::Pred::Le)) {
+        std::swap(lhs, rhs);
+        pred = (pred == ir::Cmp::Pred::Lt) ? ir::Cmp::Pred::Gt : ir::Cmp::Pred::Ge;
+      }
+
+      // the left operand has to live in a register
+      PhysReg left = { .rid = (uint)TR_INDEX, .type = type };
+      load_value(lhs, left);
+
+      // wide integer immediates have to be in a register
+      if (rhs.index() == 0 && !fp && !fits_immediate(current_function->constant(rhs))) {
+        PhysReg right = { .rid = 1, .type = type };
+        load_value(rhs, right);
+
+        utils::appendf(&output, "  cmp%c    %%%s, %%%s\n", type_suffix(type),
+                       physical_register_name(right), physical_register_name(left));
+      } else {
+        char* right = value_form(rhs);
+        const char* ln = physical_register_name(left);
+
+        if (fp)
+          utils::appendf(&output, "  ucomis%c %s, %%%s\n", type_suffix(type), right, ln);
+        else
+          utils::appendf(&output, "  cmp%c    %s, %%%s\n", type_suffix(type), right, ln);
+
+        free(right);
+      }
+
+      // clang-format off
+      switch (pred) {
+        case ir::Cmp::Pred::Eq: return "e";
+        case ir::Cmp::Pred::Ne: return "ne";
+        case ir::Cmp::Pred::Lt: return "l";
+        case ir::Cmp::Pred::Le: return "le";
+        case ir::Cmp::Pred::Gt: return fp ? "a" : "g";
+        case ir::Cmp::Pred::Ge: return fp ? "ae" : "ge";
+      }
+      // clang-format on
+
+      unreachable();
+    }
+    void Gen::generate_jump(uint target) {
+      // falling through to the next block
+      if (target == next_block)
+        return;
+
+      utils::appendf(&output, "  jmp     %s\n", block_label(target).c_str());
+    }
+    void Gen::generate_conditional_jump(const char* cc, bool parity, uint then_block, uint else_block) {
+      std::string then_label = block_label(then_block);
+      std::string else_label = block_label(else_block);
+
+      // floating point (in)equality also has to look at the parity flag
+      if (parity && strcmp(cc, "e") == 0) {
+        utils::appendf(&output, "  jne     %s\n", else_label.c_str());
+        utils::appendf(&output, "  jp      %s\n", else_label.c_str());
+        return generate_jump(then_block);
+      }
+      if (parity && strcmp(cc, "ne") == 0) {
+        utils::appendf(&output, "  jne     %s\n", then_label.c_str());
+        utils::appendf(&output, "  jp      %s\n", then_label.c_str());
+        return generate_jump(else_block);
+      }
+
+      // prefer falling through to the next block
+      if (then_block == next_block) {
+        utils::appendf(&output, "  j%-6s %s\n", negate_condition(cc), else_label.c_str());
+        return;
+      }
+
+      utils::appendf(&output, "  j%-6s %s\n", cc, then_label.c_str());
+      generate_jump(else_block);
+    }
+    const char* Gen::negate_condition(const char* cc) {
+      // clang-format off
+      static const std::pair<const char*, const char*> negations[] = {
+        { "e", "ne" }, { "ne", "e" },
+        { "l", "ge" }, { "ge", "l" },
+        { "le", "g" }, { "g", "le" },
+        { "a", "be" }, { "be", "a" },
+        { "ae", "b" }, { "b", "ae" },
+      };
+      // clang-format on
+
+      for (auto& [cond, negation] : negations) {
+        if (strcmp(cc, cond) == 0)
+          return negation;
+      }
+
+      unreachable();
+    }
+    std::string Gen::block_label(uint block) {
+      return ".L" + current_function->name + "." + std::to_string(block);
+    }
     void Gen::generate_default_terminator(ir::Type& type) {
       utils::appendf(&output, "  nop\n");
 
@@ -990,35 +1218,63 @@ namespace phantom {
         utils::appendf(&output, "  mov%c    %%%s, %%xmm0\n", suff, reg);
       }
 
-      utils::appendf(&output, "  popq    %%rbp\n");
-      utils::appendf(&output, "  ret\n");
+      generate_epilogue();
+    }
+    void Gen::generate_epilogue() {
+      generate_frame_exit();
+      utils::append(&output, "  ret\n");
+    }
+    void Gen::generate_frame_exit() {
+      if (wide_vectors)
+        utils::append(&output, "  vzeroupper\n");
+
+      for (auto& [reg, offset] : saved_registers)
+        utils::appendf(&output, "  movq    %s, %%%s\n", frame_address(-(int64_t)offset).c_str(), reg);
+
+      if (!frame_pointer) {
+        if (frame_adjust != 0)
+          utils::appendf(&output, "  addq    $%zu, %%rsp\n", frame_adjust);
+      } else if (frame_size != 0)
+        utils::append(&output, "  leave\n");
+      else
+        utils::append(&output, "  popq    %rbp\n");
     }
     DataLabel Gen::constant_label(std::variant<double, std::string> value, Directive::Kind kind) {
       switch (kind) {
         case Directive::Kind::Float: {
           assert(value.index() == 0);
           float fv = std::get<0>(value);
+          uint32_t bits;
+          memcpy(&bits, &fv, sizeof(bits));
+
+          if (floats_data.find(bits) != floats_data.end())
+            return floats_data[bits];
 
-          if (floats_data.find(fv) != floats_data.end())
-            return floats_data[fv];
+          char name[16];
+          snprintf(name, sizeof(name), ".CSTF%08x", bits);
 
           DataLabel label;
           label.dirs.push_back(Directive{ .data = fv, .kind = kind });
-          label.name = ".CSTS" + std::to_string(constants_size++);
-          floats_data[fv] = label;
+          label.name = name;
+          floats_data[bits] = label;
           return label;
         }
         case Directive::Kind::Double: {
           assert(value.index() == 0);
           double dv = std::get<0>(value);
+          uint64_t bits;
+          memcpy(&bits, &dv, sizeof(bits));
 
-          if (doubles_data.find(dv) != doubles_data.end())
-            return doubles_data[dv];
+          if (doubles_data.find(bits) != doubles_data.end())
+            return doubles_data[bits];
+
+          char name[24];
+          snprintf(name, sizeof(name), ".CSTD%016lx", bits);
 
           DataLabel label;
           label.dirs.push_back(Directive{ .data = dv, .kind = kind });
-          label.name = ".CSTS" + std::to_string(constants_size++);
-          doubles_data[dv] = label;
+          label.name = name;
+          doubles_data[bits] = label;
           return label;
         }
         case Directive::Kind::Asciz: {
@@ -1031,23 +1287,38 @@ namespace phantom {
       unreachable();
     }
 
-    void Gen::push_register(ir::PhysReg& reg) {
+    void Gen::push_register(PhysReg& reg) {
       const char* rn = physical_register_name(reg);
       utils::appendf(&output, "  push %%%s\n", rn);
+      pushed += 8;
     }
-    void Gen::pop_register(ir::PhysReg& reg) {
+    void Gen::pop_register(PhysReg& reg) {
       const char* rn = physical_register_name(reg);
       utils::appendf(&output, "  pop %%%s\n", rn);
+      pushed -= 8;
     }
 
-    void Gen::store_constant_in_memory(ir::Constant& constant, ir::VirtReg& memory) {
+    void Gen::store_constant_in_memory(const ir::Constant& constant, ir::VirtReg& memory) {
       Variable variable = scope_vars[memory.id];
       const char ds = type_suffix(variable.type);
-      const size_t vo = variable.offset;
+      std::string location = variable_form(variable, variable.type.size);
 
       if (constant.value.index() == 0) {
         int64_t v = std::get<0>(constant.value);
-        utils::appendf(&output, "  mov%c    $%ld, -%zu(%%rbp)\n", ds, v, vo);
+
+        // there is no 64-bit immediate store, go through a register
+        if (v != (int32_t)v && variable.type.size == 8) {
+          if (variable.reg) {
+            utils::appendf(&output, "  movabsq $%ld, %s\n", v, location.c_str());
+            return;
+          }
+
+          utils::appendf(&output, "  movabsq $%ld, %%rdx\n", v);
+          utils::appendf(&output, "  movq    %%rdx, %s\n", location.c_str());
+          return;
+        }
+
+        utils::appendf(&output, "  mov%c    $%ld, %s\n", ds, v, location.c_str());
         return;
       }
 
@@ -1055,8 +1326,13 @@ namespace phantom {
       double v = std::get<1>(constant.value);
 
       if (v == 0) {
+        if (variable.reg) {
+          utils::appendf(&output, "  pxor %s, %s\n", location.c_str(), location.c_str());
+          return;
+        }
+
         utils::append(&output, "  pxor %xmm3, %xmm3\n");
-        utils::appendf(&output, "  movs%c    %%xmm3, -%zu(%%rbp)\n", ds, vo);
+        utils::appendf(&output, "  movs%c    %%xmm3, %s\n", ds, location.c_str());
         return;
       }
 
@@ -1068,13 +1344,31 @@ namespace phantom {
 
       DataLabel label = constant_label(v, kind);
 
+      if (variable.reg) {
+        utils::appendf(&output, "  movs%c   %s(%%rip), %s\n", ds, label.name.c_str(), location.c_str());
+        return;
+      }
+
       utils::appendf(&output, "  movs%c   %s(%%rip), %%xmm0\n", ds, label.name.c_str());
-      utils::appendf(&output, "  movs%c   %%xmm0, -%zu(%%rbp)\n", ds, vo);
+      utils::appendf(&output, "  movs%c   %%xmm0, %s\n", ds, location.c_str());
     }
-    void Gen::store_register_in_memory(ir::PhysReg& reg, ir::VirtReg& memory) {
+    void Gen::store_register_in_memory(PhysReg& reg, ir::VirtReg& memory) {
       Variable variable = scope_vars[memory.id];
       const char* rn = physical_register_name(reg);
-      const size_t vo = variable.offset;
+
+      if (is_vector(variable.type)) {
+        utils::appendf(&output, "  %-7s %%%s, %s\n", vector_move(variable.type), rn, variable_form(variable, 0).c_str());
+        return;
+      }
+
+      std::string location = variable_form(variable, variable.type.size);
+
+      // whole register copies don't depend on the old value of the target
+      if (variable.reg && is_float(variable.type)) {
+        const char* mov = (variable.type.size == 4) ? "movaps" : "movapd";
+        utils::appendf(&output, "  %-7s %%%s, %s\n", mov, rn, location.c_str());
+        return;
+      }
 
       char* mov;
       if (is_float(variable.type) || is_float(reg.type))
@@ -1082,8 +1376,9 @@ namespace phantom {
       else
         mov = generate_integer_move(reg.type, variable.type);
 
-      if (variable.type.size <= reg.type.size) {
-        utils::appendf(&output, "  %-7s %%%s, -%zu(%%rbp)\n", mov, rn, vo);
+      // a register target takes the extension directly
+      if (variable.type.size <= reg.type.size || variable.reg) {
+        utils::appendf(&output, "  %-7s %%%s, %s\n", mov, rn, location.c_str());
         free(mov);
         return;
       }
@@ -1098,7 +1393,8 @@ namespace phantom {
       // intermediate register
       const char* ir = get_register_by_size("rdx", variable.type.size);
       utils::appendf(&output, "  %-7s %%%s, %%%s\n", mov, rn, ir);
-      utils::appendf(&output, "  mov%c    %%%s, -%zu(%%rbp)\n", type_suffix(variable.type), ir, vo);
+      utils::appendf(&output, "  mov%c    %%%s, %s\n", type_suffix(variable.type), ir,
+                     variable_form(variable, variable.type.size).c_str());
       free(mov);
     }
     void Gen::store_memory_in_memory(ir::VirtReg& src, ir::VirtReg& dst) {
@@ -1114,7 +1410,7 @@ namespace phantom {
       else
         mov = generate_integer_move(dst_var.type, dst_var.type);
 
-      utils::appendf(&output, "  %-7s -%zu(%%rbp), %%%s\n", mov, dst_var.offset, ir);
+      utils::appendf(&output, "  %-7s %s, %%%s\n", mov, variable_form(dst_var, dst_var.type.size).c_str(), ir);
       free(mov);
 
       if (is_float(dst_var.type) || is_float(variable.type))
@@ -1122,15 +1418,60 @@ namespace phantom {
       else
         mov = generate_integer_move(dst_var.type, variable.type);
 
-      utils::appendf(&output, "  %-7s %%%s, -%zu(%%rbp)\n", mov, ir, variable.offset);
+      utils::appendf(&output, "  %-7s %%%s, %s\n", mov, ir, variable_form(variable, variable.type.size).c_str());
       free(mov);
     }
-    void Gen::store_constant_in_register(ir::Constant& constant, ir::PhysReg& reg) {
+    void Gen::copy_variable(const ir::VirtReg& src, ir::VirtReg& dst) {
+      Variable from = scope_vars[src.id];
+      Variable to = scope_vars[dst.id];
+
+      bool same = from.type.kind == to.type.kind && from.type.size == to.type.size && from.type.lanes == 1 &&
+                  to.type.lanes == 1;
+
+      // memory to memory goes through a scratch register
+      if (!same || (!from.reg && !to.reg)) {
+        PhysReg reg = { .rid = 0, .type = dst.type };
+        store_memory_in_register(src, reg);
+        return store_register_in_memory(reg, dst);
+      }
+
+      if (from.reg == to.reg)
+        return;
+
+      std::string mov;
+      if (!is_float(to.type))
+        mov = std::string("mov") + type_suffix(to.type);
+      else if (from.reg && to.reg)
+        mov = (to.type.size == 4) ? "movaps" : "movapd";
+      else
+        mov = std::string("movs") + type_suffix(to.type);
+
+      std::string source = variable_form(from, to.type.size);
+      std::string target = variable_form(to, to.type.size);
+      utils::appendf(&output, "  %-7s %s, %s\n", mov.c_str(), source.c_str(), target.c_str());
+    }
+    void Gen::load_value(ir::Value& value, PhysReg& reg) {
+      switch (value.index()) {
+        case 0: // Constant
+          return store_constant_in_register(current_function->constant(value), reg);
+        case 1: // VirtReg
+          return store_memory_in_register(value.reg(), reg);
+        default:
+          unreachable();
+      }
+    }
+    void Gen::store_constant_in_register(const ir::Constant& constant, PhysReg& reg) {
       const char* name = physical_register_name(reg);
       const char ds = type_suffix(reg.type);
 
       if (constant.value.index() == 0) {
         int64_t v = std::get<0>(constant.value);
+
+        if (!fits_immediate(constant) && reg.type.size == 8) {
+          utils::appendf(&output, "  movabsq $%ld, %%%s\n", v, name);
+          return;
+        }
+
         utils::appendf(&output, "  mov%c    $%ld, %%%s\n", ds, v, name);
         return;
       }
@@ -1153,7 +1494,7 @@ namespace phantom {
 
       utils::appendf(&output, "  movs%c   %s(%%rip), %%%s\n", ds, label.name.c_str(), name);
     }
-    void Gen::store_register_in_register(ir::PhysReg& src, ir::PhysReg& dst) {
+    void Gen::store_register_in_register(PhysReg& src, PhysReg& dst) {
       const char* rn = physical_register_name(dst);
       const char* vn = physical_register_name(src);
 
@@ -1169,227 +1510,40 @@ namespace phantom {
       utils::appendf(&output, "  %-7s %%%s, %%%s\n", mov, vn, rn);
       free(mov);
     }
-    void Gen::store_memory_in_register(ir::VirtReg& memory, ir::PhysReg& reg) {
+    void Gen::store_memory_in_register(const ir::VirtReg& memory, PhysReg& reg) {
       Variable variable = scope_vars[memory.id];
-      const size_t vo = variable.offset;
       const char* rn = physical_register_name(reg);
 
+      if (is_vector(variable.type)) {
+        utils::appendf(&output, "  %-7s %s, %%%s\n", vector_move(variable.type), variable_form(variable, 0).c_str(), rn);
+        return;
+      }
+
+      if (variable.reg && is_float(variable.type)) {
+        const char* mov = (variable.type.size == 4) ? "movaps" : "movapd";
+        utils::appendf(&output, "  %-7s %s, %%%s\n", mov, variable_form(variable, 8).c_str(), rn);
+        return;
+      }
+
       char* mov;
       if (is_float(reg.type) || is_float(variable.type))
         mov = generate_floating_point_move(reg.type);
       else
         mov = generate_integer_move(variable.type, reg.type);
 
-      utils::appendf(&output, "  %-7s -%zu(%%rbp), %%%s\n", mov, vo, rn);
+      // a plain move reads as many bytes as it writes, an extension the
+      // width of the variable
+      size_t size = std::min(variable.type.size, reg.type.size);
+      utils::appendf(&output, "  %-7s %s, %%%s\n", mov, variable_form(variable, size).c_str(), rn);
       free(mov);
     }
 
-    void Gen::add_constant_to_register(ir::Constant& constant, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg);
-      const char rs = type_suffix(reg.type);
-
-      switch (constant.value.index()) {
-        case 0: // int64_t
-        {
-          int64_t v = std::get<0>(constant.value);
-          if (v == 0) return;
-          utils::appendf(&output, "  add%c    $%lu, %%%s\n", rs, v, rn);
-          return;
-        }
-        case 1: // double
-        {
-          double v = std::get<1>(constant.value);
-          if (v == 0) return;
-
-          Directive::Kind kind;
-          // clang-format off
-          if (constant.type.size == 4) kind = Directive::Kind::Float;
-          else kind = Directive::Kind::Double;
-          // clang-format on
-
-          DataLabel label = constant_label(v, kind);
-          utils::appendf(&output, "  adds%c    %s(%%rip), %%%s\n", rs, label.name.c_str(), rn);
-          return;
-        }
-      }
-      unreachable();
-    }
-    void Gen::add_register_to_register(ir::PhysReg& src, ir::PhysReg& dst) {
-      const char* dn = physical_register_name(dst);
-      const char* vn = physical_register_name(src);
-
-      const char ds = type_suffix(dst.type);
-      const char* extra = is_float(dst.type) ? "s" : "";
-
-      utils::appendf(&output, "  add%s%c    %%%s, %%%s\n", extra, ds, vn, dn);
-    }
-    void Gen::add_memory_to_register(ir::VirtReg& memory, ir::PhysReg& reg) {
-      Variable variable = scope_vars[memory.id];
-      const size_t vo = variable.offset;
-
-      const char* dn = physical_register_name(reg);
-      const char ds = type_suffix(reg.type);
-
-      const char* extra = is_float(reg.type) ? "s" : "";
-      utils::appendf(&output, "  add%s%c    -%zu(%%rbp), %%%s\n", extra, ds, vo, dn);
-    }
-
-    void Gen::sub_constant_from_register(ir::Constant& constant, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg);
-      const char rs = type_suffix(reg.type);
-
-      switch (constant.value.index()) {
-        case 0: // int64_t
-        {
-          int64_t v = std::get<0>(constant.value);
-          if (v == 0) return;
-          utils::appendf(&output, "  sub%c    $%lu, %%%s\n", rs, v, rn);
-          return;
-        }
-        case 1: // double
-        {
-          double v = std::get<1>(constant.value);
-          if (v == 0) return;
-
-          Directive::Kind kind;
-          // clang-format off
-          if (constant.type.size == 4) kind = Directive::Kind::Float;
-          else kind = Directive::Kind::Double;
-          // clang-format on
-
-          DataLabel label = constant_label(v, kind);
-          utils::appendf(&output, "  subs%c   %s(%%rip), %%%s\n", rs, label.name.c_str(), rn);
-          return;
-        }
-      }
-      unreachable();
-    }
-    void Gen::sub_register_from_register(ir::PhysReg& src, ir::PhysReg& dst) {
-      const char* dn = physical_register_name(dst);
-      const char* vn = physical_register_name(src);
-
-      const char ds = type_suffix(dst.type);
-      const char* extra = is_float(dst.type) ? "s" : "";
-
-      utils::appendf(&output, "  sub%s%c    %%%s, %%%s\n", extra, ds, vn, dn);
-    }
-    void Gen::sub_memory_from_register(ir::VirtReg& memory, ir::PhysReg& reg) {
-      Variable variable = scope_vars[memory.id];
-      const size_t vo = variable.offset;
-
-      const char* dn = physical_register_name(reg);
-      const char ds = type_suffix(reg.type);
-
-      const char* extra = is_float(reg.type) ? "s" : "";
-      utils::appendf(&output, "  sub%s%c    -%zu(%%rbp), %%%s\n", extra, ds, vo, dn);
-    }
-
-    void Gen::imul_constant_with_memory(ir::Constant& constant, ir::VirtReg& memory, ir::PhysReg& dst) {
-      const char* cst_form = constant_form(constant);
-      utils::Str mem_form = utils::init(10);
-
-      Variable var = scope_vars[memory.id];
-      utils::appendf(&mem_form, "-%zu(%%rbp)", var.offset);
-
-      const char* dstrn = physical_register_name(dst);
-      const char ops = type_suffix(dst.type); // operation suffix
-
-      utils::appendf(&output, "  imul%c   %s, %s, %%%s\n",
-                     ops, cst_form, mem_form.content, dstrn);
-
-      utils::dump(&mem_form);
-    }
-    void Gen::imul_constant_with_register(ir::Constant& constant, ir::PhysReg& reg, ir::PhysReg& dst) {
-      const char* cst_form = constant_form(constant);
-      utils::Str reg_form = utils::init(5);
-
-      utils::appendf(&reg_form, "%%%s", physical_register_name(reg));
-
-      const char* dstrn = physical_register_name(dst);
-      const char ops = type_suffix(dst.type); // operation suffix
-
-      utils::appendf(&output, "  imul%c   %s, %s, %%%s\n",
-                     ops, cst_form, reg_form.content, dstrn);
-
-      utils::dump(&reg_form);
-    }
-    void Gen::imul_register_with_register(ir::PhysReg& src, ir::PhysReg& dst) {
-      const char* srn = physical_register_name(src); // src register name
-      const char* drn = physical_register_name(dst); // destination register name
-      const char is = type_suffix(dst.type);         // instruction suffix
-
-      utils::appendf(&output, "  imul%c   %%%s, %%%s\n", is, srn, drn);
-    }
-    void Gen::imul_memory_with_register(ir::VirtReg& memory, ir::PhysReg& reg) {
-      const char* drn = physical_register_name(reg);  // destination register name
-      const char is = type_suffix(reg.type);          // instruction suffix
-      const size_t vo = scope_vars[memory.id].offset; // variable offset
-
-      utils::appendf(&output, "  imul%c   -%zu(%%rbp), %%%s\n", is, vo, drn);
-    }
-
-    void Gen::mul_constant_with_register(ir::Constant& constant, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg); // register name
-      const char* extra = is_float(reg.type) ? "s" : "";
-      const char is = type_suffix(reg.type); // instruction suffix
-      const char* cst_form = constant_form(constant);
-
-      utils::appendf(&output, "  mul%s%c    %s, %%%s\n", extra, is, cst_form, rn);
-    }
-    void Gen::mul_register_with_register(ir::PhysReg& src, ir::PhysReg& dst) {
-      const char* srn = physical_register_name(src); // src register name
-      const char* drn = physical_register_name(dst); // dst register name
-      const char* extra = is_float(dst.type) ? "s" : "";
-      const char is = type_suffix(dst.type); // instruction suffix
-
-      utils::appendf(&output, "  mul%s%c    %%%s, %%%s\n", extra, is, srn, drn);
-    }
-    void Gen::mul_memory_with_register(ir::VirtReg& memory, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg); // register name
-      const char* extra = is_float(reg.type) ? "s" : "";
-      const char is = type_suffix(reg.type);          // instruction suffix
-      const size_t vo = scope_vars[memory.id].offset; // variable offset
-
-      utils::appendf(&output, "  mul%s%c    -%zu(%%rbp), %%%s\n", extra, is, vo, rn);
-    }
-
-    void Gen::idiv_by_register(ir::PhysReg& reg) {
+    void Gen::idiv_by_register(PhysReg& reg) {
       const char* rn = physical_register_name(reg); // register name
       const char is = type_suffix(reg.type);        // instruction suffix
 
       utils::appendf(&output, "  idiv%c   %%%s\n", is, rn);
     }
-    void Gen::idiv_by_memory(ir::VirtReg& memory) {
-      const size_t vo = scope_vars[memory.id].offset; // variable offset
-      const char is = type_suffix(memory.type);       // instruction suffix
-
-      utils::appendf(&output, "  idiv%c   -%zu(%%rbp)\n", is, vo);
-    }
-
-    void Gen::div_register_by_register(ir::PhysReg& src, ir::PhysReg& dst) {
-      const char* srn = physical_register_name(src); // src register name
-      const char* drn = physical_register_name(dst); // dst register name
-      const char* extra = "s";                       // since we are operating just on floating points
-      const char is = type_suffix(dst.type);         // instruction suffix
-
-      utils::appendf(&output, "  div%s%c    %%%s, %%%s\n", extra, is, srn, drn);
-    }
-    void Gen::div_constant_by_register(ir::Constant& constant, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg);   // register name
-      const char* cst_form = constant_form(constant); // constant form
-      const char* extra = "s";                        // since we are operating just on floating points
-      const char is = type_suffix(reg.type);          // instruction suffix
-
-      utils::appendf(&output, "  div%s%c    %s, %%%s\n", extra, is, cst_form, rn);
-    }
-    void Gen::div_memory_by_register(ir::VirtReg& memory, ir::PhysReg& reg) {
-      const char* rn = physical_register_name(reg);   // register name
-      const char* extra = "s";                        // since we are operating just on floating points
-      const char is = type_suffix(reg.type);          // instruction suffix
-      const size_t vo = scope_vars[memory.id].offset; // variable offset
-
-      utils::appendf(&output, "  div%s%c    -%zu(%%rbp), %%%s\n", extra, is, vo, rn);
-    }
 
     void Gen::division_conversion(ir::Type& type) {
       if (type.size == 8)
@@ -1463,20 +1617,30 @@ namespace phantom {
       }
       // clang-format on
     }
-    char* Gen::physical_register_name(ir::PhysReg& pr) {
-      if (is_float(pr.type))
+    bool Gen::fits_immediate(const ir::Constant& constant) {
+      if (constant.value.index() != 0)
+        return true;
+
+      int64_t v = std::get<0>(constant.value);
+      return v == (int32_t)v;
+    }
+    char* Gen::physical_register_name(PhysReg& pr) {
+      if (vector_bytes(pr.type) == 32)
+        return (char*)vector_registers[pr.rid];
+
+      if (is_float(pr.type) || is_vector(pr.type))
         return (char*)float_registers[pr.rid];
 
       return get_register_by_size(integer_registers[pr.rid], pr.type.size);
     }
-    char* Gen::constant_form(ir::Constant& constant) {
+    char* Gen::constant_form(const ir::Constant& constant) {
       utils::Str form = utils::init(5);
 
       switch (constant.value.index()) {
         case 0: // int64_t
         {
           int64_t v = std::get<0>(constant.value);
-          utils::appendf(&form, "$%lu", v);
+          utils::appendf(&form, "$%ld", v);
           break;
         }
         case 1: // double
@@ -1499,6 +1663,40 @@ namespace phantom {
       return form.content;
     }
 
+    char* Gen::value_form(ir::Value& value) {
+      utils::Str form = utils::init(16);
+
+      switch (value.index()) {
+        case 0: // Constant
+        {
+          char* cst = constant_form(current_function->constant(value));
+          utils::append(&form, cst);
+          free(cst);
+          break;
+        }
+        case 1: // VirtReg
+        {
+          Variable var = scope_vars[value.reg().id];
+          utils::append(&form, variable_form(var, var.type.size).c_str());
+          break;
+        }
+      }
+
+      return form.content;
+    }
+    std::string Gen::variable_form(Variable& var, size_t size) {
+      if (var.reg)
+        return std::string("%") + get_register_by_size(var.reg, size);
+
+      return frame_address(-(int64_t)var.offset);
+    }
+    std::string Gen::frame_address(int64_t displacement, const std::string& index) {
+      if (frame_pointer)
+        return std::to_string(displacement) + "(%rbp" + index + ")";
+
+      return std::to_string(displacement + frame_base + (int64_t)pushed) + "(%rsp" + index + ")";
+    }
+
     char* Gen::generate_integer_move(ir::Type& src, ir::Type& dst) {
       utils::Str mov = utils::init("mov");
       const char ds = integer_suffix(dst.size);
@@ -1520,11 +1718,48 @@ namespace phantom {
       return mov.content;
     }
 
+    const char* Gen::vector_move(ir::Type& type) {
+      bool wide = vector_bytes(type) == 32;
+
+      if (!is_float(type))
+        return wide ? "vmovdqu" : "movdqu";
+
+      if (type.size == 4)
+        return wide ? "vmovups" : "movups";
+
+      return wide ? "vmovupd" : "movupd";
+    }
+    const char* Gen::vector_operation(ir::BinOp::Op op, ir::Type& type) {
+      bool fp = is_float(type);
+      bool doubles = type.size == 8;
+
+      // clang-format off
+      switch (op) {
+        case ir::BinOp::Op::Add: return fp ? (doubles ? "addpd" : "addps") : (doubles ? "paddq" : "paddd");
+        case ir::BinOp::Op::Sub: return fp ? (doubles ? "subpd" : "subps") : (doubles ? "psubq" : "psubd");
+        case ir::BinOp::Op::Mul: if (fp) return doubles ? "mulpd" : "mulps";
+                                 if (!doubles) return "pmulld"; // SSE4.1
+                                 break;
+        case ir::BinOp::Op::Div: if (fp) return doubles ? "divpd" : "divps";
+                                 break;
+        default:                 break;
+      }
+      // clang-format on
+
+      unreachable();
+    }
+    size_t Gen::vector_bytes(ir::Type& type) {
+      return is_vector(type) ? (size_t)type.size * type.lanes : 0;
+    }
+
     bool Gen::is_integer(ir::Type& type) {
       return (type.kind == ir::Type::Kind::Int);
     }
     bool Gen::is_float(ir::Type& type) {
       return (type.kind == ir::Type::Kind::Float);
     }
+    bool Gen::is_vector(ir::Type& type) {
+      return type.lanes > 1;
+    }
   } // namespace codegen
 } // namespace phantom
@@ -0,0 +1,877 @@
+#include "codegen/Frame.hpp"
+#include "opt/Loops.hpp"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+namespace phantom {
+  namespace codegen {
+    // the slot `id` is read or written at `position`, a definition copying
+    // another candidate knows which one
+    struct Frame::Event {
+      size_t position;
+      uint id;
+      bool def;
+      uint copy = NONE;
+
+      static constexpr uint NONE = ~0u;
+    };
+
+    namespace {
+      // the liveness sets only hold the slots live across blocks, usually
+      // a small part of them
+      struct Bits {
+        std::vector<uint64_t> words;
+
+        explicit Bits(size_t n = 0) : words((n + 63) / 64, 0) {}
+
+        void set(size_t i) { words[i / 64] |= (uint64_t)1 << (i % 64); }
+        bool test(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+      };
+
+      size_t alignment(size_t bytes) {
+        size_t align = 1;
+        while (align < 16 && bytes % (align * 2) == 0)
+          align *= 2;
+
+        return align;
+      }
+
+      // the registers `Frame` allocates from, in the order they are tried.
+      // Argument registers are only free away from calls and the prologue,
+      // a callee-saved one costs a save and a restore
+      struct Register {
+        const char* name;
+        bool callee_saved;
+        bool argument;
+      };
+
+      // clang-format off
+      const Register INTEGER_REGISTERS[] = {
+        { "r10", false, false }, { "r11", false, false },
+        { "rdi", false, true },  { "r8", false, true },   { "r9", false, true },
+        { "rbx", true, false },  { "r12", true, false },  { "r13", true, false },
+        { "r14", true, false },  { "r15", true, false },
+      };
+      const Register FLOAT_REGISTERS[] = {
+        { "xmm8", false, false },  { "xmm9", false, false },  { "xmm10", false, false }, { "xmm11", false, false },
+        { "xmm12", false, false }, { "xmm13", false, false }, { "xmm14", false, false }, { "xmm15", false, false },
+        { "xmm4", false, true },   { "xmm5", false, true },   { "xmm6", false, true },   { "xmm7", false, true },
+      };
+      // clang-format on
+
+      // the registers of the class of `type`
+      std::pair<const Register*, const Register*> registers_of(const ir::Type& type) {
+        if (type.kind == ir::Type::Kind::Float)
+          return { std::begin(FLOAT_REGISTERS), std::end(FLOAT_REGISTERS) };
+
+        return { std::begin(INTEGER_REGISTERS), std::end(INTEGER_REGISTERS) };
+      }
+
+      // a loop level multiplies the weight of a use by 10, up to this depth
+      constexpr uint MAX_WEIGHT_DEPTH = 6;
+    } // namespace
+
+    Frame::Frame(ir::Function& fn, RegAlloc regalloc) : regalloc(regalloc) {
+      for (ir::VirtReg& param : fn.params)
+        add(param.id, param.type);
+
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body) {
+          ir::VirtReg* reg = ir::defined_register(inst);
+          if (reg == nullptr)
+            continue;
+
+          // predecessors write a phi's incoming slot, the phi copies it into
+          // its own slot, so phis of the same block never clobber each other
+          if (inst.index() == 13) {
+            ir::VirtReg incoming = { .id = fn.nregs + (uint)phi_incoming.size(), .type = reg->type };
+            add(incoming.id, incoming.type);
+            phi_incoming[reg->id] = incoming;
+          }
+
+          // calls to void functions don't produce anything
+          if (reg->type.is_void)
+            continue;
+
+          // an alloca's slot holds the variable itself
+          if (inst.index() == 0) {
+            add(reg->id, std::get<0>(inst).type, std::get<0>(inst).count);
+            candidates.back().stored = true;
+          } else
+            add(reg->id, reg->type);
+        }
+      }
+
+      compute_ranges(fn);
+      allocate_registers();
+      assign_offsets();
+    }
+
+    void Frame::add(uint id, const ir::Type& type, uint count) {
+      size_t bytes = (size_t)type.size * type.lanes * std::max(count, 1u);
+
+      // the frame base is 16 bytes aligned, so are the slots SSE
+      // instructions read
+      if (type.lanes > 1 || count != 0)
+        bytes = (bytes + 15) & ~(size_t)15;
+
+      index[id] = candidates.size();
+      candidates.push_back(Slot{ .id = id, .type = type, .bytes = bytes, .array = count != 0 });
+    }
+
+    void Frame::compute_ranges(ir::Function& fn) {
+      size_t nblocks = fn.blocks.size();
+
+      // block `b` starts at `start[b]`, its instructions follow and the phi
+      // copies and the terminator are at `end[b]`
+      std::vector<size_t>& start = block_start;
+      std::vector<size_t>& end = block_end;
+      start.assign(nblocks, 0);
+      end.assign(nblocks, 0);
+      size_t position = 1; // the parameters are stored at 0
+      for (uint b = 0; b < nblocks; ++b) {
+        start[b] = position;
+        end[b] = start[b] + 1 + fn.blocks[b].body.size();
+        position = end[b] + 1;
+      }
+
+      // uses in loops weigh more
+      opt::Loops loops(fn);
+      block_weight.assign(nblocks, 1);
+      for (uint b = 0; b < nblocks; ++b)
+        if (loops.innermost[b] != opt::Loops::NONE)
+          block_weight[b] = std::pow(10.0, std::min(loops.loops[loops.innermost[b]].depth, MAX_WEIGHT_DEPTH));
+
+      std::vector<std::vector<Event>> events(nblocks);
+      auto use = [&](uint b, size_t at, const ir::Value& value) {
+        if (value.index() == 1)
+          events[b].push_back(Event{ .position = at, .id = value.reg().id, .def = false });
+      };
+      auto def = [&](uint b, size_t at, uint id, uint copy = Event::NONE) {
+        events[b].push_back(Event{ .position = at, .id = id, .def = true, .copy = copy });
+      };
+
+      if (nblocks != 0)
+        for (ir::VirtReg& param : fn.params)
+          def(0, 0, param.id);
+
+      for (uint b = 0; b < nblocks; ++b) {
+        ir::Block& block = fn.blocks[b];
+        size_t size = block.body.size();
+
+        // a comparison feeding the branch right after it is generated after
+        // the phi copies
+        bool fused = block.terminated && block.terminator.index() == 2 && size != 0 &&
+                     block.body.back().index() == 11 && std::get<2>(block.terminator).cond.index() == 1 &&
+                     std::get<2>(block.terminator).cond.reg().id == std::get<11>(block.body.back()).dst.id;
+
+        for (size_t k = 0; k < size; ++k) {
+          ir::Instruction& inst = block.body[k];
+          size_t at = start[b] + 1 + k;
+
+          if (inst.index() == 13) {
+            ir::Phi& phi = std::get<13>(inst);
+            uint incoming = phi_incoming[phi.dst.id].id;
+
+            use(b, at, phi_incoming[phi.dst.id]);
+            def(b, at, phi.dst.id, incoming);
+
+            for (auto& [pred, value] : phi.incoming) {
+              if (pred >= nblocks)
+                continue;
+
+              use(pred, end[pred], value);
+              def(pred, end[pred], incoming, (value.index() == 1) ? value.reg().id : Event::NONE);
+            }
+            continue;
+          }
+
+          if (inst.index() == 14)
+            calls.push_back(at);
+
+          size_t use_at = (fused && k + 1 == size) ? end[b] : at;
+          for (ir::Value* value : ir::operands(inst))
+            use(b, use_at, *value);
+
+          // clang-format off
+          switch (inst.index()) {
+            case 1:  use(b, at, std::get<1>(inst).dst);    break;
+            case 12: use(b, at, std::get<12>(inst).src);   break;
+            case 15: use(b, at, std::get<15>(inst).array); break;
+            case 16: use(b, at, std::get<16>(inst).array); break;
+          }
+          // clang-format on
+
+          // an integer cast of a register copies it, the low bits stay put
+          uint copy = Event::NONE;
+          if (inst.index() == 10 && std::get<10>(inst).value.index() == 1)
+            copy = std::get<10>(inst).value.reg().id;
+
+          ir::VirtReg* reg = ir::defined_register(inst);
+          if (reg != nullptr && !reg->type.is_void)
+            def(b, at, reg->id, copy);
+        }
+
+        if (block.terminated)
+          for (ir::Value* value : ir::operands(block.terminator))
+            use(b, end[b], *value);
+      }
+
+      // uses come before the definitions at the same position, phi copies
+      // read their values before writing the incoming slots
+      for (std::vector<Event>& list : events)
+        std::stable_sort(list.begin(), list.end(), [](const Event& a, const Event& c) {
+          return a.position < c.position || (a.position == c.position && !a.def && c.def);
+        });
+
+      auto touch = [&](uint id, size_t at) {
+        auto it = index.find(id);
+        if (it == index.end())
+          return;
+
+        Slot& slot = candidates[it->second];
+        slot.start = std::min(slot.start, at);
+        slot.end = std::max(slot.end, at);
+      };
+
+      // slots used in a block before being defined there are live across
+      // blocks, they're the only ones liveness is computed for
+      std::vector<std::vector<uint>> upward(nblocks), defined(nblocks);
+      std::unordered_map<uint, size_t> global;
+      std::vector<uint> globals;
+
+      for (uint b = 0; b < nblocks; ++b) {
+        std::unordered_map<uint, bool> seen;
+
+        for (const Event& event : events[b]) {
+          touch(event.id, event.position);
+
+          auto it = index.find(event.id);
+          if (it != index.end()) {
+            Slot& slot = candidates[it->second];
+            slot.weight += block_weight[b];
+
+            if (event.def)
+              slot.defs++;
+            else if (event.position < end[b] && (slot.uses.empty() || slot.uses.back() != event.position))
+              slot.uses.push_back(event.position);
+          }
+
+          if (event.def) {
+            defined[b].push_back(event.id);
+            seen[event.id] = true;
+          } else if (!seen[event.id]) {
+            upward[b].push_back(event.id);
+            seen[event.id] = true;
+
+            if (global.emplace(event.id, globals.size()).second)
+              globals.push_back(event.id);
+          }
+        }
+      }
+
+      size_t nglobals = globals.size();
+      std::vector<Bits> gen(nblocks, Bits(nglobals)), kill(nblocks, Bits(nglobals));
+      std::vector<Bits> live_in(nblocks, Bits(nglobals)), live_out(nblocks, Bits(nglobals));
+
+      for (uint b = 0; b < nblocks; ++b) {
+        for (uint id : upward[b])
+          gen[b].set(global[id]);
+
+        for (uint id : defined[b]) {
+          auto it = global.find(id);
+          if (it != global.end())
+            kill[b].set(it->second);
+        }
+      }
+
+      bool changed = true;
+      while (changed) {
+        changed = false;
+
+        for (uint b = nblocks; b-- > 0;) {
+          Bits out(nglobals);
+          for (uint succ : fn.blocks[b].succs)
+            for (size_t w = 0; w < out.words.size(); ++w)
+              out.words[w] |= live_in[succ].words[w];
+
+          Bits in(nglobals);
+          for (size_t w = 0; w < in.words.size(); ++w)
+            in.words[w] = gen[b].words[w] | (out.words[w] & ~kill[b].words[w]);
+
+          if (in.words != live_in[b].words || out.words != live_out[b].words) {
+            live_in[b] = std::move(in);
+            live_out[b] = std::move(out);
+            changed = true;
+          }
+        }
+      }
+
+      std::vector<std::vector<uint>> live_candidates(nblocks);
+      for (uint b = 0; b < nblocks; ++b) {
+        for (size_t g = 0; g < nglobals; ++g) {
+          if (live_in[b].test(g))
+            touch(globals[g], start[b]);
+          if (live_out[b].test(g)) {
+            touch(globals[g], end[b]);
+
+            auto it = index.find(globals[g]);
+            if (it != index.end())
+              live_candidates[b].push_back(it->second);
+          }
+        }
+      }
+
+      if (regalloc == RegAlloc::GraphColoring)
+        build_interference(events, live_candidates);
+    }
+
+    void Frame::build_interference(const std::vector<std::vector<Event>>& events,
+                                   const std::vector<std::vector<uint>>& live_out) {
+      size_t n = candidates.size();
+      interference.assign(n, {});
+
+      auto interfere = [&](uint a, uint b) {
+        const Slot &x = candidates[a], &y = candidates[b];
+        if (a == b || !x.allocatable() || !y.allocatable() ||
+            (x.type.kind == ir::Type::Kind::Float) != (y.type.kind == ir::Type::Kind::Float))
+          return;
+
+        if (interfering.insert((uint64_t)std::min(a, b) << 32 | std::max(a, b)).second) {
+          interference[a].push_back(b);
+          interference[b].push_back(a);
+        }
+      };
+      auto candidate = [&](uint id) {
+        auto it = index.find(id);
+        return (it == index.end()) ? Event::NONE : it->second;
+      };
+
+      // the candidates live after the current position, by their place in
+      // `live`
+      std::vector<uint> live;
+      std::vector<size_t> place(n, SIZE_MAX);
+      auto insert = [&](uint c) {
+        if (place[c] == SIZE_MAX) {
+          place[c] = live.size();
+          live.push_back(c);
+        }
+      };
+      auto erase = [&](uint c) {
+        if (place[c] == SIZE_MAX)
+          return;
+
+        place[live.back()] = place[c];
+        live[place[c]] = live.back();
+        live.pop_back();
+        place[c] = SIZE_MAX;
+      };
+
+      for (uint b = 0; b < events.size(); ++b) {
+        for (uint c : live)
+          place[c] = SIZE_MAX;
+        live.clear();
+        for (uint c : live_out[b])
+          insert(c);
+
+        const std::vector<Event>& list = events[b];
+        std::vector<uint> of(list.size()); // event -> candidate
+        for (size_t k = 0; k < list.size(); ++k)
+          of[k] = candidate(list[k].id);
+
+        for (size_t j = list.size(); j > 0;) {
+          size_t i = j - 1;
+          while (i > 0 && list[i - 1].position == list[j - 1].position)
+            --i;
+
+          // what one position defines interferes with what is live after it,
+          // with the rest it defines and with what it reads, except for the
+          // value a copy copies (it has the same value)
+          for (size_t d = i; d < j; ++d) {
+            uint dst = list[d].def ? of[d] : Event::NONE;
+            if (dst == Event::NONE)
+              continue;
+
+            uint src = (list[d].copy == Event::NONE) ? Event::NONE : candidate(list[d].copy);
+            if (src != Event::NONE && src != dst && candidates[src].allocatable() && candidates[dst].allocatable())
+              copies.push_back({ dst, src });
+
+            for (uint c : live)
+              if (c != src)
+                interfere(dst, c);
+
+            for (size_t k = i; k < j; ++k)
+              if (of[k] != Event::NONE && (list[k].def || of[k] != src))
+                interfere(dst, of[k]);
+          }
+
+          for (size_t k = i; k < j; ++k)
+            if (of[k] != Event::NONE && list[k].def)
+              erase(of[k]);
+          for (size_t k = i; k < j; ++k)
+            if (of[k] != Event::NONE && !list[k].def)
+              insert(of[k]);
+
+          j = i;
+        }
+      }
+    }
+
+    bool Frame::crosses_call(const Slot& slot, bool ends) const {
+      auto it = std::lower_bound(calls.begin(), calls.end(), slot.start + (ends ? 0 : 1));
+      return it != calls.end() && *it + (ends ? 0 : 1) <= slot.end;
+    }
+
+    void Frame::allocate_registers() {
+      std::vector<Slot*> order;
+      for (Slot& slot : candidates)
+        if (slot.allocatable() && slot.start <= slot.end)
+          order.push_back(&slot);
+
+      // a call strictly inside the range clobbers the caller-saved registers,
+      // one at either end reads or writes the argument registers
+      for (Slot* slot : order) {
+        auto [first, last] = registers_of(slot->type);
+
+        for (const Register* reg = first; reg != last; ++reg) {
+          if (reg->argument && (slot->start == 0 || crosses_call(*slot, true)))
+            continue;
+          if (reg->callee_saved || !crosses_call(*slot, false))
+            slot->usable |= 1u << (reg - first);
+        }
+      }
+
+      if (regalloc == RegAlloc::GraphColoring)
+        color_registers(order);
+      else
+        linear_scan(order);
+
+      for (Slot* slot : order)
+        if (!slot->reg)
+          spilled++;
+
+      split_ranges();
+    }
+
+    void Frame::split_ranges() {
+      splits.assign(block_start.size(), {});
+
+      // the closed ranges each register is busy over
+      std::unordered_map<const char*, std::vector<std::pair<size_t, size_t>>> busy;
+      std::unordered_set<const char*> saved_already;
+      for (Slot& slot : candidates) {
+        if (!slot.reg)
+          continue;
+
+        busy[slot.reg].push_back({ slot.start, slot.end });
+        for (const Register& reg : INTEGER_REGISTERS)
+          if (reg.callee_saved && reg.name == slot.reg)
+            saved_already.insert(slot.reg);
+      }
+
+      auto block_of = [&](size_t position) {
+        return (uint)(std::upper_bound(block_start.begin(), block_start.end(), position) - block_start.begin() - 1);
+      };
+      // a call at `from` or after it, before `to`
+      auto call_between = [&](size_t from, size_t to) {
+        auto it = std::lower_bound(calls.begin(), calls.end(), from);
+        return it != calls.end() && *it < to;
+      };
+
+      struct Piece {
+        Slot* slot;
+        uint block;
+        size_t first, last;
+        double weight;
+      };
+      std::vector<Piece> pieces_left;
+
+      for (Slot& slot : candidates) {
+        if (slot.reg || !slot.allocatable() || slot.stored || slot.defs != 1 || slot.uses.size() < 2)
+          continue;
+
+        // a call clobbers the caller-saved registers after reading its
+        // arguments, the uses after it start another piece
+        std::vector<size_t>& uses = slot.uses;
+        for (size_t i = 0, j = 0; i < uses.size(); i = ++j) {
+          uint block = block_of(uses[i]);
+          while (j + 1 < uses.size() && uses[j + 1] < block_end[block] && !call_between(uses[j], uses[j + 1]))
+            ++j;
+
+          if (j != i)
+            pieces_left.push_back(Piece{ .slot = &slot, .block = block, .first = uses[i], .last = uses[j],
+                                         .weight = (double)(j - i) * block_weight[block] });
+        }
+      }
+
+      // the heaviest first, a piece saves a load per use after its first
+      std::stable_sort(pieces_left.begin(), pieces_left.end(),
+                       [](const Piece& a, const Piece& b) { return a.weight > b.weight; });
+
+      for (Piece& piece : pieces_left) {
+        auto [first, last] = registers_of(piece.slot->type);
+        bool at_call = call_between(piece.first, piece.last + 1);
+
+        for (const Register* reg = first; reg != last; ++reg) {
+          if ((reg->argument && at_call) || (reg->callee_saved && !saved_already.count(reg->name)))
+            continue;
+
+          std::vector<std::pair<size_t, size_t>>& ranges = busy[reg->name];
+          bool free = std::none_of(ranges.begin(), ranges.end(), [&](const std::pair<size_t, size_t>& range) {
+            return range.first <= piece.last && piece.first <= range.second;
+          });
+          if (!free)
+            continue;
+
+          ranges.push_back({ piece.first, piece.last });
+          size_t base = block_start[piece.block] + 1;
+          splits[piece.block].push_back(
+              Split{ .id = piece.slot->id, .first = piece.first - base, .last = piece.last - base, .reg = reg->name });
+          pieces++;
+          break;
+        }
+      }
+    }
+
+    void Frame::linear_scan(std::vector<Slot*>& order) {
+      std::stable_sort(order.begin(), order.end(), [](Slot* a, Slot* b) { return a->start < b->start; });
+
+      for (Slot* slot : order)
+        slot->weight /= (double)(slot->end - slot->start + 1);
+
+      // the slots holding a register, and who holds each register
+      std::vector<Slot*> active;
+      std::unordered_map<const char*, Slot*> holder;
+
+      for (Slot* slot : order) {
+        // ranges ending before this one starts give their register back
+        for (size_t i = 0; i < active.size();) {
+          if (active[i]->end < slot->start) {
+            holder.erase(active[i]->reg);
+            active[i] = active.back();
+            active.pop_back();
+          } else
+            ++i;
+        }
+
+        auto [first, last] = registers_of(slot->type);
+        const Register* chosen = nullptr;
+        Slot* victim = nullptr;
+
+        for (const Register* reg = first; reg != last && !chosen; ++reg) {
+          if (!(slot->usable >> (reg - first) & 1))
+            continue;
+
+          auto it = holder.find(reg->name);
+          if (it == holder.end())
+            chosen = reg;
+          else if (!victim || it->second->weight < victim->weight)
+            victim = it->second;
+        }
+
+        if (!chosen) {
+          // the lightest range holding a register this one could use goes
+          // back to memory, unless it is heavier than this one
+          if (!victim || victim->weight >= slot->weight)
+            continue;
+
+          slot->reg = victim->reg;
+          victim->reg = nullptr;
+          active.erase(std::find(active.begin(), active.end(), victim));
+          holder[slot->reg] = slot;
+          active.push_back(slot);
+          continue;
+        }
+
+        slot->reg = chosen->name;
+        holder[slot->reg] = slot;
+        active.push_back(slot);
+      }
+    }
+
+    void Frame::color_registers(std::vector<Slot*>& order) {
+      size_t n = candidates.size();
+
+      enum class State : uint8_t { None, Simplify, Freeze, Spill, Selected, Coalesced };
+      enum class Move : uint8_t { Worklist, Active, Done };
+
+      std::vector<State> state(n, State::None);
+      std::vector<uint> degree(n, 0), alias(n);
+      std::vector<uint32_t> usable(n, 0);
+      std::vector<double> weight(n, 0);
+      std::vector<std::vector<uint>> moves_of(n);
+      std::vector<Move> moves(copies.size(), Move::Worklist);
+
+      std::vector<uint> simplify, freeze, spill, move_worklist, selected;
+
+      for (uint c = 0; c < n; ++c) {
+        alias[c] = c;
+        usable[c] = candidates[c].usable;
+        weight[c] = candidates[c].weight;
+        degree[c] = interference[c].size();
+      }
+
+      auto colors = [&](uint c) { return (uint)__builtin_popcount(usable[c]); };
+      auto significant = [&](uint c) { return degree[c] >= colors(c); };
+      auto find = [&](uint c) {
+        while (state[c] == State::Coalesced)
+          c = alias[c];
+        return c;
+      };
+      auto move_related = [&](uint c) {
+        for (uint m : moves_of[c])
+          if (moves[m] != Move::Done)
+            return true;
+        return false;
+      };
+      auto enable_moves = [&](uint c) {
+        for (uint m : moves_of[c]) {
+          if (moves[m] == Move::Active) {
+            moves[m] = Move::Worklist;
+            move_worklist.push_back(m);
+          }
+        }
+      };
+      auto push = [&](uint c, State to) {
+        state[c] = to;
+        (to == State::Simplify) ? simplify.push_back(c) : (to == State::Freeze) ? freeze.push_back(c) : spill.push_back(c);
+      };
+      // the neighbours still in the graph
+      auto for_adjacent = [&](uint c, auto&& f) {
+        for (uint other : interference[c])
+          if (state[other] != State::Selected && state[other] != State::Coalesced)
+            f(other);
+      };
+      auto decrement = [&](uint c) {
+        if (degree[c]-- != colors(c))
+          return;
+
+        enable_moves(c);
+        for_adjacent(c, enable_moves);
+        if (state[c] == State::Spill)
+          push(c, move_related(c) ? State::Freeze : State::Simplify);
+      };
+      auto add_worklist = [&](uint c) {
+        if (state[c] == State::Freeze && !move_related(c) && !significant(c))
+          push(c, State::Simplify);
+      };
+      auto freeze_moves = [&](uint c) {
+        for (uint m : moves_of[c]) {
+          if (moves[m] == Move::Done)
+            continue;
+
+          moves[m] = Move::Done;
+          uint other = (find(copies[m].first) == c) ? find(copies[m].second) : find(copies[m].first);
+          if (state[other] == State::Freeze && !move_related(other) && !significant(other))
+            push(other, State::Simplify);
+        }
+      };
+      // Briggs: the merged node has fewer significant neighbours than the
+      // registers it may get, so it will still simplify
+      std::vector<uint> seen(n, 0); // the last test a node was counted by
+      uint tests = 0;
+      auto conservative = [&](uint u, uint v) {
+        uint k = __builtin_popcount(usable[u] & usable[v]);
+        uint heavy = 0;
+
+        tests++;
+        for (uint c : { u, v })
+          for_adjacent(c, [&](uint other) {
+            if (seen[other] != tests && significant(other))
+              heavy++;
+            seen[other] = tests;
+          });
+
+        return heavy < k;
+      };
+      auto combine = [&](uint u, uint v) {
+        state[v] = State::Coalesced;
+        alias[v] = u;
+        moves_of[u].insert(moves_of[u].end(), moves_of[v].begin(), moves_of[v].end());
+        usable[u] &= usable[v];
+        weight[u] += weight[v];
+        enable_moves(v);
+
+        for_adjacent(v, [&](uint other) {
+          if (interfering.insert((uint64_t)std::min(u, other) << 32 | std::max(u, other)).second) {
+            interference[u].push_back(other);
+            interference[other].push_back(u);
+            degree[u]++;
+            degree[other]++;
+          }
+          decrement(other);
+        });
+
+        if (state[u] == State::Freeze && significant(u))
+          push(u, State::Spill);
+      };
+
+      for (uint m = 0; m < copies.size(); ++m) {
+        moves_of[copies[m].first].push_back(m);
+        moves_of[copies[m].second].push_back(m);
+        move_worklist.push_back(m);
+      }
+
+      for (Slot* slot : order) {
+        uint c = index[slot->id];
+        push(c, significant(c) ? State::Spill : move_related(c) ? State::Freeze : State::Simplify);
+      }
+
+      while (true) {
+        if (!simplify.empty()) {
+          uint c = simplify.back();
+          simplify.pop_back();
+
+          state[c] = State::Selected;
+          selected.push_back(c);
+          for_adjacent(c, decrement);
+        } else if (!move_worklist.empty()) {
+          uint m = move_worklist.back();
+          move_worklist.pop_back();
+          if (moves[m] != Move::Worklist)
+            continue;
+
+          uint u = find(copies[m].first), v = find(copies[m].second);
+          if (u == v) {
+            moves[m] = Move::Done;
+            add_worklist(u);
+          } else if (interfering.count((uint64_t)std::min(u, v) << 32 | std::max(u, v)) ||
+                     (usable[u] & usable[v]) == 0) {
+            moves[m] = Move::Done;
+            add_worklist(u);
+            add_worklist(v);
+          } else if (conservative(u, v)) {
+            moves[m] = Move::Done;
+            combine(u, v);
+            add_worklist(u);
+          } else
+            moves[m] = Move::Active;
+        } else if (!freeze.empty()) {
+          uint c = freeze.back();
+          freeze.pop_back();
+          if (state[c] != State::Freeze)
+            continue;
+
+          push(c, State::Simplify);
+          freeze_moves(c);
+        } else if (!spill.empty()) {
+          // the cheapest to keep in memory: the lowest weight per
+          // interference
+          size_t best = SIZE_MAX;
+          for (size_t i = 0; i < spill.size(); ++i) {
+            uint c = spill[i];
+            if (state[c] != State::Spill)
+              continue;
+            if (best == SIZE_MAX ||
+                weight[c] * (degree[spill[best]] + 1) < weight[spill[best]] * (degree[c] + 1))
+              best = i;
+          }
+
+          if (best == SIZE_MAX) {
+            spill.clear();
+            continue;
+          }
+
+          uint c = spill[best];
+          spill.erase(spill.begin() + best);
+          push(c, State::Simplify);
+          freeze_moves(c);
+        } else
+          break;
+      }
+
+      // the last simplified takes its register first, a node whose
+      // neighbours took every register it may get stays in memory
+      for (size_t i = selected.size(); i-- > 0;) {
+        uint c = selected[i];
+        uint32_t free = usable[c];
+
+        for (uint other : interference[c]) {
+          const Slot& holder = candidates[find(other)];
+          if (holder.reg) {
+            auto [first, last] = registers_of(holder.type);
+            for (const Register* reg = first; reg != last; ++reg)
+              if (reg->name == holder.reg)
+                free &= ~(1u << (reg - first));
+          }
+        }
+
+        if (free != 0)
+          candidates[c].reg = registers_of(candidates[c].type).first[__builtin_ctz(free)].name;
+      }
+
+      for (Slot* slot : order)
+        slot->reg = candidates[find(index[slot->id])].reg;
+    }
+
+    void Frame::assign_offsets() {
+      std::vector<const char*> callee_saved;
+
+      // bytes -> the slots of that size, by the start of their range
+      std::map<size_t, std::vector<Slot*>, std::greater<size_t>> sizes;
+      for (Slot& slot : candidates) {
+        if (slot.reg) {
+          slots[slot.id] = Variable{ .type = slot.type, .offset = 0, .reg = slot.reg };
+          in_registers++;
+
+          for (const Register& reg : INTEGER_REGISTERS)
+            if (reg.callee_saved && reg.name == slot.reg &&
+                std::find(callee_saved.begin(), callee_saved.end(), slot.reg) == callee_saved.end())
+              callee_saved.push_back(slot.reg);
+          continue;
+        }
+
+        if (slot.bytes == 0)
+          continue;
+
+        if (slot.start > slot.end)
+          slot.start = slot.end = 0;
+
+        sizes[slot.bytes].push_back(&slot);
+        unshared_size += slot.bytes;
+      }
+
+      // interval partitioning per size: a slot takes over the shared slot
+      // whose last range ended first, when it ended before this one starts
+      size_t top = 0;
+      for (auto& [bytes, list] : sizes) {
+        std::sort(list.begin(), list.end(), [](Slot* a, Slot* b) { return a->start < b->start; });
+
+        using Busy = std::pair<size_t, size_t>; // (end of the range, offset)
+        std::priority_queue<Busy, std::vector<Busy>, std::greater<Busy>> busy;
+
+        for (Slot* slot : list) {
+          size_t offset;
+
+          if (!busy.empty() && busy.top().first < slot->start) {
+            offset = busy.top().second;
+            busy.pop();
+          } else {
+            size_t align = alignment(bytes);
+            top = (top + bytes + align - 1) & ~(align - 1);
+            offset = top;
+          }
+
+          busy.push({ slot->end, offset });
+          slots[slot->id] = Variable{ .type = slot->type, .offset = offset };
+        }
+      }
+
+      // in the order of `INTEGER_REGISTERS`, so the saves don't depend on
+      // the order of the slots
+      for (const Register& reg : INTEGER_REGISTERS) {
+        if (std::find(callee_saved.begin(), callee_saved.end(), reg.name) == callee_saved.end())
+          continue;
+
+        top = (top + 8 + 7) & ~(size_t)7;
+        saved.push_back({ reg.name, top });
+        unshared_size += 8;
+      }
+
+      size = (top + 15) & ~(size_t)15;
+      unshared_size = (unshared_size + 15) & ~(size_t)15;
+    }
+  } // namespace codegen
+} // namespace phantom
@@ -0,0 +1,623 @@
+#include "codegen/Codegen.hpp"
+#include "common.hpp"
+#include <cstring>
+
+namespace phantom {
+  namespace codegen {
+    namespace {
+      // what a subtree is reduced to, the nonterminals of the grammar
+      enum Goal : uint8_t {
+        Imm,     // a constant that fits a 32-bit immediate
+        Operand, // an instruction's source operand: register, memory or immediate
+        Source,  // any register
+        Reg,     // a scratch register the parent may overwrite
+        Index,   // a register scaled by 1, 2, 4 or 8
+        Address, // base + index * scale + displacement
+        GOALS
+      };
+
+      enum class Form : uint8_t {
+        Alu,      // "op operand, reg"
+        Swapped,  // the same, with the operands of a commutative operator swapped
+        Neg,      // 0 - x
+        Imul,     // "imul $c, operand, reg"
+        Shift,    // a shift by a constant
+        Scale,    // x * 1/2/4/8 and x << 0..3 as an index
+        Triple,   // x * 3/5/9 as the address (x,x,2/4/8)
+        Indexed,  // base + index
+        Displace, // address + constant
+        Chain,    // the same value, reduced to `lhs`
+        Lea,      // an address computed into a register
+      };
+
+      using Op = ir::BinOp::Op;
+
+      struct Rule {
+        Goal goal;
+        Form form;
+        Op op;         // unused by chain rules
+        Goal lhs, rhs; // chain rules only have `lhs`
+        uint8_t cost;
+      };
+
+      // The costs roughly count instructions, multiplications count twice
+      // (their latency is 3 cycles) and the address arithmetic is free until
+      // the "lea" computing it. The first of the rules costing the same wins.
+      // clang-format off
+      const Rule rules[] = {
+        // goal      form              op       lhs      rhs      cost
+        { Reg,     Form::Alu,      Op::Add, Reg,     Operand, 1 },
+        { Reg,     Form::Swapped,  Op::Add, Operand, Reg,     1 },
+        { Reg,     Form::Neg,      Op::Sub, Imm,     Reg,     1 },
+        { Reg,     Form::Alu,      Op::Sub, Reg,     Operand, 1 },
+        { Reg,     Form::Alu,      Op::Mul, Reg,     Operand, 2 },
+        { Reg,     Form::Swapped,  Op::Mul, Operand, Reg,     2 },
+        { Reg,     Form::Imul,     Op::Mul, Operand, Imm,     2 },
+        { Reg,     Form::Alu,      Op::Div, Reg,     Operand, 1 },
+        { Reg,     Form::Shift,    Op::Shl, Reg,     Imm,     1 },
+        { Reg,     Form::Shift,    Op::Sar, Reg,     Imm,     1 },
+        { Reg,     Form::Shift,    Op::Shr, Reg,     Imm,     1 },
+        { Index,   Form::Scale,    Op::Mul, Source,  Imm,     0 },
+        { Index,   Form::Scale,    Op::Shl, Source,  Imm,     0 },
+        { Address, Form::Triple,   Op::Mul, Source,  Imm,     0 },
+        { Address, Form::Indexed,  Op::Add, Source,  Index,   0 },
+        { Address, Form::Indexed,  Op::Add, Index,   Source,  0 },
+        { Address, Form::Displace, Op::Add, Address, Imm,     0 },
+        { Address, Form::Displace, Op::Sub, Address, Imm,     0 },
+        // chain rules
+        { Source,  Form::Chain,    {},      Reg,     {},      0 },
+        { Operand, Form::Chain,    {},      Source,  {},      0 },
+        { Operand, Form::Chain,    {},      Imm,     {},      0 },
+        { Index,   Form::Chain,    {},      Source,  {},      0 },
+        { Address, Form::Chain,    {},      Index,   {},      0 },
+        { Reg,     Form::Lea,      {},      Address, {},      1 },
+      };
+      // clang-format on
+
+      constexpr size_t RULES = sizeof(rules) / sizeof(rules[0]);
+      constexpr uint INF = ~0u >> 2;
+      // `Node::rule` of the goals a leaf is reduced to directly
+      constexpr int8_t NONE = -1, LEAF = -2;
+      // interior nodes of a tree, it needs at most 3 scratch registers
+      constexpr size_t MAX_TREE = 4;
+
+      bool chain(const Rule& rule) {
+        return rule.form == Form::Chain || rule.form == Form::Lea;
+      }
+      bool same_type(const ir::Type& a, const ir::Type& b) {
+        return a.kind == b.kind && a.size == b.size && a.lanes == b.lanes;
+      }
+    } // namespace
+
+    struct Gen::Node {
+      ir::BinOp* binop = nullptr; // null for leaves
+      ir::Value* value = nullptr; // the value of a leaf
+      bool integer = false;       // a leaf holding the integer constant `imm`
+      int64_t imm = 0;
+      Node* kids[2] = { nullptr, nullptr };
+      size_t size = 0; // interior nodes
+      ir::Type type;
+
+      // the cheapest way to reduce the subtree to each goal
+      uint cost[GOALS];
+      int8_t rule[GOALS];
+
+      bool constant(int64_t& v) {
+        v = imm;
+        return integer;
+      }
+    };
+
+    // A reduced subtree. Registers are named by their 64-bit (or xmm) name,
+    // `reg` holds a `Source`/`Reg`/`Index` and the index of an `Address`,
+    // `disp` the value of an `Imm`, `text` the form of an `Operand`.
+    struct Gen::Place {
+      const char* base = nullptr;
+      const char* reg = nullptr;
+      int64_t scale = 1;
+      int64_t disp = 0;
+      std::string text;
+      unsigned held = 0; // the scratch registers it keeps busy
+    };
+
+    bool Gen::selectable(ir::BinOp& binop) {
+      ir::Type& type = binop.dst.type;
+      if (is_vector(type))
+        return false;
+
+      // clang-format off
+      switch (binop.op) {
+        case Op::Add: case Op::Sub:               return true;
+        case Op::Mul:                             return is_float(type) || type.size != 1;
+        case Op::Div:                             return is_float(type);
+        case Op::Shl: case Op::Sar: case Op::Shr: return binop.rhs.index() == 0;
+        default:                                  return false;
+      }
+      // clang-format on
+    }
+    void Gen::plan_trees(ir::Block& block) {
+      std::vector<ir::Instruction>& body = block.body;
+
+      // where the pieces of spilled ranges are loaded (see `Frame::Split`)
+      std::vector<bool> loads(body.size(), false);
+      for (Frame::Split& split : splits[current_block])
+        loads[split.first] = true;
+
+      for (size_t i = body.size(); i-- > 0;) {
+        if (body[i].index() != 2 || folded.count(std::get<2>(body[i]).dst.id) || !selectable(std::get<2>(body[i])))
+          continue;
+
+        // only the instructions right before the root are folded, nothing
+        // runs between them so the values of their leaves are still there.
+        // A piece loaded in between may take the register of a leaf whose
+        // range ends at the folded use, the leaves are read at the root
+        std::vector<ir::BinOp*> tree = { &std::get<2>(body[i]) };
+        while (tree.size() < MAX_TREE && i > 0 && body[i - 1].index() == 2 && !loads[i]) {
+          ir::BinOp& binop = std::get<2>(body[i - 1]);
+          if (!selectable(binop) || !same_type(binop.dst.type, tree[0]->dst.type) || uses[binop.dst.id] != 1)
+            break;
+
+          bool leaf = false;
+          for (ir::BinOp* node : tree)
+            for (ir::Value* operand : { &node->lhs, &node->rhs })
+              leaf = leaf || (operand->index() == 1 && operand->reg().id == binop.dst.id);
+
+          if (!leaf)
+            break;
+
+          folded[binop.dst.id] = &binop;
+          tree.push_back(&binop);
+          --i;
+        }
+      }
+    }
+
+    void Gen::build_tree(Node& node, std::vector<Node>& nodes) {
+      node.size = 1;
+
+      ir::Value* operands[2] = { &node.binop->lhs, &node.binop->rhs };
+      for (size_t k = 0; k < 2; ++k) {
+        nodes.emplace_back();
+        Node& kid = nodes.back();
+        kid.type = node.type;
+        node.kids[k] = &kid;
+
+        auto it = (operands[k]->index() == 1) ? folded.find(operands[k]->reg().id) : folded.end();
+        if (it == folded.end()) {
+          kid.value = operands[k];
+          if (kid.value->index() == 0) {
+            ir::Constant constant = current_function->constant(*kid.value);
+            kid.integer = constant.value.index() == 0;
+            kid.imm = kid.integer ? std::get<0>(constant.value) : 0;
+          }
+
+          label(kid);
+          continue;
+        }
+
+        kid.binop = it->second;
+        build_tree(kid, nodes);
+        node.size += kid.size;
+      }
+
+      label(node);
+    }
+    bool Gen::applies(Node& node, size_t r) {
+      const Rule& rule = rules[r];
+      ir::Type& type = node.type;
+      bool address = is_integer(type) && (type.size == 4 || type.size == 8);
+
+      switch (rule.form) {
+        case Form::Alu:
+        case Form::Swapped:
+          return true;
+        case Form::Chain:
+          return address || (rule.goal != Index && rule.goal != Address);
+        case Form::Lea:
+          return address;
+        default:
+          break;
+      }
+
+      if (!is_integer(type))
+        return false;
+
+      int64_t v = 0;
+      switch (rule.form) {
+        case Form::Neg:
+          return node.kids[0]->constant(v) && v == 0;
+        case Form::Imul:
+          // the constant goes in the immediate
+          return !node.kids[0]->constant(v);
+        case Form::Shift:
+          return true;
+        case Form::Scale:
+          if (!address || !node.kids[1]->constant(v))
+            return false;
+          return (rule.op == Op::Shl) ? (v >= 0 && v <= 3) : (v == 1 || v == 2 || v == 4 || v == 8);
+        case Form::Triple:
+          return address && node.kids[1]->constant(v) && (v == 3 || v == 5 || v == 9);
+        case Form::Indexed:
+          return address;
+        case Form::Displace:
+          // a few of them still fit the 32-bit displacement
+          return address && node.kids[1]->constant(v) && v > -(1 << 28) && v < (1 << 28);
+        default:
+          unreachable();
+      }
+    }
+    uint Gen::rule_cost(Node& node, size_t r) {
+      const Rule& rule = rules[r];
+      if (!chain(rule) && (!node.binop || node.binop->op != rule.op))
+        return INF;
+      if (!applies(node, r))
+        return INF;
+
+      if (chain(rule))
+        return (node.cost[rule.lhs] >= INF) ? INF : node.cost[rule.lhs] + rule.cost;
+
+      uint lhs = node.kids[0]->cost[rule.lhs], rhs = node.kids[1]->cost[rule.rhs];
+      return (lhs >= INF || rhs >= INF) ? INF : lhs + rhs + rule.cost;
+    }
+    void Gen::label(Node& node) {
+      std::fill(std::begin(node.cost), std::end(node.cost), INF);
+      std::fill(std::begin(node.rule), std::end(node.rule), NONE);
+
+      auto set = [&](Goal goal, uint cost, int8_t rule) {
+        if (cost >= node.cost[goal])
+          return false;
+
+        node.cost[goal] = cost;
+        node.rule[goal] = rule;
+        return true;
+      };
+
+      if (node.value) {
+        ir::Value& value = *node.value;
+        bool in_register = value.index() == 1 && scope_vars[value.reg().id].reg;
+
+        if (value.index() == 0 && is_integer(node.type) && fits_immediate(current_function->constant(value)))
+          set(Imm, 0, LEAF);
+        else if (value.index() == 1 || is_float(node.type))
+          set(Operand, 0, LEAF); // the variable or the constant's label
+
+        set(Source, in_register ? 0 : 1, LEAF);
+        set(Reg, 1, LEAF);
+      } else {
+        for (size_t r = 0; r < RULES; ++r)
+          if (!chain(rules[r]))
+            set(rules[r].goal, rule_cost(node, r), r);
+      }
+
+      // the chain rules until nothing gets cheaper
+      for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t r = 0; r < RULES; ++r)
+          if (chain(rules[r]))
+            changed = set(rules[r].goal, rule_cost(node, r), r) || changed;
+      }
+    }
+
+    const char* Gen::take_scratch(Place& place, ir::Type& type) {
+      for (uint rid = 0; rid < 4; ++rid) {
+        if (scratch_busy & (1u << rid))
+          continue;
+
+        scratch_busy |= 1u << rid;
+        place.held |= 1u << rid;
+        return is_float(type) ? float_registers[rid] : integer_registers[rid];
+      }
+
+      unreachable();
+    }
+    void Gen::release(Place& place, const char* keep) {
+      for (uint rid = 0; rid < 4; ++rid) {
+        if (!(place.held & (1u << rid)) || (keep && (keep == integer_registers[rid] || keep == float_registers[rid])))
+          continue;
+
+        scratch_busy &= ~(1u << rid);
+        place.held &= ~(1u << rid);
+      }
+    }
+    bool Gen::reads(Node& node, const char* reg) {
+      if (node.value) {
+        if (node.value->index() != 1)
+          return false;
+
+        const char* in = scope_vars[node.value->reg().id].reg;
+        return in && strcmp(in, reg) == 0;
+      }
+
+      return reads(*node.kids[0], reg) || reads(*node.kids[1], reg);
+    }
+    std::string Gen::address_form(Place& place) {
+      std::string form = (place.disp != 0) ? std::to_string(place.disp) : "";
+
+      // (,x,2) needs a 32-bit displacement, (x,x) doesn't
+      if (!place.base && place.scale == 2) {
+        place.base = place.reg;
+        place.scale = 1;
+      }
+
+      if (!place.base)
+        return (place.scale == 1) ? form + "(%" + place.reg + ")"
+                                  : form + "(,%" + place.reg + "," + std::to_string(place.scale) + ")";
+
+      std::string scale = (place.scale == 1) ? "" : "," + std::to_string(place.scale);
+      return form + "(%" + place.base + ",%" + place.reg + scale + ")";
+    }
+
+    Gen::Place Gen::reduce(Node& node, uint goal) {
+      if (node.rule[goal] == LEAF)
+        return reduce_leaf(node, goal);
+
+      return apply(node, node.rule[goal], nullptr);
+    }
+    Gen::Place Gen::reduce_leaf(Node& node, uint goal) {
+      ir::Value& value = *node.value;
+      Place place;
+
+      switch (goal) {
+        case Imm:
+          node.constant(place.disp);
+          return place;
+        case Operand:
+        {
+          char* form = value_form(value);
+          place.text = form;
+          free(form);
+          return place;
+        }
+        case Source:
+          if (value.index() == 1 && scope_vars[value.reg().id].reg) {
+            place.reg = scope_vars[value.reg().id].reg;
+            return place;
+          }
+          [[fallthrough]];
+        case Reg:
+        {
+          place.reg = take_scratch(place, node.type);
+          PhysReg reg = { .rid = (uint)__builtin_ctz(place.held), .type = node.type };
+          load_value(value, reg);
+          return place;
+        }
+      }
+
+      unreachable();
+    }
+    Gen::Place Gen::apply(Node& node, size_t r, ir::VirtReg* target) {
+      const Rule& rule = rules[r];
+      size_t size = node.type.size;
+
+      if (rule.form == Form::Chain) {
+        Place place = reduce(node, rule.lhs);
+
+        if (rule.goal == Operand && rule.lhs == Imm)
+          place.text = "$" + std::to_string(place.disp);
+        else if (rule.goal == Operand)
+          place.text = std::string("%") + get_register_by_size(place.reg, size);
+
+        return place;
+      }
+
+      if (rule.form == Form::Lea) {
+        Place address = reduce(node, Address);
+        std::string form = address_form(address);
+
+        const char* reg = target ? scope_vars[target->id].reg : (address.held ? nullptr : take_scratch(address, node.type));
+        if (!reg)
+          reg = integer_registers[__builtin_ctz(address.held)];
+
+        utils::appendf(&output, "  lea%c    %s, %%%s\n", type_suffix(node.type), form.c_str(),
+                       get_register_by_size(reg, size));
+        release(address, target ? nullptr : reg);
+
+        address.base = nullptr;
+        address.reg = reg;
+        address.scale = 1;
+        address.disp = 0;
+        return address;
+      }
+
+      Node& lhs = *node.kids[0];
+      Node& rhs = *node.kids[1];
+      Place a, b;
+
+      // the operand computed in the target register: a leaf moved there
+      // (if it isn't there already) once the other operand is computed
+      Node* in_target = nullptr;
+      if (target) {
+        // clang-format off
+        switch (rule.form) {
+          case Form::Alu: case Form::Shift:  in_target = &lhs; break;
+          case Form::Swapped: case Form::Neg: in_target = &rhs; break;
+          default:                            break;
+        }
+        // clang-format on
+      }
+
+      if (in_target) {
+        Node& other = (in_target == &lhs) ? rhs : lhs;
+        Place& other_place = (in_target == &lhs) ? b : a;
+        Place& place = (in_target == &lhs) ? a : b;
+
+        other_place = reduce(other, (in_target == &lhs) ? rule.rhs : rule.lhs);
+        if (in_target->value->index() == 0)
+          store_constant_in_memory(current_function->constant(*in_target->value), *target);
+        else
+          copy_variable(in_target->value->reg(), *target);
+
+        place.reg = scope_vars[target->id].reg;
+      } else if (rhs.size > lhs.size) {
+        // the operand needing more registers first, the other one is kept
+        // in a register meanwhile
+        b = reduce(rhs, rule.rhs);
+        a = reduce(lhs, rule.lhs);
+      } else {
+        a = reduce(lhs, rule.lhs);
+        b = reduce(rhs, rule.rhs);
+      }
+
+      const char suffix = type_suffix(node.type);
+      Place result;
+
+      switch (rule.form) {
+        case Form::Alu:
+        case Form::Swapped:
+        {
+          Place& reg = (rule.form == Form::Alu) ? a : b;
+          Place& operand = (rule.form == Form::Alu) ? b : a;
+          const char* rn = get_register_by_size(reg.reg, size);
+
+          if (is_float(node.type)) {
+            // clang-format off
+            const char* mnemonic = (rule.op == Op::Add) ? "adds" : (rule.op == Op::Sub) ? "subs"
+                                 : (rule.op == Op::Mul) ? "muls" : "divs";
+            // clang-format on
+            utils::appendf(&output, "  %s%c   %s, %%%s\n", mnemonic, suffix, operand.text.c_str(), rn);
+          } else if (rule.op == Op::Mul) {
+            utils::appendf(&output, "  imul%c   %s, %%%s\n", suffix, operand.text.c_str(), rn);
+          } else if (operand.text[0] == '$') {
+            // adding zero emits nothing, one is "inc"/"dec"
+            int64_t v = (rule.op == Op::Sub) ? -operand.disp : operand.disp;
+
+            // clang-format off
+            if (v == 1)                    utils::appendf(&output, "  inc%c    %%%s\n", suffix, rn);
+            else if (v == -1)              utils::appendf(&output, "  dec%c    %%%s\n", suffix, rn);
+            else if (v != 0)               utils::appendf(&output, "  %s%c    %s, %%%s\n", (rule.op == Op::Add) ? "add" : "sub",
+                                                          suffix, operand.text.c_str(), rn);
+            // clang-format on
+          } else {
+            utils::appendf(&output, "  %s%c    %s, %%%s\n", (rule.op == Op::Add) ? "add" : "sub", suffix,
+                           operand.text.c_str(), rn);
+          }
+
+          release(operand, nullptr);
+          result = reg;
+          break;
+        }
+        case Form::Neg:
+          utils::appendf(&output, "  neg%c    %%%s\n", suffix, get_register_by_size(b.reg, size));
+          result = b;
+          break;
+        case Form::Imul:
+        {
+          const char* reg = target ? scope_vars[target->id].reg : (a.held ? nullptr : take_scratch(a, node.type));
+          if (!reg)
+            reg = integer_registers[__builtin_ctz(a.held)];
+
+          utils::appendf(&output, "  imul%c   $%ld, %s, %%%s\n", suffix, b.disp, a.text.c_str(),
+                         get_register_by_size(reg, size));
+          release(a, target ? nullptr : reg);
+
+          result = a;
+          result.reg = reg;
+          break;
+        }
+        case Form::Shift:
+        {
+          // clang-format off
+          const char* mnemonic = (rule.op == Op::Shl) ? "sal" : (rule.op == Op::Sar) ? "sar" : "shr";
+          // clang-format on
+          utils::appendf(&output, "  %s%c    $%ld, %%%s\n", mnemonic, suffix, b.disp, get_register_by_size(a.reg, size));
+          result = a;
+          break;
+        }
+        case Form::Scale:
+          result = a;
+          result.scale = (rule.op == Op::Shl) ? (1 << b.disp) : b.disp;
+          break;
+        case Form::Triple:
+          result = a;
+          result.base = a.reg;
+          result.scale = b.disp - 1;
+          break;
+        case Form::Indexed:
+        {
+          Place& base = (rule.lhs == Source) ? a : b;
+          Place& index = (rule.lhs == Source) ? b : a;
+
+          result = index;
+          result.base = base.reg;
+          result.held |= base.held;
+          break;
+        }
+        case Form::Displace:
+          result = a;
+          result.disp += (rule.op == Op::Add) ? b.disp : -b.disp;
+          break;
+        default:
+          unreachable();
+      }
+
+      return result;
+    }
+
+    void Gen::select_binop(ir::BinOp& binop, bool flags) {
+      std::vector<Node> nodes;
+      nodes.reserve(4 * MAX_TREE);
+
+      nodes.emplace_back();
+      Node& root = nodes.back();
+      root.binop = &binop;
+      root.type = binop.dst.type;
+      build_tree(root, nodes);
+
+      // the result goes straight into the register of `dst` when it is
+      // written last: by "lea"/"imul", or by the operation on an operand
+      // moved there first (none, if it is already there) that the other
+      // operand doesn't read. Otherwise it's computed in a scratch register
+      // and moved to `dst`. The flags of a branch on the result are those
+      // of an addition or a subtraction.
+      const char* target = scope_vars[binop.dst.id].reg;
+      size_t best = RULES;
+      uint best_cost = INF;
+      bool best_direct = false;
+
+      for (size_t r = 0; r < RULES; ++r) {
+        const Rule& rule = rules[r];
+        uint cost = (rule.goal == Reg) ? rule_cost(root, r) : INF;
+        if (cost >= INF)
+          continue;
+
+        bool alu = rule.form == Form::Alu || rule.form == Form::Swapped || rule.form == Form::Neg;
+        if (flags && !(alu && (rule.op == Op::Add || rule.op == Op::Sub)))
+          continue;
+
+        Node* moved = nullptr;
+        if (rule.form == Form::Alu || rule.form == Form::Shift)
+          moved = root.kids[0];
+        else if (rule.form == Form::Swapped || rule.form == Form::Neg)
+          moved = root.kids[1];
+
+        bool direct = target != nullptr;
+        if (direct && moved) {
+          Node& other = (moved == root.kids[0]) ? *root.kids[1] : *root.kids[0];
+          direct = moved->value && !reads(other, target);
+          if (direct)
+            cost = cost - moved->cost[Reg] + !reads(*moved, target);
+        } else if (direct) {
+          direct = rule.form == Form::Lea || rule.form == Form::Imul;
+        }
+
+        cost += !direct;
+        if (cost < best_cost) {
+          best = r;
+          best_cost = cost;
+          best_direct = direct;
+        }
+      }
+
+      if (best == RULES)
+        unreachable();
+
+      scratch_busy = 0;
+      Place result = apply(root, best, best_direct ? &binop.dst : nullptr);
+      if (best_direct)
+        return;
+
+      PhysReg reg = { .rid = (uint)__builtin_ctz(result.held), .type = binop.dst.type };
+      store_register_in_memory(reg, binop.dst);
+    }
+  } // namespace codegen
+} // namespace phantom
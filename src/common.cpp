@@ -1,4 +1,6 @@
 #include "common.hpp"
+#include "Logger.hpp"
+#include "info.hpp"
 #include <cstdio>
 #include <cstdlib>
 
@@ -33,6 +35,14 @@ namespace phantom {
     else if (reg == "xmm5") return (char*) "xmm5";
     else if (reg == "xmm6") return (char*) "xmm6";
     else if (reg == "xmm7") return (char*) "xmm7";
+    else if (reg == "xmm8") return (char*) "xmm8";
+    else if (reg == "xmm9") return (char*) "xmm9";
+    else if (reg == "xmm10") return (char*) "xmm10";
+    else if (reg == "xmm11") return (char*) "xmm11";
+    else if (reg == "xmm12") return (char*) "xmm12";
+    else if (reg == "xmm13") return (char*) "xmm13";
+    else if (reg == "xmm14") return (char*) "xmm14";
+    else if (reg == "xmm15") return (char*) "xmm15";
 
     // others
     if      (reg == "al"  || reg == "ax" || reg == "eax" || reg == "rax") base = "rax";
@@ -154,4 +164,60 @@ namespace phantom {
     printf("%s, base: %s, size: %d\n", reg.c_str(), base.c_str(), size);
     unreachable();
   }
+
+  FileInfo read_file(const std::string& file_path, Logger& logger) {
+    std::string content = "";
+    std::vector<std::string> content_lines;
+
+    FILE* file = fopen(file_path.c_str(), "rb");
+    if (!file)
+      logger.log(Logger::Level::FATAL, "Failed to open file: " + file_path, true);
+
+    if (fseek(file, 0, SEEK_END) != 0) {
+      fclose(file);
+      logger.log(Logger::Level::FATAL, "Failed to seek to end of file: " + file_path, true);
+    }
+
+    long file_size = ftell(file);
+    if (file_size == -1) {
+      fclose(file);
+      logger.log(Logger::Level::FATAL, "Failed to get file size: " + file_path, true);
+    }
+
+    if (fseek(file, 0, SEEK_SET) != 0) {
+      fclose(file);
+      logger.log(Logger::Level::FATAL, "Failed to seek to beginning of file: " + file_path, true);
+    }
+
+    // Handle empty file
+    if (file_size == 0) {
+      fclose(file);
+      return FileInfo(file_path, content, content_lines);
+    }
+
+    content.resize(file_size);
+    size_t bytes_read = fread(content.data(), 1, file_size, file);
+    fclose(file);
+
+    if (bytes_read != static_cast<size_t>(file_size))
+      logger.log(Logger::Level::FATAL, "Failed to read complete file: " + file_path, true);
+
+    content_lines.reserve((file_size / 60) + 1);
+
+    const char* start = content.c_str();
+    const char* end = start + file_size;
+    const char* line_start = start;
+
+    for (const char* p = start; p < end; ++p) {
+      if (*p == '\n') {
+        content_lines.emplace_back(line_start, p - line_start);
+        line_start = p + 1;
+      }
+    }
+
+    if (line_start < end)
+      content_lines.emplace_back(line_start, end - line_start);
+
+    return FileInfo(file_path, content, content_lines);
+  }
 } // namespace phantom
@@ -0,0 +1,178 @@
+#include "irgen/Cfg.hpp"
+#include "common.hpp"
+
+namespace phantom {
+  namespace ir {
+    std::vector<uint> successors(Terminator& term) {
+      switch (term.index()) {
+        case 0: // Return
+          return {};
+        case 1: // Branch
+          return { std::get<1>(term).target };
+        case 2: // CondBranch
+        {
+          CondBranch& br = std::get<2>(term);
+          if (br.then_block == br.else_block)
+            return { br.then_block };
+
+          return { br.then_block, br.else_block };
+        }
+        default:
+          unreachable();
+      }
+    }
+
+    bool returns_register(Function& fn, uint block, const VirtReg& reg) {
+      auto is_reg = [&](Value& value) {
+        return value.index() == 1 && value.reg().id == reg.id;
+      };
+
+      Block* exit = &fn.blocks[block];
+      if (exit->terminated && exit->terminator.index() == 1) {
+        exit = &fn.blocks[std::get<1>(exit->terminator).target];
+
+        for (Instruction& inst : exit->body)
+          if (inst.index() != 13)
+            return false;
+      }
+
+      // falling off the end returns nothing useful
+      if (!exit->terminated)
+        return fn.return_type.is_void;
+
+      if (exit->terminator.index() != 0)
+        return false;
+
+      Value& value = std::get<0>(exit->terminator).value;
+      if (fn.return_type.is_void || is_reg(value))
+        return true;
+
+      // the phi picks `reg` when coming from `block`
+      for (Instruction& inst : exit->body) {
+        if (inst.index() != 13 || value.index() != 1 || value.reg().id != std::get<13>(inst).dst.id)
+          continue;
+
+        for (auto& [pred, incoming] : std::get<13>(inst).incoming)
+          if (pred == block && is_reg(incoming))
+            return true;
+      }
+
+      return false;
+    }
+
+    void rebuild_cfg(Function& fn) {
+      for (Block& block : fn.blocks) {
+        block.preds.clear();
+        block.succs.clear();
+      }
+
+      for (uint i = 0; i < fn.blocks.size(); ++i) {
+        Block& block = fn.blocks[i];
+        if (!block.terminated)
+          continue;
+
+        block.succs = successors(block.terminator);
+        for (uint succ : block.succs)
+          fn.blocks[succ].preds.push_back(i);
+      }
+    }
+
+    std::vector<uint> reverse_post_order(Function& fn) {
+      std::vector<uint> order;
+      if (fn.blocks.empty())
+        return order;
+
+      std::vector<bool> visited(fn.blocks.size(), false);
+
+      // iterative DFS, (block, next successor to visit)
+      std::vector<std::pair<uint, size_t>> stack;
+      stack.push_back({ 0, 0 });
+      visited[0] = true;
+
+      while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        std::vector<uint>& succs = fn.blocks[block].succs;
+
+        if (next < succs.size()) {
+          uint succ = succs[next++];
+          if (!visited[succ]) {
+            visited[succ] = true;
+            stack.push_back({ succ, 0 });
+          }
+
+          continue;
+        }
+
+        order.push_back(block);
+        stack.pop_back();
+      }
+
+      return std::vector<uint>(order.rbegin(), order.rend());
+    }
+
+    bool remove_unreachable_blocks(Function& fn) {
+      rebuild_cfg(fn);
+
+      std::vector<uint> order = reverse_post_order(fn);
+      if (order.size() == fn.blocks.size())
+        return false;
+
+      std::vector<bool> reachable(fn.blocks.size(), false);
+      for (uint block : order)
+        reachable[block] = true;
+
+      // keep the original layout order of the surviving blocks
+      std::vector<uint> remap(fn.blocks.size(), 0);
+      std::vector<Block> blocks;
+
+      for (uint i = 0; i < fn.blocks.size(); ++i) {
+        if (!reachable[i])
+          continue;
+
+        remap[i] = blocks.size();
+        blocks.push_back(std::move(fn.blocks[i]));
+      }
+
+      for (Block& block : blocks) {
+        // forget the edges coming from removed blocks
+        for (Instruction& inst : block.body) {
+          if (inst.index() != 13)
+            break;
+
+          std::vector<std::pair<uint, Value>>& incoming = std::get<13>(inst).incoming;
+          std::vector<std::pair<uint, Value>> kept;
+
+          for (auto& [pred, value] : incoming) {
+            if (reachable[pred])
+              kept.push_back({ remap[pred], value });
+          }
+
+          incoming = std::move(kept);
+        }
+
+        if (!block.terminated)
+          continue;
+
+        switch (block.terminator.index()) {
+          case 1: // Branch
+          {
+            Branch& br = std::get<1>(block.terminator);
+            br.target = remap[br.target];
+            break;
+          }
+          case 2: // CondBranch
+          {
+            CondBranch& br = std::get<2>(block.terminator);
+            br.then_block = remap[br.then_block];
+            br.else_block = remap[br.else_block];
+            break;
+          }
+        }
+      }
+
+      fn.blocks = std::move(blocks);
+      rebuild_cfg(fn);
+      return true;
+    }
+  } // namespace ir
+} // namespace phantom
@@ -1,4 +1,5 @@
 #include "irgen/Gen.hpp"
+#include "irgen/Cfg.hpp"
 #include <cassert>
 
 namespace phantom {
@@ -12,6 +13,14 @@ namespace phantom {
 
       program.target = target;
 
+      // functions may be called before (or without) being defined
+      for (auto& stmt : ast) {
+        if (stmt->index() == 2)
+          declare_signature(std::get<2>(*stmt));
+        else if (stmt->index() == 3)
+          declare_signature(std::get<3>(*stmt)->decl);
+      }
+
       for (auto& stmt : ast) {
         generate_stmt(stmt);
       }
@@ -26,40 +35,157 @@ namespace phantom {
         case 1: generate_expr(std::get<1>(*stmt)->expr); break; // Expmt
         case 2: declare_function(std::get<2>(*stmt));    break; // FnDecl
         case 3: define_function(std::get<3>(*stmt));     break; // FnDef
+        case 4: generate_if(std::get<4>(*stmt));         break; // If
+        case 5: generate_while(std::get<5>(*stmt));      break; // While
+        case 6: generate_for(std::get<6>(*stmt));        break; // For
         default: unreachable();
       }
       // clang-format on
     }
+    void Gen::generate_body(std::vector<std::unique_ptr<ast::Stmt>>& body) {
+      // variables declared in a block die with it
+      auto old_scope_vars = scope_vars;
+
+      for (auto& stmt : body)
+        generate_stmt(stmt);
+
+      scope_vars = old_scope_vars;
+    }
     void Gen::generate_return(std::unique_ptr<ast::Return>& ast_rt) {
       if (!current_function) {
         printf("You messed up!\n");
         exit(1);
       }
 
-      if (current_function->terminated) {
-        printf("functions can't have more than one return\n");
-        exit(1);
-      }
-
       if (current_function->return_type.is_void && ast_rt->expr != nullptr) {
         printf("function does not return something has a return value\n");
         exit(1);
       }
 
       Return ret;
-      if (ast_rt) {
+      ret.value = current_function->intern(Constant{ .type = current_function->return_type, .value = (int64_t)0 });
+
+      if (ast_rt->expr) {
         ret.value = generate_expr(ast_rt->expr);
 
         // check return type
         Type type = extract_value_type(ret.value);
-        if (type.kind != current_function->return_type.kind) {
+        if (type.is_void || type.kind != current_function->return_type.kind) {
           printf("incorrect return type for function: %s\n", current_function->name.c_str());
           exit(1);
         }
+
+        convert(ret.value, type, current_function->return_type);
       }
 
-      current_function->terminator = ret;
-      current_function->terminated = true;
+      terminate(ret);
+
+      // anything after a return is unreachable, it still gets lowered into
+      // its own block which is dropped at the end of the function.
+      current_block = create_block();
+    }
+    void Gen::generate_if(std::unique_ptr<ast::If>& ast_if) {
+      uint then_block = create_block();
+      uint merge_block = create_block();
+      uint else_block = ast_if->otherwise.empty() ? merge_block : create_block();
+
+      generate_condition(ast_if->cond, then_block, else_block);
+
+      current_block = then_block;
+      generate_body(ast_if->then);
+      terminate(Branch{ .target = merge_block });
+
+      if (else_block != merge_block) {
+        current_block = else_block;
+        generate_body(ast_if->otherwise);
+        terminate(Branch{ .target = merge_block });
+      }
+
+      current_block = merge_block;
+    }
+    void Gen::generate_while(std::unique_ptr<ast::While>& ast_while) {
+      uint cond_block = create_block();
+      uint body_block = create_block();
+      uint exit_block = create_block();
+
+      terminate(Branch{ .target = cond_block });
+
+      current_block = cond_block;
+      generate_condition(ast_while->cond, body_block, exit_block);
+
+      current_block = body_block;
+      generate_body(ast_while->body);
+      terminate(Branch{ .target = cond_block });
+
+      current_block = exit_block;
+    }
+    void Gen::generate_for(std::unique_ptr<ast::For>& ast_for) {
+      // the loop variable belongs to the loop scope
+      auto old_scope_vars = scope_vars;
+
+      if (ast_for->init)
+        generate_expr(ast_for->init);
+
+      uint cond_block = create_block();
+      uint body_block = create_block();
+      uint step_block = create_block();
+      uint exit_block = create_block();
+
+      terminate(Branch{ .target = cond_block });
+
+      current_block = cond_block;
+      if (ast_for->cond)
+        generate_condition(ast_for->cond, body_block, exit_block);
+      else
+        terminate(Branch{ .target = body_block });
+
+      current_block = body_block;
+      generate_body(ast_for->body);
+      terminate(Branch{ .target = step_block });
+
+      current_block = step_block;
+      if (ast_for->step)
+        generate_expr(ast_for->step);
+      terminate(Branch{ .target = cond_block });
+
+      current_block = exit_block;
+      scope_vars = old_scope_vars;
+    }
+    void Gen::generate_condition(std::unique_ptr<ast::Expr>& cond, uint then_block, uint else_block) {
+      Value value = generate_expr(cond);
+
+      if (value.index() == 0) {
+        Constant constant = current_function->constant(value);
+        bool taken = (constant.value.index() == 0) ? (std::get<0>(constant.value) != 0)
+                                                   : (std::get<1>(constant.value) != 0);
+
+        terminate(Branch{ .target = taken ? then_block : else_block });
+        return;
+      }
+
+      // comparisons are branched on directly, anything else is compared
+      // against zero first.
+      std::vector<Instruction>& body = current_function->blocks[current_block].body;
+      bool compared = !body.empty() && body.back().index() == 11 &&
+                      std::get<11>(body.back()).dst.id == value.reg().id;
+
+      if (!compared) {
+        Type type = extract_value_type(value);
+
+        Constant zero;
+        zero.type = type;
+        if (type.kind == Type::Kind::Float)
+          zero.value = 0.0;
+        else
+          zero.value = (int64_t)0;
+
+        Type bool_type{ .kind = Type::Kind::Int, .size = 1, .is_void = false };
+        VirtReg dst = allocate_vritual_register(bool_type);
+        emit(Cmp{ .pred = Cmp::Pred::Ne, .lhs = value, .rhs = current_function->intern(zero), .dst = dst });
+        value = dst;
+      }
+
+      terminate(CondBranch{ .cond = value, .then_block = then_block, .else_block = else_block });
     }
     Value Gen::generate_expr(std::unique_ptr<ast::Expr>& expr) {
       switch (expr->index()) {
@@ -83,7 +209,7 @@ namespace phantom {
 
           // int64_t
           constant.value = (int64_t)lit->value;
-          return constant;
+          return current_function->intern(constant);
         }
         case 1: // FloatLit
         {
@@ -104,7 +230,7 @@ namespace phantom {
 
           // double
           constant.value = lit->value;
-          return constant;
+          return current_function->intern(constant);
         }
         case 2: // StrLit
         {
@@ -112,7 +238,8 @@ namespace phantom {
         }
         case 3: // ArrLit
         {
-          todo();
+          printf("array literals can only initialize array variables\n");
+          exit(1);
         }
         case 4: // Identifier
         {
@@ -122,29 +249,85 @@ namespace phantom {
             exit(1);
           }
 
-          return scope_vars[ide->name];
+          VirtReg& reg = scope_vars[ide->name];
+          if (arrays.find(reg.id) != arrays.end()) {
+            printf("array %s can only be used through an index\n", ide->name.c_str());
+            exit(1);
+          }
+
+          return generate_load(reg);
         }
         case 5: // BinOp
         {
           std::unique_ptr<ast::BinOp>& binop = std::get<5>(*expr);
-          Value lhs = generate_expr(binop->lhs);
-          Value rhs = generate_expr(binop->rhs);
+
+          // assigning an array element
+          if (binop->op == Token::Kind::Eq && binop->lhs->index() == 9) {
+            std::unique_ptr<ast::Index>& element = std::get<9>(*binop->lhs);
+            VirtReg array = resolve_array(element->name);
+            Value index = generate_index(array, element->index);
+
+            Value rhs = generate_expr(binop->rhs);
+            Type type = extract_value_type(rhs);
+            if (type.is_void) {
+              printf("void value can't be assigned\n");
+              exit(1);
+            }
+
+            cast_if_needed(rhs, type, array.type);
+            emit(ElemStore{ .src = rhs, .array = array, .index = index });
+            return rhs;
+          }
 
           // Handle assignment as a store
           if (binop->op == Token::Kind::Eq) {
-            assert(lhs.index() == 1 && "can't assign to a non-variable destination");
-            generate_assignment(rhs, std::get<1>(lhs));
+            assert(binop->lhs->index() == 4 && "can't assign to a non-variable destination");
+            std::unique_ptr<ast::Identifier>& ide = std::get<4>(*binop->lhs);
+
+            if (scope_vars.find(ide->name) == scope_vars.end()) {
+              printf("Use of undeclared Identifier: %s\n", ide->name.c_str());
+              exit(1);
+            }
+
+            if (arrays.find(scope_vars[ide->name].id) != arrays.end()) {
+              printf("array %s can't be assigned, only its elements\n", ide->name.c_str());
+              exit(1);
+            }
+
+            Value rhs = generate_expr(binop->rhs);
+            generate_assignment(rhs, scope_vars[ide->name]);
             return rhs;
           }
 
+          Value lhs = generate_expr(binop->lhs);
+          Value rhs = generate_expr(binop->rhs);
+
+          if (binop->op == Token::Kind::Mod && (extract_value_type(lhs).kind == Type::Kind::Float ||
+                                                extract_value_type(rhs).kind == Type::Kind::Float)) {
+            printf("the '%%' operator only works on integers\n");
+            exit(1);
+          }
+
           // basic constant-folding
           if (lhs.index() == 0 && rhs.index() == 0) {
-            Constant lv = std::get<0>(lhs);
-            Constant rv = std::get<0>(rhs);
+            Constant lv = current_function->constant(lhs);
+            Constant rv = current_function->constant(rhs);
 
             Constant result;
             result.type.size = std::max(lv.type.size, rv.type.size);
 
+            if (is_comparison(binop->op)) {
+              bool value;
+              if (lv.type.kind == Type::Kind::Float || rv.type.kind == Type::Kind::Float)
+                value = calculate_comparison(binop->op, extract_double_constant(lv.value), extract_double_constant(rv.value));
+              else
+                value = calculate_comparison(binop->op, extract_integer_constant(lv.value), extract_integer_constant(rv.value));
+
+              result.type = Type{ .kind = Type::Kind::Int, .size = 1, .is_void = false };
+              result.value = (int64_t)value;
+              return current_function->intern(result);
+            }
+
             if (lv.type.kind == Type::Kind::Float || rv.type.kind == Type::Kind::Float) {
               double lvalue = extract_double_constant(lv.value);
               double rvalue = extract_double_constant(rv.value);
@@ -159,17 +342,25 @@ namespace phantom {
               result.value = calculate_integer_constant(binop->op, lvalue, rvalue);
             }
 
-            return result;
+            return current_function->intern(result);
           }
 
           // clang-format off
-          BinOp::Op op;
+          BinOp::Op op = BinOp::Op::Add;
+          Cmp::Pred pred = Cmp::Pred::Eq;
           switch (binop->op) {
-            case Token::Kind::Plus:  op = BinOp::Op::Add; break;
-            case Token::Kind::Minus: op = BinOp::Op::Sub; break;
-            case Token::Kind::Mul:   op = BinOp::Op::Mul; break;
-            case Token::Kind::Div:   op = BinOp::Op::Div; break;
-            default:                 unreachable();
+            case Token::Kind::Plus:      op = BinOp::Op::Add; break;
+            case Token::Kind::Minus:     op = BinOp::Op::Sub; break;
+            case Token::Kind::Mul:       op = BinOp::Op::Mul; break;
+            case Token::Kind::Div:       op = BinOp::Op::Div; break;
+            case Token::Kind::Mod:       op = BinOp::Op::Rem; break;
+            case Token::Kind::EqEq:      pred = Cmp::Pred::Eq; break;
+            case Token::Kind::NotEq:     pred = Cmp::Pred::Ne; break;
+            case Token::Kind::Less:      pred = Cmp::Pred::Lt; break;
+            case Token::Kind::LessEq:    pred = Cmp::Pred::Le; break;
+            case Token::Kind::Greater:   pred = Cmp::Pred::Gt; break;
+            case Token::Kind::GreaterEq: pred = Cmp::Pred::Ge; break;
+            default:                     unreachable();
           }
           // clang-format on
 
@@ -184,19 +375,21 @@ namespace phantom {
           else
             type.kind = Type::Kind::Int;
 
-          cast_if_needed(lhs, lty, type);
-          cast_if_needed(rhs, rty, type);
+          convert(lhs, lty, type);
+          convert(rhs, rty, type);
+
+          if (is_comparison(binop->op)) {
+            Type bool_type{ .kind = Type::Kind::Int, .size = 1, .is_void = false };
+            VirtReg dst = allocate_vritual_register(bool_type);
 
-          // free registers
-          if (lhs.index() == 2)
-            free_register(std::get<2>(lhs));
-          if (rhs.index() == 2)
-            free_register(std::get<2>(rhs));
+            emit(Cmp{ .pred = pred, .lhs = lhs, .rhs = rhs, .dst = dst });
+            return dst;
+          }
 
-          // Binary operations store the result in physical register treated temporaries
-          PhysReg dst = allocate_physical_register(type);
+          // every result gets a fresh virtual register
+          VirtReg dst = allocate_vritual_register(type);
 
-          current_function->body.push_back(BinOp{
+          emit(BinOp{
               .op = op,
               .lhs = lhs,
               .rhs = rhs,
@@ -220,10 +413,10 @@ namespace phantom {
           }
           // clang-format on
 
-          Type type = (operand.index() == 0) ? std::get<0>(operand).type : std::get<1>(operand).type;
-          PhysReg dst = allocate_physical_register(type);
+          Type type = extract_value_type(operand);
+          VirtReg dst = allocate_vritual_register(type);
 
-          current_function->body.push_back(UnOp{ .op = op, .operand = operand, .dst = dst });
+          emit(UnOp{ .op = op, .operand = operand, .dst = dst });
           return dst;
         }
         case 7: // VarDecl
@@ -235,6 +428,29 @@ namespace phantom {
             exit(1);
           }
 
+          // arrays live in a single alloca of `length` elements
+          if (decl->type && decl->type->length != 0) {
+            Type type = resolve_type(*decl->type);
+            VirtReg reg = allocate_vritual_register(type);
+
+            Alloca alloca{ .type = type, .reg = reg, .count = decl->type->length };
+            std::vector<Instruction>& entry = current_function->blocks[0].body;
+            entry.insert(entry.begin() + allocas++, alloca);
+
+            scope_vars[decl->name] = reg;
+            arrays[reg.id] = decl->type->length;
+
+            if (decl->init)
+              generate_array_init(reg, decl->init);
+
+            return {};
+          }
+
+          if (decl->init && decl->init->index() == 3) {
+            printf("array literal assigned to %s, which isn't declared as an array\n", decl->name.c_str());
+            exit(1);
+          }
+
           Type type;
           Value value = {};
           bool initialized = false;
@@ -253,8 +469,11 @@ namespace phantom {
           VirtReg reg = allocate_vritual_register(type);
           scope_vars[decl->name] = reg;
 
+          // every alloca lives at the top of the entry block, no matter
+          // which block declared the variable.
           Alloca alloca{ .type = type, .reg = reg };
-          current_function->body.push_back(alloca);
+          std::vector<Instruction>& entry = current_function->blocks[0].body;
+          entry.insert(entry.begin() + allocas++, alloca);
 
           if (initialized) {
             generate_assignment(value, reg);
@@ -265,13 +484,85 @@ namespace phantom {
         }
         case 8: // FnCall
         {
-          todo();
+          std::unique_ptr<ast::FnCall>& ast_call = std::get<8>(*expr);
+          if (funcs_table.find(ast_call->name) == funcs_table.end()) {
+            printf("Call to undeclared function: %s\n", ast_call->name.c_str());
+            exit(1);
+          }
+
+          Function& callee = funcs_table[ast_call->name];
+          if (ast_call->args.size() != callee.params.size()) {
+            printf("function %s expects %zu arguments, got %zu\n", callee.name.c_str(),
+                   callee.params.size(), ast_call->args.size());
+            exit(1);
+          }
+
+          Call call{ .callee = symbol(callee.name), .args = {}, .dst = allocate_vritual_register(callee.return_type) };
+          for (size_t i = 0; i < ast_call->args.size(); ++i) {
+            Value arg = generate_expr(ast_call->args[i]);
+            Type type = extract_value_type(arg);
+            Type& target = callee.params[i].type;
+
+            if (type.is_void) {
+              printf("void value passed as argument %zu of %s\n", i + 1, callee.name.c_str());
+              exit(1);
+            }
+
+            convert(arg, type, target);
+            call.args.push_back(arg);
+          }
+
+          emit(call);
+          return call.dst;
+        }
+        case 9: // Index
+        {
+          std::unique_ptr<ast::Index>& element = std::get<9>(*expr);
+          VirtReg array = resolve_array(element->name);
+          Value index = generate_index(array, element->index);
+
+          VirtReg dst = allocate_vritual_register(array.type);
+          emit(ElemLoad{ .array = array, .index = index, .dst = dst });
+          return dst;
         }
       }
 
       unreachable();
     }
 
+    void Gen::declare_signature(std::unique_ptr<ast::FnDecl>& ast_decl) {
+      Function fn;
+      fn.name = ast_decl->name;
+
+      if (ast_decl->type)
+        fn.return_type = resolve_type(*ast_decl->type);
+      else
+        fn.return_type.is_void = true;
+
+      if (ast_decl->type && ast_decl->type->length != 0) {
+        printf("function %s can't return an array\n", fn.name.c_str());
+        exit(1);
+      }
+
+      for (auto& param : ast_decl->params) {
+        assert(param->type != nullptr);
+        if (param->type->length != 0) {
+          printf("parameter %s of %s can't be an array\n", param->name.c_str(), fn.name.c_str());
+          exit(1);
+        }
+
+        Type type = resolve_type(*param->type);
+        fn.params.push_back(VirtReg{ .id = (uint)fn.params.size(), .type = type });
+      }
+
+      auto it = funcs_table.find(fn.name);
+      if (it != funcs_table.end() && it->second.params.size() != fn.params.size()) {
+        printf("conflicting declarations of function: %s\n", fn.name.c_str());
+        exit(1);
+      }
+
+      funcs_table[fn.name] = fn;
+    }
     void Gen::define_function(std::unique_ptr<ast::FnDef>& ast_fn) {
       Function fn;
       fn.name = ast_fn->decl->name;
@@ -286,6 +577,12 @@ namespace phantom {
       auto old_scope_vars = scope_vars;
       nrid = 0;
 
+      current_function = &fn;
+      current_block = create_block();
+      allocas = 0;
+      arrays.clear();
+      bounds_trap = NO_BLOCK;
+
       for (auto& param : ast_fn->decl->params) {
         if (scope_vars.find(param->name) != scope_vars.end()) {
           printf("Duplicated variable with the same name\n");
@@ -297,14 +594,25 @@ namespace phantom {
         VirtReg reg = allocate_vritual_register(type);
         fn.params.push_back(reg);
 
-        scope_vars[param->name] = reg;
+        // parameters are assignable like any other variable, give them a
+        // stack slot of their own.
+        VirtReg slot = allocate_vritual_register(type);
+        std::vector<Instruction>& entry = fn.blocks[0].body;
+        entry.insert(entry.begin() + allocas++, Alloca{ .type = type, .reg = slot });
+        generate_store(slot, reg);
+
+        scope_vars[param->name] = slot;
       }
 
-      current_function = &fn;
       for (auto& stmt : ast_fn->body) {
         generate_stmt(stmt);
       }
 
+      remove_unreachable_blocks(fn);
+      rebuild_cfg(fn);
+      fn.nregs = nrid;
+
+      current_function = nullptr;
       scope_vars = old_scope_vars;
       program.funcs.push_back(fn);
     }
@@ -336,23 +644,31 @@ namespace phantom {
         scope_vars[param->name] = reg;
       }
 
+      fn.nregs = nrid;
       scope_vars = old_scope_vars;
       program.funcs.push_back(fn);
     }
 
     void Gen::generate_assignment(Value& value, VirtReg& dst) {
       Type vt = extract_value_type(value);
+      if (vt.is_void) {
+        printf("void value can't be assigned\n");
+        exit(1);
+      }
+
       cast_if_needed(value, vt, dst.type);
       generate_store(dst, value);
     }
-    void Gen::generate_store(std::variant<VirtReg, PhysReg> dst, Value src) {
+    void Gen::generate_store(VirtReg dst, Value src) {
       Store store{ .src = src, .dst = dst };
-      current_function->body.push_back(store);
-
-      if (src.index() == 2)
-        free_register(std::get<2>(src));
+      emit(store);
+    }
+    VirtReg Gen::generate_load(VirtReg src) {
+      VirtReg dst = allocate_vritual_register(src.type);
+      emit(Load{ .src = src, .dst = dst });
+      return dst;
     }
-    void Gen::generate_cast(Value& src, PhysReg dst, Type& src_type, Type& dst_type) {
+    void Gen::generate_cast(Value& src, VirtReg dst, Type& src_type, Type& dst_type) {
       Instruction cast;
 
       switch (src_type.kind) {
@@ -374,8 +690,6 @@ namespace phantom {
         case Type::Kind::Float:
           switch (dst_type.kind) {
             case Type::Kind::Int:
-              dst.type.size = 4;
-
               if (src_type.size == 4)
                 cast = Float2Int{ .value = src, .dst = dst };
               else if (src_type.size == 8)
@@ -394,7 +708,23 @@ namespace phantom {
           break;
       }
 
-      current_function->body.push_back(cast);
+      emit(cast);
+    }
+
+    void Gen::emit(Instruction inst) {
+      current_function->blocks[current_block].body.push_back(inst);
+    }
+    uint Gen::create_block() {
+      current_function->blocks.emplace_back();
+      return current_function->blocks.size() - 1;
+    }
+    void Gen::terminate(Terminator term) {
+      Block& block = current_function->blocks[current_block];
+      if (block.terminated)
+        return;
+
+      block.terminator = term;
+      block.terminated = true;
     }
 
     VirtReg Gen::allocate_vritual_register(Type& type) {
@@ -405,45 +735,124 @@ namespace phantom {
 
       return reg;
     }
-    PhysReg Gen::allocate_physical_register(Type& type) {
-      int rid = -1;
-
-      // integers
-      // searching for free registers to use
-      if (type.kind == Type::Kind::Int) {
-        for (size_t i = 0; i < integer_registers.size(); ++i) {
-          if (!integer_registers[i]) {
-            integer_registers[i] = true;
-            rid = i;
-            break;
-          }
-        }
+    VirtReg Gen::resolve_array(const std::string& name) {
+      auto it = scope_vars.find(name);
+      if (it == scope_vars.end()) {
+        printf("Use of undeclared Identifier: %s\n", name.c_str());
+        exit(1);
       }
 
-      else if (type.kind == Type::Kind::Float) {
-        for (size_t i = 0; i < float_registers.size(); ++i) {
-          if (!float_registers[i]) {
-            float_registers[i] = true;
-            rid = i;
-            break;
-          }
-        }
+      if (arrays.find(it->second.id) == arrays.end()) {
+        printf("%s isn't an array, it can't be indexed\n", name.c_str());
+        exit(1);
       }
 
-      if (rid == -1) {
-        printf("not enough temporary register\n");
+      return it->second;
+    }
+    Value Gen::generate_index(VirtReg array, std::unique_ptr<ast::Expr>& index) {
+      Value value = generate_expr(index);
+      Type type = extract_value_type(value);
+
+      if (type.is_void || type.kind != Type::Kind::Int) {
+        printf("array index must be an integer\n");
         exit(1);
       }
 
-      return { .rid = (uint)rid, .type = type };
+      if (value.index() == 0) {
+        int64_t element = std::get<0>(current_function->constant(value).value);
+        uint length = arrays[array.id];
+
+        if (element < 0 || element >= (int64_t)length) {
+          printf("array index %ld is out of bounds (length %u)\n", element, length);
+          exit(1);
+        }
+      } else if (bounds_check)
+        generate_bounds_check(value, arrays[array.id]);
+
+      return value;
     }
-    void Gen::free_register(PhysReg reg) {
-      if (reg.type.kind == Type::Kind::Int)
-        integer_registers[reg.rid] = false;
-      else
-        float_registers[reg.rid] = false;
+    void Gen::generate_bounds_check(Value index, uint length) {
+      // one block per function calls the runtime, it doesn't return
+      if (bounds_trap == NO_BLOCK) {
+        const std::string fail = "__phantom_bounds_fail";
+        Type void_type{ .kind = Type::Kind::Int, .size = 0, .is_void = true };
+
+        if (funcs_table.find(fail) == funcs_table.end()) {
+          Function decl{ .name = fail, .return_type = void_type, .params = {}, .blocks = {}, .nregs = 0 };
+          funcs_table[fail] = decl;
+          program.funcs.push_back(decl);
+        }
+
+        uint from = current_block;
+        bounds_trap = current_block = create_block();
+        emit(Call{ .callee = symbol(fail), .args = {}, .dst = allocate_vritual_register(void_type) });
+
+        Constant zero{ .type = current_function->return_type, .value = (int64_t)0 };
+        if (current_function->return_type.kind == Type::Kind::Float)
+          zero.value = 0.0;
+
+        Return ret{ .value = current_function->intern(zero) };
+        terminate(ret);
+        current_block = from;
+      }
+
+      Type type = extract_value_type(index);
+      Type bool_type{ .kind = Type::Kind::Int, .size = 1, .is_void = false };
+
+      Value zero = current_function->intern(Constant{ .type = type, .value = (int64_t)0 });
+      VirtReg above = allocate_vritual_register(bool_type);
+      emit(Cmp{ .pred = Cmp::Pred::Ge, .lhs = index, .rhs = zero, .dst = above });
+      uint next = create_block();
+      terminate(CondBranch{ .cond = above, .then_block = next, .else_block = bounds_trap });
+      current_block = next;
+
+      // narrow indices may not reach the length
+      if (type.size < 8 && (int64_t)length > ((int64_t)1 << (type.size * 8 - 1)) - 1)
+        return;
+
+      Value end = current_function->intern(Constant{ .type = type, .value = (int64_t)length });
+      VirtReg below = allocate_vritual_register(bool_type);
+      emit(Cmp{ .pred = Cmp::Pred::Lt, .lhs = index, .rhs = end, .dst = below });
+      next = create_block();
+      terminate(CondBranch{ .cond = below, .then_block = next, .else_block = bounds_trap });
+      current_block = next;
     }
+    void Gen::generate_array_init(VirtReg array, std::unique_ptr<ast::Expr>& init) {
+      if (init->index() != 3) {
+        printf("arrays can only be initialized by an array literal\n");
+        exit(1);
+      }
 
+      std::vector<std::unique_ptr<ast::Expr>>& elements = std::get<3>(*init)->elements;
+      uint length = arrays[array.id];
+
+      if (elements.size() > length) {
+        printf("%zu elements given to an array of length %u\n", elements.size(), length);
+        exit(1);
+      }
+
+      // elements left out are zero, like C does
+      for (uint i = 0; i < length; ++i) {
+        Constant index{ .type = Type{ .kind = Type::Kind::Int, .size = 8, .is_void = false }, .value = (int64_t)i };
+        Value value;
+
+        if (i < elements.size()) {
+          value = generate_expr(elements[i]);
+          Type type = extract_value_type(value);
+          if (type.is_void) {
+            printf("void value can't be assigned\n");
+            exit(1);
+          }
+
+          cast_if_needed(value, type, array.type);
+        } else if (array.type.kind == Type::Kind::Float)
+          value = current_function->intern(Constant{ .type = array.type, .value = 0.0 });
+        else
+          value = current_function->intern(Constant{ .type = array.type, .value = (int64_t)0 });
+
+        emit(ElemStore{ .src = value, .array = array, .index = current_function->intern(index) });
+      }
+    }
     double Gen::extract_double_constant(std::variant<int64_t, double>& v) {
       if (v.index() == 0)
         return (double)std::get<0>(v);
@@ -459,11 +868,9 @@ namespace phantom {
     Type Gen::extract_value_type(Value& value) {
       switch (value.index()) {
         case 0: // constant
-          return std::get<0>(value).type;
+          return value.type;
         case 1: // VirtReg
-          return std::get<1>(value).type;
-        case 2: // PhysReg
-          return std::get<2>(value).type;
+          return value.reg().type;
         default:
           unreachable();
       }
@@ -489,22 +896,85 @@ namespace phantom {
         case Token::Kind::Minus: return lv - rv;
         case Token::Kind::Mul:   return lv * rv;
         case Token::Kind::Div:   return lv / rv;
+        case Token::Kind::Mod:   return lv % rv;
         default:                 unreachable();
       }
       // clang-format on
     }
 
+    bool Gen::calculate_comparison(Token::Kind op, double lv, double rv) {
+      // clang-format off
+      switch (op) {
+        case Token::Kind::EqEq:      return lv == rv;
+        case Token::Kind::NotEq:     return lv != rv;
+        case Token::Kind::Less:      return lv < rv;
+        case Token::Kind::LessEq:    return lv <= rv;
+        case Token::Kind::Greater:   return lv > rv;
+        case Token::Kind::GreaterEq: return lv >= rv;
+        default:                     unreachable();
+      }
+      // clang-format on
+    }
+    bool Gen::calculate_comparison(Token::Kind op, int64_t lv, int64_t rv) {
+      // clang-format off
+      switch (op) {
+        case Token::Kind::EqEq:      return lv == rv;
+        case Token::Kind::NotEq:     return lv != rv;
+        case Token::Kind::Less:      return lv < rv;
+        case Token::Kind::LessEq:    return lv <= rv;
+        case Token::Kind::Greater:   return lv > rv;
+        case Token::Kind::GreaterEq: return lv >= rv;
+        default:                     unreachable();
+      }
+      // clang-format on
+    }
+    bool Gen::is_comparison(Token::Kind op) {
+      switch (op) {
+        case Token::Kind::EqEq:
+        case Token::Kind::NotEq:
+        case Token::Kind::Less:
+        case Token::Kind::LessEq:
+        case Token::Kind::Greater:
+        case Token::Kind::GreaterEq:
+          return true;
+        default:
+          return false;
+      }
+    }
+
     void Gen::cast_if_needed(Value& v, Type& type, Type& target) {
       if (!need_cast(type, target, v.index() == 0))
         return;
 
-      if (v.index() == 2)
-        free_register(std::get<2>(v));
-
-      PhysReg reg = allocate_physical_register(target);
+      VirtReg reg = allocate_vritual_register(target);
       generate_cast(v, reg, type, target);
       v = reg;
     }
+    void Gen::convert(Value& v, Type& type, Type& target) {
+      cast_if_needed(v, type, target);
+      if (type.kind != Type::Kind::Int || target.kind != Type::Kind::Int)
+        return;
+
+      // integer constants aren't casted, they just take the new width
+      if (v.index() == 0) {
+        Constant constant = current_function->constant(v);
+        if (target.size < 8) {
+          int shift = 64 - target.size * 8;
+          constant.value = (int64_t)((uint64_t)std::get<0>(constant.value) << shift) >> shift;
+        }
+
+        constant.type = target;
+        v = current_function->intern(constant);
+        return;
+      }
+
+      if (type.size <= target.size)
+        return;
+
+      VirtReg reg = allocate_vritual_register(target);
+      emit(IntExtend{ .value = v, .dst = reg });
+      v = reg;
+    }
     bool Gen::need_cast(Type& type, Type& target, bool constant) {
       if (type.kind == target.kind && type.size == target.size)
         return false;
@@ -516,13 +986,13 @@ namespace phantom {
     }
     Type Gen::resolve_type(phantom::Type& type) {
       if (type.kind == phantom::Type::Kind::FP) {
-        uint size = type.bitwidth / 8;
+        uint8_t size = type.bitwidth / 8;
         assert(size == 4 || size == 8 && "Floating points bitwidth must be either 4 or 8");
         return Type{ .kind = Type::Kind::Float, .size = size, .is_void = false };
       }
 
       else if (type.kind == phantom::Type::Kind::Int) {
-        uint size = (type.bitwidth == 1) ? 1 : (type.bitwidth / 8);
+        uint8_t size = (type.bitwidth == 1) ? 1 : (type.bitwidth / 8);
         assert(size == 1 || size == 2 || size == 4 || size == 8 && "Integers bitwidth must be either 4 or 8");
         return Type{ .kind = Type::Kind::Int, .size = size, .is_void = false };
       }
@@ -0,0 +1,891 @@
+#include "irgen/Text.hpp"
+#include "common.hpp"
+#include "info.hpp"
+#include "irgen/Cfg.hpp"
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace phantom {
+  namespace ir {
+    namespace {
+      // clang-format off
+      const char* binop_names[] = { "add", "sub", "mul", "div", "rem", "shl", "sar", "shr", "mulhi" };
+      const char* unop_names[]  = { "neg", "not" };
+      const char* pred_names[]  = { "eq", "ne", "lt", "le", "gt", "ge" };
+      // the conversions, by instruction index (4 to 10)
+      const char* cast_names[]  = { "int2float", "int2double", "float2int", "float2double",
+                                    "double2int", "double2float", "iext" };
+      // clang-format on
+
+      struct Printer {
+        std::string out;
+        const Function* fn = nullptr; // the one being printed, for its constants
+
+        void reg(const VirtReg& reg) {
+          out += "%" + std::to_string(reg.id);
+        }
+        void def(const VirtReg& dst) {
+          out += "  ";
+          reg(dst);
+          out += ": " + print_type(dst.type) + " = ";
+        }
+        void value(const Value& value) {
+          if (value.index() == 1)
+            return reg(value.reg());
+
+          Constant constant = fn->constant(value);
+          out += print_type(constant.type) + " ";
+
+          if (constant.value.index() == 0) {
+            out += std::to_string(std::get<0>(constant.value));
+            return;
+          }
+
+          // enough digits to read the same double back, always with a
+          // '.' (or an exponent) so it doesn't read back as an integer
+          char buffer[64];
+          snprintf(buffer, sizeof(buffer), "%.17g", std::get<1>(constant.value));
+          out += buffer;
+
+          if (strpbrk(buffer, ".eni") == nullptr)
+            out += ".0";
+        }
+
+        void instruction(const Instruction& inst) {
+          switch (inst.index()) {
+            case 0: // Alloca
+            {
+              const Alloca& alloca = std::get<0>(inst);
+              out += "  ";
+              reg(alloca.reg);
+              out += " = alloca ";
+
+              if (alloca.count != 0)
+                out += "[" + std::to_string(alloca.count) + " x " + print_type(alloca.type) + "]";
+              else
+                out += print_type(alloca.type);
+
+              break;
+            }
+            case 1: // Store
+              out += "  store ";
+              value(std::get<1>(inst).src);
+              out += ", ";
+              reg(std::get<1>(inst).dst);
+              break;
+            case 2: // BinOp
+            {
+              const BinOp& binop = std::get<2>(inst);
+              def(binop.dst);
+              out += std::string(binop_names[(int)binop.op]) + " ";
+              value(binop.lhs);
+              out += ", ";
+              value(binop.rhs);
+              break;
+            }
+            case 3: // UnOp
+              def(std::get<3>(inst).dst);
+              out += std::string(unop_names[(int)std::get<3>(inst).op]) + " ";
+              value(std::get<3>(inst).operand);
+              break;
+            case 11: // Cmp
+            {
+              const Cmp& cmp = std::get<11>(inst);
+              def(cmp.dst);
+              out += "cmp " + std::string(pred_names[(int)cmp.pred]) + " ";
+              value(cmp.lhs);
+              out += ", ";
+              value(cmp.rhs);
+              break;
+            }
+            case 12: // Load
+              def(std::get<12>(inst).dst);
+              out += "load ";
+              reg(std::get<12>(inst).src);
+              break;
+            case 13: // Phi
+            {
+              const Phi& phi = std::get<13>(inst);
+              def(phi.dst);
+              out += "phi";
+
+              const char* separator = " ";
+              for (auto& [pred, incoming] : phi.incoming) {
+                out += separator + std::string("[bb") + std::to_string(pred) + ": ";
+                value(incoming);
+                out += "]";
+                separator = ", ";
+              }
+              break;
+            }
+            case 14: // Call
+            {
+              const Call& call = std::get<14>(inst);
+              if (call.dst.type.is_void)
+                out += "  ";
+              else
+                def(call.dst);
+
+              out += "call @" + *call.callee + "(";
+              for (size_t i = 0; i < call.args.size(); ++i) {
+                if (i != 0)
+                  out += ", ";
+                value(call.args[i]);
+              }
+              out += ")";
+              break;
+            }
+            case 15: // ElemLoad
+              def(std::get<15>(inst).dst);
+              out += "load ";
+              reg(std::get<15>(inst).array);
+              out += "[";
+              value(std::get<15>(inst).index);
+              out += "]";
+              break;
+            case 16: // ElemStore
+              out += "  store ";
+              value(std::get<16>(inst).src);
+              out += ", ";
+              reg(std::get<16>(inst).array);
+              out += "[";
+              value(std::get<16>(inst).index);
+              out += "]";
+              break;
+            case 17: // Splat
+              def(std::get<17>(inst).dst);
+              out += "splat ";
+              value(std::get<17>(inst).value);
+              break;
+            case 18: // ReduceAdd
+              def(std::get<18>(inst).dst);
+              out += "reduce.add ";
+              value(std::get<18>(inst).value);
+              break;
+            case 19: // Fma
+              def(std::get<19>(inst).dst);
+              out += "fma ";
+              value(std::get<19>(inst).a());
+              out += ", ";
+              value(std::get<19>(inst).b());
+              out += ", ";
+              value(std::get<19>(inst).c());
+              break;
+            case 20: // Count
+              out += "  count " + std::to_string(std::get<20>(inst).counter);
+              break;
+            default: // the conversions
+            {
+              const Value* operand = nullptr;
+              const VirtReg* dst = nullptr;
+              std::visit([&](auto& i) {
+                using T = std::decay_t<decltype(i)>;
+                if constexpr (std::is_same_v<T, Int2Float> || std::is_same_v<T, Int2Double> ||
+                              std::is_same_v<T, Float2Int> || std::is_same_v<T, Float2Double> ||
+                              std::is_same_v<T, Double2Int> || std::is_same_v<T, Double2Float> ||
+                              std::is_same_v<T, IntExtend>) {
+                  operand = &i.value;
+                  dst = &i.dst;
+                }
+              }, inst);
+
+              def(*dst);
+              out += std::string(cast_names[inst.index() - 4]) + " ";
+              value(*operand);
+              break;
+            }
+          }
+
+          out += "\n";
+        }
+
+        void terminator(const Terminator& term) {
+          switch (term.index()) {
+            case 0: // Return
+            {
+              const Value& ret = std::get<0>(term).value;
+              if (type_of(ret).is_void) {
+                out += "  ret void\n";
+                break;
+              }
+
+              out += "  ret ";
+              value(ret);
+              out += "\n";
+              break;
+            }
+            case 1: // Branch
+              out += "  br bb" + std::to_string(std::get<1>(term).target) + "\n";
+              break;
+            case 2: // CondBranch
+            {
+              const CondBranch& br = std::get<2>(term);
+              out += "  br ";
+              value(br.cond);
+              out += ", bb" + std::to_string(br.then_block) + ", bb" + std::to_string(br.else_block) + "\n";
+              break;
+            }
+          }
+        }
+
+        void function(const Function& fn) {
+          this->fn = &fn;
+          out += fn.defined ? "define " : "declare ";
+          out += (fn.internal ? "internal @" : "@") + fn.name + "(";
+
+          for (size_t i = 0; i < fn.params.size(); ++i) {
+            if (i != 0)
+              out += ", ";
+
+            reg(fn.params[i]);
+            out += ": " + print_type(fn.params[i].type);
+          }
+
+          out += ") -> " + print_type(fn.return_type);
+          if (!fn.defined) {
+            out += "\n";
+            return;
+          }
+
+          out += " {\n";
+          for (size_t b = 0; b < fn.blocks.size(); ++b) {
+            out += "bb" + std::to_string(b) + ":";
+            if (fn.blocks[b].count != NO_COUNT)
+              out += " ; executed " + std::to_string(fn.blocks[b].count) + " times";
+            out += "\n";
+
+            for (const Instruction& inst : fn.blocks[b].body)
+              instruction(inst);
+
+            if (fn.blocks[b].terminated)
+              terminator(fn.blocks[b].terminator);
+          }
+          out += "}\n";
+        }
+      };
+
+      struct Token {
+        enum class Kind {
+          Word,     // keywords, types and block labels
+          Register, // %id
+          Global,   // @name
+          Number,
+          Punct,    // one character, or "->"
+          String,   // "text", without the quotes
+          End
+        } kind;
+        std::string text;
+        size_t line, column;
+      };
+
+      std::vector<Token> tokenize(const std::string& text) {
+        std::vector<Token> tokens;
+        size_t line = 1, column = 1;
+
+        auto word_char = [](char c) { return isalnum((unsigned char)c) || c == '_' || c == '.'; };
+
+        for (size_t i = 0; i < text.size();) {
+          char c = text[i];
+          Token token{ .kind = Token::Kind::Punct, .text = "", .line = line, .column = column };
+          size_t start = i;
+
+          if (c == '\n') {
+            line++;
+            column = 1;
+            i++;
+            continue;
+          }
+          if (isspace((unsigned char)c)) {
+            column++;
+            i++;
+            continue;
+          }
+          if (c == ';') {
+            while (i < text.size() && text[i] != '\n')
+              i++;
+            continue;
+          }
+
+          if (c == '"') {
+            size_t end = text.find('"', i + 1);
+            if (end == std::string::npos)
+              end = text.size();
+
+            token.kind = Token::Kind::String;
+            token.text = text.substr(i + 1, end - i - 1);
+            column += end + 1 - i;
+            i = end + 1;
+            tokens.push_back(std::move(token));
+            continue;
+          }
+
+          if (c == '%' || c == '@') {
+            token.kind = (c == '%') ? Token::Kind::Register : Token::Kind::Global;
+            i++;
+            while (i < text.size() && word_char(text[i]))
+              i++;
+          } else if (isdigit((unsigned char)c) || (c == '-' && i + 1 < text.size() && text[i + 1] != '>')) {
+            token.kind = Token::Kind::Number;
+            i++;
+            while (i < text.size() && (word_char(text[i]) || ((text[i] == '-' || text[i] == '+') && tolower(text[i - 1]) == 'e')))
+              i++;
+          } else if (word_char(c)) {
+            token.kind = Token::Kind::Word;
+            while (i < text.size() && word_char(text[i]))
+              i++;
+          } else if (c == '-' && i + 1 < text.size() && text[i + 1] == '>')
+            i += 2;
+          else
+            i++;
+
+          token.text = text.substr(start, i - start);
+          column += i - start;
+          tokens.push_back(std::move(token));
+        }
+
+        tokens.push_back(Token{ .kind = Token::Kind::End, .text = "end of file", .line = line, .column = column });
+        return tokens;
+      }
+
+      class Parser {
+    public:
+        Parser(const std::string& text, Logger& logger)
+            : tokens(tokenize(text)), logger(logger) {}
+
+        Program parse() {
+          Program program;
+          program.target = Target{ .arch = "x86_64", .kernel = "linux" };
+
+          while (peek().kind != Token::Kind::End) {
+            if (accept("profile"))
+              profile(program.profile);
+            else
+              program.funcs.push_back(function());
+          }
+
+          std::unordered_set<std::string> names;
+          for (Function& fn : program.funcs)
+            names.insert(fn.name);
+
+          for (size_t callee : callees)
+            if (names.find(tokens[callee].text.substr(1)) == names.end())
+              error("call to an undeclared function", tokens[callee]);
+
+          return program;
+        }
+
+    private:
+        std::vector<Token> tokens;
+        size_t pos = 0;
+        Logger& logger;
+
+        // the function being parsed: the type of every register it defines
+        // and the pool its constants go to
+        std::unordered_map<uint, Type> types;
+        Function* current = nullptr;
+        uint max_id = 0;
+        // the tokens of the blocks the function refers to, and of the
+        // functions the program calls, checked once they're all known
+        std::vector<size_t> targets;
+        std::vector<size_t> callees;
+
+        Token& peek() { return tokens[pos]; }
+        Token& advance() {
+          Token& token = tokens[pos];
+          if (token.kind != Token::Kind::End)
+            pos++;
+
+          return token;
+        }
+
+        [[noreturn]] void error(const std::string& message, const Token& token) {
+          logger.log(Logger::FATAL, message + ", got '" + token.text + "'", Location(token.line, token.column), true);
+          exit(1);
+        }
+        [[noreturn]] void error(const std::string& message) {
+          logger.log(Logger::FATAL, message, true);
+          exit(1);
+        }
+
+        bool check(const char* text) {
+          return (peek().kind == Token::Kind::Punct || peek().kind == Token::Kind::Word) && peek().text == text;
+        }
+        bool accept(const char* text) {
+          if (!check(text))
+            return false;
+
+          advance();
+          return true;
+        }
+        void expect(const char* text) {
+          if (!accept(text))
+            error(std::string("expected '") + text + "'", peek());
+        }
+
+        uint64_t number(const Token& token) {
+          if (token.kind != Token::Kind::Number || token.text.find_first_not_of("0123456789") != std::string::npos)
+            error("expected a number", token);
+
+          return std::stoull(token.text);
+        }
+
+        uint register_id(const Token& token) {
+          if (token.kind != Token::Kind::Register || token.text.size() < 2 ||
+              token.text.find_first_not_of("0123456789", 1) != std::string::npos)
+            error("expected a register", token);
+
+          uint id = std::stoul(token.text.substr(1));
+          max_id = std::max(max_id, id + 1);
+          return id;
+        }
+
+        uint block_label(const Token& token) {
+          if (token.kind != Token::Kind::Word || token.text.rfind("bb", 0) != 0 || token.text.size() < 3 ||
+              token.text.find_first_not_of("0123456789", 2) != std::string::npos)
+            error("expected a block label", token);
+
+          return std::stoul(token.text.substr(2));
+        }
+        uint target() {
+          targets.push_back(pos);
+          return block_label(advance());
+        }
+
+        void define(uint id, const Type& type, const Token& token) {
+          if (!types.emplace(id, type).second)
+            error("register %" + std::to_string(id) + " is defined twice", token);
+        }
+
+        Type type() {
+          if (accept("<")) {
+            uint64_t lanes = number(advance());
+            expect("x");
+            Type element = type();
+            expect(">");
+
+            if (lanes < 2 || lanes > 255 || element.lanes != 1 || element.is_void)
+              error("invalid vector type", tokens[pos - 1]);
+
+            element.lanes = lanes;
+            return element;
+          }
+
+          Token& token = advance();
+          if (token.kind == Token::Kind::Word) {
+            // clang-format off
+            if (token.text == "void") return Type{ .kind = Type::Kind::Int, .size = 0, .is_void = true };
+            if (token.text == "i8")   return Type{ .kind = Type::Kind::Int, .size = 1 };
+            if (token.text == "i16")  return Type{ .kind = Type::Kind::Int, .size = 2 };
+            if (token.text == "i32")  return Type{ .kind = Type::Kind::Int, .size = 4 };
+            if (token.text == "i64")  return Type{ .kind = Type::Kind::Int, .size = 8 };
+            if (token.text == "f32")  return Type{ .kind = Type::Kind::Float, .size = 4 };
+            if (token.text == "f64")  return Type{ .kind = Type::Kind::Float, .size = 8 };
+            // clang-format on
+          }
+
+          error("expected a type", token);
+        }
+
+        // `%id` (typed once the function is parsed) or a typed constant
+        Value value() {
+          if (peek().kind == Token::Kind::Register)
+            return VirtReg{ .id = register_id(advance()), .type = {} };
+
+          Type constant_type = type();
+          Token& token = advance();
+
+          bool is_number = token.kind == Token::Kind::Number;
+          bool is_special = token.kind == Token::Kind::Word && (token.text == "inf" || token.text == "nan");
+          if (!is_number && !is_special)
+            error("expected a constant", token);
+
+          Constant constant{ .type = constant_type, .value = (int64_t)0 };
+          bool is_float = token.text.find_first_of(".eEni") != std::string::npos;
+
+          try {
+            if (is_float)
+              constant.value = std::stod(token.text);
+            else
+              constant.value = (int64_t)std::stoll(token.text);
+          } catch (std::exception&) {
+            // `stod` refuses denormals with ERANGE, `strtod` reads them fine
+            if (!is_float)
+              error("invalid constant", token);
+
+            constant.value = strtod(token.text.c_str(), nullptr);
+          }
+
+          return current->intern(constant);
+        }
+
+        // `%id: type =`, the register being defined
+        VirtReg definition(uint id, const Token& token) {
+          expect(":");
+          VirtReg dst{ .id = id, .type = type() };
+          expect("=");
+
+          define(id, dst.type, token);
+          return dst;
+        }
+
+        Instruction instruction() {
+          // instructions without a result
+          if (accept("store")) {
+            Value src = value();
+            expect(",");
+            VirtReg dst{ .id = register_id(advance()), .type = {} };
+
+            if (!accept("["))
+              return Store{ .src = src, .dst = dst };
+
+            Value index = value();
+            expect("]");
+            return ElemStore{ .src = src, .array = dst, .index = index };
+          }
+          if (accept("count"))
+            return Count{ .counter = (uint)number(advance()) };
+          if (check("call"))
+            return call(VirtReg{ .id = 0, .type = Type{ .kind = Type::Kind::Int, .size = 0, .is_void = true } });
+
+          Token& reg = advance();
+          uint id = register_id(reg);
+
+          if (accept("=")) {
+            expect("alloca");
+            Alloca alloca{ .type = {}, .reg = { .id = id, .type = {} }, .count = 0 };
+
+            if (accept("[")) {
+              alloca.count = number(advance());
+              expect("x");
+              alloca.type = type();
+              expect("]");
+
+              if (alloca.count == 0)
+                error("arrays have at least one element", tokens[pos - 2]);
+            } else
+              alloca.type = type();
+
+            alloca.reg.type = alloca.type;
+            define(id, alloca.type, reg);
+            return alloca;
+          }
+
+          VirtReg dst = definition(id, reg);
+          Token& opcode = advance();
+          if (opcode.kind != Token::Kind::Word)
+            error("expected an instruction", opcode);
+
+          const std::string& name = opcode.text;
+
+          for (size_t op = 0; op < std::size(binop_names); ++op) {
+            if (name != binop_names[op])
+              continue;
+
+            Value lhs = value();
+            expect(",");
+            return BinOp{ .op = (BinOp::Op)op, .lhs = lhs, .rhs = value(), .dst = dst };
+          }
+          for (size_t op = 0; op < std::size(unop_names); ++op)
+            if (name == unop_names[op])
+              return UnOp{ .op = (UnOp::Op)op, .operand = value(), .dst = dst };
+
+          // clang-format off
+          if (name == "int2float")    return Int2Float{ .value = value(), .dst = dst };
+          if (name == "int2double")   return Int2Double{ .value = value(), .dst = dst };
+          if (name == "float2int")    return Float2Int{ .value = value(), .dst = dst };
+          if (name == "float2double") return Float2Double{ .value = value(), .dst = dst };
+          if (name == "double2int")   return Double2Int{ .value = value(), .dst = dst };
+          if (name == "double2float") return Double2Float{ .value = value(), .dst = dst };
+          if (name == "iext")         return IntExtend{ .value = value(), .dst = dst };
+          if (name == "splat")        return Splat{ .value = value(), .dst = dst };
+          if (name == "reduce.add")   return ReduceAdd{ .value = value(), .dst = dst };
+          // clang-format on
+
+          if (name == "fma") {
+            Value a = value();
+            expect(",");
+            Value b = value();
+            expect(",");
+            return Fma{ .operands = { a, b, value() }, .dst = dst };
+          }
+
+          if (name == "cmp") {
+            Token& pred = advance();
+            for (size_t p = 0; p < std::size(pred_names); ++p) {
+              if (pred.text != pred_names[p])
+                continue;
+
+              Value lhs = value();
+              expect(",");
+              return Cmp{ .pred = (Cmp::Pred)p, .lhs = lhs, .rhs = value(), .dst = dst };
+            }
+
+            error("expected a comparison predicate", pred);
+          }
+
+          if (name == "load") {
+            VirtReg src{ .id = register_id(advance()), .type = {} };
+            if (!accept("["))
+              return Load{ .src = src, .dst = dst };
+
+            Value index = value();
+            expect("]");
+            return ElemLoad{ .array = src, .index = index, .dst = dst };
+          }
+
+          if (name == "phi") {
+            Phi phi{ .incoming = {}, .dst = dst };
+
+            do {
+              expect("[");
+              uint pred = target();
+              expect(":");
+              phi.incoming.push_back({ pred, value() });
+              expect("]");
+            } while (accept(","));
+
+            return phi;
+          }
+
+          if (name == "call") {
+            pos--;
+            return call(dst);
+          }
+
+          error("unknown instruction", opcode);
+        }
+
+        Instruction call(VirtReg dst) {
+          expect("call");
+
+          Token& callee = advance();
+          if (callee.kind != Token::Kind::Global || callee.text.size() < 2)
+            error("expected a function name", callee);
+
+          callees.push_back(pos - 1);
+          Call call{ .callee = symbol(callee.text.substr(1)), .args = {}, .dst = dst };
+          expect("(");
+
+          if (!accept(")")) {
+            do
+              call.args.push_back(value());
+            while (accept(","));
+
+            expect(")");
+          }
+
+          return call;
+        }
+
+        Terminator terminator() {
+          if (accept("ret")) {
+            if (accept("void")) {
+              Constant none{ .type = Type{ .kind = Type::Kind::Int, .size = 0, .is_void = true }, .value = (int64_t)0 };
+              return Return{ .value = current->intern(none) };
+            }
+
+            return Return{ .value = value() };
+          }
+
+          expect("br");
+          if (peek().kind == Token::Kind::Word)
+            return Branch{ .target = target() };
+
+          Value cond = value();
+          expect(",");
+          uint then_block = target();
+          expect(",");
+          uint else_block = target();
+
+          return CondBranch{ .cond = cond, .then_block = then_block, .else_block = else_block };
+        }
+
+        bool at_block_label() {
+          return peek().kind == Token::Kind::Word && peek().text.rfind("bb", 0) == 0 &&
+                 tokens[pos + 1].kind == Token::Kind::Punct && tokens[pos + 1].text == ":";
+        }
+
+        // `profile "path"` or `profile @function checksum first counters`
+        void profile(Profile& profile) {
+          if (peek().kind == Token::Kind::String) {
+            profile.path = advance().text;
+            return;
+          }
+
+          Token& name = advance();
+          if (name.kind != Token::Kind::Global || name.text.size() < 2)
+            error("expected a function name", name);
+
+          ProfiledFunction fn{ .name = name.text.substr(1), .checksum = 0, .first = 0, .counters = 0 };
+          fn.checksum = number(advance());
+          fn.first = number(advance());
+          fn.counters = number(advance());
+
+          profile.functions.push_back(fn);
+          profile.counters = std::max(profile.counters, fn.first + fn.counters);
+        }
+
+        Function function() {
+          Function fn;
+          current = &fn;
+          types.clear();
+          targets.clear();
+          max_id = 0;
+
+          Token& keyword = advance();
+          if (keyword.kind != Token::Kind::Word || (keyword.text != "define" && keyword.text != "declare"))
+            error("expected 'define' or 'declare'", keyword);
+
+          fn.defined = keyword.text == "define";
+          fn.internal = accept("internal");
+
+          Token& name = advance();
+          if (name.kind != Token::Kind::Global || name.text.size() < 2)
+            error("expected a function name", name);
+
+          fn.name = name.text.substr(1);
+
+          expect("(");
+          if (!accept(")")) {
+            do {
+              Token& reg = advance();
+              uint id = register_id(reg);
+              expect(":");
+              fn.params.push_back(VirtReg{ .id = id, .type = type() });
+              define(id, fn.params.back().type, reg);
+            } while (accept(","));
+
+            expect(")");
+          }
+
+          expect("->");
+          fn.return_type = type();
+
+          if (!fn.defined) {
+            fn.nregs = max_id;
+            return fn;
+          }
+
+          expect("{");
+          while (!accept("}")) {
+            Token& label = peek();
+            if (block_label(label) != fn.blocks.size())
+              error("blocks are numbered in order, expected bb" + std::to_string(fn.blocks.size()), label);
+
+            advance();
+            expect(":");
+
+            Block block;
+            while (!at_block_label() && !check("}")) {
+              if (check("ret") || check("br")) {
+                block.terminator = terminator();
+                block.terminated = true;
+                break;
+              }
+
+              block.body.push_back(instruction());
+            }
+
+            fn.blocks.push_back(std::move(block));
+          }
+
+          if (fn.blocks.empty())
+            error("@" + fn.name + " is defined without an entry block");
+
+          for (size_t label : targets)
+            if (block_label(tokens[label]) >= fn.blocks.size())
+              error("@" + fn.name + " has no such block", tokens[label]);
+
+          resolve(fn);
+          return fn;
+        }
+
+        // uses only name their registers, they get the type of the definition
+        void resolve(Function& fn) {
+          auto resolve_register = [&](VirtReg& reg) {
+            auto it = types.find(reg.id);
+            if (it == types.end())
+              error("use of the undefined register %" + std::to_string(reg.id) + " in @" + fn.name);
+
+            reg.type = it->second;
+          };
+          auto resolve_value = [&](Value* value) {
+            if (value->index() != 1)
+              return;
+
+            VirtReg reg = value->reg();
+            resolve_register(reg);
+            value->type = reg.type;
+          };
+
+          for (Block& block : fn.blocks) {
+            for (Instruction& inst : block.body) {
+              for (Value* value : operands(inst))
+                resolve_value(value);
+
+              // clang-format off
+              switch (inst.index()) {
+                case 1:  resolve_register(std::get<1>(inst).dst);    break;
+                case 12: resolve_register(std::get<12>(inst).src);   break;
+                case 15: resolve_register(std::get<15>(inst).array); break;
+                case 16: resolve_register(std::get<16>(inst).array); break;
+              }
+              // clang-format on
+            }
+
+            if (block.terminated)
+              for (Value* value : operands(block.terminator))
+                resolve_value(value);
+          }
+
+          // calls to void functions define a register nothing refers to
+          fn.nregs = max_id;
+          for (Block& block : fn.blocks)
+            for (Instruction& inst : block.body)
+              if (inst.index() == 14 && std::get<14>(inst).dst.type.is_void)
+                std::get<14>(inst).dst.id = fn.nregs++;
+
+          rebuild_cfg(fn);
+        }
+      };
+    } // namespace
+
+    std::string print_type(const Type& type) {
+      if (type.is_void)
+        return "void";
+
+      std::string name = ((type.kind == Type::Kind::Int) ? "i" : "f") + std::to_string(type.size * 8);
+      if (type.lanes > 1)
+        return "<" + std::to_string(type.lanes) + " x " + name + ">";
+
+      return name;
+    }
+
+    void print_program(Program& program, FILE* stream) {
+      Printer printer;
+
+      if (!program.profile.functions.empty()) {
+        printer.out += "profile \"" + program.profile.path + "\"\n";
+        for (const ProfiledFunction& fn : program.profile.functions)
+          printer.out += "profile @" + fn.name + " " + std::to_string(fn.checksum) + " " + std::to_string(fn.first) +
+                         " " + std::to_string(fn.counters) + "\n";
+        printer.out += "\n";
+      }
+
+      for (size_t f = 0; f < program.funcs.size(); ++f) {
+        if (f != 0)
+          printer.out += "\n";
+
+        printer.function(program.funcs[f]);
+      }
+
+      fwrite(printer.out.data(), 1, printer.out.size(), stream);
+    }
+
+    Program parse_program(const std::string& text, Logger& logger) {
+      return Parser(text, logger).parse();
+    }
+  } // namespace ir
+} // namespace phantom
@@ -0,0 +1,119 @@
+#include "opt/CallGraph.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace phantom {
+  namespace opt {
+    CallGraph::CallGraph(ir::Program& program)
+        : program(program), callee_lists(program.funcs.size()), sites(program.funcs.size()) {
+      for (uint f = 0; f < program.funcs.size(); ++f) {
+        ir::Function& fn = program.funcs[f];
+        auto it = functions.find(fn.name);
+
+        if (it == functions.end() || (fn.defined && !program.funcs[it->second].defined))
+          functions[fn.name] = f;
+      }
+
+      for (uint f = 0; f < program.funcs.size(); ++f) {
+        std::vector<ir::Block>& blocks = program.funcs[f].blocks;
+
+        for (uint b = 0; b < blocks.size(); ++b) {
+          for (size_t i = 0; i < blocks[b].body.size(); ++i) {
+            if (blocks[b].body[i].index() != 14)
+              continue;
+
+            uint callee = lookup(*std::get<14>(blocks[b].body[i]).callee);
+            if (callee == NONE)
+              continue;
+
+            sites[callee].push_back(Site{ .caller = f, .block = b, .index = i });
+
+            std::vector<uint>& callees = callee_lists[f];
+            if (std::find(callees.begin(), callees.end(), callee) == callees.end())
+              callees.push_back(callee);
+          }
+        }
+      }
+    }
+
+    uint CallGraph::lookup(const std::string& name) const {
+      auto it = functions.find(name);
+      return (it == functions.end()) ? NONE : it->second;
+    }
+
+    ir::Call& CallGraph::call(const Site& site) const {
+      return std::get<14>(program.funcs[site.caller].blocks[site.block].body[site.index]);
+    }
+
+    std::vector<uint> CallGraph::bottom_up() const {
+      std::vector<uint> order;
+      std::vector<bool> visited(program.funcs.size(), false);
+
+      std::function<void(uint)> visit = [&](uint f) {
+        visited[f] = true;
+
+        for (uint callee : callee_lists[f])
+          if (!visited[callee])
+            visit(callee);
+
+        if (program.funcs[f].defined)
+          order.push_back(f);
+      };
+
+      for (uint f = 0; f < program.funcs.size(); ++f)
+        if (program.funcs[f].defined && !visited[f])
+          visit(f);
+
+      return order;
+    }
+
+    std::vector<bool> CallGraph::reachable(const std::vector<uint>& roots) const {
+      std::vector<bool> reached(program.funcs.size(), false);
+      std::vector<uint> worklist;
+
+      for (uint root : roots) {
+        if (!reached[root]) {
+          reached[root] = true;
+          worklist.push_back(root);
+        }
+      }
+
+      while (!worklist.empty()) {
+        uint f = worklist.back();
+        worklist.pop_back();
+
+        for (uint callee : callee_lists[f]) {
+          if (!reached[callee]) {
+            reached[callee] = true;
+            worklist.push_back(callee);
+          }
+        }
+      }
+
+      return reached;
+    }
+
+    std::vector<uint> CallGraph::entry_points(const Options& opts) const {
+      std::vector<uint> entries;
+
+      uint main = lookup("main");
+      if (main != NONE && program.funcs[main].defined)
+        entries.push_back(main);
+
+      for (const std::string& name : opts.exported) {
+        uint f = lookup(name);
+        if (f != NONE && std::find(entries.begin(), entries.end(), f) == entries.end())
+          entries.push_back(f);
+      }
+
+      if (!entries.empty() || !opts.exported.empty())
+        return entries;
+
+      for (uint f = 0; f < program.funcs.size(); ++f)
+        if (program.funcs[f].defined && lookup(program.funcs[f].name) == f)
+          entries.push_back(f);
+
+      return entries;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,368 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <cmath>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // integer expression trees narrowed at once, at most this deep
+      constexpr uint MAX_NARROW_DEPTH = 4;
+
+      // any of the conversions (instructions 4 to 10)
+      struct Conversion {
+        ir::Value value;
+        ir::VirtReg dst;
+      };
+
+      bool as_conversion(ir::Instruction& inst, Conversion& result) {
+        if (inst.index() < 4 || inst.index() > 10)
+          return false;
+
+        std::visit([&](auto& i) {
+          using T = std::decay_t<decltype(i)>;
+          if constexpr (std::is_same_v<T, ir::Int2Float> || std::is_same_v<T, ir::Int2Double> ||
+                        std::is_same_v<T, ir::Float2Int> || std::is_same_v<T, ir::Float2Double> ||
+                        std::is_same_v<T, ir::Double2Int> || std::is_same_v<T, ir::Double2Float> ||
+                        std::is_same_v<T, ir::IntExtend>)
+            result = Conversion{ .value = i.value, .dst = i.dst };
+        }, inst);
+
+        return true;
+      }
+
+      // the instruction converting `value` into `dst`, as `ir::Gen` picks it
+      ir::Instruction make_conversion(ir::Value value, ir::VirtReg dst) {
+        ir::Type from = ir::type_of(value);
+        bool from_int = from.kind == ir::Type::Kind::Int;
+        bool to_int = dst.type.kind == ir::Type::Kind::Int;
+
+        // clang-format off
+        if (from_int && to_int)        return ir::IntExtend{ .value = value, .dst = dst };
+        if (from_int)                  return (dst.type.size == 4) ? ir::Instruction(ir::Int2Float{ .value = value, .dst = dst })
+                                                                   : ir::Instruction(ir::Int2Double{ .value = value, .dst = dst });
+        if (to_int)                    return (from.size == 4) ? ir::Instruction(ir::Float2Int{ .value = value, .dst = dst })
+                                                               : ir::Instruction(ir::Double2Int{ .value = value, .dst = dst });
+        // clang-format on
+
+        return (dst.type.size == 8) ? ir::Instruction(ir::Float2Double{ .value = value, .dst = dst })
+                                    : ir::Instruction(ir::Double2Float{ .value = value, .dst = dst });
+      }
+
+      bool is_int(const ir::Type& type) { return type.kind == ir::Type::Kind::Int; }
+      bool same_type(const ir::Type& a, const ir::Type& b) {
+        return a.kind == b.kind && a.size == b.size && a.lanes == b.lanes;
+      }
+
+      // every integer of `size` bytes has an exact floating point form of
+      // `fp_size` bytes (24 and 53 bits of mantissa)
+      bool exact_in_float(uint size, uint fp_size) {
+        return (fp_size == 8) ? size <= 4 : size <= 2;
+      }
+
+      // converting S -> M -> D gives the same value as S -> D, for every
+      // value of S
+      bool lossless_through(const ir::Type& s, const ir::Type& m, const ir::Type& d) {
+        if (is_int(s) && is_int(m))
+          return is_int(d) ? m.size >= std::min(s.size, d.size) : m.size >= s.size;
+
+        // the integers are exact in M, converting to D rounds only once,
+        // back to integers they must fit
+        if (is_int(s))
+          return exact_in_float(s.size, m.size) && (!is_int(d) || d.size >= s.size);
+
+        // f32 -> f64 is exact, the other way rounds
+        if (!is_int(m))
+          return s.size == 4 && m.size == 8;
+
+        return false;
+      }
+
+      // converting from S to M keeps the order and equality of any two
+      // values, comparisons may as well use the values before
+      bool order_preserving(const ir::Type& s, const ir::Type& m) {
+        if (is_int(s) && is_int(m))
+          return m.size >= s.size;
+        if (is_int(s))
+          return exact_in_float(s.size, m.size);
+
+        return !is_int(m) && s.size <= m.size;
+      }
+
+      // `constant` (of type M) as a value of type S, when it has one that
+      // converts back to it exactly
+      bool narrow_constant(const ir::Constant& constant, const ir::Type& s, ir::Constant& result) {
+        double value = (constant.value.index() == 0) ? (double)std::get<0>(constant.value)
+                                                     : std::get<1>(constant.value);
+
+        if (is_int(s)) {
+          if (constant.value.index() == 0) {
+            int64_t integer = std::get<0>(constant.value);
+            if (wrap(integer, s.size) != integer)
+              return false;
+
+            result = make_constant(s, integer);
+            return true;
+          }
+
+          double limit = std::ldexp(1.0, s.size * 8 - 1);
+          if (!(value >= -limit && value < limit) || std::trunc(value) != value)
+            return false;
+
+          result = make_constant(s, (int64_t)value);
+          return true;
+        }
+
+        ir::Type type = s;
+        if (!std::isnan(value) && round_to(value, type) != value)
+          return false;
+
+        result = make_constant(s, value);
+        return true;
+      }
+
+      // Rewrites conversion chains into the conversion they amount to, see
+      // `casts()`.
+      struct CastFolder {
+        ir::Function& fn;
+        Context& ctx;
+
+        CastFolder(ir::Function& fn, Context& ctx)
+            : fn(fn), ctx(ctx) {}
+
+        Replacements replacements;
+        std::unordered_map<uint, Conversion> conversions; // seen so far
+        std::unordered_map<uint, ir::BinOp> binops;
+
+        std::vector<ir::Instruction>* out = nullptr;
+        size_t folded = 0, chains = 0, compares = 0, narrowed = 0;
+
+        const Conversion* converted(const ir::Value& value) {
+          if (value.index() != 1)
+            return nullptr;
+
+          auto it = conversions.find(value.reg().id);
+          return (it == conversions.end()) ? nullptr : &it->second;
+        }
+
+        // returns false when the conversion was replaced by a value
+        bool simplify(ir::Instruction& inst, Conversion& conv) {
+          if (conv.value.index() == 0) {
+            ir::Constant result;
+            if (!fold(inst, { fn.constant(conv.value) }, result))
+              return true;
+
+            replacements.add(conv.dst, fn.intern(result));
+            folded++;
+            return false;
+          }
+
+          // S -> M -> D
+          if (const Conversion* inner = converted(conv.value)) {
+            ir::Type s = ir::type_of(inner->value);
+            ir::Type m = inner->dst.type;
+
+            if (lossless_through(s, m, conv.dst.type)) {
+              chains++;
+
+              if (same_type(s, conv.dst.type)) {
+                replacements.add(conv.dst, inner->value);
+                return false;
+              }
+
+              conv.value = inner->value;
+              inst = make_conversion(conv.value, conv.dst);
+              return true;
+            }
+          }
+
+          narrow(inst, conv);
+          return true;
+        }
+
+        // op(M a, M b) -> D, with both operands converted from D, computes
+        // in D directly when that gives the same result: the low bits of
+        // integer +, -, * only depend on the low bits of the operands (so
+        // whole expression trees narrow), f64 has enough precision for one
+        // f32 +, -, *, / to round the same as in f32
+        bool narrowable(const ir::Value& value, const ir::Type& d, uint depth) {
+          if (value.index() == 0) {
+            ir::Constant narrowed;
+            return is_int(d) || narrow_constant(fn.constant(value), d, narrowed);
+          }
+
+          if (const Conversion* inner = converted(value))
+            return same_type(ir::type_of(inner->value), d);
+
+          auto it = binops.find(value.reg().id);
+          if (it == binops.end() || depth > (is_int(d) ? MAX_NARROW_DEPTH : 0))
+            return false;
+
+          ir::BinOp& binop = it->second;
+          switch (binop.op) {
+            case ir::BinOp::Op::Add:
+            case ir::BinOp::Op::Sub:
+              break;
+            case ir::BinOp::Op::Mul:
+              if (d.size != 1) // no 8-bit `imul`
+                break;
+              return false;
+            case ir::BinOp::Op::Div:
+              if (!is_int(d))
+                break;
+              return false;
+            default:
+              return false;
+          }
+
+          return narrowable(binop.lhs, d, depth + 1) && narrowable(binop.rhs, d, depth + 1);
+        }
+        ir::Value narrow_operand(const ir::Value& value, const ir::Type& d) {
+          if (value.index() == 0) {
+            ir::Constant constant = fn.constant(value);
+            if (is_int(d))
+              return fn.intern(make_constant(d, std::get<0>(constant.value)));
+
+            ir::Constant result;
+            narrow_constant(constant, d, result);
+            return fn.intern(result);
+          }
+
+          if (const Conversion* inner = converted(value))
+            return inner->value;
+
+          ir::BinOp binop = binops[value.reg().id];
+          ir::VirtReg reg{ .id = fn.nregs++, .type = d };
+          out->push_back(narrowed_binop(binop, reg));
+          return reg;
+        }
+        ir::BinOp narrowed_binop(ir::BinOp binop, ir::VirtReg dst) {
+          ir::BinOp result{ .op = binop.op,
+                            .lhs = narrow_operand(binop.lhs, dst.type),
+                            .rhs = narrow_operand(binop.rhs, dst.type),
+                            .dst = dst };
+          binops[dst.id] = result;
+          return result;
+        }
+
+        void narrow(ir::Instruction& inst, Conversion& conv) {
+          if (conv.value.index() != 1)
+            return;
+
+          auto it = binops.find(conv.value.reg().id);
+          if (it == binops.end())
+            return;
+
+          ir::Type d = conv.dst.type;
+          ir::Type m = it->second.dst.type;
+
+          bool integer = is_int(d) && is_int(m) && d.size < m.size;
+          bool floating = !is_int(d) && !is_int(m) && d.size == 4 && m.size == 8;
+          if ((!integer && !floating) || !narrowable(conv.value, d, 0))
+            return;
+
+          inst = narrowed_binop(it->second, conv.dst);
+          narrowed++;
+        }
+
+        // comparisons of two converted values (or of one and a constant)
+        // compare the values before the conversion
+        void compare(ir::Cmp& cmp) {
+          const Conversion* lhs = converted(cmp.lhs);
+          const Conversion* rhs = converted(cmp.rhs);
+          const Conversion* some = lhs ? lhs : rhs;
+          if (some == nullptr)
+            return;
+
+          ir::Type s = ir::type_of(some->value);
+          ir::Type m = some->dst.type;
+          if (s.lanes != 1 || !order_preserving(s, m))
+            return;
+
+          ir::Value values[2] = { cmp.lhs, cmp.rhs };
+          const Conversion* sides[2] = { lhs, rhs };
+
+          for (int i = 0; i < 2; ++i) {
+            if (sides[i] != nullptr) {
+              if (!same_type(ir::type_of(sides[i]->value), s) || !same_type(sides[i]->dst.type, m))
+                return;
+
+              values[i] = sides[i]->value;
+              continue;
+            }
+
+            ir::Constant narrowed;
+            if (values[i].index() != 0 || !narrow_constant(fn.constant(values[i]), s, narrowed))
+              return;
+
+            values[i] = fn.intern(narrowed);
+          }
+
+          cmp.lhs = values[0];
+          cmp.rhs = values[1];
+          compares++;
+        }
+
+        bool run() {
+          for (uint b : ir::reverse_post_order(fn)) {
+            ir::Block& block = fn.blocks[b];
+            std::vector<ir::Instruction> body;
+            out = &body;
+
+            for (ir::Instruction& inst : block.body) {
+              for (ir::Value* value : ir::operands(inst))
+                replacements.resolve(*value);
+
+              Conversion conv;
+              if (as_conversion(inst, conv) && conv.dst.type.lanes == 1) {
+                if (!simplify(inst, conv))
+                  continue;
+
+                if (as_conversion(inst, conv))
+                  conversions[conv.dst.id] = conv;
+              } else if (inst.index() == 11)
+                compare(std::get<11>(inst));
+              else if (inst.index() == 2)
+                binops[std::get<2>(inst).dst.id] = std::get<2>(inst);
+
+              body.push_back(std::move(inst));
+            }
+
+            block.body = std::move(body);
+
+            if (block.terminated)
+              for (ir::Value* value : ir::operands(block.terminator))
+                replacements.resolve(*value);
+          }
+
+          replacements.apply(fn);
+
+          ctx.stats.add("casts", "conversions of constants folded", folded);
+          ctx.stats.add("casts", "conversion chains collapsed", chains);
+          ctx.stats.add("casts", "comparisons without conversions", compares);
+          ctx.stats.add("casts", "operations narrowed", narrowed);
+          return folded + chains + compares + narrowed != 0;
+        }
+      };
+    } // namespace
+
+    // Conversion chains as `ir::Gen` emits them at mixed-type assignments
+    // and operations:
+    //   - conversions of constants are folded;
+    //   - S -> M -> D becomes S -> D (or just the value when S is D) when M
+    //     holds every value of S: f32 -> f64 -> f32, i32 -> i64 -> f64
+    //     (`cvtsi2sd` takes the i32 directly), i16 -> f32 -> i32...;
+    //   - comparisons of values converted the same exact way compare the
+    //     values before the conversion;
+    //   - arithmetic computed in a wider type only to be converted back
+    //     (`let r: f32 = a * b` with one f64 operand converted from f32,
+    //     `let s: i8 = x * y + 1` with i32 operands extended from i8) is
+    //     computed in the narrow type when the result is the same.
+    // The conversions left unused are for dce.
+    bool casts(ir::Function& fn, Context& ctx) {
+      return CastFolder(fn, ctx).run();
+    }
+  } // namespace opt
+} // namespace phantom
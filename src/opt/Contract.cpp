@@ -0,0 +1,115 @@
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      bool is_float_op(const ir::Instruction& inst, ir::BinOp::Op op) {
+        if (inst.index() != 2)
+          return false;
+
+        const ir::BinOp& binop = std::get<2>(inst);
+        return binop.op == op && binop.dst.type.kind == ir::Type::Kind::Float;
+      }
+
+      std::unordered_map<uint, size_t> count_uses(ir::Function& fn) {
+        std::unordered_map<uint, size_t> uses;
+        auto count = [&](ir::Operands values) {
+          for (ir::Value* value : values)
+            if (value->index() == 1)
+              uses[value->reg().id]++;
+        };
+
+        for (ir::Block& block : fn.blocks) {
+          for (ir::Instruction& inst : block.body)
+            count(ir::operands(inst));
+
+          if (block.terminated)
+            count(ir::operands(block.terminator));
+        }
+
+        return uses;
+      }
+    } // namespace
+
+    // FMA contraction (`-ffp-contract=fast` with `-mfma`): a * b + c, with
+    // the product used only there and computed in the same block, becomes
+    // one multiply-add. So does a * b - c for a constant c. The product isn't
+    // rounded anymore, so the result may differ in the last bit.
+    bool contract(ir::Function& fn, Context& ctx) {
+      if (!ctx.opts.fp_contract || !ctx.opts.fma)
+        return false;
+
+      std::unordered_map<uint, size_t> uses = count_uses(fn);
+      size_t contracted = 0;
+
+      for (ir::Block& block : fn.blocks) {
+        std::unordered_map<uint, size_t> products; // register -> its multiplication
+        std::vector<bool> fused(block.body.size(), false);
+
+        for (size_t i = 0; i < block.body.size(); ++i) {
+          ir::Instruction& inst = block.body[i];
+
+          if (is_float_op(inst, ir::BinOp::Op::Mul)) {
+            products[std::get<2>(inst).dst.id] = i;
+            continue;
+          }
+
+          bool add = is_float_op(inst, ir::BinOp::Op::Add);
+          if (!add && !is_float_op(inst, ir::BinOp::Op::Sub))
+            continue;
+
+          ir::BinOp binop = std::get<2>(inst);
+          auto product = [&](ir::Value& value) -> long {
+            if (value.index() != 1 || uses[value.reg().id] != 1)
+              return -1;
+
+            auto it = products.find(value.reg().id);
+            return (it == products.end() || fused[it->second]) ? -1 : (long)it->second;
+          };
+
+          long mul = product(binop.lhs);
+          ir::Value addend = binop.rhs;
+
+          if (add && mul < 0) {
+            mul = product(binop.rhs);
+            addend = binop.lhs;
+          } else if (!add) {
+            // a * b - c => fma(a, b, -c)
+            if (addend.index() != 0) {
+              mul = -1;
+            } else {
+              double c = std::get<1>(fn.constant(addend).value);
+              addend = fn.intern(make_constant(binop.dst.type, -c));
+            }
+          }
+
+          if (mul < 0)
+            continue;
+
+          ir::BinOp& multiply = std::get<2>(block.body[mul]);
+          if (multiply.dst.type.lanes != binop.dst.type.lanes)
+            continue;
+
+          inst = ir::Fma{ .operands = { multiply.lhs, multiply.rhs, addend }, .dst = binop.dst };
+          fused[mul] = true;
+          contracted++;
+        }
+
+        if (contracted == 0)
+          continue;
+
+        std::vector<ir::Instruction> body;
+        for (size_t i = 0; i < block.body.size(); ++i)
+          if (!fused[i])
+            body.push_back(std::move(block.body[i]));
+
+        block.body = std::move(body);
+      }
+
+      ctx.stats.add("contract", "multiply-adds formed", contracted);
+      return contracted != 0;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,273 @@
+#include "opt/CallGraph.hpp"
+#include "opt/Passes.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // allocas of the function, numbered densely
+      std::unordered_map<uint, uint> collect_allocas(ir::Function& fn) {
+        std::unordered_map<uint, uint> allocas;
+
+        for (ir::Block& block : fn.blocks)
+          for (ir::Instruction& inst : block.body)
+            if (inst.index() == 0) allocas.emplace(std::get<0>(inst).reg.id, allocas.size());
+
+        return allocas;
+      }
+    } // namespace
+
+    // Mark and sweep: terminators, calls, profile counters and stores to
+    // allocas (or arrays) that are read are live, and so is everything they
+    // (transitively) use. Only those have side effects, so cycles of phis
+    // that feed nothing go away too.
+    bool dce(ir::Function& fn, Context& ctx) {
+      std::vector<bool> live(fn.nregs, false);
+      std::vector<uint> worklist;
+
+      std::unordered_map<uint, ir::Instruction*> defs;
+      std::vector<bool> loaded(fn.nregs, false);
+
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body) {
+          if (ir::VirtReg* reg = ir::defined_register(inst))
+            defs[reg->id] = &inst;
+
+          if (inst.index() == 12)
+            loaded[std::get<12>(inst).src.id] = true;
+          else if (inst.index() == 15)
+            loaded[std::get<15>(inst).array.id] = true;
+        }
+      }
+
+      auto mark = [&](ir::Value& value) {
+        if (value.index() == 1 && !live[value.reg().id]) {
+          live[value.reg().id] = true;
+          worklist.push_back(value.reg().id);
+        }
+      };
+      auto mark_register = [&](ir::VirtReg& reg) {
+        ir::Value value = reg;
+        mark(value);
+      };
+
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body) {
+          if (inst.index() == 14) {
+            for (ir::Value* value : ir::operands(inst))
+              mark(*value);
+
+            continue;
+          }
+
+          if (inst.index() == 16) {
+            ir::ElemStore& store = std::get<16>(inst);
+            if (!loaded[store.array.id])
+              continue;
+
+            for (ir::Value* value : ir::operands(inst))
+              mark(*value);
+
+            mark_register(store.array);
+            continue;
+          }
+
+          if (inst.index() != 1)
+            continue;
+
+          ir::Store& store = std::get<1>(inst);
+          if (!loaded[store.dst.id])
+            continue;
+
+          mark(store.src);
+          mark_register(store.dst);
+        }
+
+        if (block.terminated)
+          for (ir::Value* value : ir::operands(block.terminator))
+            mark(*value);
+      }
+
+      while (!worklist.empty()) {
+        uint id = worklist.back();
+        worklist.pop_back();
+
+        auto it = defs.find(id);
+        if (it == defs.end())
+          continue; // a parameter
+
+        ir::Instruction& inst = *it->second;
+        for (ir::Value* value : ir::operands(inst))
+          mark(*value);
+
+        if (inst.index() == 12)
+          mark_register(std::get<12>(inst).src);
+        else if (inst.index() == 15)
+          mark_register(std::get<15>(inst).array);
+      }
+
+      size_t removed = 0;
+      for (ir::Block& block : fn.blocks) {
+        std::vector<ir::Instruction> body;
+
+        for (ir::Instruction& inst : block.body) {
+          bool keep;
+          if (inst.index() == 1)
+            keep = loaded[std::get<1>(inst).dst.id];
+          else if (inst.index() == 16)
+            keep = loaded[std::get<16>(inst).array.id];
+          else if (inst.index() == 14 || inst.index() == 20)
+            keep = true;
+          else
+            keep = live[ir::defined_register(inst)->id];
+
+          if (keep)
+            body.push_back(std::move(inst));
+          else
+            removed++;
+        }
+
+        block.body = std::move(body);
+      }
+
+      ctx.stats.add("dce", "instructions removed", removed);
+      return removed != 0;
+    }
+
+    // A store is dead when its alloca is stored again or never read before
+    // the function returns, found with a backward liveness analysis of the
+    // allocas.
+    bool dse(ir::Function& fn, Context& ctx) {
+      std::unordered_map<uint, uint> allocas = collect_allocas(fn);
+      if (allocas.empty())
+        return false;
+
+      size_t nblocks = fn.blocks.size();
+      size_t nallocas = allocas.size();
+
+      // per block: allocas read before being written (gen), written (kill)
+      std::vector<std::vector<bool>> gen(nblocks, std::vector<bool>(nallocas, false));
+      std::vector<std::vector<bool>> kill(nblocks, std::vector<bool>(nallocas, false));
+
+      for (uint b = 0; b < nblocks; ++b) {
+        for (ir::Instruction& inst : fn.blocks[b].body) {
+          if (inst.index() == 12) {
+            uint a = allocas[std::get<12>(inst).src.id];
+            if (!kill[b][a])
+              gen[b][a] = true;
+          } else if (inst.index() == 1)
+            kill[b][allocas[std::get<1>(inst).dst.id]] = true;
+        }
+      }
+
+      std::vector<std::vector<bool>> live_in(nblocks, std::vector<bool>(nallocas, false));
+      std::vector<std::vector<bool>> live_out(nblocks, std::vector<bool>(nallocas, false));
+
+      bool changed = true;
+      while (changed) {
+        changed = false;
+
+        for (uint b = nblocks; b-- > 0;) {
+          std::vector<bool> out(nallocas, false);
+          for (uint succ : fn.blocks[b].succs)
+            for (size_t a = 0; a < nallocas; ++a)
+              out[a] = out[a] || live_in[succ][a];
+
+          std::vector<bool> in(nallocas);
+          for (size_t a = 0; a < nallocas; ++a)
+            in[a] = gen[b][a] || (out[a] && !kill[b][a]);
+
+          if (in != live_in[b] || out != live_out[b]) {
+            live_in[b] = std::move(in);
+            live_out[b] = std::move(out);
+            changed = true;
+          }
+        }
+      }
+
+      // walk each block backwards, a store is dead unless a later load
+      // (or a successor) may read it
+      size_t removed = 0;
+      for (uint b = 0; b < nblocks; ++b) {
+        std::vector<ir::Instruction>& body = fn.blocks[b].body;
+        std::vector<bool> live = live_out[b];
+        std::vector<bool> dead(body.size(), false);
+
+        for (size_t i = body.size(); i-- > 0;) {
+          ir::Instruction& inst = body[i];
+
+          if (inst.index() == 12)
+            live[allocas[std::get<12>(inst).src.id]] = true;
+          else if (inst.index() == 1) {
+            uint a = allocas[std::get<1>(inst).dst.id];
+            dead[i] = !live[a];
+            live[a] = false;
+          }
+        }
+
+        std::vector<ir::Instruction> kept;
+        for (size_t i = 0; i < body.size(); ++i) {
+          if (dead[i])
+            removed++;
+          else
+            kept.push_back(std::move(body[i]));
+        }
+
+        body = std::move(kept);
+      }
+
+      ctx.stats.add("dse", "dead stores removed", removed);
+      return removed != 0;
+    }
+
+    // Functions no entry point (`main` and `--export=`) reaches through calls
+    // are removed, with their declarations. When the entry points are known
+    // the remaining functions only matter to the program, they're marked
+    // internal and don't get a global symbol.
+    bool globaldce(ir::Program& program, Context& ctx) {
+      CallGraph graph(program);
+      std::vector<uint> entries = graph.entry_points(ctx.opts);
+      std::vector<bool> reached = graph.reachable(entries);
+
+      std::unordered_set<std::string> live;
+      for (uint f = 0; f < program.funcs.size(); ++f)
+        if (reached[f])
+          live.insert(program.funcs[f].name);
+
+      // a library (no `main`, no `--export=`) keeps all of its functions global
+      bool whole_program = graph.lookup("main") != CallGraph::NONE || !ctx.opts.exported.empty();
+
+      std::vector<ir::Function> kept;
+      size_t removed = 0, internalized = 0;
+
+      for (uint f = 0; f < program.funcs.size(); ++f) {
+        ir::Function& fn = program.funcs[f];
+
+        if (live.count(fn.name) == 0) {
+          if (fn.defined) {
+            ctx.remarks.add("globaldce", "removed @" + fn.name + ": not called from an entry point");
+            removed++;
+          }
+          continue;
+        }
+
+        bool entry = std::find(entries.begin(), entries.end(), graph.lookup(fn.name)) != entries.end();
+        if (whole_program && fn.defined && !entry && !fn.internal) {
+          fn.internal = true;
+          internalized++;
+        }
+
+        kept.push_back(std::move(fn));
+      }
+
+      bool changed = kept.size() != program.funcs.size() || internalized != 0;
+      program.funcs = std::move(kept);
+
+      ctx.stats.add("globaldce", "functions removed", removed);
+      ctx.stats.add("globaldce", "functions internalized", internalized);
+      return changed;
+    }
+  } // namespace opt
+} // namespace phantom
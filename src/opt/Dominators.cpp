@@ -0,0 +1,111 @@
+#include "opt/Dominators.hpp"
+#include "irgen/Cfg.hpp"
+
+namespace phantom {
+  namespace opt {
+    Dominators::Dominators(ir::Function& fn) {
+      size_t size = fn.blocks.size();
+      order = ir::reverse_post_order(fn);
+      idom.assign(size, NONE);
+      children.assign(size, {});
+      frontier.assign(size, {});
+      enter.assign(size, 0);
+      leave.assign(size, 0);
+
+      if (order.empty())
+        return;
+
+      std::vector<uint> rpo(size, NONE);
+      for (uint i = 0; i < order.size(); ++i)
+        rpo[order[i]] = i;
+
+      auto intersect = [&](uint a, uint b) {
+        while (a != b) {
+          while (rpo[a] > rpo[b]) a = idom[a];
+          while (rpo[b] > rpo[a]) b = idom[b];
+        }
+
+        return a;
+      };
+
+      // the entry temporarily dominates itself so the walk up stops there
+      uint entry = order[0];
+      idom[entry] = entry;
+
+      bool changed = true;
+      while (changed) {
+        changed = false;
+
+        for (size_t i = 1; i < order.size(); ++i) {
+          uint block = order[i];
+          uint dom = NONE;
+
+          for (uint pred : fn.blocks[block].preds) {
+            if (idom[pred] == NONE)
+              continue;
+
+            dom = (dom == NONE) ? pred : intersect(pred, dom);
+          }
+
+          if (dom != idom[block]) {
+            idom[block] = dom;
+            changed = true;
+          }
+        }
+      }
+
+      idom[entry] = NONE;
+
+      for (size_t i = 1; i < order.size(); ++i)
+        children[idom[order[i]]].push_back(order[i]);
+
+      // a join point is in the frontier of every block between each of its
+      // predecessors and its immediate dominator
+      for (uint block : order) {
+        std::vector<uint>& preds = fn.blocks[block].preds;
+        if (preds.size() < 2)
+          continue;
+
+        for (uint pred : preds) {
+          if (rpo[pred] == NONE)
+            continue;
+
+          for (uint runner = pred; runner != idom[block]; runner = idom[runner]) {
+            std::vector<uint>& df = frontier[runner];
+            if (df.empty() || df.back() != block)
+              df.push_back(block);
+          }
+        }
+      }
+
+      // number the tree for constant time `dominates()`
+      uint clock = 1;
+      std::vector<std::pair<uint, size_t>> stack = { { entry, 0 } };
+      enter[entry] = clock++;
+
+      while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+
+        if (next < children[block].size()) {
+          uint child = children[block][next++];
+          enter[child] = clock++;
+          stack.push_back({ child, 0 });
+          continue;
+        }
+
+        leave[block] = clock++;
+        stack.pop_back();
+      }
+    }
+
+    bool Dominators::reachable(uint block) const {
+      return enter[block] != 0;
+    }
+    bool Dominators::dominates(uint a, uint b) const {
+      if (!reachable(a) || !reachable(b))
+        return false;
+
+      return enter[a] <= enter[b] && leave[b] <= leave[a];
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,241 @@
+#include "opt/Fold.hpp"
+#include "common.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace phantom {
+  namespace opt {
+    int64_t wrap(int64_t value, uint size) {
+      // clang-format off
+      switch (size) {
+        case 1:  return (int8_t)value;
+        case 2:  return (int16_t)value;
+        case 4:  return (int32_t)value;
+        default: return value;
+      }
+      // clang-format on
+    }
+    double round_to(double value, ir::Type& type) {
+      return (type.size == 4) ? (double)(float)value : value;
+    }
+
+    ir::Constant make_constant(ir::Type type, int64_t value) {
+      ir::Constant constant;
+      constant.type = type;
+      constant.value = wrap(value, type.size);
+      return constant;
+    }
+    ir::Constant make_constant(ir::Type type, double value) {
+      ir::Constant constant;
+      constant.type = type;
+      constant.value = round_to(value, type);
+      return constant;
+    }
+
+    bool same_constant(const ir::Constant& a, const ir::Constant& b) {
+      if (a.type.kind != b.type.kind || a.type.size != b.type.size || a.value.index() != b.value.index())
+        return false;
+
+      if (a.value.index() == 0)
+        return std::get<0>(a.value) == std::get<0>(b.value);
+
+      // compare the bits, so 0.0 and -0.0 differ and NaN matches itself
+      double x = std::get<1>(a.value), y = std::get<1>(b.value);
+      return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+
+    namespace {
+      int64_t integer(const ir::Constant& constant) {
+        if (constant.value.index() == 0)
+          return std::get<0>(constant.value);
+
+        return (int64_t)std::get<1>(constant.value);
+      }
+      double floating(const ir::Constant& constant) {
+        if (constant.value.index() == 1)
+          return std::get<1>(constant.value);
+
+        return (double)std::get<0>(constant.value);
+      }
+
+      bool binop(ir::BinOp& binop, const ir::Constant& lhs, const ir::Constant& rhs, ir::Constant& result) {
+        ir::Type type = binop.dst.type;
+
+        if (type.kind == ir::Type::Kind::Float) {
+          double lv = floating(lhs), rv = floating(rhs), value = 0;
+
+          // clang-format off
+          switch (binop.op) {
+            case ir::BinOp::Op::Add: value = lv + rv; break;
+            case ir::BinOp::Op::Sub: value = lv - rv; break;
+            case ir::BinOp::Op::Mul: value = lv * rv; break;
+            case ir::BinOp::Op::Div: value = lv / rv; break;
+            default:                 return false;
+          }
+          // clang-format on
+
+          result = make_constant(type, value);
+          return true;
+        }
+
+        // wrapping arithmetic, done unsigned to stay away from overflow UB
+        uint64_t lv = integer(lhs), rv = integer(rhs);
+        int64_t value = 0;
+
+        switch (binop.op) {
+          case ir::BinOp::Op::Add:
+            value = (int64_t)(lv + rv);
+            break;
+          case ir::BinOp::Op::Sub:
+            value = (int64_t)(lv - rv);
+            break;
+          case ir::BinOp::Op::Mul:
+            value = (int64_t)(lv * rv);
+            break;
+          case ir::BinOp::Op::Div:
+          case ir::BinOp::Op::Rem:
+          {
+            int64_t dividend = wrap(lv, type.size), divisor = wrap(rv, type.size);
+
+            // both trap at runtime (#DE), leave them there
+            if (divisor == 0)
+              return false;
+            if (divisor == -1 && dividend == wrap(INT64_MIN >> (64 - type.size * 8), type.size))
+              return false;
+
+            value = (binop.op == ir::BinOp::Op::Div) ? dividend / divisor : dividend % divisor;
+            break;
+          }
+          case ir::BinOp::Op::Shl:
+          case ir::BinOp::Op::Sar:
+          case ir::BinOp::Op::Shr:
+          {
+            // the hardware masks the count, 8/16-bit shifts by more than
+            // their width aren't worth reproducing
+            uint bits = type.size * 8;
+            uint count = rv & ((bits == 64) ? 63 : 31);
+            if (count >= bits)
+              return false;
+
+            uint64_t mask = (bits == 64) ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+
+            if (binop.op == ir::BinOp::Op::Shl)
+              value = (int64_t)(lv << count);
+            else if (binop.op == ir::BinOp::Op::Sar)
+              value = wrap(lv, type.size) >> count;
+            else
+              value = (int64_t)((lv & mask) >> count);
+
+            break;
+          }
+          case ir::BinOp::Op::MulHi:
+          {
+            __int128 product = (__int128)wrap(lv, type.size) * (__int128)wrap(rv, type.size);
+            value = (int64_t)(product >> (type.size * 8));
+            break;
+          }
+        }
+
+        result = make_constant(type, value);
+        return true;
+      }
+
+      bool compare(ir::Cmp& cmp, const ir::Constant& lhs, const ir::Constant& rhs, ir::Constant& result) {
+        bool value = false;
+
+        if (lhs.type.kind == ir::Type::Kind::Float || rhs.type.kind == ir::Type::Kind::Float) {
+          double lv = floating(lhs), rv = floating(rhs);
+
+          // clang-format off
+          switch (cmp.pred) {
+            case ir::Cmp::Pred::Eq: value = lv == rv; break;
+            case ir::Cmp::Pred::Ne: value = lv != rv; break;
+            case ir::Cmp::Pred::Lt: value = lv < rv;  break;
+            case ir::Cmp::Pred::Le: value = lv <= rv; break;
+            case ir::Cmp::Pred::Gt: value = lv > rv;  break;
+            case ir::Cmp::Pred::Ge: value = lv >= rv; break;
+          }
+          // clang-format on
+        } else {
+          int64_t lv = integer(lhs), rv = integer(rhs);
+
+          // clang-format off
+          switch (cmp.pred) {
+            case ir::Cmp::Pred::Eq: value = lv == rv; break;
+            case ir::Cmp::Pred::Ne: value = lv != rv; break;
+            case ir::Cmp::Pred::Lt: value = lv < rv;  break;
+            case ir::Cmp::Pred::Le: value = lv <= rv; break;
+            case ir::Cmp::Pred::Gt: value = lv > rv;  break;
+            case ir::Cmp::Pred::Ge: value = lv >= rv; break;
+          }
+          // clang-format on
+        }
+
+        result = make_constant(cmp.dst.type, (int64_t)value);
+        return true;
+      }
+
+      // `cvts*2si` rounds to nearest, anything that doesn't fit gives the
+      // "integer indefinite" value which we don't try to reproduce
+      bool float_to_int(const ir::Constant& value, ir::Type& type, ir::Constant& result) {
+        double rounded = std::nearbyint(floating(value));
+        double limit = (type.size == 8) ? 9223372036854775808.0 : 2147483648.0;
+
+        if (!(rounded >= -limit && rounded < limit))
+          return false;
+
+        result = make_constant(type, (int64_t)rounded);
+        return true;
+      }
+    } // namespace
+
+    bool fold(ir::Instruction& inst, const std::vector<ir::Constant>& args, ir::Constant& result) {
+      switch (inst.index()) {
+        case 2: // BinOp
+          return binop(std::get<2>(inst), args[0], args[1], result);
+        case 4: // Int2Float
+        {
+          ir::Type& type = std::get<4>(inst).dst.type;
+          result = make_constant(type, (double)(float)integer(args[0]));
+          return true;
+        }
+        case 5: // Int2Double
+        {
+          ir::Type& type = std::get<5>(inst).dst.type;
+          result = make_constant(type, (double)integer(args[0]));
+          return true;
+        }
+        case 6: // Float2Int
+          return float_to_int(args[0], std::get<6>(inst).dst.type, result);
+        case 8: // Double2Int
+          return float_to_int(args[0], std::get<8>(inst).dst.type, result);
+        case 7: // Float2Double
+        case 9: // Double2Float
+        {
+          ir::Type& type = (inst.index() == 7) ? std::get<7>(inst).dst.type : std::get<9>(inst).dst.type;
+          result = make_constant(type, floating(args[0]));
+          return true;
+        }
+        case 10: // IntExtend
+        {
+          // sign extension keeps the value, truncation wraps it
+          result = make_constant(std::get<10>(inst).dst.type, integer(args[0]));
+          return true;
+        }
+        case 11: // Cmp
+          return compare(std::get<11>(inst), args[0], args[1], result);
+        case 19: // Fma
+        {
+          // rounded once, f32 ones too
+          ir::Type& type = std::get<19>(inst).dst.type;
+          double a = floating(args[0]), b = floating(args[1]), c = floating(args[2]);
+          double value = (type.size == 4) ? (double)std::fmaf((float)a, (float)b, (float)c) : std::fma(a, b, c);
+          result = make_constant(type, value);
+          return true;
+        }
+        default:
+          return false;
+      }
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,308 @@
+#include "opt/Dominators.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // An expression as a flat list of words: what the instruction is, its
+      // result type and its (already numbered) operands.
+      struct Expression {
+        std::vector<uint64_t> words;
+
+        bool operator==(const Expression& other) const {
+          return words == other.words;
+        }
+      };
+      struct ExpressionHash {
+        size_t operator()(const Expression& expr) const {
+          uint64_t hash = 1469598103934665603ull;
+          for (uint64_t word : expr.words)
+            hash = (hash ^ word) * 1099511628211ull;
+
+          return hash;
+        }
+      };
+
+      // Dominator-based value numbering: walks the dominator tree with a
+      // scoped table of the expressions available in the current block,
+      // an instruction computing one of them again is replaced by the first
+      // one. Loads are numbered with the store generation of their alloca,
+      // a store makes the value it stores available to later loads.
+      struct GVN {
+        ir::Function& fn;
+        Context& ctx;
+        Dominators& dom;
+
+        GVN(ir::Function& fn, Context& ctx, Dominators& dom)
+            : fn(fn), ctx(ctx), dom(dom) {}
+
+        std::unordered_map<Expression, ir::Value, ExpressionHash> table;
+        Replacements replacements;
+
+        // memory state: every store to an alloca starts a new generation,
+        // and so does entering a join point since stores on other paths
+        // may reach it
+        uint64_t clock = 0;
+        uint64_t epoch = 0;
+        std::unordered_map<uint, uint64_t> generations;
+
+        size_t removed = 0, loads = 0;
+
+        struct Scope {
+          std::vector<Expression> inserted;
+          uint64_t epoch;
+          std::unordered_map<uint, uint64_t> generations;
+        };
+
+        static void encode(Expression& expr, ir::Type& type) {
+          expr.words.push_back(((uint64_t)type.lanes << 40) | ((uint64_t)type.kind << 32) | type.size);
+        }
+        static void encode(Expression& expr, ir::Value& value) {
+          if (value.index() == 1) {
+            expr.words.push_back(1);
+            expr.words.push_back(value.reg().id);
+            return;
+          }
+
+          // the pool holds every constant once, equal constants share a slot
+          expr.words.push_back(2);
+          encode(expr, value.type);
+          expr.words.push_back(value.ref);
+        }
+        static bool commutative(ir::BinOp& binop) {
+          switch (binop.op) {
+            case ir::BinOp::Op::Add:
+            case ir::BinOp::Op::Mul:
+            case ir::BinOp::Op::MulHi:
+              return true;
+            default:
+              return false;
+          }
+        }
+        static ir::Cmp::Pred swapped(ir::Cmp::Pred pred) {
+          // clang-format off
+          switch (pred) {
+            case ir::Cmp::Pred::Lt: return ir::Cmp::Pred::Gt;
+            case ir::Cmp::Pred::Le: return ir::Cmp::Pred::Ge;
+            case ir::Cmp::Pred::Gt: return ir::Cmp::Pred::Lt;
+            case ir::Cmp::Pred::Ge: return ir::Cmp::Pred::Le;
+            default:                return pred;
+          }
+          // clang-format on
+        }
+        // operands of commutative operations are ordered so `a + b` and
+        // `b + a` get the same number
+        static void encode_pair(Expression& expr, ir::Value& lhs, ir::Value& rhs, bool ordered) {
+          Expression l, r;
+          encode(l, lhs);
+          encode(r, rhs);
+
+          if (ordered && r.words < l.words)
+            std::swap(l, r);
+
+          expr.words.insert(expr.words.end(), l.words.begin(), l.words.end());
+          expr.words.insert(expr.words.end(), r.words.begin(), r.words.end());
+        }
+
+        // the expression `inst` computes, false for what can't be numbered
+        bool expression(ir::Instruction& inst, Expression& expr) {
+          expr.words.push_back(inst.index());
+
+          switch (inst.index()) {
+            case 2: // BinOp
+            {
+              ir::BinOp& binop = std::get<2>(inst);
+              expr.words.push_back((uint64_t)binop.op);
+              encode(expr, binop.dst.type);
+              encode_pair(expr, binop.lhs, binop.rhs, commutative(binop));
+              return true;
+            }
+            case 3: // UnOp
+            {
+              ir::UnOp& unop = std::get<3>(inst);
+              expr.words.push_back((uint64_t)unop.op);
+              encode(expr, unop.dst.type);
+              encode(expr, unop.operand);
+              return true;
+            }
+            case 11: // Cmp
+            {
+              ir::Cmp& cmp = std::get<11>(inst);
+              Expression l, r;
+              encode(l, cmp.lhs);
+              encode(r, cmp.rhs);
+
+              // a < b is b > a
+              ir::Cmp::Pred pred = cmp.pred;
+              if (r.words < l.words) {
+                std::swap(l, r);
+                pred = swapped(pred);
+              }
+
+              expr.words.push_back((uint64_t)pred);
+              expr.words.insert(expr.words.end(), l.words.begin(), l.words.end());
+              expr.words.insert(expr.words.end(), r.words.begin(), r.words.end());
+              return true;
+            }
+            case 12: // Load
+            {
+              ir::Load& load = std::get<12>(inst);
+              load_key(expr, load.src);
+              return true;
+            }
+            case 15: // ElemLoad
+            {
+              ir::ElemLoad& load = std::get<15>(inst);
+              encode(expr, load.dst.type);
+              load_key(expr, load.array);
+              encode(expr, load.index);
+              return true;
+            }
+            case 17: // Splat
+            {
+              ir::Splat& splat = std::get<17>(inst);
+              encode(expr, splat.dst.type);
+              encode(expr, splat.value);
+              return true;
+            }
+            case 19: // Fma
+            {
+              ir::Fma& fma = std::get<19>(inst);
+              encode(expr, fma.dst.type);
+              encode_pair(expr, fma.a(), fma.b(), true);
+              encode(expr, fma.c());
+              return true;
+            }
+            case 4: case 5: case 6: case 7: case 8: case 9: case 10: // casts
+            {
+              ir::VirtReg* dst = ir::defined_register(inst);
+              encode(expr, dst->type);
+              encode(expr, *ir::operands(inst)[0]);
+              return true;
+            }
+            default:
+              return false;
+          }
+        }
+        void load_key(Expression& expr, ir::VirtReg& address) {
+          expr.words.push_back(address.id);
+          expr.words.push_back(epoch);
+          expr.words.push_back(generations[address.id]);
+        }
+
+        void insert(Scope& scope, Expression& expr, ir::Value value) {
+          if (table.emplace(expr, value).second)
+            scope.inserted.push_back(expr);
+        }
+
+        void visit(uint b, Scope& scope) {
+          ir::Block& block = fn.blocks[b];
+          std::vector<ir::Instruction> body;
+
+          // stores along other paths may reach a join point (the entry
+          // block is also entered from outside the function)
+          if (block.preds.size() > 1 || (b == dom.order[0] && !block.preds.empty()))
+            epoch = ++clock;
+
+          for (ir::Instruction& inst : block.body) {
+            for (ir::Value* value : ir::operands(inst))
+              replacements.resolve(*value);
+
+            if (inst.index() == 1) {
+              ir::Store& store = std::get<1>(inst);
+              generations[store.dst.id] = ++clock;
+
+              // the stored value is what a load reads back
+              Expression expr;
+              expr.words.push_back(12);
+              load_key(expr, store.dst);
+              insert(scope, expr, store.src);
+
+              body.push_back(std::move(inst));
+              continue;
+            }
+
+            // any element may be the one stored
+            if (inst.index() == 16) {
+              generations[std::get<16>(inst).array.id] = ++clock;
+              body.push_back(std::move(inst));
+              continue;
+            }
+
+            Expression expr;
+            if (!expression(inst, expr)) {
+              body.push_back(std::move(inst));
+              continue;
+            }
+
+            ir::VirtReg* dst = ir::defined_register(inst);
+            auto it = table.find(expr);
+
+            if (it == table.end()) {
+              insert(scope, expr, *dst);
+              body.push_back(std::move(inst));
+              continue;
+            }
+
+            replacements.add(*dst, it->second);
+            removed++;
+            if (inst.index() == 12 || inst.index() == 15)
+              loads++;
+          }
+
+          block.body = std::move(body);
+
+          if (block.terminated)
+            for (ir::Value* value : ir::operands(block.terminator))
+              replacements.resolve(*value);
+        }
+
+        bool run() {
+          if (dom.order.empty())
+            return false;
+
+          // (block, leaving) pairs, scopes are popped when leaving a subtree
+          std::vector<std::pair<uint, bool>> worklist = { { dom.order[0], false } };
+          std::vector<Scope> scopes;
+
+          while (!worklist.empty()) {
+            auto [b, leaving] = worklist.back();
+            worklist.pop_back();
+
+            if (leaving) {
+              Scope& scope = scopes.back();
+              for (Expression& expr : scope.inserted)
+                table.erase(expr);
+
+              epoch = scope.epoch;
+              generations = std::move(scope.generations);
+              scopes.pop_back();
+              continue;
+            }
+
+            scopes.push_back(Scope{ .inserted = {}, .epoch = epoch, .generations = generations });
+            visit(b, scopes.back());
+
+            worklist.push_back({ b, true });
+            for (uint child : dom.children[b])
+              worklist.push_back({ child, false });
+          }
+
+          // phis on back edges may still refer to removed registers
+          replacements.apply(fn);
+
+          ctx.stats.add("gvn", "redundant instructions removed", removed);
+          ctx.stats.add("gvn", "redundant loads removed", loads);
+          return removed != 0;
+        }
+      };
+    } // namespace
+
+    bool gvn(ir::Function& fn, Context& ctx) {
+      Dominators& dom = ctx.analyses.get<Dominators>(fn);
+      return GVN(fn, ctx, dom).run();
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,342 @@
+#include "opt/CallGraph.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // clones are only made of functions up to this size, and only so many
+      // of each
+      constexpr size_t MAX_CLONE_SIZE = 200;
+      constexpr size_t MAX_CLONES = 4;
+      // uses of the constant parameters a clone must fold to be worth it
+      constexpr size_t MIN_BENEFIT = 2;
+
+      using Bindings = std::vector<std::pair<size_t, ir::Constant>>; // (parameter, value)
+
+      // what a parameter or a result of `type` holds when given `constant`,
+      // integers wrap to its width
+      ir::Constant retype(const ir::Constant& constant, ir::Type type) {
+        if (constant.value.index() == 0)
+          return make_constant(type, std::get<0>(constant.value));
+
+        return make_constant(type, std::get<1>(constant.value));
+      }
+
+      // the same value once given to `type`, -0.0 and 0.0 are different
+      // arguments
+      bool same_constant(const ir::Constant& a, const ir::Constant& b, ir::Type type) {
+        if (a.value.index() != b.value.index())
+          return false;
+
+        if (a.value.index() == 0)
+          return wrap(std::get<0>(a.value), type.size) == wrap(std::get<0>(b.value), type.size);
+
+        double x = std::get<1>(a.value), y = std::get<1>(b.value);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+      }
+
+      bool fits(const ir::Constant& constant, const ir::VirtReg& param) {
+        bool is_float = constant.value.index() == 1;
+        return is_float == (param.type.kind == ir::Type::Kind::Float) && param.type.lanes == 1;
+      }
+
+      std::string describe(const ir::Constant& constant) {
+        if (constant.value.index() == 0)
+          return std::to_string(std::get<0>(constant.value));
+
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%g", std::get<1>(constant.value));
+        return buffer;
+      }
+
+      size_t count_uses(ir::Function& fn, uint id) {
+        size_t uses = 0;
+        auto count = [&](ir::Operands values) {
+          for (ir::Value* value : values)
+            if (value->index() == 1 && value->reg().id == id)
+              uses++;
+        };
+
+        for (ir::Block& block : fn.blocks) {
+          for (ir::Instruction& inst : block.body)
+            count(ir::operands(inst));
+
+          if (block.terminated)
+            count(ir::operands(block.terminator));
+        }
+
+        return uses;
+      }
+
+      // the bound parameters become constants and leave the parameter list,
+      // every call must drop the matching arguments (`drop_arguments()`)
+      void bind_parameters(ir::Function& fn, const Bindings& bindings) {
+        Replacements replacements;
+        for (auto& [i, constant] : bindings) {
+          replacements.add(fn.params[i], fn.intern(retype(constant, fn.params[i].type)));
+        }
+        replacements.apply(fn);
+
+        for (size_t b = bindings.size(); b-- > 0;)
+          fn.params.erase(fn.params.begin() + bindings[b].first);
+      }
+      void drop_arguments(ir::Call& call, const Bindings& bindings) {
+        for (size_t b = bindings.size(); b-- > 0;)
+          call.args.erase(call.args.begin() + bindings[b].first);
+      }
+
+      // Parameters of internal functions that every call passes the same
+      // constant for (recursive calls may pass the parameter on unchanged).
+      size_t propagate_arguments(ir::Program& program, Context& ctx) {
+        CallGraph graph(program);
+        std::vector<uint> entries = graph.entry_points(ctx.opts);
+        size_t propagated = 0;
+
+        for (uint f = 0; f < program.funcs.size(); ++f) {
+          ir::Function& fn = program.funcs[f];
+          const std::vector<CallGraph::Site>& sites = graph.callers(f);
+
+          if (!fn.defined || graph.lookup(fn.name) != f || sites.empty() ||
+              std::find(entries.begin(), entries.end(), f) != entries.end())
+            continue;
+
+          bool arity = std::all_of(sites.begin(), sites.end(), [&](const CallGraph::Site& site) {
+            return graph.call(site).args.size() == fn.params.size();
+          });
+          if (!arity)
+            continue;
+
+          Bindings bindings;
+          for (size_t i = 0; i < fn.params.size(); ++i) {
+            ir::Constant common;
+            bool found = false, constant = true;
+
+            for (const CallGraph::Site& site : sites) {
+              ir::Value& arg = graph.call(site).args[i];
+
+              if (arg.index() == 1) {
+                constant = site.caller == f && arg.reg().id == fn.params[i].id;
+                if (!constant)
+                  break;
+
+                continue;
+              }
+
+              ir::Constant passed = program.funcs[site.caller].constant(arg);
+              if (!found) {
+                common = passed;
+                found = true;
+              } else if (!same_constant(common, passed, fn.params[i].type)) {
+                constant = false;
+                break;
+              }
+            }
+
+            if (constant && found && fits(common, fn.params[i]))
+              bindings.push_back({ i, retype(common, fn.params[i].type) });
+          }
+
+          if (bindings.empty())
+            continue;
+
+          for (auto& [i, value] : bindings)
+            ctx.remarks.add("ipcp", "@" + fn.name + ": %" + std::to_string(fn.params[i].id) + " is always " +
+                                        describe(value));
+
+          for (const CallGraph::Site& site : sites)
+            drop_arguments(graph.call(site), bindings);
+
+          bind_parameters(fn, bindings);
+          propagated += bindings.size();
+
+          // forward declarations keep matching the definition
+          for (ir::Function& decl : program.funcs)
+            if (!decl.defined && decl.name == fn.name)
+              decl.params = fn.params;
+        }
+
+        return propagated;
+      }
+
+      // Calls passing constants to functions that have other callers get a
+      // clone of the callee with those parameters bound, when the constants
+      // have enough uses to fold. Calls passing the same constants share
+      // their clone.
+      size_t specialize(ir::Program& program, Context& ctx) {
+        if (ctx.opts.opt_level == OptLevel::Os)
+          return 0;
+
+        CallGraph graph(program);
+        std::unordered_map<std::string, std::string> clones; // bindings -> clone
+        size_t originals = program.funcs.size();
+        size_t redirected = 0;
+
+        for (uint g = 0; g < originals; ++g) {
+          if (!program.funcs[g].defined || graph.lookup(program.funcs[g].name) != g)
+            continue;
+
+          size_t count = 0;
+
+          for (const CallGraph::Site& site : graph.callers(g)) {
+            // clones are appended to `program.funcs`, references don't last
+            ir::Function& callee = program.funcs[g];
+            ir::Call& call = graph.call(site);
+
+            if (site.caller == g || call.args.size() != callee.params.size())
+              continue;
+
+            Bindings bindings;
+            size_t benefit = 0;
+            for (size_t i = 0; i < call.args.size(); ++i) {
+              if (call.args[i].index() != 0)
+                continue;
+
+              ir::Constant passed = program.funcs[site.caller].constant(call.args[i]);
+              if (!fits(passed, callee.params[i]))
+                continue;
+
+              bindings.push_back({ i, retype(passed, callee.params[i].type) });
+              benefit += count_uses(callee, callee.params[i].id);
+            }
+
+            if (bindings.empty())
+              continue;
+
+            std::string site_name = "@" + callee.name + " for @" + program.funcs[site.caller].name;
+
+            if (benefit < MIN_BENEFIT) {
+              ctx.remarks.add("ipcp", "not specialized " + site_name + ": the constants have " +
+                                          std::to_string(benefit) + " use" + (benefit == 1 ? "" : "s"));
+              continue;
+            }
+            if (instruction_count(callee) > MAX_CLONE_SIZE) {
+              ctx.remarks.add("ipcp", "not specialized " + site_name + ": @" + callee.name + " is too large");
+              continue;
+            }
+
+            std::string key = callee.name + "(";
+            for (auto& [i, value] : bindings)
+              key += std::to_string(i) + "=" + std::to_string(value.value.index()) + ":" + describe(value) + ",";
+
+            auto it = clones.find(key);
+            if (it == clones.end()) {
+              if (count >= MAX_CLONES) {
+                ctx.remarks.add("ipcp", "not specialized " + site_name + ": @" + callee.name + " has " +
+                                            std::to_string(MAX_CLONES) + " clones already");
+                continue;
+              }
+
+              ir::Function clone = callee;
+              do
+                clone.name = callee.name + ".spec" + std::to_string(count++);
+              while (graph.lookup(clone.name) != CallGraph::NONE);
+
+              clone.internal = true;
+              bind_parameters(clone, bindings);
+
+              ctx.remarks.add("ipcp", "specialized " + site_name + " as @" + clone.name + " (" +
+                                          std::to_string(benefit) + " uses of constants)");
+
+              it = clones.emplace(key, clone.name).first;
+              program.funcs.push_back(std::move(clone));
+            }
+
+            ir::Call& redirect = graph.call(site);
+            redirect.callee = ir::symbol(it->second);
+            drop_arguments(redirect, bindings);
+            redirected++;
+          }
+        }
+
+        ctx.stats.add("ipcp", "functions cloned", program.funcs.size() - originals);
+        return redirected;
+      }
+
+      // the constant every return of `fn` returns
+      bool returned_constant(ir::Function& fn, ir::Constant& common) {
+        bool found = false;
+
+        for (ir::Block& block : fn.blocks) {
+          if (!block.terminated)
+            return false;
+          if (block.terminator.index() != 0)
+            continue;
+
+          ir::Value& value = std::get<0>(block.terminator).value;
+          if (value.index() != 0)
+            return false;
+
+          ir::Constant returned = fn.constant(value);
+          if (!found) {
+            common = returned;
+            found = true;
+          } else if (!same_constant(common, returned, fn.return_type))
+            return false;
+        }
+
+        return found;
+      }
+
+      // Results of calls to functions that always return the same constant,
+      // the calls stay for their side effects.
+      size_t propagate_returns(ir::Program& program, Context& ctx) {
+        CallGraph graph(program);
+        std::vector<Replacements> replacements(program.funcs.size());
+        size_t propagated = 0;
+
+        for (uint f = 0; f < program.funcs.size(); ++f) {
+          ir::Function& fn = program.funcs[f];
+          if (!fn.defined || fn.return_type.is_void || graph.lookup(fn.name) != f)
+            continue;
+
+          ir::Constant constant;
+          if (!returned_constant(fn, constant))
+            continue;
+
+          size_t uses = 0;
+          for (const CallGraph::Site& site : graph.callers(f)) {
+            ir::VirtReg& dst = graph.call(site).dst;
+            size_t n = count_uses(program.funcs[site.caller], dst.id);
+            if (n == 0)
+              continue;
+
+            ir::Function& caller = program.funcs[site.caller];
+            replacements[site.caller].add(dst, caller.intern(retype(constant, fn.return_type)));
+            uses += n;
+          }
+
+          if (uses != 0)
+            ctx.remarks.add("ipcp", "@" + fn.name + " always returns " + describe(constant) + ", " +
+                                        std::to_string(uses) + " use" + (uses == 1 ? "" : "s") + " replaced");
+          propagated += uses;
+        }
+
+        for (uint f = 0; f < program.funcs.size(); ++f)
+          replacements[f].apply(program.funcs[f]);
+
+        return propagated;
+      }
+    } // namespace
+
+    // Interprocedural constant propagation over the call graph: constant
+    // arguments of internal functions are bound in the callee, the calls
+    // passing constants to other functions get specialized clones, and
+    // constant return values are forwarded to the callers. What's left
+    // folds in the following sccp/simplify runs, globaldce then removes the
+    // originals nothing calls anymore.
+    bool ipcp(ir::Program& program, Context& ctx) {
+      size_t arguments = propagate_arguments(program, ctx);
+      size_t specialized = specialize(program, ctx);
+      size_t returns = propagate_returns(program, ctx);
+
+      ctx.stats.add("ipcp", "constant arguments propagated", arguments);
+      ctx.stats.add("ipcp", "calls specialized", specialized);
+      ctx.stats.add("ipcp", "return values propagated", returns);
+      return arguments + specialized + returns != 0;
+    }
+  } // namespace opt
+} // namespace phantom
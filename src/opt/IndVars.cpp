@@ -0,0 +1,527 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Loops.hpp"
+#include "opt/Passes.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // i = phi [preheader: init, latch: i + step]
+      struct Induction {
+        ir::VirtReg phi;
+        ir::Value init;
+        int64_t step;
+      };
+
+      struct IndVars {
+        ir::Function& fn;
+        Context& ctx;
+        Loops& info;
+
+        IndVars(ir::Function& fn, Context& ctx, Loops& info)
+            : fn(fn), ctx(ctx), info(info) {}
+
+        std::vector<uint> def_block;
+        size_t reduced = 0, rotated = 0, countdowns = 0;
+
+        ir::VirtReg fresh(ir::Type type) {
+          ir::VirtReg reg{ .id = fn.nregs++, .type = type };
+          def_block.push_back(Loops::NONE);
+          return reg;
+        }
+        ir::Value integer(ir::Type type, int64_t value) {
+          return fn.intern(make_constant(type, value));
+        }
+        bool invariant(Loop& loop, ir::Value& value) {
+          if (value.index() == 0)
+            return true;
+
+          uint block = def_block[value.reg().id];
+          return block == Loops::NONE || !loop.contains(block);
+        }
+        // `op lhs, rhs` appended to `block`, folded when both are constants
+        ir::Value emit(uint block, ir::BinOp::Op op, ir::Value lhs, ir::Value rhs, ir::Type type) {
+          ir::BinOp binop{ .op = op, .lhs = lhs, .rhs = rhs, .dst = ir::VirtReg{ .id = 0, .type = type } };
+
+          if (lhs.index() == 0 && rhs.index() == 0) {
+            ir::Instruction inst = binop;
+            ir::Constant result;
+            if (fold(inst, { fn.constant(lhs), fn.constant(rhs) }, result))
+              return fn.intern(result);
+          }
+
+          binop.dst = fresh(type);
+          def_block[binop.dst.id] = block;
+          fn.blocks[block].body.push_back(binop);
+          return binop.dst;
+        }
+        // before the first non-phi instruction
+        void insert_phi(uint block, ir::Phi phi) {
+          std::vector<ir::Instruction>& body = fn.blocks[block].body;
+          size_t at = 0;
+          while (at < body.size() && body[at].index() == 13)
+            at++;
+
+          def_block[phi.dst.id] = block;
+          body.insert(body.begin() + at, phi);
+        }
+
+        std::vector<Induction> inductions(Loop& loop, uint pre, uint latch) {
+          std::unordered_map<uint, ir::BinOp*> adds;
+          for (uint b : loop.blocks)
+            for (ir::Instruction& inst : fn.blocks[b].body)
+              if (inst.index() == 2 && std::get<2>(inst).op == ir::BinOp::Op::Add)
+                adds[std::get<2>(inst).dst.id] = &std::get<2>(inst);
+
+          std::vector<Induction> result;
+          for (ir::Instruction& inst : fn.blocks[loop.header].body) {
+            if (inst.index() != 13)
+              break;
+
+            ir::Phi& phi = std::get<13>(inst);
+            if (phi.dst.type.kind != ir::Type::Kind::Int || phi.incoming.size() != 2)
+              continue;
+
+            ir::Value init, next;
+            for (auto& [pred, value] : phi.incoming) {
+              if (pred == pre)
+                init = value;
+              else if (pred == latch)
+                next = value;
+            }
+
+            if (next.index() != 1 || adds.find(next.reg().id) == adds.end())
+              continue;
+
+            ir::BinOp& add = *adds[next.reg().id];
+            ir::Value* other = nullptr;
+            if (add.lhs.index() == 1 && add.lhs.reg().id == phi.dst.id)
+              other = &add.rhs;
+            else if (add.rhs.index() == 1 && add.rhs.reg().id == phi.dst.id)
+              other = &add.lhs;
+
+            if (other == nullptr || other->index() != 0)
+              continue;
+
+            result.push_back(Induction{ .phi = phi.dst, .init = init, .step = std::get<0>(fn.constant(*other).value) });
+          }
+
+          return result;
+        }
+
+        // `iv * c` (or `iv << c`) becomes a variable of its own stepping by
+        // `step * c`, the multiplication turns into an addition
+        void strength_reduce(Loop& loop, uint pre, uint latch, std::vector<Induction>& ivs) {
+          std::unordered_map<uint, Induction*> by_phi;
+          for (Induction& iv : ivs)
+            by_phi[iv.phi.id] = &iv;
+
+          std::unordered_map<uint, ir::Value> replaced;
+
+          // added once the loop's blocks have been walked
+          std::vector<ir::Phi> phis;
+          std::vector<ir::Instruction> steps;
+
+          for (uint b : loop.blocks) {
+            std::vector<ir::Instruction> body;
+
+            for (ir::Instruction& inst : fn.blocks[b].body) {
+              if (inst.index() != 2) {
+                body.push_back(std::move(inst));
+                continue;
+              }
+
+              ir::BinOp& binop = std::get<2>(inst);
+              ir::Value* var = &binop.lhs;
+              ir::Value* scale = &binop.rhs;
+
+              if (binop.op == ir::BinOp::Op::Mul && var->index() == 0)
+                std::swap(var, scale);
+
+              bool reducible = (binop.op == ir::BinOp::Op::Mul || binop.op == ir::BinOp::Op::Shl) &&
+                               var->index() == 1 && scale->index() == 0 &&
+                               by_phi.count(var->reg().id);
+
+              if (!reducible) {
+                body.push_back(std::move(inst));
+                continue;
+              }
+
+              Induction& iv = *by_phi[var->reg().id];
+              ir::Type type = binop.dst.type;
+              int64_t factor = std::get<0>(fn.constant(*scale).value);
+              if (binop.op == ir::BinOp::Op::Shl) {
+                if (factor < 0 || factor >= (int64_t)type.size * 8) {
+                  body.push_back(std::move(inst));
+                  continue;
+                }
+
+                factor = (int64_t)((uint64_t)1 << factor);
+              }
+
+              ir::Value start = emit(pre, ir::BinOp::Op::Mul, iv.init, integer(type, factor), type);
+              int64_t step = wrap((int64_t)((uint64_t)iv.step * (uint64_t)factor), type.size);
+
+              ir::VirtReg phi = fresh(type);
+              ir::VirtReg next = fresh(type);
+              def_block[next.id] = latch;
+
+              phis.push_back(ir::Phi{ .incoming = { { pre, start }, { latch, next } }, .dst = phi });
+              steps.push_back(ir::BinOp{ .op = ir::BinOp::Op::Add, .lhs = phi, .rhs = integer(type, step), .dst = next });
+
+              replaced[binop.dst.id] = phi;
+              reduced++;
+            }
+
+            fn.blocks[b].body = std::move(body);
+          }
+
+          if (replaced.empty())
+            return;
+
+          for (ir::Phi& phi : phis)
+            insert_phi(loop.header, phi);
+
+          std::vector<ir::Instruction>& latch_body = fn.blocks[latch].body;
+          latch_body.insert(latch_body.end(), steps.begin(), steps.end());
+
+          auto substitute = [&](ir::Value* value) {
+            if (value->index() != 1)
+              return;
+
+            auto it = replaced.find(value->reg().id);
+            if (it != replaced.end())
+              *value = it->second;
+          };
+
+          for (ir::Block& block : fn.blocks) {
+            for (ir::Instruction& inst : block.body)
+              for (ir::Value* value : ir::operands(inst))
+                substitute(value);
+
+            if (block.terminated)
+              for (ir::Value* value : ir::operands(block.terminator))
+                substitute(value);
+          }
+        }
+
+        // Turns a top-tested loop into a guarded bottom-tested one, the test
+        // of the header is copied into the preheader (the guard) and into
+        // the latch (the new exit test):
+        //
+        //   pre: br h           pre: t0 = test(init); br t0, h, exit
+        //   h:   t = test(i)    h:   br body
+        //        br t, body, exit
+        //   latch: br h         latch: t1 = test(next); br t1, h, exit
+        //
+        // Values of the header used after the loop are merged in the exit.
+        // Only loops whose header does nothing but the test are rotated,
+        // returns the new latch condition.
+        bool rotate(Loop& loop, uint pre, uint latch, ir::Value& latch_cond) {
+          ir::Block& header = fn.blocks[loop.header];
+          if (!header.terminated || header.terminator.index() != 2 || latch == loop.header)
+            return false;
+
+          ir::Block& last = fn.blocks[latch];
+          if (!last.terminated || last.terminator.index() != 1 || loop.exits.size() != 1)
+            return false;
+
+          ir::CondBranch br = std::get<2>(header.terminator);
+          bool inside = loop.contains(br.then_block);
+          uint body_block = inside ? br.then_block : br.else_block;
+          uint exit = inside ? br.else_block : br.then_block;
+
+          if (!loop.contains(body_block) || loop.contains(exit) || fn.blocks[exit].preds.size() != 1)
+            return false;
+
+          for (ir::Instruction& inst : header.body) {
+            switch (inst.index()) {
+              case 2: case 3: case 4: case 5: case 6: case 7: case 8: case 9: case 10: case 11: case 13:
+                break;
+              default:
+                return false;
+            }
+
+            if (inst.index() == 2) {
+              ir::BinOp& binop = std::get<2>(inst);
+              if (binop.op == ir::BinOp::Op::Div || binop.op == ir::BinOp::Op::Rem)
+                return false;
+            }
+          }
+
+          // a copy of the test for each way into the loop, with the phis
+          // standing for what flows in from there
+          std::unordered_map<uint, ir::Value> at_pre, at_latch;
+          std::vector<ir::VirtReg> defined;
+
+          for (ir::Instruction& inst : header.body) {
+            ir::VirtReg dst = *ir::defined_register(inst);
+            defined.push_back(dst);
+
+            if (inst.index() == 13) {
+              for (auto& [pred, value] : std::get<13>(inst).incoming) {
+                if (pred == pre)
+                  at_pre[dst.id] = value;
+                else
+                  at_latch[dst.id] = value;
+              }
+            }
+          }
+
+          auto copy = [&](uint block, std::unordered_map<uint, ir::Value>& map) {
+            for (ir::Instruction& original : fn.blocks[loop.header].body) {
+              if (original.index() == 13)
+                continue;
+
+              ir::Instruction inst = original;
+              for (ir::Value* value : ir::operands(inst)) {
+                if (value->index() == 1 && map.count(value->reg().id))
+                  *value = map[value->reg().id];
+              }
+
+              ir::VirtReg* dst = ir::defined_register(inst);
+              ir::VirtReg old = *dst;
+              *dst = fresh(dst->type);
+              def_block[dst->id] = block;
+              map[old.id] = *dst;
+
+              fn.blocks[block].body.push_back(inst);
+            }
+          };
+
+          copy(pre, at_pre);
+          copy(latch, at_latch);
+
+          auto mapped = [](std::unordered_map<uint, ir::Value>& map, ir::Value value) {
+            if (value.index() == 1 && map.count(value.reg().id))
+              return map[value.reg().id];
+
+            return value;
+          };
+
+          ir::Value cond_pre = mapped(at_pre, br.cond);
+          latch_cond = mapped(at_latch, br.cond);
+
+          auto branch = [&](ir::Value cond) {
+            return ir::CondBranch{ .cond = cond,
+                                   .then_block = inside ? loop.header : exit,
+                                   .else_block = inside ? exit : loop.header };
+          };
+
+          fn.blocks[pre].terminator = branch(cond_pre);
+          fn.blocks[latch].terminator = branch(latch_cond);
+          fn.blocks[loop.header].terminator = ir::Branch{ .target = body_block };
+
+          // the exit is now entered from the guard and the latch
+          std::vector<ir::Instruction>& exit_body = fn.blocks[exit].body;
+          for (ir::Instruction& inst : exit_body) {
+            if (inst.index() != 13)
+              break;
+
+            ir::Phi& phi = std::get<13>(inst);
+            ir::Value value = phi.incoming[0].second;
+            phi.incoming = { { pre, mapped(at_pre, value) }, { latch, mapped(at_latch, value) } };
+          }
+
+          std::unordered_map<uint, ir::Value> merged;
+          std::vector<ir::Instruction> phis;
+
+          for (ir::VirtReg& reg : defined) {
+            ir::Phi phi{ .incoming = { { pre, mapped(at_pre, reg) }, { latch, mapped(at_latch, reg) } },
+                         .dst = fresh(reg.type) };
+            def_block[phi.dst.id] = exit;
+            merged[reg.id] = phi.dst;
+            phis.push_back(phi);
+          }
+
+          // uses after the loop see the merged values (the exit phis built
+          // above already have theirs)
+          size_t first = 0;
+          while (first < exit_body.size() && exit_body[first].index() == 13)
+            first++;
+
+          auto substitute = [&](ir::Value* value) {
+            if (value->index() == 1 && merged.count(value->reg().id))
+              *value = merged[value->reg().id];
+          };
+
+          for (uint b = 0; b < fn.blocks.size(); ++b) {
+            if (loop.contains(b))
+              continue;
+
+            std::vector<ir::Instruction>& body = fn.blocks[b].body;
+            for (size_t i = (b == exit) ? first : 0; i < body.size(); ++i)
+              for (ir::Value* value : ir::operands(body[i]))
+                substitute(value);
+
+            if (fn.blocks[b].terminated)
+              for (ir::Value* value : ir::operands(fn.blocks[b].terminator))
+                substitute(value);
+          }
+
+          exit_body.insert(exit_body.begin() + first, phis.begin(), phis.end());
+
+          ir::rebuild_cfg(fn);
+          rotated++;
+          return true;
+        }
+
+        // With the exit test at the bottom, `i < n` (i stepping by one from
+        // `init`) runs the loop `n - init` times, a counter going down to zero
+        // replaces the test so the latch ends with a decrement and a jump on
+        // non-zero.
+        void countdown(Loop& loop, uint pre, uint latch, ir::Value& cond, std::vector<Induction>& ivs) {
+          if (cond.index() != 1)
+            return;
+
+          ir::Cmp* cmp = nullptr;
+          for (ir::Instruction& inst : fn.blocks[latch].body)
+            if (inst.index() == 11 && std::get<11>(inst).dst.id == cond.reg().id)
+              cmp = &std::get<11>(inst);
+
+          if (cmp == nullptr)
+            return;
+
+          ir::CondBranch& br = std::get<2>(fn.blocks[latch].terminator);
+          if (br.then_block != loop.header)
+            return;
+
+          // the copied test compares what the latch passes to the phi
+          for (Induction& iv : ivs) {
+            ir::Value next;
+            for (ir::Instruction& inst : fn.blocks[loop.header].body)
+              if (inst.index() == 13 && std::get<13>(inst).dst.id == iv.phi.id)
+                for (auto& [pred, value] : std::get<13>(inst).incoming)
+                  if (pred == latch)
+                    next = value;
+
+            ir::Value lhs = cmp->lhs, rhs = cmp->rhs;
+            ir::Cmp::Pred pred = cmp->pred;
+
+            auto same = [](ir::Value& a, ir::Value& b) {
+              return a.index() == 1 && b.index() == 1 && a.reg().id == b.reg().id;
+            };
+
+            if (same(rhs, next)) {
+              std::swap(lhs, rhs);
+              // clang-format off
+              switch (pred) {
+                case ir::Cmp::Pred::Lt: pred = ir::Cmp::Pred::Gt; break;
+                case ir::Cmp::Pred::Le: pred = ir::Cmp::Pred::Ge; break;
+                case ir::Cmp::Pred::Gt: pred = ir::Cmp::Pred::Lt; break;
+                case ir::Cmp::Pred::Ge: pred = ir::Cmp::Pred::Le; break;
+                default: break;
+              }
+              // clang-format on
+            }
+
+            if (!same(lhs, next) || !invariant(loop, rhs))
+              continue;
+
+            ir::Type type = iv.phi.type;
+            if (ir::type_of(rhs).kind != ir::Type::Kind::Int || ir::type_of(rhs).size != type.size)
+              continue;
+
+            // iterations left when entering the header
+            bool up = iv.step == 1;
+            bool inclusive;
+            if (up && (pred == ir::Cmp::Pred::Lt || pred == ir::Cmp::Pred::Ne))
+              inclusive = false;
+            else if (up && pred == ir::Cmp::Pred::Le)
+              inclusive = true;
+            else if (iv.step == -1 && (pred == ir::Cmp::Pred::Gt || pred == ir::Cmp::Pred::Ne))
+              inclusive = false;
+            else if (iv.step == -1 && pred == ir::Cmp::Pred::Ge)
+              inclusive = true;
+            else
+              continue;
+
+            // the guard's copy of the test sits at the end of the preheader
+            ir::Value count = up ? emit(pre, ir::BinOp::Op::Sub, rhs, iv.init, type)
+                                 : emit(pre, ir::BinOp::Op::Sub, iv.init, rhs, type);
+            if (inclusive)
+              count = emit(pre, ir::BinOp::Op::Add, count, integer(type, 1), type);
+
+            ir::VirtReg counter = fresh(type);
+            ir::VirtReg left = fresh(type);
+            def_block[left.id] = latch;
+
+            insert_phi(loop.header, ir::Phi{ .incoming = { { pre, count }, { latch, left } }, .dst = counter });
+
+            ir::Type bool_type{ .kind = ir::Type::Kind::Int, .size = 1, .is_void = false };
+            ir::VirtReg test = fresh(bool_type);
+            def_block[test.id] = latch;
+
+            std::vector<ir::Instruction>& body = fn.blocks[latch].body;
+            body.push_back(ir::BinOp{ .op = ir::BinOp::Op::Add, .lhs = counter, .rhs = integer(type, -1), .dst = left });
+            body.push_back(ir::Cmp{ .pred = ir::Cmp::Pred::Ne, .lhs = left, .rhs = integer(type, 0), .dst = test });
+            br.cond = test;
+
+            countdowns++;
+            return;
+          }
+        }
+
+        bool run() {
+          def_block.assign(fn.nregs, Loops::NONE);
+          for (uint b = 0; b < fn.blocks.size(); ++b)
+            for (ir::Instruction& inst : fn.blocks[b].body)
+              if (ir::VirtReg* reg = ir::defined_register(inst))
+                def_block[reg->id] = b;
+
+          bool changed = false;
+
+          for (uint l = 0; l < info.loops.size(); ++l) {
+            size_t nblocks = fn.blocks.size();
+            uint pre = info.preheader(fn, l);
+            Loop& loop = info.loops[l];
+
+            if (fn.blocks.size() != nblocks) {
+              changed = true;
+              def_block.resize(fn.nregs, Loops::NONE);
+              for (ir::Instruction& inst : fn.blocks[pre].body)
+                def_block[ir::defined_register(inst)->id] = pre;
+            }
+
+            if (loop.latches.size() != 1)
+              continue;
+
+            uint latch = loop.latches[0];
+            std::vector<Induction> ivs = inductions(loop, pre, latch);
+
+            size_t before = reduced;
+            strength_reduce(loop, pre, latch, ivs);
+            changed = changed || reduced != before;
+
+            // only innermost loops are rotated, their shape is what the
+            // exit test rewriting expects
+            bool inner = true;
+            for (Loop& other : info.loops)
+              if (other.parent == l)
+                inner = false;
+
+            ir::Value cond;
+            if (inner && rotate(loop, pre, latch, cond)) {
+              changed = true;
+              countdown(loop, pre, latch, cond, ivs);
+            }
+          }
+
+          ctx.stats.add("indvars", "multiplications strength reduced", reduced);
+          ctx.stats.add("indvars", "loops rotated", rotated);
+          ctx.stats.add("indvars", "exit tests counting down", countdowns);
+          return changed;
+        }
+      };
+    } // namespace
+
+    // Induction variable optimizations on loops with a single latch:
+    // strength reduction of `i * c`, rotation of innermost loops into
+    // bottom-tested ones and countdown exit tests.
+    bool indvars(ir::Function& fn, Context& ctx) {
+      Loops& info = ctx.analyses.get<Loops>(fn);
+      return IndVars(fn, ctx, info).run();
+    }
+  } // namespace opt
+} // namespace phantom
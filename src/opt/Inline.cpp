@@ -0,0 +1,395 @@
+#include "irgen/Cfg.hpp"
+#include "opt/CallGraph.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // clang-format off
+      // the largest estimated cost (in instructions) a call may have to be
+      // inlined, -Os only inlines calls that don't make the code bigger
+      int default_threshold(OptLevel level) {
+        switch (level) {
+          case OptLevel::O0: return -1;
+          case OptLevel::O1: return 15;
+          case OptLevel::O2: return 40;
+          case OptLevel::Os: return 0;
+        }
+
+        unreachable();
+      }
+      // clang-format on
+
+      // callers stop growing past this size, whatever the cost model says
+      constexpr size_t MAX_CALLER_SIZE = 2000;
+
+      // with a profile, calls that ran at least a tenth as often as the
+      // hottest one get a threshold this many times larger, calls that
+      // never ran are only inlined when that makes the code smaller
+      constexpr uint64_t HOT_FRACTION = 10;
+      constexpr int HOT_BONUS = 3;
+
+      bool same_type(const ir::Type& a, const ir::Type& b) {
+        return a.kind == b.kind && a.size == b.size && a.is_void == b.is_void;
+      }
+
+      struct Inliner {
+        ir::Program& program;
+        Context& ctx;
+        int threshold;
+
+        Inliner(ir::Program& program, Context& ctx, int threshold)
+            : program(program), ctx(ctx), threshold(threshold) {
+          for (ir::Function& fn : program.funcs)
+            for (ir::Block& block : fn.blocks)
+              for (ir::Instruction& inst : block.body)
+                if (inst.index() == 14 && std::get<14>(inst).count != ir::NO_COUNT)
+                  hottest = std::max(hottest, std::get<14>(inst).count);
+        }
+
+        // only the names and the order are used, inlining doesn't add or
+        // rename functions
+        CallGraph graph{ program };
+        size_t inlined = 0;
+        uint64_t hottest = 0; // call count, from the profile
+
+        ir::Function* lookup(const std::string& name) {
+          uint f = graph.lookup(name);
+          return (f == CallGraph::NONE) ? nullptr : &program.funcs[f];
+        }
+
+        static bool calls(ir::Function& fn, const std::string& name) {
+          for (ir::Block& block : fn.blocks)
+            for (ir::Instruction& inst : block.body)
+              if (inst.index() == 14 && *std::get<14>(inst).callee == name)
+                return true;
+
+          return false;
+        }
+
+        // instructions the call site would cost once inlined: the callee's
+        // body, minus the call sequence it replaces and the instructions
+        // that constant arguments let fold away
+        long cost(ir::Call& call, ir::Function& callee) {
+          long cost = (long)instruction_count(callee) - 2 - (long)call.args.size();
+
+          for (size_t i = 0; i < call.args.size(); ++i) {
+            if (call.args[i].index() != 0)
+              continue;
+
+            uint param = callee.params[i].id;
+            auto uses = [&](ir::Operands values) {
+              for (ir::Value* value : values)
+                if (value->index() == 1 && value->reg().id == param)
+                  cost--;
+            };
+
+            for (ir::Block& block : callee.blocks) {
+              for (ir::Instruction& inst : block.body)
+                uses(ir::operands(inst));
+
+              if (block.terminated)
+                uses(ir::operands(block.terminator));
+            }
+          }
+
+          return cost;
+        }
+
+        // whether to inline the call, every decision is left as a remark
+        bool decide(ir::Function& caller, ir::Call& call, ir::Function* callee) {
+          std::string site = "@" + *call.callee + " into @" + caller.name;
+
+          if (callee == nullptr || !callee->defined) {
+            ctx.remarks.add("inline", "not inlined " + site + ": no definition");
+            return false;
+          }
+          if (callee == &caller || calls(*callee, callee->name)) {
+            ctx.remarks.add("inline", "not inlined " + site + ": recursive");
+            return false;
+          }
+          if (!callee->blocks[0].preds.empty()) {
+            ctx.remarks.add("inline", "not inlined " + site + ": the entry block of @" + *call.callee + " is a loop header");
+            return false;
+          }
+
+          for (size_t i = 0; i < call.args.size(); ++i) {
+            if (!same_type(ir::type_of(call.args[i]), callee->params[i].type)) {
+              ctx.remarks.add("inline", "not inlined " + site + ": argument types differ from the parameters");
+              return false;
+            }
+          }
+
+          // the returned values replace the call's result
+          for (ir::Block& block : callee->blocks) {
+            if (call.dst.type.is_void || !block.terminated || block.terminator.index() != 0)
+              continue;
+
+            if (!same_type(ir::type_of(std::get<0>(block.terminator).value), call.dst.type)) {
+              ctx.remarks.add("inline", "not inlined " + site + ": a returned value doesn't have the result's type");
+              return false;
+            }
+          }
+
+          if (instruction_count(caller) + instruction_count(*callee) > MAX_CALLER_SIZE) {
+            ctx.remarks.add("inline", "not inlined " + site + ": @" + caller.name + " is too large");
+            return false;
+          }
+
+          long estimate = cost(call, *callee);
+          int limit = threshold;
+          std::string numbers = "cost " + std::to_string(estimate);
+
+          if (call.count != ir::NO_COUNT) {
+            if (call.count == 0)
+              limit = std::min(threshold, 0);
+            else if (call.count * HOT_FRACTION >= hottest)
+              limit = threshold * HOT_BONUS;
+
+            numbers += ", count " + std::to_string(call.count);
+          }
+          numbers += ", threshold " + std::to_string(limit);
+
+          if (estimate > limit) {
+            ctx.remarks.add("inline", "not inlined " + site + ": too costly (" + numbers + ")");
+            return false;
+          }
+
+          ctx.remarks.add("inline", "inlined " + site + " (" + numbers + ")");
+          return true;
+        }
+
+        // replaces the call `caller.blocks[b].body[index]` by a copy of the
+        // callee's blocks, the instructions after the call move to a new
+        // block the copied returns branch to
+        void inline_call(ir::Function& caller, uint b, size_t index, ir::Function& callee, Replacements& replacements) {
+          ir::Call call = std::get<14>(caller.blocks[b].body[index]);
+
+          // the callee's counts, for the share of its calls made from here
+          uint64_t calls = callee.blocks[0].count;
+          auto scale = [&](uint64_t count) {
+            if (count == ir::NO_COUNT || call.count == ir::NO_COUNT || calls == ir::NO_COUNT || calls == 0)
+              return ir::NO_COUNT;
+
+            return (uint64_t)((double)count * call.count / calls);
+          };
+
+          uint reg_base = caller.nregs;
+          uint block_base = caller.blocks.size();
+          uint cont = block_base + callee.blocks.size();
+          caller.nregs += callee.nregs;
+
+          std::unordered_map<uint, ir::Value> args;
+          for (size_t i = 0; i < call.args.size(); ++i)
+            args[callee.params[i].id] = call.args[i];
+
+          // constants move to the caller's pool
+          auto remap_register = [&](ir::VirtReg& reg) { reg.id += reg_base; };
+          auto remap = [&](ir::Value& value) {
+            if (value.index() == 0) {
+              value = caller.intern(callee.constant(value));
+              return;
+            }
+
+            auto it = args.find(value.reg().id);
+            if (it != args.end())
+              value = it->second;
+            else
+              value.ref += reg_base;
+          };
+
+          // the continuation takes over what followed the call
+          ir::Block tail;
+          {
+            ir::Block& block = caller.blocks[b];
+            tail.body.assign(std::make_move_iterator(block.body.begin() + index + 1),
+                             std::make_move_iterator(block.body.end()));
+            tail.terminator = block.terminator;
+            tail.terminated = block.terminated;
+            tail.count = block.count;
+
+            block.body.resize(index);
+            block.terminator = ir::Branch{ .target = block_base };
+            block.terminated = true;
+          }
+
+          if (tail.terminated) {
+            for (uint succ : ir::successors(tail.terminator)) {
+              for (ir::Instruction& inst : caller.blocks[succ].body) {
+                if (inst.index() != 13)
+                  break;
+
+                for (auto& [pred, value] : std::get<13>(inst).incoming)
+                  if (pred == b)
+                    pred = cont;
+              }
+            }
+          }
+
+          std::vector<ir::Instruction> allocas;
+          std::vector<std::pair<uint, ir::Value>> returns;
+
+          for (uint cb = 0; cb < callee.blocks.size(); ++cb) {
+            ir::Block block;
+
+            for (const ir::Instruction& original : callee.blocks[cb].body) {
+              ir::Instruction inst = original;
+
+              for (ir::Value* value : ir::operands(inst))
+                remap(*value);
+
+              if (ir::VirtReg* reg = ir::defined_register(inst))
+                remap_register(*reg);
+
+              if (inst.index() == 1)
+                remap_register(std::get<1>(inst).dst);
+              else if (inst.index() == 12)
+                remap_register(std::get<12>(inst).src);
+              else if (inst.index() == 15)
+                remap_register(std::get<15>(inst).array);
+              else if (inst.index() == 16)
+                remap_register(std::get<16>(inst).array);
+              else if (inst.index() == 13)
+                for (auto& [pred, value] : std::get<13>(inst).incoming)
+                  pred += block_base;
+
+              if (inst.index() == 14)
+                std::get<14>(inst).count = scale(std::get<14>(inst).count);
+
+              // allocas stay at the top of the entry block
+              if (inst.index() == 0)
+                allocas.push_back(std::move(inst));
+              else
+                block.body.push_back(std::move(inst));
+            }
+
+            ir::Terminator term = callee.blocks[cb].terminator;
+            uint self = block_base + cb;
+
+            if (!callee.blocks[cb].terminated) {
+              // falling off the end returns nothing useful
+              ir::Constant zero{ .type = callee.return_type, .value = (int64_t)0 };
+              if (callee.return_type.kind == ir::Type::Kind::Float)
+                zero.value = 0.0;
+
+              term = ir::Return{ .value = caller.intern(zero) };
+            }
+
+            switch (term.index()) {
+              case 0: // Return
+              {
+                ir::Value value = std::get<0>(term).value;
+                if (callee.blocks[cb].terminated)
+                  remap(value);
+                returns.push_back({ self, value });
+                term = ir::Branch{ .target = cont };
+                break;
+              }
+              case 1: // Branch
+                std::get<1>(term).target += block_base;
+                break;
+              case 2: // CondBranch
+              {
+                ir::CondBranch& br = std::get<2>(term);
+                remap(br.cond);
+                br.then_block += block_base;
+                br.else_block += block_base;
+                break;
+              }
+            }
+
+            block.terminator = term;
+            block.terminated = true;
+            block.count = scale(callee.blocks[cb].count);
+            caller.blocks.push_back(std::move(block));
+          }
+
+          // the result is the returned value, merged by a phi when there
+          // are several returns
+          if (!call.dst.type.is_void) {
+            if (returns.size() == 1)
+              replacements.add(call.dst, returns[0].second);
+            else if (!returns.empty())
+              tail.body.insert(tail.body.begin(), ir::Phi{ .incoming = returns, .dst = call.dst });
+          }
+
+          caller.blocks.push_back(std::move(tail));
+
+          std::vector<ir::Instruction>& entry = caller.blocks[0].body;
+          size_t at = 0;
+          while (at < entry.size() && entry[at].index() == 13)
+            at++;
+
+          entry.insert(entry.begin() + at, std::make_move_iterator(allocas.begin()),
+                       std::make_move_iterator(allocas.end()));
+        }
+
+        void run(ir::Function& caller) {
+          Replacements replacements;
+          bool changed = false;
+
+          // copied callee bodies were already processed as the callee, only
+          // the continuations appended after them are scanned
+          std::vector<bool> copied(caller.blocks.size(), false);
+
+          for (uint b = 0; b < caller.blocks.size(); ++b) {
+            if (copied[b])
+              continue;
+
+            for (size_t i = 0; i < caller.blocks[b].body.size(); ++i) {
+              if (caller.blocks[b].body[i].index() != 14)
+                continue;
+
+              ir::Call& call = std::get<14>(caller.blocks[b].body[i]);
+              for (ir::Value& arg : call.args)
+                replacements.resolve(arg);
+
+              ir::Function* callee = lookup(*call.callee);
+              if (!decide(caller, call, callee))
+                continue;
+
+              inline_call(caller, b, i, *callee, replacements);
+              inlined++;
+              changed = true;
+
+              copied.resize(caller.blocks.size(), true);
+              copied.back() = false;
+              break; // the rest of the block moved to the continuation
+            }
+          }
+
+          if (!changed)
+            return;
+
+          replacements.apply(caller);
+          rebuild_cfg(caller);
+        }
+      };
+    } // namespace
+
+    // Bottom-up inlining: every function is processed after the functions it
+    // calls, each call site is inlined when its estimated cost stays under
+    // the threshold of the optimization level (`--inline-threshold=`),
+    // raised for hot calls and dropped for cold ones with `-fprofile-use`.
+    // Every decision is reported with `--remarks`.
+    bool inline_calls(ir::Program& program, Context& ctx) {
+      int threshold = (ctx.opts.inline_threshold >= 0) ? ctx.opts.inline_threshold
+                                                        : default_threshold(ctx.opts.opt_level);
+      if (threshold < 0)
+        return false;
+
+      Inliner inliner(program, ctx, threshold);
+
+      // callees before their callers, so what gets inlined is already as
+      // small as inlining made it
+      for (uint f : inliner.graph.bottom_up())
+        inliner.run(program.funcs[f]);
+
+      ctx.stats.add("inline", "calls inlined", inliner.inlined);
+      return inliner.inlined != 0;
+    }
+  } // namespace opt
+} // namespace phantom
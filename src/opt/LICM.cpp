@@ -0,0 +1,127 @@
+#include "opt/Loops.hpp"
+#include "opt/Passes.hpp"
+#include <unordered_set>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // instructions that can run whether or not the loop would have run
+      // them: no side effects and nothing that can trap
+      bool speculatable(ir::Function& fn, ir::Instruction& inst) {
+        switch (inst.index()) {
+          case 2: // BinOp
+          {
+            ir::BinOp& binop = std::get<2>(inst);
+            if (binop.dst.type.kind == ir::Type::Kind::Float)
+              return true;
+
+            if (binop.op != ir::BinOp::Op::Div && binop.op != ir::BinOp::Op::Rem)
+              return true;
+
+            // division by zero and MIN / -1 trap
+            if (binop.rhs.index() != 0)
+              return false;
+
+            int64_t divisor = std::get<0>(fn.constant(binop.rhs).value);
+            return divisor != 0 && divisor != -1;
+          }
+          case 3: case 4: case 5: case 6: case 7: case 8: case 9: case 10: case 11:
+          case 12: // loads only read stack slots
+          case 19: // Fma
+            return true;
+          default:
+            return false;
+        }
+      }
+    } // namespace
+
+    // Loop-invariant code motion: an instruction whose operands are all
+    // defined outside of the loop computes the same value every iteration,
+    // it moves to the preheader. Loads are invariant when nothing in the
+    // loop stores to their alloca. Inner loops go first so what they hoist
+    // can keep going up.
+    bool licm(ir::Function& fn, Context& ctx) {
+      Loops& info = ctx.analyses.get<Loops>(fn);
+      if (info.loops.empty())
+        return false;
+
+      // the block defining each register, parameters are nowhere
+      std::vector<uint> def_block(fn.nregs, Loops::NONE);
+      for (uint b = 0; b < fn.blocks.size(); ++b)
+        for (ir::Instruction& inst : fn.blocks[b].body)
+          if (ir::VirtReg* reg = ir::defined_register(inst))
+            def_block[reg->id] = b;
+
+      size_t hoisted = 0, loads = 0, preheaders = 0;
+
+      for (uint l = 0; l < info.loops.size(); ++l) {
+        size_t nblocks = fn.blocks.size();
+        uint pre = info.preheader(fn, l);
+        if (fn.blocks.size() != nblocks) {
+          preheaders++;
+
+          // a merging phi may have been added
+          def_block.resize(fn.nregs, Loops::NONE);
+          for (ir::Instruction& inst : fn.blocks[pre].body)
+            def_block[ir::defined_register(inst)->id] = pre;
+        }
+
+        Loop& loop = info.loops[l];
+
+        std::unordered_set<uint> stored;
+        for (uint b : loop.blocks)
+          for (ir::Instruction& inst : fn.blocks[b].body)
+            if (inst.index() == 1)
+              stored.insert(std::get<1>(inst).dst.id);
+
+        auto invariant = [&](ir::Value* value) {
+          if (value->index() == 0)
+            return true;
+
+          uint block = def_block[value->reg().id];
+          return block == Loops::NONE || !loop.contains(block);
+        };
+
+        bool changed = true;
+        while (changed) {
+          changed = false;
+
+          for (uint b : loop.blocks) {
+            std::vector<ir::Instruction>& body = fn.blocks[b].body;
+            std::vector<ir::Instruction> kept;
+
+            for (ir::Instruction& inst : body) {
+              bool hoist = speculatable(fn, inst);
+
+              for (ir::Value* value : ir::operands(inst))
+                hoist = hoist && invariant(value);
+
+              if (hoist && inst.index() == 12)
+                hoist = stored.count(std::get<12>(inst).src.id) == 0;
+
+              if (!hoist) {
+                kept.push_back(std::move(inst));
+                continue;
+              }
+
+              def_block[ir::defined_register(inst)->id] = pre;
+              if (inst.index() == 12)
+                loads++;
+
+              fn.blocks[pre].body.push_back(std::move(inst));
+              hoisted++;
+              changed = true;
+            }
+
+            body = std::move(kept);
+          }
+        }
+      }
+
+      ctx.stats.add("licm", "instructions hoisted", hoisted);
+      ctx.stats.add("licm", "loads hoisted", loads);
+      ctx.stats.add("licm", "preheaders created", preheaders);
+      return hoisted != 0 || preheaders != 0;
+    }
+  } // namespace opt
+} // namespace phantom
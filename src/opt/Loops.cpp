@@ -0,0 +1,154 @@
+#include "opt/Loops.hpp"
+#include "irgen/Cfg.hpp"
+#include "opt/Dominators.hpp"
+#include <algorithm>
+
+namespace phantom {
+  namespace opt {
+    Loops::Loops(ir::Function& fn) {
+      size_t nblocks = fn.blocks.size();
+      innermost.assign(nblocks, NONE);
+
+      Dominators dom(fn);
+      std::vector<uint> rpo(nblocks, NONE);
+      for (uint i = 0; i < dom.order.size(); ++i)
+        rpo[dom.order[i]] = i;
+
+      for (uint header : dom.order) {
+        Loop loop{ .header = header, .blocks = {}, .latches = {}, .exits = {}, .parent = NONE, .depth = 1, .members = {} };
+
+        for (uint pred : fn.blocks[header].preds)
+          if (dom.reachable(pred) && dom.dominates(header, pred))
+            loop.latches.push_back(pred);
+
+        if (loop.latches.empty())
+          continue;
+
+        // walk the CFG backwards from the latches up to the header
+        loop.members.assign(nblocks, false);
+        loop.members[header] = true;
+
+        std::vector<uint> worklist = loop.latches;
+        while (!worklist.empty()) {
+          uint b = worklist.back();
+          worklist.pop_back();
+
+          if (loop.members[b])
+            continue;
+
+          loop.members[b] = true;
+          for (uint pred : fn.blocks[b].preds)
+            if (dom.reachable(pred))
+              worklist.push_back(pred);
+        }
+
+        for (uint b : dom.order)
+          if (loop.members[b])
+            loop.blocks.push_back(b);
+
+        for (uint b : loop.blocks)
+          for (uint succ : fn.blocks[b].succs)
+            if (!loop.members[succ] && std::find(loop.exits.begin(), loop.exits.end(), succ) == loop.exits.end())
+              loop.exits.push_back(succ);
+
+        loops.push_back(std::move(loop));
+      }
+
+      // a loop nested in another one has fewer blocks
+      std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+        return a.blocks.size() < b.blocks.size();
+      });
+
+      for (uint l = 0; l < loops.size(); ++l) {
+        for (uint b : loops[l].blocks)
+          if (innermost[b] == NONE)
+            innermost[b] = l;
+
+        for (uint outer = l + 1; outer < loops.size(); ++outer) {
+          if (loops[outer].contains(loops[l].header)) {
+            loops[l].parent = outer;
+            break;
+          }
+        }
+      }
+
+      for (uint l = loops.size(); l-- > 0;)
+        if (loops[l].parent != NONE)
+          loops[l].depth = loops[loops[l].parent].depth + 1;
+    }
+
+    uint Loops::preheader(ir::Function& fn, uint index) {
+      Loop& loop = loops[index];
+      ir::Block& header = fn.blocks[loop.header];
+
+      std::vector<uint> outside;
+      for (uint pred : header.preds)
+        if (!loop.contains(pred))
+          outside.push_back(pred);
+
+      if (outside.size() == 1 && fn.blocks[outside[0]].succs.size() == 1)
+        return outside[0];
+
+      uint pre = fn.blocks.size();
+      fn.blocks.emplace_back();
+      fn.blocks[pre].terminator = ir::Branch{ .target = loop.header };
+      fn.blocks[pre].terminated = true;
+
+      for (uint pred : outside) {
+        ir::Terminator& term = fn.blocks[pred].terminator;
+
+        if (term.index() == 1)
+          std::get<1>(term).target = pre;
+        else if (term.index() == 2) {
+          ir::CondBranch& br = std::get<2>(term);
+          if (br.then_block == loop.header)
+            br.then_block = pre;
+          if (br.else_block == loop.header)
+            br.else_block = pre;
+        }
+      }
+
+      // the values flowing in from outside are merged in the preheader
+      for (ir::Instruction& inst : fn.blocks[loop.header].body) {
+        if (inst.index() != 13)
+          break;
+
+        ir::Phi& phi = std::get<13>(inst);
+        ir::Phi merged{ .incoming = {}, .dst = ir::VirtReg{ .id = fn.nregs, .type = phi.dst.type } };
+        std::vector<std::pair<uint, ir::Value>> kept;
+
+        for (auto& entry : phi.incoming) {
+          if (loop.contains(entry.first))
+            kept.push_back(entry);
+          else
+            merged.incoming.push_back(entry);
+        }
+
+        if (merged.incoming.size() == 1)
+          kept.push_back({ pre, merged.incoming[0].second });
+        else if (!merged.incoming.empty()) {
+          fn.nregs++;
+          kept.push_back({ pre, merged.dst });
+          fn.blocks[pre].body.push_back(merged);
+        }
+
+        phi.incoming = std::move(kept);
+      }
+
+      ir::rebuild_cfg(fn);
+
+      // the preheader belongs to every loop around this one
+      for (Loop& other : loops) {
+        other.members.resize(fn.blocks.size(), false);
+
+        if (&other != &loop && other.contains(loop.header)) {
+          other.members[pre] = true;
+          other.blocks.push_back(pre);
+        }
+      }
+
+      innermost.push_back(loop.parent);
+      return pre;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,388 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Dominators.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // Promotes allocas that are only loaded and stored to SSA registers,
+      // placing phis on the iterated dominance frontier of the stores where
+      // the variable is live (pruned SSA), then renaming along the
+      // dominator tree.
+      struct Promoter {
+        ir::Function& fn;
+        Context& ctx;
+        Dominators& dom;
+
+        Promoter(ir::Function& fn, Context& ctx, Dominators& dom)
+            : fn(fn), ctx(ctx), dom(dom) {}
+
+        std::unordered_map<uint, uint> variables; // alloca id -> variable index
+        std::vector<ir::Type> types;
+
+        std::unordered_map<uint, uint> phis;          // inserted phi id -> variable index
+        std::unordered_map<uint, ir::Value> replaced; // removed load id -> its value
+        std::vector<std::vector<ir::Value>> stacks;   // reaching definitions
+
+        size_t promoted = 0, inserted = 0, removed = 0;
+
+        ir::Value zero(ir::Type type) {
+          ir::Constant constant;
+          constant.type = type;
+
+          if (type.kind == ir::Type::Kind::Float)
+            constant.value = 0.0;
+          else
+            constant.value = (int64_t)0;
+
+          return fn.intern(constant);
+        }
+
+        void collect() {
+          for (ir::Instruction& inst : fn.blocks[0].body) {
+            // arrays are only accessed element by element
+            if (inst.index() != 0 || std::get<0>(inst).count != 0)
+              continue;
+
+            ir::Alloca& alloca = std::get<0>(inst);
+            variables[alloca.reg.id] = types.size();
+            types.push_back(alloca.type);
+          }
+
+          // the address escapes when it is used as a value
+          for (ir::Block& block : fn.blocks) {
+            for (ir::Instruction& inst : block.body) {
+              for (ir::Value* value : ir::operands(inst))
+                escape(*value);
+            }
+
+            if (block.terminated) {
+              for (ir::Value* value : ir::operands(block.terminator))
+                escape(*value);
+            }
+          }
+        }
+        void escape(ir::Value& value) {
+          if (value.index() == 1)
+            variables.erase(value.reg().id);
+        }
+
+        // the variable a load/store accesses, or -1 when it isn't promoted
+        int variable(ir::VirtReg& address) {
+          auto it = variables.find(address.id);
+          return (it == variables.end()) ? -1 : (int)it->second;
+        }
+
+        void place_phis() {
+          size_t nblocks = fn.blocks.size();
+          size_t nvars = types.size();
+
+          // blocks storing each variable, and blocks loading it before any store
+          std::vector<std::vector<bool>> defs(nvars, std::vector<bool>(nblocks, false));
+          std::vector<std::vector<bool>> live(nvars, std::vector<bool>(nblocks, false));
+
+          for (uint b = 0; b < nblocks; ++b) {
+            for (ir::Instruction& inst : fn.blocks[b].body) {
+              if (inst.index() == 1) {
+                int var = variable(std::get<1>(inst).dst);
+                if (var >= 0)
+                  defs[var][b] = true;
+              } else if (inst.index() == 12) {
+                int var = variable(std::get<12>(inst).src);
+                if (var >= 0 && !defs[var][b])
+                  live[var][b] = true;
+              }
+            }
+          }
+
+          std::vector<std::vector<ir::Phi>> placed(nblocks);
+
+          for (auto& [id, var] : variables) {
+            // the variable is live into a block if it's read before being
+            // written there or in a successor it reaches without a store
+            std::vector<uint> worklist;
+            for (uint b = 0; b < nblocks; ++b)
+              if (live[var][b]) worklist.push_back(b);
+
+            while (!worklist.empty()) {
+              uint b = worklist.back();
+              worklist.pop_back();
+
+              for (uint pred : fn.blocks[b].preds) {
+                if (live[var][pred] || defs[var][pred])
+                  continue;
+
+                live[var][pred] = true;
+                worklist.push_back(pred);
+              }
+            }
+
+            std::vector<bool> has_phi(nblocks, false);
+            for (uint b = 0; b < nblocks; ++b)
+              if (defs[var][b]) worklist.push_back(b);
+
+            while (!worklist.empty()) {
+              uint b = worklist.back();
+              worklist.pop_back();
+
+              for (uint join : dom.frontier[b]) {
+                if (has_phi[join] || !live[var][join])
+                  continue;
+
+                has_phi[join] = true;
+
+                ir::Phi phi;
+                phi.dst = ir::VirtReg{ .id = fn.nregs++, .type = types[var] };
+                phis[phi.dst.id] = var;
+                placed[join].push_back(phi);
+                inserted++;
+
+                if (!defs[var][join])
+                  worklist.push_back(join);
+              }
+            }
+          }
+
+          for (uint b = 0; b < nblocks; ++b) {
+            std::vector<ir::Instruction>& body = fn.blocks[b].body;
+            body.insert(body.begin(), placed[b].begin(), placed[b].end());
+          }
+        }
+
+        ir::Value current(uint var) {
+          if (stacks[var].empty())
+            return zero(types[var]); // read before any store
+
+          return stacks[var].back();
+        }
+        void substitute(ir::Value& value) {
+          if (value.index() != 1)
+            return;
+
+          auto it = replaced.find(value.reg().id);
+          if (it == replaced.end())
+            return;
+
+          ir::Type type = value.reg().type;
+          value = it->second;
+
+          if (value.index() == 0)
+            value.type = type;
+        }
+
+        void rename_block(uint b) {
+          ir::Block& block = fn.blocks[b];
+          std::vector<ir::Instruction> body;
+
+          for (ir::Instruction& inst : block.body) {
+            if (inst.index() == 13) {
+              auto it = phis.find(std::get<13>(inst).dst.id);
+              if (it != phis.end())
+                stacks[it->second].push_back(std::get<13>(inst).dst);
+
+              body.push_back(std::move(inst));
+              continue;
+            }
+
+            for (ir::Value* value : ir::operands(inst))
+              substitute(*value);
+
+            switch (inst.index()) {
+              case 0: // Alloca
+              {
+                if (variable(std::get<0>(inst).reg) >= 0)
+                  continue;
+
+                break;
+              }
+              case 1: // Store
+              {
+                ir::Store& store = std::get<1>(inst);
+                int var = variable(store.dst);
+                if (var < 0)
+                  break;
+
+                // wider integers are stored truncated, the value the loads
+                // see must be too
+                ir::Value value = store.src;
+                ir::Type type = types[var];
+                if (value.index() == 0 && fn.constant(value).value.index() == 0 && type.kind == ir::Type::Kind::Int)
+                  value = fn.intern(make_constant(type, std::get<0>(fn.constant(value).value)));
+                else if (value.index() == 0)
+                  value.type = type;
+                else if (type.kind == ir::Type::Kind::Int && ir::type_of(value).size > type.size) {
+                  ir::VirtReg truncated{ .id = fn.nregs++, .type = type };
+                  body.push_back(ir::IntExtend{ .value = value, .dst = truncated });
+                  value = truncated;
+                }
+
+                stacks[var].push_back(value);
+                removed++;
+                continue;
+              }
+              case 12: // Load
+              {
+                ir::Load& load = std::get<12>(inst);
+                int var = variable(load.src);
+                if (var < 0)
+                  break;
+
+                replaced[load.dst.id] = current(var);
+                removed++;
+                continue;
+              }
+            }
+
+            body.push_back(std::move(inst));
+          }
+
+          block.body = std::move(body);
+
+          if (block.terminated) {
+            for (ir::Value* value : ir::operands(block.terminator))
+              substitute(*value);
+          }
+
+          for (uint succ : block.succs) {
+            for (ir::Instruction& inst : fn.blocks[succ].body) {
+              if (inst.index() != 13)
+                break;
+
+              ir::Phi& phi = std::get<13>(inst);
+              auto it = phis.find(phi.dst.id);
+              if (it != phis.end())
+                phi.incoming.push_back({ b, current(it->second) });
+            }
+          }
+        }
+
+        void rename() {
+          stacks.assign(types.size(), {});
+
+          // iterative walk of the dominator tree, restoring the definition
+          // stacks when leaving a subtree
+          std::vector<std::vector<size_t>> saved(fn.blocks.size());
+          std::vector<std::pair<uint, bool>> worklist = { { dom.order[0], false } };
+
+          while (!worklist.empty()) {
+            auto [b, leaving] = worklist.back();
+            worklist.pop_back();
+
+            if (leaving) {
+              for (size_t var = 0; var < stacks.size(); ++var)
+                stacks[var].resize(saved[b][var]);
+
+              continue;
+            }
+
+            for (std::vector<ir::Value>& stack : stacks)
+              saved[b].push_back(stack.size());
+
+            rename_block(b);
+
+            worklist.push_back({ b, true });
+            for (uint child : dom.children[b])
+              worklist.push_back({ child, false });
+          }
+        }
+
+        // a phi merging a single value (besides itself) is just that value
+        void remove_trivial_phis() {
+          bool changed = true;
+          while (changed) {
+            changed = false;
+
+            for (ir::Block& block : fn.blocks) {
+              for (size_t i = 0; i < block.body.size() && block.body[i].index() == 13; ++i) {
+                ir::Phi& phi = std::get<13>(block.body[i]);
+                if (phis.find(phi.dst.id) == phis.end())
+                  continue;
+
+                for (auto& [pred, value] : phi.incoming)
+                  resolve(value);
+
+                if (!trivial(phi))
+                  continue;
+
+                replaced[phi.dst.id] = phi.incoming.empty() ? zero(phi.dst.type) : unique(phi);
+                block.body.erase(block.body.begin() + i--);
+                inserted--;
+                changed = true;
+              }
+            }
+          }
+
+          if (replaced.empty())
+            return;
+
+          for (ir::Block& block : fn.blocks) {
+            for (ir::Instruction& inst : block.body)
+              for (ir::Value* value : ir::operands(inst))
+                resolve(*value);
+
+            if (block.terminated)
+              for (ir::Value* value : ir::operands(block.terminator))
+                resolve(*value);
+          }
+        }
+        ir::Value unique(ir::Phi& phi) {
+          for (auto& [pred, value] : phi.incoming) {
+            if (value.index() != 1 || value.reg().id != phi.dst.id)
+              return value;
+          }
+
+          return zero(phi.dst.type);
+        }
+        bool trivial(ir::Phi& phi) {
+          ir::Value first = unique(phi);
+
+          for (auto& [pred, value] : phi.incoming) {
+            if (value.index() == 1 && value.reg().id == phi.dst.id)
+              continue;
+            if (!same(value, first))
+              return false;
+          }
+
+          return true;
+        }
+        static bool same(ir::Value& a, ir::Value& b) {
+          // registers by id, constants by their slot in the pool
+          return a.ref == b.ref;
+        }
+        // follow replacement chains left by removed phis
+        void resolve(ir::Value& value) {
+          while (value.index() == 1 && replaced.count(value.reg().id))
+            substitute(value);
+        }
+
+        bool run() {
+          collect();
+          if (variables.empty())
+            return false;
+
+          promoted = variables.size();
+          place_phis();
+          rename();
+          remove_trivial_phis();
+
+          ctx.stats.add("mem2reg", "allocas promoted", promoted);
+          ctx.stats.add("mem2reg", "phis inserted", inserted);
+          ctx.stats.add("mem2reg", "loads/stores removed", removed);
+          return true;
+        }
+      };
+    } // namespace
+
+    bool mem2reg(ir::Function& fn, Context& ctx) {
+      // the renaming only visits blocks reachable from the entry
+      bool changed = ir::remove_unreachable_blocks(fn);
+      if (changed)
+        ctx.analyses.invalidate(fn);
+
+      Dominators& dom = ctx.analyses.get<Dominators>(fn);
+      return Promoter(fn, ctx, dom).run() || changed;
+    }
+  } // namespace opt
+} // namespace phantom
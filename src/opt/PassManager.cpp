@@ -0,0 +1,221 @@
+#include "opt/PassManager.hpp"
+#include "opt/Passes.hpp"
+#include "utils/parallel.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace phantom {
+  namespace opt {
+    const std::vector<PassInfo>& PassManager::registry() {
+      // clang-format off
+      static const std::vector<PassInfo> passes = {
+        { .name = "verify",   .description = "check the IR invariants",                          .function = verify },
+        { .name = "profile",  .description = "count block and call executions, or read their counts (-fprofile-*)", .module = profile },
+        { .name = "ipcp",     .description = "interprocedural constant propagation and function specialization", .module = ipcp },
+        { .name = "inline",   .description = "inline calls the cost model finds profitable",     .module = inline_calls },
+        { .name = "globaldce", .description = "remove functions no entry point calls",           .module = globaldce },
+        { .name = "tailrec",  .description = "turn self-recursive tail calls into loops",         .function = tailrec },
+        { .name = "mem2reg",  .description = "promote stack variables to SSA values",             .function = mem2reg },
+        { .name = "sccp",     .description = "sparse conditional constant propagation",          .function = sccp },
+        { .name = "simplify", .description = "algebraic simplification and strength reduction", .function = simplify },
+        { .name = "casts",    .description = "collapse conversion chains, narrow mixed-width arithmetic", .function = casts },
+        { .name = "vrp",      .description = "value range propagation: decided comparisons, narrower arithmetic", .function = vrp },
+        { .name = "gvn",      .description = "dominator-based global value numbering",            .function = gvn },
+        { .name = "licm",     .description = "hoist loop-invariant computations and loads",      .function = licm },
+        { .name = "vectorize", .description = "vectorize counted loops over arrays (SSE2, AVX2 with -mavx2)", .function = vectorize },
+        { .name = "indvars",  .description = "induction variable strength reduction, countdown loops", .function = indvars },
+        { .name = "contract", .description = "fuse multiplies and adds into FMAs (-ffp-contract=fast -mfma)", .function = contract },
+        { .name = "dse",      .description = "remove stores that are never read",                 .function = dse },
+        { .name = "dce",      .description = "remove instructions whose results are unused",      .function = dce },
+      };
+      // clang-format on
+
+      return passes;
+    }
+    const PassInfo* PassManager::lookup(const std::string& name) {
+      for (const PassInfo& pass : registry()) {
+        if (name == pass.name)
+          return &pass;
+      }
+
+      return nullptr;
+    }
+    void PassManager::print_registry(FILE* stream) {
+      for (const PassInfo& pass : registry())
+        fprintf(stream, "  %-16s %s\n", pass.name, pass.description);
+    }
+
+    std::vector<std::string> PassManager::pipeline(OptLevel level) {
+      // clang-format off
+      switch (level) {
+        case OptLevel::O0: return {};
+        case OptLevel::O1: return { "mem2reg", "sccp", "simplify", "casts", "ipcp", "inline", "globaldce", "tailrec", "vrp", "sccp", "simplify", "gvn", "licm", "contract", "dse", "dce" };
+        case OptLevel::O2: return { "mem2reg", "sccp", "simplify", "casts", "ipcp", "inline", "globaldce", "tailrec", "vrp", "sccp", "simplify", "gvn", "licm", "vectorize", "indvars", "contract", "dse", "dce" };
+        case OptLevel::Os: return { "mem2reg", "sccp", "simplify", "casts", "ipcp", "inline", "globaldce", "tailrec", "vrp", "sccp", "simplify", "gvn", "licm", "contract", "dse", "dce" };
+      }
+      // clang-format on
+
+      unreachable();
+    }
+    std::vector<std::string> PassManager::pipeline(const Options& opts) {
+      std::vector<std::string> passes = opts.passes_specified ? opts.passes : pipeline(opts.opt_level);
+
+      // the counters go in before anything changes the code, where the
+      // `-fprofile-use` build finds the same blocks
+      bool profiled = !opts.profile_generate.empty() || !opts.profile_use.empty();
+      if (profiled && std::find(passes.begin(), passes.end(), "profile") == passes.end())
+        passes.insert(passes.begin(), "profile");
+
+      return passes;
+    }
+
+    void PassManager::add(const std::string& name) {
+      const PassInfo* pass = lookup(name);
+      if (!pass)
+        ctx.logger.log(Logger::Level::FATAL, "Unknown pass \"" + name + "\" (see --print passes)", true);
+
+      passes.push_back(PassTiming{ .pass = pass });
+    }
+    void PassManager::run() {
+      for (PassTiming& timing : passes)
+        run_pass(timing);
+    }
+    bool PassManager::run_pass(PassTiming& timing) {
+      const PassInfo* pass = timing.pass;
+      long before = instruction_count(program);
+      bool changed = false;
+
+      auto start = std::chrono::steady_clock::now();
+
+      if (pass->module) {
+        timing.runs++;
+
+        if (pass->module(program, ctx)) {
+          timing.changed++;
+          changed = true;
+
+          // module passes may add, remove or reorder functions
+          ctx.analyses.invalidate_all();
+        }
+      } else {
+        // functions are independent, each gets its own context so the
+        // statistics and remarks come out as in a serial run
+        std::vector<ir::Function*> defined;
+        for (ir::Function& fn : program.funcs)
+          if (fn.defined)
+            defined.push_back(&fn);
+
+        std::vector<std::unique_ptr<Context>> contexts(defined.size());
+        std::vector<char> results(defined.size(), false);
+
+        utils::parallel_for(defined.size(), utils::thread_count(ctx.opts.jobs), [&](size_t i) {
+          contexts[i] = std::make_unique<Context>(ctx.opts, ctx.logger, analyses);
+          results[i] = pass->function(*defined[i], *contexts[i]);
+
+          if (results[i])
+            analyses.invalidate(*defined[i]);
+        });
+
+        for (size_t i = 0; i < defined.size(); ++i) {
+          timing.runs++;
+          ctx.merge(*contexts[i]);
+
+          if (results[i]) {
+            timing.changed++;
+            changed = true;
+          }
+        }
+      }
+
+      auto end = std::chrono::steady_clock::now();
+      timing.seconds += std::chrono::duration<double>(end - start).count();
+      timing.insts_delta += instruction_count(program) - before;
+
+      return changed;
+    }
+
+    void PassManager::print_timings(FILE* stream) const {
+      double total = 0;
+      for (const PassTiming& timing : passes)
+        total += timing.seconds;
+
+      fprintf(stream, "===--- Pass execution timing report ---===\n");
+      fprintf(stream, "  %-16s %10s %7s %6s %8s %8s\n", "pass", "time (ms)", "%", "runs", "changed", "insts");
+
+      for (const PassTiming& timing : passes) {
+        double percent = (total > 0) ? (timing.seconds * 100 / total) : 0;
+        fprintf(stream, "  %-16s %10.3f %6.1f%% %6zu %8zu %+8ld\n", timing.pass->name,
+                timing.seconds * 1000, percent, timing.runs, timing.changed, timing.insts_delta);
+      }
+
+      fprintf(stream, "  %-16s %10.3f\n", "total", total * 1000);
+      fprintf(stream, "  analyses: %zu computed, %zu cached, %zu invalidated\n",
+              ctx.analyses.computed, ctx.analyses.hits, ctx.analyses.invalidated);
+
+      size_t count = instruction_count(program);
+      size_t bytes = instruction_bytes(program);
+      fprintf(stream, "  ir: %zu instructions, %zu bytes (%.1f per instruction, %zu without operand lists)\n",
+              count, bytes, count ? (double)bytes / count : 0.0, sizeof(ir::Instruction));
+    }
+    void PassManager::print_statistics(FILE* stream) const {
+      fprintf(stream, "===--- Statistics ---===\n");
+
+      for (auto& [key, count] : ctx.stats.counters)
+        fprintf(stream, "  %8zu %-16s - %s\n", count, key.first.c_str(), key.second.c_str());
+    }
+
+    void PassManager::print_remarks(FILE* stream) const {
+      fprintf(stream, "===--- Remarks ---===\n");
+
+      for (auto& [pass, message] : ctx.remarks.entries)
+        fprintf(stream, "  %s: %s\n", pass.c_str(), message.c_str());
+    }
+
+    void Context::merge(Context& other) {
+      for (auto& [key, count] : other.stats.counters)
+        stats.counters[key] += count;
+
+      for (auto& entry : other.remarks.entries)
+        remarks.entries.push_back(std::move(entry));
+    }
+
+    size_t instruction_count(ir::Function& fn) {
+      size_t count = 0;
+      for (ir::Block& block : fn.blocks)
+        count += block.body.size() + (block.terminated ? 1 : 0);
+
+      return count;
+    }
+    size_t instruction_count(ir::Program& program) {
+      size_t count = 0;
+      for (ir::Function& fn : program.funcs)
+        count += instruction_count(fn);
+
+      return count;
+    }
+    size_t instruction_bytes(ir::Program& program) {
+      size_t bytes = 0;
+
+      for (ir::Function& fn : program.funcs) {
+        bytes += fn.constants.size() * sizeof(fn.constants[0]);
+
+        for (ir::Block& block : fn.blocks) {
+          bytes += block.body.size() * sizeof(ir::Instruction);
+          if (block.terminated)
+            bytes += sizeof(ir::Terminator);
+
+          for (ir::Instruction& inst : block.body) {
+            if (inst.index() == 13)
+              bytes += std::get<13>(inst).incoming.size() * sizeof(std::pair<uint, ir::Value>);
+            else if (inst.index() == 14)
+              bytes += std::get<14>(inst).args.size() * sizeof(ir::Value);
+            else if (inst.index() == 19)
+              bytes += std::get<19>(inst).operands.size() * sizeof(ir::Value);
+          }
+        }
+      }
+
+      return bytes;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,224 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Passes.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // the header `codegen::Gen` emits and the runtime writes before the
+      // counters, every field is a little endian u64:
+      //   magic, number of functions, number of counters
+      //   per function: name hash, checksum, first counter, counters
+      constexpr char MAGIC[8] = { 'P', 'H', 'P', 'R', 'O', 'F', '0', '1' };
+
+      // FNV-1a, over the bytes of 64-bit words
+      struct Hash {
+        uint64_t value = 0xcbf29ce484222325;
+
+        void add(uint64_t word) {
+          for (int i = 0; i < 8; ++i) {
+            value ^= (word >> (8 * i)) & 0xff;
+            value *= 0x100000001b3;
+          }
+        }
+      };
+
+      // the shape the counters were placed in: the successors of every
+      // block and the calls it makes, a profile of another shape is stale
+      uint64_t checksum(ir::Function& fn) {
+        Hash hash;
+        hash.add(fn.blocks.size());
+
+        for (ir::Block& block : fn.blocks) {
+          size_t calls = 0;
+          for (ir::Instruction& inst : block.body)
+            calls += (inst.index() == 14);
+
+          std::vector<uint> succs;
+          if (block.terminated)
+            succs = ir::successors(block.terminator);
+
+          hash.add(calls);
+          hash.add(succs.size());
+          for (uint succ : succs)
+            hash.add(succ);
+        }
+
+        return hash.value;
+      }
+
+      size_t call_count(ir::Function& fn) {
+        size_t calls = 0;
+        for (ir::Block& block : fn.blocks)
+          for (ir::Instruction& inst : block.body)
+            calls += (inst.index() == 14);
+
+        return calls;
+      }
+
+      // a counter at the top of every block (after its phis and allocas),
+      // then one right before every call
+      void instrument(ir::Function& fn, ir::Profile& profile) {
+        ir::ProfiledFunction entry{ .name = fn.name, .checksum = checksum(fn), .first = profile.counters, .counters = 0 };
+        uint call_counter = entry.first + fn.blocks.size();
+
+        for (uint b = 0; b < fn.blocks.size(); ++b) {
+          std::vector<ir::Instruction> body;
+          body.reserve(fn.blocks[b].body.size() + 1);
+
+          size_t i = 0;
+          std::vector<ir::Instruction>& original = fn.blocks[b].body;
+          for (; i < original.size() && (original[i].index() == 13 || original[i].index() == 0); ++i)
+            body.push_back(std::move(original[i]));
+
+          body.push_back(ir::Count{ .counter = entry.first + b });
+
+          for (; i < original.size(); ++i) {
+            if (original[i].index() == 14)
+              body.push_back(ir::Count{ .counter = call_counter++ });
+            body.push_back(std::move(original[i]));
+          }
+
+          original = std::move(body);
+        }
+
+        entry.counters = call_counter - entry.first;
+        profile.counters += entry.counters;
+        profile.functions.push_back(entry);
+      }
+
+      struct ProfileReader {
+        std::vector<char> bytes;
+        size_t pos = 0;
+
+        bool read(uint64_t& word) {
+          if (pos + 8 > bytes.size())
+            return false;
+
+          memcpy(&word, bytes.data() + pos, 8);
+          pos += 8;
+          return true;
+        }
+      };
+
+      struct ProfileData {
+        struct Entry {
+          uint64_t checksum;
+          uint64_t first;
+          uint64_t counters;
+        };
+
+        std::unordered_map<uint64_t, Entry> functions; // by name hash
+        std::vector<uint64_t> counters;
+      };
+
+      // false when the file is missing or isn't a profile
+      bool read_profile(const std::string& path, ProfileData& data) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+          return false;
+
+        ProfileReader reader;
+        reader.bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        if (reader.bytes.size() < sizeof(MAGIC) || memcmp(reader.bytes.data(), MAGIC, sizeof(MAGIC)) != 0)
+          return false;
+        reader.pos = sizeof(MAGIC);
+
+        uint64_t nfunctions, ncounters;
+        if (!reader.read(nfunctions) || !reader.read(ncounters))
+          return false;
+
+        for (uint64_t f = 0; f < nfunctions; ++f) {
+          uint64_t hash;
+          ProfileData::Entry entry;
+          if (!reader.read(hash) || !reader.read(entry.checksum) || !reader.read(entry.first) ||
+              !reader.read(entry.counters))
+            return false;
+
+          if (entry.first + entry.counters > ncounters)
+            return false;
+
+          data.functions[hash] = entry;
+        }
+
+        data.counters.resize(ncounters);
+        for (uint64_t& counter : data.counters)
+          if (!reader.read(counter))
+            return false;
+
+        return true;
+      }
+
+      // fills `Block::count` and `Call::count`, in the order `instrument()`
+      // placed their counters
+      bool annotate(ir::Function& fn, ProfileData& data, Context& ctx) {
+        auto it = data.functions.find(ir::profile_name_hash(fn.name));
+        if (it == data.functions.end()) {
+          ctx.remarks.add("profile", "no profile for @" + fn.name);
+          return false;
+        }
+
+        ProfileData::Entry& entry = it->second;
+        if (entry.checksum != checksum(fn) || entry.counters != fn.blocks.size() + call_count(fn)) {
+          ctx.logger.log(Logger::Level::WARNING, "The profile of @" + fn.name + " doesn't match its code, ignored");
+          return false;
+        }
+
+        uint64_t counter = entry.first;
+        for (ir::Block& block : fn.blocks)
+          block.count = data.counters[counter++];
+
+        for (ir::Block& block : fn.blocks)
+          for (ir::Instruction& inst : block.body)
+            if (inst.index() == 14)
+              std::get<14>(inst).count = data.counters[counter++];
+
+        ctx.remarks.add("profile", "@" + fn.name + " ran " + std::to_string(fn.blocks[0].count) + " times");
+        return true;
+      }
+    } // namespace
+
+    // Profile-guided optimization, first in the pipeline so both builds see
+    // the same code. `-fprofile-use` reads the counts of a previous run into
+    // the blocks and calls (block layout, hot/cold splitting and inlining
+    // look at them), `-fprofile-generate` counts the executions of every
+    // block and call in counters the runtime writes at exit.
+    bool profile(ir::Program& program, Context& ctx) {
+      bool changed = false;
+
+      if (!ctx.opts.profile_use.empty()) {
+        ProfileData data;
+        if (!read_profile(ctx.opts.profile_use, data)) {
+          ctx.logger.log(Logger::Level::WARNING, "Couldn't read the profile \"" + ctx.opts.profile_use + "\", ignored");
+        } else {
+          for (ir::Function& fn : program.funcs) {
+            if (fn.defined && annotate(fn, data, ctx)) {
+              ctx.stats.add("profile", "functions annotated");
+              changed = true;
+            }
+          }
+        }
+      }
+
+      // textual IR that already counts, `program.profile` came with it
+      if (!ctx.opts.profile_generate.empty() && program.profile.functions.empty()) {
+        program.profile = ir::Profile{ .path = ctx.opts.profile_generate, .functions = {}, .counters = 0 };
+
+        for (ir::Function& fn : program.funcs) {
+          if (!fn.defined)
+            continue;
+
+          instrument(fn, program.profile);
+          ctx.stats.add("profile", "functions instrumented");
+          changed = true;
+        }
+      }
+
+      return changed;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,373 @@
+#include "opt/Ranges.hpp"
+#include <algorithm>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // a register's range may grow this many times before its moving
+      // bounds jump to the limits of the type
+      constexpr uint WIDEN_AFTER = 3;
+      // passes over the function once the widened ranges are stable, each
+      // one only makes them tighter
+      constexpr uint NARROW_ROUNDS = 2;
+
+      Range join(Range a, Range b) {
+        if (a.empty())
+          return b;
+        if (b.empty())
+          return a;
+
+        return Range{ std::min(a.lo, b.lo), std::max(a.hi, b.hi) };
+      }
+      Range meet(Range a, Range b) {
+        Range range{ std::max(a.lo, b.lo), std::min(a.hi, b.hi) };
+        return range.empty() ? Ranges::EMPTY : range;
+      }
+
+      // [lo, hi] if it fits `limits`, `limits` otherwise (the operation may
+      // wrap around)
+      Range fit(__int128 lo, __int128 hi, Range limits) {
+        if (lo < limits.lo || hi > limits.hi)
+          return limits;
+
+        return Range{ (int64_t)lo, (int64_t)hi };
+      }
+
+      ir::Cmp::Pred negate(ir::Cmp::Pred pred) {
+        // clang-format off
+        switch (pred) {
+          case ir::Cmp::Pred::Eq: return ir::Cmp::Pred::Ne;
+          case ir::Cmp::Pred::Ne: return ir::Cmp::Pred::Eq;
+          case ir::Cmp::Pred::Lt: return ir::Cmp::Pred::Ge;
+          case ir::Cmp::Pred::Le: return ir::Cmp::Pred::Gt;
+          case ir::Cmp::Pred::Gt: return ir::Cmp::Pred::Le;
+          case ir::Cmp::Pred::Ge: return ir::Cmp::Pred::Lt;
+        }
+        // clang-format on
+
+        return pred;
+      }
+      // `a pred b` is `b swap(pred) a`
+      ir::Cmp::Pred swap(ir::Cmp::Pred pred) {
+        // clang-format off
+        switch (pred) {
+          case ir::Cmp::Pred::Lt: return ir::Cmp::Pred::Gt;
+          case ir::Cmp::Pred::Le: return ir::Cmp::Pred::Ge;
+          case ir::Cmp::Pred::Gt: return ir::Cmp::Pred::Lt;
+          case ir::Cmp::Pred::Ge: return ir::Cmp::Pred::Le;
+          default:                return pred;
+        }
+        // clang-format on
+      }
+
+      bool same(const ir::Value& value, const ir::VirtReg& reg) {
+        return value.index() == 1 && value.reg().id == reg.id;
+      }
+    } // namespace
+
+    Ranges::Ranges(ir::Function& fn)
+        : dom(fn), fn(fn) {
+      ranges.assign(fn.nregs, EMPTY);
+      facts.assign(fn.blocks.size(), {});
+
+      for (const ir::VirtReg& param : fn.params)
+        if (tracked(param.type))
+          ranges[param.id] = full(param.type);
+
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body)
+          if (inst.index() == 11)
+            conditions[std::get<11>(inst).dst.id] = &std::get<11>(inst);
+      }
+
+      for (uint b : dom.order) {
+        std::vector<uint>& preds = fn.blocks[b].preds;
+        Fact fact;
+
+        if (preds.size() == 1 && edge_fact(preds[0], b, fact))
+          facts[b].push_back(fact);
+      }
+
+      // the registers every instruction defines, in reverse post-order so
+      // definitions come before their uses outside of loops
+      std::vector<std::pair<ir::Instruction*, uint>> defs;
+      for (uint b : dom.order) {
+        for (ir::Instruction& inst : fn.blocks[b].body) {
+          ir::VirtReg* dst = ir::defined_register(inst);
+          if (dst && inst.index() != 0 && tracked(dst->type))
+            defs.push_back({ &inst, b });
+        }
+      }
+
+      std::vector<uint> changes(fn.nregs, 0);
+      bool changed = true;
+
+      while (changed) {
+        changed = false;
+
+        for (auto& [inst, b] : defs) {
+          ir::VirtReg& dst = *ir::defined_register(*inst);
+          Range& old = ranges[dst.id];
+          Range range = join(old, evaluate(*inst, b));
+
+          if (range.lo == old.lo && range.hi == old.hi)
+            continue;
+
+          if (!old.empty() && ++changes[dst.id] > WIDEN_AFTER) {
+            Range limits = full(dst.type);
+            if (range.lo < old.lo)
+              range.lo = limits.lo;
+            if (range.hi > old.hi)
+              range.hi = limits.hi;
+          }
+
+          old = range;
+          changed = true;
+        }
+      }
+
+      for (uint round = 0; round < NARROW_ROUNDS; ++round) {
+        for (auto& [inst, b] : defs) {
+          Range& range = ranges[ir::defined_register(*inst)->id];
+          range = meet(range, evaluate(*inst, b));
+        }
+      }
+    }
+
+    Range Ranges::full(const ir::Type& type) {
+      if (!tracked(type) || type.size >= 8)
+        return Range{ INT64_MIN, INT64_MAX };
+
+      int64_t limit = (int64_t)1 << (type.size * 8 - 1);
+      return Range{ -limit, limit - 1 };
+    }
+    bool Ranges::tracked(const ir::Type& type) {
+      return type.kind == ir::Type::Kind::Int && !type.is_void && type.lanes == 1;
+    }
+
+    Range Ranges::range(const ir::Value& value) const {
+      if (value.index() == 0) {
+        ir::Constant constant = fn.constant(value);
+        if (constant.value.index() != 0)
+          return full(constant.type);
+
+        int64_t v = std::get<0>(constant.value);
+        return Range{ v, v };
+      }
+
+      ir::VirtReg reg = value.reg();
+      if (!tracked(reg.type) || reg.id >= ranges.size())
+        return full(reg.type);
+
+      return ranges[reg.id];
+    }
+    Range Ranges::range(const ir::Value& value, uint block) const {
+      Range result = range(value);
+      if (value.index() != 1 || result.empty() || !tracked(value.reg().type))
+        return result;
+
+      ir::VirtReg reg = value.reg();
+      for (uint b = block; b != Dominators::NONE; b = dom.idom[b])
+        for (const Fact& fact : facts[b])
+          result = refine(result, reg, fact);
+
+      return result;
+    }
+
+    int Ranges::decide(const ir::Cmp& cmp, uint block) const {
+      if (!tracked(ir::type_of(cmp.lhs)))
+        return -1;
+
+      Range a = range(cmp.lhs, block), b = range(cmp.rhs, block);
+      if (a.empty() || b.empty())
+        return -1;
+
+      // clang-format off
+      switch (cmp.pred) {
+        case ir::Cmp::Pred::Lt: return (a.hi < b.lo) ? 1 : (a.lo >= b.hi) ? 0 : -1;
+        case ir::Cmp::Pred::Le: return (a.hi <= b.lo) ? 1 : (a.lo > b.hi) ? 0 : -1;
+        case ir::Cmp::Pred::Gt: return (a.lo > b.hi) ? 1 : (a.hi <= b.lo) ? 0 : -1;
+        case ir::Cmp::Pred::Ge: return (a.lo >= b.hi) ? 1 : (a.hi < b.lo) ? 0 : -1;
+        case ir::Cmp::Pred::Eq:
+        case ir::Cmp::Pred::Ne:
+        {
+          int equal = (a.constant() && b.constant() && a.lo == b.lo) ? 1 : (a.hi < b.lo || b.hi < a.lo) ? 0 : -1;
+          if (equal == -1 || cmp.pred == ir::Cmp::Pred::Eq)
+            return equal;
+
+          return !equal;
+        }
+      }
+      // clang-format on
+
+      return -1;
+    }
+
+    bool Ranges::edge_fact(uint from, uint to, Fact& fact) const {
+      ir::Block& block = fn.blocks[from];
+      if (!block.terminated || block.terminator.index() != 2)
+        return false;
+
+      ir::CondBranch& br = std::get<2>(block.terminator);
+      if (br.then_block == br.else_block || br.cond.index() != 1)
+        return false;
+
+      auto it = conditions.find(br.cond.reg().id);
+      if (it == conditions.end() || !tracked(ir::type_of(it->second->lhs)))
+        return false;
+
+      const ir::Cmp& cmp = *it->second;
+      fact = Fact{ .pred = (to == br.then_block) ? cmp.pred : negate(cmp.pred), .lhs = cmp.lhs, .rhs = cmp.rhs };
+      return true;
+    }
+
+    Range Ranges::refine(Range result, const ir::VirtReg& reg, const Fact& fact) const {
+      ir::Cmp::Pred pred;
+      Range other;
+
+      if (same(fact.lhs, reg) && !same(fact.rhs, reg)) {
+        pred = fact.pred;
+        other = range(fact.rhs);
+      } else if (same(fact.rhs, reg) && !same(fact.lhs, reg)) {
+        pred = swap(fact.pred);
+        other = range(fact.lhs);
+      } else
+        return result;
+
+      if (other.empty() || result.empty())
+        return result;
+
+      // clang-format off
+      __int128 lo = result.lo, hi = result.hi;
+      switch (pred) {
+        case ir::Cmp::Pred::Lt: hi = std::min(hi, (__int128)other.hi - 1); break;
+        case ir::Cmp::Pred::Le: hi = std::min(hi, (__int128)other.hi);     break;
+        case ir::Cmp::Pred::Gt: lo = std::max(lo, (__int128)other.lo + 1); break;
+        case ir::Cmp::Pred::Ge: lo = std::max(lo, (__int128)other.lo);     break;
+        case ir::Cmp::Pred::Eq: lo = std::max(lo, (__int128)other.lo); hi = std::min(hi, (__int128)other.hi); break;
+        case ir::Cmp::Pred::Ne:
+          if (other.constant() && lo == other.lo) lo++;
+          if (other.constant() && hi == other.lo) hi--;
+          break;
+      }
+      // clang-format on
+
+      if (lo > hi)
+        return EMPTY;
+
+      return Range{ (int64_t)lo, (int64_t)hi };
+    }
+
+    Range Ranges::evaluate(ir::Instruction& inst, uint block) const {
+      ir::VirtReg& dst = *ir::defined_register(inst);
+
+      switch (inst.index()) {
+        case 2: // BinOp
+          return evaluate(std::get<2>(inst), block);
+        case 10: // IntExtend
+        {
+          // sign extensions keep the value, so do truncations of values
+          // that fit
+          Range value = range(std::get<10>(inst).value, block);
+          Range limits = full(dst.type);
+          return value.empty() ? EMPTY : fit(value.lo, value.hi, limits);
+        }
+        case 11: // Cmp
+        {
+          int outcome = decide(std::get<11>(inst), block);
+          return (outcome == -1) ? Range{ 0, 1 } : Range{ outcome, outcome };
+        }
+        case 13: // Phi
+          return evaluate(std::get<13>(inst), block);
+        default:
+          return full(dst.type);
+      }
+    }
+
+    Range Ranges::evaluate(ir::BinOp& binop, uint block) const {
+      Range limits = full(binop.dst.type);
+      Range a = range(binop.lhs, block), b = range(binop.rhs, block);
+      if (a.empty() || b.empty())
+        return EMPTY;
+
+      uint bits = binop.dst.type.size * 8;
+
+      switch (binop.op) {
+        case ir::BinOp::Op::Add:
+          return fit((__int128)a.lo + b.lo, (__int128)a.hi + b.hi, limits);
+        case ir::BinOp::Op::Sub:
+          return fit((__int128)a.lo - b.hi, (__int128)a.hi - b.lo, limits);
+        case ir::BinOp::Op::Mul:
+        case ir::BinOp::Op::Div:
+        {
+          // both are monotonic in each operand (while the divisor keeps its
+          // sign), the extremes are at the corners
+          if (binop.op == ir::BinOp::Op::Div && b.lo <= 0 && b.hi >= 0)
+            return limits;
+
+          __int128 corners[4];
+          int64_t xs[2] = { a.lo, a.hi }, ys[2] = { b.lo, b.hi };
+          for (int i = 0; i < 4; ++i) {
+            __int128 x = xs[i / 2], y = ys[i % 2];
+            corners[i] = (binop.op == ir::BinOp::Op::Mul) ? x * y : x / y;
+          }
+
+          return fit(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4), limits);
+        }
+        case ir::BinOp::Op::Rem:
+        {
+          // the sign of the dividend, smaller than the divisor's magnitude
+          if (b.lo <= 0 && b.hi >= 0)
+            return limits;
+
+          __int128 magnitude = std::max(-(__int128)b.lo, (__int128)b.hi) - 1;
+          __int128 lo = (a.lo >= 0) ? 0 : std::max((__int128)a.lo, -magnitude);
+          __int128 hi = (a.hi <= 0) ? 0 : std::min((__int128)a.hi, magnitude);
+          return fit(lo, hi, limits);
+        }
+        case ir::BinOp::Op::Shl:
+        case ir::BinOp::Op::Sar:
+        case ir::BinOp::Op::Shr:
+        {
+          if (!b.constant() || b.lo < 0 || b.lo >= bits)
+            return limits;
+
+          uint k = b.lo;
+          if (binop.op == ir::BinOp::Op::Shl)
+            return fit((__int128)a.lo * ((__int128)1 << k), (__int128)a.hi * ((__int128)1 << k), limits);
+          if (binop.op == ir::BinOp::Op::Sar || a.lo >= 0)
+            return Range{ a.lo >> k, a.hi >> k };
+          if (k == 0)
+            return a;
+
+          // negative values shift in as large unsigned ones
+          __int128 modulus = (__int128)1 << bits;
+          if (a.hi < 0)
+            return fit((a.lo + modulus) >> k, (a.hi + modulus) >> k, limits);
+
+          return fit(0, (modulus - 1) >> k, limits);
+        }
+        default:
+          return limits;
+      }
+    }
+
+    Range Ranges::evaluate(ir::Phi& phi, uint block) const {
+      Range result = EMPTY;
+
+      for (auto& [pred, value] : phi.incoming) {
+        if (!dom.reachable(pred))
+          continue;
+
+        Range incoming = range(value, pred);
+        Fact fact;
+        if (value.index() == 1 && edge_fact(pred, block, fact))
+          incoming = refine(incoming, value.reg(), fact);
+
+        result = join(result, incoming);
+      }
+
+      return result;
+    }
+  } // namespace opt
+} // namespace phantom
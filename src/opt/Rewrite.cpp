@@ -0,0 +1,39 @@
+#include "opt/Rewrite.hpp"
+
+namespace phantom {
+  namespace opt {
+    void Replacements::add(const ir::VirtReg& reg, const ir::Value& value) {
+      map[reg.id] = value;
+    }
+
+    void Replacements::resolve(ir::Value& value) const {
+      while (value.index() == 1) {
+        auto it = map.find(value.reg().id);
+        if (it == map.end())
+          return;
+
+        // constants take the type of the use they replace
+        ir::Type type = value.reg().type;
+        value = it->second;
+
+        if (value.index() == 0)
+          value.type = type;
+      }
+    }
+
+    void Replacements::apply(ir::Function& fn) const {
+      if (map.empty())
+        return;
+
+      for (ir::Block& block : fn.blocks) {
+        for (ir::Instruction& inst : block.body)
+          for (ir::Value* value : ir::operands(inst))
+            resolve(*value);
+
+        if (block.terminated)
+          for (ir::Value* value : ir::operands(block.terminator))
+            resolve(*value);
+      }
+    }
+  } // namespace opt
+} // namespace phantom
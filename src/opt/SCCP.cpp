@@ -0,0 +1,339 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // lattice value of a register: not known yet (top), a single constant,
+      // or overdefined (bottom)
+      struct Lattice {
+        enum class State { Unknown, Constant, Overdefined } state = State::Unknown;
+        ir::Constant constant;
+      };
+
+      // Sparse conditional constant propagation (Wegman and Zadeck), only
+      // blocks found executable are evaluated and a phi only merges the
+      // values flowing along executable edges.
+      struct SCCP {
+        ir::Function& fn;
+        Context& ctx;
+
+        SCCP(ir::Function& fn, Context& ctx)
+            : fn(fn), ctx(ctx) {}
+
+        static constexpr uint TERMINATOR = (uint)-1;
+
+        std::vector<Lattice> values;
+        std::vector<bool> executable;
+        std::set<std::pair<uint, uint>> edges; // executable (from, to) edges
+
+        // users of each register, (block, instruction index or TERMINATOR)
+        std::unordered_map<uint, std::vector<std::pair<uint, uint>>> users;
+
+        std::vector<std::pair<uint, uint>> cfg_worklist; // edges
+        std::vector<uint> ssa_worklist;                  // registers
+
+        size_t folded = 0, branches = 0;
+
+        void collect_users() {
+          for (uint b = 0; b < fn.blocks.size(); ++b) {
+            ir::Block& block = fn.blocks[b];
+
+            for (uint i = 0; i < block.body.size(); ++i)
+              for (ir::Value* value : ir::operands(block.body[i]))
+                if (value->index() == 1) users[value->reg().id].push_back({ b, i });
+
+            if (block.terminated)
+              for (ir::Value* value : ir::operands(block.terminator))
+                if (value->index() == 1) users[value->reg().id].push_back({ b, TERMINATOR });
+          }
+        }
+
+        Lattice get(ir::Value& value) {
+          if (value.index() == 0)
+            return Lattice{ .state = Lattice::State::Constant, .constant = fn.constant(value) };
+
+          return values[value.reg().id];
+        }
+        void update(ir::VirtReg& reg, Lattice value) {
+          Lattice& old = values[reg.id];
+          if (old.state == value.state &&
+              (value.state != Lattice::State::Constant || same_constant(old.constant, value.constant)))
+            return;
+
+          // a value only moves down the lattice
+          if (old.state == Lattice::State::Constant && value.state == Lattice::State::Constant)
+            value.state = Lattice::State::Overdefined;
+          if (old.state == Lattice::State::Overdefined)
+            return;
+
+          old = value;
+          ssa_worklist.push_back(reg.id);
+        }
+        void overdefine(ir::VirtReg& reg) {
+          update(reg, Lattice{ .state = Lattice::State::Overdefined, .constant = {} });
+        }
+
+        void meet(Lattice& acc, Lattice value) {
+          if (value.state == Lattice::State::Unknown || acc.state == Lattice::State::Overdefined)
+            return;
+
+          if (acc.state == Lattice::State::Unknown) {
+            acc = value;
+            return;
+          }
+
+          if (value.state == Lattice::State::Overdefined || !same_constant(acc.constant, value.constant))
+            acc.state = Lattice::State::Overdefined;
+        }
+
+        void visit_phi(ir::Phi& phi, uint b) {
+          Lattice acc;
+          for (auto& [pred, value] : phi.incoming) {
+            if (edges.count({ pred, b }))
+              meet(acc, get(value));
+          }
+
+          if (acc.state == Lattice::State::Constant)
+            acc.constant.type = phi.dst.type;
+
+          update(phi.dst, acc);
+        }
+        void visit_instruction(ir::Instruction& inst, uint b) {
+          if (inst.index() == 13)
+            return visit_phi(std::get<13>(inst), b);
+
+          ir::VirtReg* dst = ir::defined_register(inst);
+          if (dst == nullptr)
+            return;
+
+          // allocas, loads and everything we can't evaluate
+          std::vector<ir::Constant> args;
+          bool unknown = false;
+
+          for (ir::Value* value : ir::operands(inst)) {
+            Lattice operand = get(*value);
+
+            if (operand.state == Lattice::State::Overdefined || inst.index() == 0 || inst.index() == 12)
+              return overdefine(*dst);
+
+            if (operand.state == Lattice::State::Unknown)
+              unknown = true;
+
+            args.push_back(operand.constant);
+          }
+
+          if (inst.index() == 0 || inst.index() == 12)
+            return overdefine(*dst);
+
+          // wait until every operand is known
+          if (unknown)
+            return;
+
+          ir::Constant result;
+          if (!fold(inst, args, result))
+            return overdefine(*dst);
+
+          update(*dst, Lattice{ .state = Lattice::State::Constant, .constant = result });
+        }
+        void visit_terminator(ir::Block& block, uint b) {
+          if (!block.terminated)
+            return;
+
+          switch (block.terminator.index()) {
+            case 1: // Branch
+              return mark_edge(b, std::get<1>(block.terminator).target);
+            case 2: // CondBranch
+            {
+              ir::CondBranch& br = std::get<2>(block.terminator);
+              Lattice cond = get(br.cond);
+
+              if (cond.state == Lattice::State::Unknown)
+                return;
+
+              if (cond.state == Lattice::State::Overdefined) {
+                mark_edge(b, br.then_block);
+                mark_edge(b, br.else_block);
+                return;
+              }
+
+              mark_edge(b, taken(cond.constant) ? br.then_block : br.else_block);
+              return;
+            }
+          }
+        }
+        static bool taken(const ir::Constant& cond) {
+          if (cond.value.index() == 0)
+            return std::get<0>(cond.value) != 0;
+
+          return std::get<1>(cond.value) != 0;
+        }
+        void mark_edge(uint from, uint to) {
+          if (edges.insert({ from, to }).second)
+            cfg_worklist.push_back({ from, to });
+        }
+
+        void visit_block(uint b) {
+          ir::Block& block = fn.blocks[b];
+          for (ir::Instruction& inst : block.body)
+            visit_instruction(inst, b);
+
+          visit_terminator(block, b);
+        }
+
+        void solve() {
+          values.assign(fn.nregs, Lattice{});
+          executable.assign(fn.blocks.size(), false);
+
+          for (ir::VirtReg& param : fn.params)
+            values[param.id].state = Lattice::State::Overdefined;
+
+          executable[0] = true;
+          visit_block(0);
+
+          while (!cfg_worklist.empty() || !ssa_worklist.empty()) {
+            while (!cfg_worklist.empty()) {
+              auto [from, to] = cfg_worklist.back();
+              cfg_worklist.pop_back();
+
+              if (!executable[to]) {
+                executable[to] = true;
+                visit_block(to);
+                continue;
+              }
+
+              // a new edge into a block already visited only changes its phis
+              for (ir::Instruction& inst : fn.blocks[to].body) {
+                if (inst.index() != 13)
+                  break;
+
+                visit_phi(std::get<13>(inst), to);
+              }
+            }
+
+            while (!ssa_worklist.empty()) {
+              uint id = ssa_worklist.back();
+              ssa_worklist.pop_back();
+
+              for (auto [b, i] : users[id]) {
+                if (!executable[b])
+                  continue;
+
+                if (i == TERMINATOR)
+                  visit_terminator(fn.blocks[b], b);
+                else
+                  visit_instruction(fn.blocks[b].body[i], b);
+              }
+            }
+          }
+        }
+
+        void replace(ir::Value& value) {
+          if (value.index() != 1)
+            return;
+
+          Lattice& lattice = values[value.reg().id];
+          if (lattice.state != Lattice::State::Constant)
+            return;
+
+          ir::Constant constant = lattice.constant;
+          constant.type = value.reg().type;
+          value = fn.intern(constant);
+        }
+
+        bool rewrite() {
+          bool changed = false;
+
+          for (uint b = 0; b < fn.blocks.size(); ++b) {
+            if (!executable[b])
+              continue;
+
+            ir::Block& block = fn.blocks[b];
+            std::vector<ir::Instruction> body;
+
+            for (ir::Instruction& inst : block.body) {
+              ir::VirtReg* dst = ir::defined_register(inst);
+              if (dst && values[dst->id].state == Lattice::State::Constant) {
+                folded++;
+                changed = true;
+                continue;
+              }
+
+              for (ir::Value* value : ir::operands(inst))
+                replace(*value);
+
+              body.push_back(std::move(inst));
+            }
+
+            block.body = std::move(body);
+
+            if (!block.terminated)
+              continue;
+
+            for (ir::Value* value : ir::operands(block.terminator))
+              replace(*value);
+
+            if (block.terminator.index() == 2) {
+              ir::CondBranch& br = std::get<2>(block.terminator);
+
+              if (br.cond.index() == 0) {
+                uint target = taken(fn.constant(br.cond)) ? br.then_block : br.else_block;
+                block.terminator = ir::Branch{ .target = target };
+                branches++;
+                changed = true;
+              }
+            }
+          }
+
+          if (!changed)
+            return false;
+
+          // drop the phi entries of edges that are gone, then the blocks
+          // nothing reaches anymore
+          ir::rebuild_cfg(fn);
+
+          for (ir::Block& block : fn.blocks) {
+            for (ir::Instruction& inst : block.body) {
+              if (inst.index() != 13)
+                break;
+
+              std::vector<std::pair<uint, ir::Value>>& incoming = std::get<13>(inst).incoming;
+              std::vector<std::pair<uint, ir::Value>> kept;
+
+              for (auto& entry : incoming) {
+                if (std::find(block.preds.begin(), block.preds.end(), entry.first) != block.preds.end())
+                  kept.push_back(entry);
+              }
+
+              incoming = std::move(kept);
+            }
+          }
+
+          ir::remove_unreachable_blocks(fn);
+          return true;
+        }
+
+        bool run() {
+          collect_users();
+          solve();
+
+          size_t before = fn.blocks.size();
+          bool changed = rewrite();
+
+          ctx.stats.add("sccp", "values folded", folded);
+          ctx.stats.add("sccp", "branches folded", branches);
+          ctx.stats.add("sccp", "blocks removed", before - fn.blocks.size());
+          return changed;
+        }
+      };
+    } // namespace
+
+    bool sccp(ir::Function& fn, Context& ctx) {
+      return SCCP(fn, ctx).run();
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,413 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <cfloat>
+#include <cmath>
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // Hacker's Delight signed magic numbers: for a `bits` wide `divisor`
+      // (>= 2, not a power of two), x / divisor == mulhi(x, multiplier) (+ x
+      // when the multiplier is negative) >> shift, plus one when x < 0.
+      void magic(uint64_t divisor, uint bits, int64_t& multiplier, uint& shift) {
+        uint64_t mask = (bits == 64) ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+        uint64_t two = (uint64_t)1 << (bits - 1);
+
+        uint64_t anc = two - 1 - two % divisor; // absolute value of nc
+        uint p = bits - 1;
+        uint64_t q1 = two / anc, r1 = two - q1 * anc;
+        uint64_t q2 = two / divisor, r2 = two - q2 * divisor;
+        uint64_t delta;
+
+        do {
+          p++;
+          q1 = (2 * q1) & mask;
+          r1 = (2 * r1) & mask;
+          if (r1 >= anc) {
+            q1 = (q1 + 1) & mask;
+            r1 = (r1 - anc) & mask;
+          }
+
+          q2 = (2 * q2) & mask;
+          r2 = (2 * r2) & mask;
+          if (r2 >= divisor) {
+            q2 = (q2 + 1) & mask;
+            r2 = (r2 - divisor) & mask;
+          }
+
+          delta = divisor - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+
+        multiplier = wrap((int64_t)(q2 + 1), bits / 8);
+        shift = p - bits;
+      }
+
+      // log2 of a positive power of two, -1 otherwise
+      int power_of_two(int64_t value) {
+        if (value <= 0 || (value & (value - 1)) != 0)
+          return -1;
+
+        return __builtin_ctzll((uint64_t)value);
+      }
+
+      // Peephole rewrites of integer arithmetic: identities, constant
+      // chains and strength reduction of multiplications and divisions by
+      // constants. Floating point only gets the rewrites that are exact,
+      // unless `-fassociative-math`/`-freciprocal-math` allow more.
+      struct Simplifier {
+        ir::Function& fn;
+        Context& ctx;
+
+        Simplifier(ir::Function& fn, Context& ctx)
+            : fn(fn), ctx(ctx) {}
+
+        Replacements replacements;
+        std::unordered_map<uint, ir::BinOp> defs; // binops seen so far
+
+        std::vector<ir::Instruction>* out = nullptr;
+        size_t identities = 0, chains = 0, shifts = 0, divisions = 0, reciprocals = 0;
+
+        bool constant(ir::Value& value, int64_t& result) {
+          if (value.index() != 0 || fn.constant(value).value.index() != 0)
+            return false;
+
+          result = std::get<0>(fn.constant(value).value);
+          return true;
+        }
+        bool constant(ir::Value& value, double& result) {
+          if (value.index() != 0 || fn.constant(value).value.index() != 1)
+            return false;
+
+          result = std::get<1>(fn.constant(value).value);
+          return true;
+        }
+        static bool same(ir::Value& a, ir::Value& b) {
+          return a.index() == 1 && b.index() == 1 && a.reg().id == b.reg().id;
+        }
+
+        ir::Value integer(ir::Type type, int64_t value) {
+          return fn.intern(make_constant(type, value));
+        }
+        ir::Value floating(ir::Type type, double value) {
+          return fn.intern(make_constant(type, value));
+        }
+        // appends `lhs op rhs` to the block, into a fresh register unless
+        // `dst` is given
+        ir::VirtReg emit(ir::BinOp::Op op, ir::Value lhs, ir::Value rhs, ir::Type type, ir::VirtReg* dst = nullptr) {
+          ir::VirtReg reg = dst ? *dst : ir::VirtReg{ .id = fn.nregs++, .type = type };
+          ir::BinOp binop{ .op = op, .lhs = lhs, .rhs = rhs, .dst = reg };
+
+          defs[reg.id] = binop;
+          out->push_back(binop);
+          return reg;
+        }
+
+        // the binop is replaced by `value`
+        void replace(ir::BinOp& binop, ir::Value value) {
+          replacements.add(binop.dst, value);
+          identities++;
+        }
+
+        // x / 2^k rounding towards zero: negative dividends are biased by
+        // 2^k - 1 first
+        ir::Value divide_power_of_two(ir::Value x, uint k, ir::Type type) {
+          uint bits = type.size * 8;
+          ir::Value bias;
+
+          if (k == 1)
+            bias = emit(ir::BinOp::Op::Shr, x, integer(type, bits - 1), type);
+          else {
+            ir::VirtReg sign = emit(ir::BinOp::Op::Sar, x, integer(type, bits - 1), type);
+            bias = emit(ir::BinOp::Op::Shr, sign, integer(type, bits - k), type);
+          }
+
+          ir::VirtReg biased = emit(ir::BinOp::Op::Add, x, bias, type);
+          return emit(ir::BinOp::Op::Sar, biased, integer(type, k), type);
+        }
+        ir::Value divide_magic(ir::Value x, uint64_t divisor, ir::Type type) {
+          uint bits = type.size * 8;
+          int64_t multiplier;
+          uint shift;
+          magic(divisor, bits, multiplier, shift);
+
+          ir::Value q = emit(ir::BinOp::Op::MulHi, x, integer(type, multiplier), type);
+          if (multiplier < 0)
+            q = emit(ir::BinOp::Op::Add, q, x, type);
+          if (shift > 0)
+            q = emit(ir::BinOp::Op::Sar, q, integer(type, shift), type);
+
+          ir::VirtReg sign = emit(ir::BinOp::Op::Shr, x, integer(type, bits - 1), type);
+          return emit(ir::BinOp::Op::Add, q, sign, type);
+        }
+        // the quotient of x / divisor (|divisor| >= 2) without `idiv`, or
+        // nothing if it isn't worth it
+        bool divide(ir::Value x, int64_t divisor, ir::Type type, ir::Value& result) {
+          uint64_t magnitude = (divisor < 0) ? -(uint64_t)divisor : (uint64_t)divisor;
+          int k = power_of_two((int64_t)magnitude);
+
+          // the minimum value of the type is its own magnitude
+          if (magnitude == ((uint64_t)1 << (type.size * 8 - 1)))
+            return false;
+
+          if (k > 0)
+            result = divide_power_of_two(x, k, type);
+          else if (type.size == 4 || type.size == 8)
+            result = divide_magic(x, magnitude, type);
+          else
+            return false; // `MulHi` only has 32/64-bit forms
+
+          if (divisor < 0)
+            result = emit(ir::BinOp::Op::Sub, integer(type, 0), result, type);
+
+          return true;
+        }
+
+        // returns false when the binop was rewritten and shouldn't be kept
+        bool simplify_integer(ir::BinOp& binop) {
+          ir::Type type = binop.dst.type;
+          int64_t c = 0, inner = 0;
+
+          // constants go on the right of commutative operations
+          if ((binop.op == ir::BinOp::Op::Add || binop.op == ir::BinOp::Op::Mul) &&
+              binop.lhs.index() == 0 && binop.rhs.index() == 1)
+            std::swap(binop.lhs, binop.rhs);
+
+          // x - c => x + (-c), so constant chains only come in one shape
+          if (binop.op == ir::BinOp::Op::Sub && constant(binop.rhs, c) && c != 0) {
+            binop.op = ir::BinOp::Op::Add;
+            binop.rhs = integer(type, -(uint64_t)c);
+          }
+
+          if (binop.op == ir::BinOp::Op::Sub && same(binop.lhs, binop.rhs)) {
+            replace(binop, integer(type, 0));
+            return false;
+          }
+
+          if (!constant(binop.rhs, c))
+            return true;
+
+          // (x + c1) + c2 => x + (c1 + c2), (x * c1) * c2 => x * (c1 * c2)
+          if ((binop.op == ir::BinOp::Op::Add || binop.op == ir::BinOp::Op::Mul) && binop.lhs.index() == 1) {
+            auto it = defs.find(binop.lhs.reg().id);
+
+            if (it != defs.end() && it->second.op == binop.op && it->second.lhs.index() == 1 &&
+                constant(it->second.rhs, inner)) {
+              uint64_t combined = (binop.op == ir::BinOp::Op::Add) ? (uint64_t)inner + (uint64_t)c
+                                                                   : (uint64_t)inner * (uint64_t)c;
+              binop.lhs = it->second.lhs;
+              binop.rhs = integer(type, (int64_t)combined);
+              c = std::get<0>(fn.constant(binop.rhs).value);
+              chains++;
+            }
+          }
+
+          switch (binop.op) {
+            case ir::BinOp::Op::Add:
+            case ir::BinOp::Op::Sub:
+            case ir::BinOp::Op::Shl:
+            case ir::BinOp::Op::Sar:
+            case ir::BinOp::Op::Shr:
+            {
+              if (c != 0)
+                return true;
+
+              replace(binop, binop.lhs);
+              return false;
+            }
+            case ir::BinOp::Op::Mul:
+            {
+              if (c == 0 || c == 1) {
+                replace(binop, (c == 0) ? integer(type, 0) : binop.lhs);
+                return false;
+              }
+
+              if (c == -1) {
+                binop.op = ir::BinOp::Op::Sub;
+                binop.rhs = binop.lhs;
+                binop.lhs = integer(type, 0);
+                return true;
+              }
+
+              int k = power_of_two(c);
+              if (k > 0) {
+                binop.op = ir::BinOp::Op::Shl;
+                binop.rhs = integer(type, k);
+                shifts++;
+              }
+
+              return true;
+            }
+            case ir::BinOp::Op::Div:
+            case ir::BinOp::Op::Rem:
+            {
+              bool rem = binop.op == ir::BinOp::Op::Rem;
+
+              if (c == 1 || c == -1) {
+                if (rem)
+                  replace(binop, integer(type, 0));
+                else if (c == 1)
+                  replace(binop, binop.lhs);
+                else
+                  emit(ir::BinOp::Op::Sub, integer(type, 0), binop.lhs, type, &binop.dst);
+
+                return false;
+              }
+
+              if (c == 0)
+                return true; // traps, leave it
+
+              ir::Value quotient;
+              if (!divide(binop.lhs, c, type, quotient))
+                return true;
+
+              if (!rem) {
+                // the last instruction computes the quotient, it takes over
+                // the binop's register
+                std::get<2>(out->back()).dst = binop.dst;
+                defs[binop.dst.id] = std::get<2>(out->back());
+              } else {
+                // x % c = x - (x / c) * c, the shift only multiplies by
+                // positive powers of two
+                ir::VirtReg product = (c > 0 && power_of_two(c) > 0)
+                                          ? emit(ir::BinOp::Op::Shl, quotient, integer(type, power_of_two(c)), type)
+                                          : emit(ir::BinOp::Op::Mul, quotient, integer(type, c), type);
+                emit(ir::BinOp::Op::Sub, binop.lhs, product, type, &binop.dst);
+              }
+
+              divisions++;
+              return false;
+            }
+            default:
+              return true;
+          }
+        }
+
+        // x / c == x * (1 / c) for every x when 1 / c is exact: c is a power
+        // of two whose reciprocal is a normal number
+        static bool exact_reciprocal(double c, const ir::Type& type) {
+          int exponent;
+          if (std::fabs(std::frexp(c, &exponent)) != 0.5)
+            return false;
+
+          double r = std::fabs(1.0 / c);
+          return (type.size == 4) ? (r >= FLT_MIN && r <= FLT_MAX) : (r >= DBL_MIN && r <= DBL_MAX);
+        }
+
+        bool simplify_float(ir::BinOp& binop) {
+          ir::Type type = binop.dst.type;
+          double c = 0, inner = 0;
+
+          if ((binop.op == ir::BinOp::Op::Add || binop.op == ir::BinOp::Op::Mul) && binop.lhs.index() == 0 &&
+              binop.rhs.index() == 1)
+            std::swap(binop.lhs, binop.rhs);
+
+          if (!constant(binop.rhs, c))
+            return true;
+
+          // x - c => x + (-c) is exact, so constant chains only come in one
+          // shape
+          if (binop.op == ir::BinOp::Op::Sub) {
+            binop.op = ir::BinOp::Op::Add;
+            binop.rhs = floating(type, -c);
+            c = -c;
+          }
+
+          if (binop.op == ir::BinOp::Op::Div && c != 0 && std::isfinite(c) &&
+              (exact_reciprocal(c, type) || ctx.opts.fp_reciprocal)) {
+            binop.op = ir::BinOp::Op::Mul;
+            binop.rhs = floating(type, round_to(1.0 / c, type));
+            c = std::get<1>(fn.constant(binop.rhs).value);
+            reciprocals++;
+          }
+
+          // (x + c1) + c2 => x + (c1 + c2), (x * c1) * c2 => x * (c1 * c2),
+          // rounding once instead of twice changes the result
+          if (ctx.opts.fp_reassociate && (binop.op == ir::BinOp::Op::Add || binop.op == ir::BinOp::Op::Mul) &&
+              binop.lhs.index() == 1) {
+            auto it = defs.find(binop.lhs.reg().id);
+
+            if (it != defs.end() && it->second.op == binop.op && it->second.lhs.index() == 1 &&
+                it->second.dst.type.lanes == 1 && constant(it->second.rhs, inner)) {
+              double combined = (binop.op == ir::BinOp::Op::Add) ? inner + c : inner * c;
+              binop.lhs = it->second.lhs;
+              binop.rhs = floating(type, round_to(combined, type));
+              c = std::get<1>(fn.constant(binop.rhs).value);
+              chains++;
+            }
+          }
+
+          // only the exact ones: x * 1, x / 1 and x + -0 keep every input
+          // (including -0 and NaN) as is
+          bool identity = false;
+          switch (binop.op) {
+            case ir::BinOp::Op::Mul:
+            case ir::BinOp::Op::Div:
+              identity = c == 1.0;
+              break;
+            case ir::BinOp::Op::Add:
+              identity = c == 0.0 && std::signbit(c);
+              break;
+            default:
+              break;
+          }
+
+          if (!identity)
+            return true;
+
+          replace(binop, binop.lhs);
+          return false;
+        }
+
+        bool run() {
+          for (uint b : ir::reverse_post_order(fn)) {
+            ir::Block& block = fn.blocks[b];
+            std::vector<ir::Instruction> body;
+            out = &body;
+
+            for (ir::Instruction& inst : block.body) {
+              for (ir::Value* value : ir::operands(inst))
+                replacements.resolve(*value);
+
+              // the identities below produce scalar constants
+              if (inst.index() != 2 || std::get<2>(inst).dst.type.lanes != 1) {
+                body.push_back(std::move(inst));
+                continue;
+              }
+
+              ir::BinOp& binop = std::get<2>(inst);
+              bool keep = (binop.dst.type.kind == ir::Type::Kind::Float) ? simplify_float(binop)
+                                                                          : simplify_integer(binop);
+              if (!keep)
+                continue;
+
+              defs[binop.dst.id] = binop;
+              body.push_back(std::move(inst));
+            }
+
+            block.body = std::move(body);
+
+            if (block.terminated)
+              for (ir::Value* value : ir::operands(block.terminator))
+                replacements.resolve(*value);
+          }
+
+          replacements.apply(fn);
+
+          ctx.stats.add("simplify", "identities removed", identities);
+          ctx.stats.add("simplify", "constant chains folded", chains);
+          ctx.stats.add("simplify", "multiplies turned into shifts", shifts);
+          ctx.stats.add("simplify", "divisions without idiv", divisions);
+          ctx.stats.add("simplify", "divisions turned into multiplies", reciprocals);
+          return identities + chains + shifts + divisions + reciprocals != 0;
+        }
+      };
+    } // namespace
+
+    bool simplify(ir::Function& fn, Context& ctx) {
+      return Simplifier(fn, ctx).run();
+    }
+  } // namespace opt
+} // namespace phantom
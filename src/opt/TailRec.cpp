@@ -0,0 +1,138 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Rewrite.hpp"
+#include <algorithm>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      bool same_type(const ir::Type& a, const ir::Type& b) {
+        return a.kind == b.kind && a.size == b.size && a.is_void == b.is_void;
+      }
+
+      // the call ending `block` whose result is returned right away, if the
+      // callee is the function itself
+      ir::Call* recursive_tail_call(ir::Function& fn, uint b) {
+        ir::Block& block = fn.blocks[b];
+        if (block.body.empty() || block.body.back().index() != 14)
+          return nullptr;
+
+        ir::Call& call = std::get<14>(block.body.back());
+        if (*call.callee != fn.name || call.args.size() != fn.params.size())
+          return nullptr;
+
+        for (size_t i = 0; i < call.args.size(); ++i)
+          if (!same_type(ir::type_of(call.args[i]), fn.params[i].type))
+            return nullptr;
+
+        return ir::returns_register(fn, b, call.dst) ? &call : nullptr;
+      }
+    } // namespace
+
+    // Self-recursive calls in tail position become branches back to the top
+    // of the function: the entry block is split after its allocas, the rest
+    // of it is a loop header with a phi per parameter, fed by the arguments
+    // of every recursive call. Loop passes then see an ordinary loop.
+    bool tailrec(ir::Function& fn, Context& ctx) {
+      std::vector<uint> sites;
+      for (uint b = 0; b < fn.blocks.size(); ++b)
+        if (recursive_tail_call(fn, b) != nullptr)
+          sites.push_back(b);
+
+      if (sites.empty())
+        return false;
+
+      // the header gets the phis, an entry block that already is a loop
+      // header has phis of its own without an incoming for the function entry
+      if (!fn.blocks[0].preds.empty()) {
+        ctx.remarks.add("tailrec", "tail recursion in @" + fn.name + " not removed: the entry block is a loop header");
+        return false;
+      }
+
+      uint header = fn.blocks.size();
+
+      // the successors of the entry are going to be reached from the header
+      if (fn.blocks[0].terminated) {
+        for (uint succ : ir::successors(fn.blocks[0].terminator)) {
+          for (ir::Instruction& inst : fn.blocks[succ].body) {
+            if (inst.index() != 13)
+              break;
+
+            for (auto& [pred, value] : std::get<13>(inst).incoming)
+              if (pred == 0)
+                pred = header;
+          }
+        }
+      }
+
+      // the parameters are replaced by the phis everywhere, the recursive
+      // calls' arguments included
+      Replacements replacements;
+      std::vector<ir::Phi> phis;
+      for (ir::VirtReg& param : fn.params) {
+        ir::VirtReg reg{ .id = fn.nregs++, .type = param.type };
+        phis.push_back(ir::Phi{ .incoming = { { 0, param } }, .dst = reg });
+        replacements.add(param, reg);
+      }
+      replacements.apply(fn);
+
+      for (uint b : sites) {
+        ir::Block& block = fn.blocks[b];
+        ir::Call& call = *recursive_tail_call(fn, b);
+
+        // a call in the entry block ends up in the header
+        for (size_t i = 0; i < phis.size(); ++i)
+          phis[i].incoming.push_back({ (b == 0) ? header : b, call.args[i] });
+
+        // the return block the call may have branched to loses an edge
+        if (block.terminated) {
+          for (uint succ : ir::successors(block.terminator)) {
+            for (ir::Instruction& inst : fn.blocks[succ].body) {
+              if (inst.index() != 13)
+                break;
+
+              auto& incoming = std::get<13>(inst).incoming;
+              incoming.erase(std::remove_if(incoming.begin(), incoming.end(), [&](auto& in) { return in.first == b; }),
+                             incoming.end());
+            }
+          }
+        }
+
+        block.body.pop_back();
+        block.terminator = ir::Branch{ .target = header };
+        block.terminated = true;
+      }
+
+      // everything after the allocas moves to the header, the entry keeps
+      // the allocas so they still happen once
+      ir::Block& entry = fn.blocks[0];
+      ir::Block loop;
+
+      std::vector<ir::Instruction> allocas;
+      for (ir::Phi& phi : phis)
+        loop.body.push_back(std::move(phi));
+
+      for (ir::Instruction& inst : entry.body) {
+        if (inst.index() == 0)
+          allocas.push_back(std::move(inst));
+        else
+          loop.body.push_back(std::move(inst));
+      }
+
+      loop.terminator = entry.terminator;
+      loop.terminated = entry.terminated;
+
+      entry.body = std::move(allocas);
+      entry.terminator = ir::Branch{ .target = header };
+      entry.terminated = true;
+
+      fn.blocks.push_back(std::move(loop));
+      ir::rebuild_cfg(fn);
+
+      ctx.remarks.add("tailrec", "tail recursion in @" + fn.name + " turned into a loop (" +
+                                     std::to_string(sites.size()) + " call" + (sites.size() == 1 ? "" : "s") + ")");
+      ctx.stats.add("tailrec", "recursive calls removed", sites.size());
+      return true;
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,221 @@
+#include "opt/Fold.hpp"
+#include "opt/Passes.hpp"
+#include "opt/Ranges.hpp"
+#include "opt/Rewrite.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // Rewrites what the value ranges prove: registers that only hold one
+      // value become constants (comparisons whose outcome is known, bounds
+      // checks among them), 64-bit arithmetic on sign extended 32-bit values
+      // that can't overflow 32 bits is done in 32 bits, and comparisons and
+      // array indices use the values before their sign extension (the
+      // addressing extends the index anyway).
+      struct RangePropagation {
+        ir::Function& fn;
+        Context& ctx;
+        Ranges& ranges;
+
+        RangePropagation(ir::Function& fn, Context& ctx, Ranges& ranges)
+            : fn(fn), ctx(ctx), ranges(ranges) {}
+
+        Replacements replacements;
+        // widening `IntExtend`s: register -> the value it extends
+        std::unordered_map<uint, ir::Value> extended;
+        // array allocas -> their length
+        std::unordered_map<uint, uint> lengths;
+
+        size_t folded = 0, decided = 0, narrowed = 0, extensions = 0;
+        size_t accesses = 0, in_bounds = 0;
+
+        // `value` as a `type` value with the same meaning: the source of its
+        // sign extension or a constant that fits, false if there is none
+        bool narrow(const ir::Value& value, const ir::Type& type, ir::Value& result) {
+          ir::Value resolved = value;
+          replacements.resolve(resolved);
+
+          if (resolved.index() == 0) {
+            Range range = ranges.range(resolved);
+            Range limits = Ranges::full(type);
+            if (range.empty() || range.lo < limits.lo || range.hi > limits.hi)
+              return false;
+
+            result = fn.intern(make_constant(type, range.lo));
+            return true;
+          }
+
+          auto it = extended.find(resolved.reg().id);
+          if (it == extended.end() || ir::type_of(it->second).size != type.size)
+            return false;
+
+          result = it->second;
+          return true;
+        }
+        // the narrowest type both operands of a comparison come from
+        bool narrow_pair(ir::Value& lhs, ir::Value& rhs) {
+          ir::Value a, b;
+
+          for (const ir::Value* side : { &lhs, &rhs }) {
+            if (side->index() != 1)
+              continue;
+
+            auto it = extended.find(side->reg().id);
+            if (it == extended.end())
+              continue;
+
+            ir::Type type = ir::type_of(it->second);
+            if (narrow(lhs, type, a) && narrow(rhs, type, b)) {
+              lhs = a;
+              rhs = b;
+              return true;
+            }
+          }
+
+          return false;
+        }
+
+        // i64 `x op y` of sign extended i32 values that stays in the i32
+        // range: `sext(x' op y')`
+        bool narrow_binop(ir::BinOp& binop, std::vector<ir::Instruction>& body) {
+          if (!Ranges::tracked(binop.dst.type) || binop.dst.type.size != 8 || (binop.op != ir::BinOp::Op::Add && binop.op != ir::BinOp::Op::Sub &&
+                                           binop.op != ir::BinOp::Op::Mul))
+            return false;
+
+          ir::Type narrow_type = binop.dst.type;
+          narrow_type.size = 4;
+
+          Range range = ranges.range(binop.dst);
+          Range limits = Ranges::full(narrow_type);
+          if (range.empty() || range.lo < limits.lo || range.hi > limits.hi)
+            return false;
+
+          ir::Value lhs, rhs;
+          if (!narrow(binop.lhs, narrow_type, lhs) || !narrow(binop.rhs, narrow_type, rhs))
+            return false;
+
+          ir::VirtReg result{ .id = fn.nregs++, .type = narrow_type };
+          body.push_back(ir::BinOp{ .op = binop.op, .lhs = lhs, .rhs = rhs, .dst = result });
+          body.push_back(ir::IntExtend{ .value = result, .dst = binop.dst });
+          extended[binop.dst.id] = result;
+
+          narrowed++;
+          return true;
+        }
+
+        // the addressing sign extends the index itself
+        void narrow_index(ir::Value& index) {
+          replacements.resolve(index);
+          if (index.index() != 1)
+            return;
+
+          auto it = extended.find(index.reg().id);
+          if (it == extended.end())
+            return;
+
+          index = it->second;
+          extensions++;
+        }
+
+        void check_bounds(ir::VirtReg& array, ir::Value& index, uint b) {
+          auto it = lengths.find(array.id);
+          if (it == lengths.end() || index.index() != 1)
+            return;
+
+          accesses++;
+          Range range = ranges.range(index, b);
+          if (!range.empty() && range.lo >= 0 && range.hi < (int64_t)it->second)
+            in_bounds++;
+          else if (!range.empty() && (range.hi < 0 || range.lo >= (int64_t)it->second))
+            ctx.remarks.add("vrp", "bb" + std::to_string(b) + " in @" + fn.name + " always indexes %" +
+                                       std::to_string(array.id) + " out of bounds");
+        }
+
+        void run_block(uint b) {
+          std::vector<ir::Instruction> body;
+          body.reserve(fn.blocks[b].body.size());
+
+          for (ir::Instruction& inst : fn.blocks[b].body) {
+            ir::VirtReg* dst = ir::defined_register(inst);
+
+            if (dst && inst.index() != 0 && !ir::has_side_effects(inst) && Ranges::tracked(dst->type)) {
+              Range range = ranges.range(*dst);
+
+              if (!range.empty() && range.constant()) {
+                replacements.add(*dst, fn.intern(make_constant(dst->type, range.lo)));
+                (inst.index() == 11) ? decided++ : folded++;
+                continue;
+              }
+            }
+
+            switch (inst.index()) {
+              case 2: // BinOp
+                if (narrow_binop(std::get<2>(inst), body))
+                  continue;
+                break;
+              case 10: // IntExtend
+              {
+                ir::IntExtend& ext = std::get<10>(inst);
+                if (ir::type_of(ext.value).size < ext.dst.type.size)
+                  extended[ext.dst.id] = ext.value;
+                break;
+              }
+              case 11: // Cmp
+              {
+                ir::Cmp& cmp = std::get<11>(inst);
+                if (Ranges::tracked(ir::type_of(cmp.lhs)) && narrow_pair(cmp.lhs, cmp.rhs))
+                  extensions++;
+                break;
+              }
+              case 15: // ElemLoad
+                check_bounds(std::get<15>(inst).array, std::get<15>(inst).index, b);
+                narrow_index(std::get<15>(inst).index);
+                break;
+              case 16: // ElemStore
+                check_bounds(std::get<16>(inst).array, std::get<16>(inst).index, b);
+                narrow_index(std::get<16>(inst).index);
+                break;
+            }
+
+            body.push_back(std::move(inst));
+          }
+
+          fn.blocks[b].body = std::move(body);
+        }
+
+        bool run() {
+          for (ir::Block& block : fn.blocks)
+            for (ir::Instruction& inst : block.body)
+              if (inst.index() == 0 && std::get<0>(inst).count != 0)
+                lengths[std::get<0>(inst).reg.id] = std::get<0>(inst).count;
+
+          // definitions before their uses, except along back edges
+          for (uint b : ranges.dom.order)
+            run_block(b);
+
+          replacements.apply(fn);
+
+          ctx.stats.add("vrp", "values folded", folded);
+          ctx.stats.add("vrp", "comparisons decided", decided);
+          ctx.stats.add("vrp", "operations narrowed", narrowed);
+          ctx.stats.add("vrp", "sign extensions bypassed", extensions);
+          ctx.stats.add("vrp", "array accesses proven in bounds", in_bounds);
+
+          if (accesses != 0)
+            ctx.remarks.add("vrp", "@" + fn.name + ": " + std::to_string(in_bounds) + " of " + std::to_string(accesses) +
+                                       " array accesses proven in bounds");
+
+          return folded + decided + narrowed + extensions != 0;
+        }
+      };
+    } // namespace
+
+    // Value range propagation, see `Ranges` for the analysis. Branches on
+    // the comparisons it decides are left for `sccp` to fold.
+    bool vrp(ir::Function& fn, Context& ctx) {
+      Ranges& ranges = ctx.analyses.get<Ranges>(fn);
+      return RangePropagation(fn, ctx, ranges).run();
+    }
+  } // namespace opt
+} // namespace phantom
@@ -0,0 +1,552 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Fold.hpp"
+#include "opt/Loops.hpp"
+#include "opt/Passes.hpp"
+#include <unordered_map>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      // `phi = [pre: init, latch: next]` where `next` is `phi` plus and
+      // minus values computed by the loop
+      struct Reduction {
+        ir::VirtReg phi;
+        ir::Value init;
+        ir::VirtReg next;
+      };
+
+      // what a loop has to look like to be vectorized
+      struct Plan {
+        uint loop, pre, latch;
+        std::vector<uint> body; // the blocks from the header to the latch
+
+        ir::VirtReg iv;   // `iv = [pre: init, latch: iv + 1]`
+        ir::Value init;
+        ir::VirtReg next; // `iv + 1`
+        ir::Value bound;  // the loop runs while `iv < bound`
+
+        std::vector<Reduction> reductions;
+        uint size = 0; // bytes of every element
+      };
+
+      // Turns innermost counted loops over arrays into a vector loop that
+      // handles `lanes` iterations at a time, followed by the original loop
+      // which finishes the last ones:
+      //
+      //   pre -> vheader <-> vbody         vector loop
+      //            |
+      //           mid -> header <-> ...    the scalar loop as the epilogue
+      //
+      // Every array is accessed at the induction variable, so iterations
+      // never depend on each other and elements are read and written in
+      // whole vectors. Floating point reductions are only vectorized with
+      // `-fassociative-math`, adding floats in another order changes the
+      // result.
+      struct Vectorizer {
+        ir::Function& fn;
+        Context& ctx;
+        Loops& info;
+        uint width; // bytes of a vector register
+
+        Vectorizer(ir::Function& fn, Context& ctx, Loops& info, uint width)
+            : fn(fn), ctx(ctx), info(info), width(width) {}
+
+        std::vector<uint> def_block; // the block defining each register
+        size_t vectorized = 0;
+
+        void reject(Plan& plan, const std::string& reason) {
+          ctx.remarks.add("vectorize", "loop bb" + std::to_string(info.loops[plan.loop].header) + " in @" + fn.name +
+                                           " not vectorized: " + reason);
+        }
+
+        bool same(const ir::Value& value, const ir::VirtReg& reg) {
+          return value.index() == 1 && value.reg().id == reg.id;
+        }
+        bool invariant(Plan& plan, ir::Value& value) {
+          if (value.index() == 0)
+            return true;
+
+          uint block = def_block[value.reg().id];
+          return block == Loops::NONE || !info.loops[plan.loop].contains(block);
+        }
+        bool supported(ir::Type& type) {
+          return type.lanes == 1 && (type.size == 4 || type.size == 8);
+        }
+        bool element(Plan& plan, ir::Type& type) {
+          if (!supported(type))
+            return false;
+
+          if (plan.size == 0)
+            plan.size = type.size;
+
+          return type.size == plan.size;
+        }
+
+        // the shape of the header: phis then `iv < bound` branching into
+        // the loop, the body a straight line of blocks up to the latch
+        bool shape(Plan& plan) {
+          Loop& loop = info.loops[plan.loop];
+          ir::Block& header = fn.blocks[loop.header];
+
+          for (Loop& other : info.loops) {
+            if (other.parent == plan.loop) {
+              reject(plan, "not an innermost loop");
+              return false;
+            }
+          }
+
+          if (loop.latches.size() != 1 || !header.terminated || header.terminator.index() != 2 || header.body.empty()) {
+            reject(plan, "not a counted loop");
+            return false;
+          }
+
+          plan.latch = loop.latches[0];
+          ir::CondBranch& br = std::get<2>(header.terminator);
+          ir::Instruction& last = header.body.back();
+
+          if (last.index() != 11 || !same(br.cond, std::get<11>(last).dst) ||
+              !loop.contains(br.then_block) || loop.contains(br.else_block)) {
+            reject(plan, "the header doesn't test the trip count");
+            return false;
+          }
+
+          for (size_t i = 0; i + 1 < header.body.size(); ++i) {
+            if (header.body[i].index() != 13) {
+              reject(plan, "the header computes more than its test");
+              return false;
+            }
+          }
+
+          for (uint b = br.then_block; b != loop.header;) {
+            ir::Block& block = fn.blocks[b];
+            if (!loop.contains(b) || plan.body.size() >= loop.blocks.size() || !block.terminated ||
+                block.terminator.index() != 1) {
+              reject(plan, "control flow in the body");
+              return false;
+            }
+
+            plan.body.push_back(b);
+            b = std::get<1>(block.terminator).target;
+          }
+
+          if (plan.body.size() + 1 != loop.blocks.size() || plan.body.back() != plan.latch) {
+            reject(plan, "control flow in the body");
+            return false;
+          }
+
+          // `iv < bound`, with `iv` stepping by one
+          ir::Cmp& cmp = std::get<11>(last);
+          bool found = false;
+
+          for (ir::Instruction& inst : header.body) {
+            if (inst.index() != 13 || !same(cmp.lhs, std::get<13>(inst).dst))
+              continue;
+
+            ir::Phi& phi = std::get<13>(inst);
+            plan.iv = phi.dst;
+
+            for (auto& [pred, value] : phi.incoming) {
+              if (pred == plan.pre)
+                plan.init = value;
+              else if (value.index() == 1) {
+                plan.next = value.reg();
+                found = true;
+              }
+            }
+          }
+
+          ir::Instruction* step = nullptr;
+          for (uint b : plan.body)
+            for (ir::Instruction& inst : fn.blocks[b].body)
+              if (ir::VirtReg* reg = ir::defined_register(inst); found && reg && reg->id == plan.next.id)
+                step = &inst;
+
+          bool counted = cmp.pred == ir::Cmp::Pred::Lt && plan.iv.type.kind == ir::Type::Kind::Int &&
+                         step != nullptr && step->index() == 2 && invariant(plan, cmp.rhs);
+          if (counted) {
+            ir::BinOp& add = std::get<2>(*step);
+            ir::Value* one = same(add.lhs, plan.iv) ? &add.rhs : same(add.rhs, plan.iv) ? &add.lhs : nullptr;
+
+            counted = add.op == ir::BinOp::Op::Add && one != nullptr && one->index() == 0 &&
+                      std::get<0>(fn.constant(*one).value) == 1;
+          }
+
+          if (!counted) {
+            reject(plan, "the trip count isn't `iv < n` with `iv` stepping by one");
+            return false;
+          }
+
+          plan.bound = cmp.rhs;
+          return true;
+        }
+
+        // the other phis of the header have to be sums
+        bool reductions(Plan& plan) {
+          for (ir::Instruction& inst : fn.blocks[info.loops[plan.loop].header].body) {
+            if (inst.index() != 13 || std::get<13>(inst).dst.id == plan.iv.id)
+              continue;
+
+            ir::Phi& phi = std::get<13>(inst);
+            Reduction reduction{ .phi = phi.dst, .init = {}, .next = {} };
+            bool found = false;
+
+            for (auto& [pred, value] : phi.incoming) {
+              if (pred == plan.pre)
+                reduction.init = value;
+              else if (value.index() == 1) {
+                reduction.next = value.reg();
+                found = true;
+              }
+            }
+
+            // the sum of floats depends on the order it's done in
+            if (phi.dst.type.kind == ir::Type::Kind::Float && !ctx.opts.fp_reassociate) {
+              reject(plan, "%" + std::to_string(phi.dst.id) + " is a floating point sum");
+              return false;
+            }
+
+            if (!found || !element(plan, phi.dst.type)) {
+              reject(plan, "%" + std::to_string(phi.dst.id) + " isn't a sum");
+              return false;
+            }
+
+            plan.reductions.push_back(reduction);
+          }
+
+          return true;
+        }
+
+        // every instruction of the body has a vector form, and its operands
+        // are vectors too or the same for every lane
+        bool body(Plan& plan) {
+          // the induction variable and the phis are defined in the loop
+          // without a vector form, so they can't be operands. A partial sum
+          // can only be added to (or subtracted from) to get another one.
+          std::unordered_map<uint, bool> vectors;
+          std::unordered_map<uint, size_t> partial; // register -> its reduction
+          bool memory = false;
+
+          for (size_t r = 0; r < plan.reductions.size(); ++r)
+            partial[plan.reductions[r].phi.id] = r;
+
+          auto partial_of = [&](ir::Value& value) -> long {
+            if (value.index() != 1 || !partial.count(value.reg().id))
+              return -1;
+
+            return (long)partial[value.reg().id];
+          };
+
+          auto operand = [&](ir::Value& value) {
+            if (value.index() == 1 && vectors.count(value.reg().id))
+              return true;
+
+            return invariant(plan, value);
+          };
+
+          for (uint b : plan.body) {
+            for (ir::Instruction& inst : fn.blocks[b].body) {
+              switch (inst.index()) {
+                case 15: // ElemLoad
+                {
+                  ir::ElemLoad& load = std::get<15>(inst);
+                  if (!same(load.index, plan.iv) || !element(plan, load.dst.type)) {
+                    reject(plan, "an element isn't accessed at the induction variable");
+                    return false;
+                  }
+
+                  vectors[load.dst.id] = true;
+                  memory = true;
+                  continue;
+                }
+                case 16: // ElemStore
+                {
+                  ir::ElemStore& store = std::get<16>(inst);
+                  if (!same(store.index, plan.iv) || !element(plan, store.array.type) || !operand(store.src)) {
+                    reject(plan, "an element isn't accessed at the induction variable");
+                    return false;
+                  }
+
+                  memory = true;
+                  continue;
+                }
+                case 2: // BinOp
+                {
+                  ir::BinOp& binop = std::get<2>(inst);
+                  if (binop.dst.id == plan.next.id)
+                    continue;
+
+                  long lhs = partial_of(binop.lhs), rhs = partial_of(binop.rhs);
+                  if (lhs >= 0 || rhs >= 0) {
+                    bool sum = (binop.op == ir::BinOp::Op::Add && (lhs < 0 ? operand(binop.lhs) : operand(binop.rhs))) ||
+                               (binop.op == ir::BinOp::Op::Sub && lhs >= 0 && operand(binop.rhs));
+
+                    if (!sum) {
+                      reject(plan, "a partial sum is used by something else than a sum");
+                      return false;
+                    }
+
+                    partial[binop.dst.id] = (lhs >= 0) ? lhs : rhs;
+                    continue;
+                  }
+
+                  bool fp = binop.dst.type.kind == ir::Type::Kind::Float;
+                  bool supported_op;
+
+                  // packed 32-bit multiplication ("pmulld") needs AVX2 here,
+                  // plain SSE2 has no packed 64-bit one
+                  switch (binop.op) {
+                    case ir::BinOp::Op::Add:
+                    case ir::BinOp::Op::Sub:
+                      supported_op = true;
+                      break;
+                    case ir::BinOp::Op::Mul:
+                      supported_op = fp || (width == 32 && binop.dst.type.size == 4);
+                      break;
+                    case ir::BinOp::Op::Div:
+                      supported_op = fp;
+                      break;
+                    default:
+                      supported_op = false;
+                      break;
+                  }
+
+                  if (!supported_op || !element(plan, binop.dst.type) || !operand(binop.lhs) || !operand(binop.rhs)) {
+                    reject(plan, "an operation has no vector form");
+                    return false;
+                  }
+
+                  vectors[binop.dst.id] = true;
+                  continue;
+                }
+                default:
+                  reject(plan, "an operation has no vector form");
+                  return false;
+              }
+            }
+          }
+
+          for (size_t r = 0; r < plan.reductions.size(); ++r) {
+            auto it = partial.find(plan.reductions[r].next.id);
+            if (it == partial.end() || it->second != r) {
+              reject(plan, "%" + std::to_string(plan.reductions[r].phi.id) + " isn't a sum");
+              return false;
+            }
+          }
+
+          if (!memory) {
+            reject(plan, "no array is accessed");
+            return false;
+          }
+
+          return true;
+        }
+
+        ir::VirtReg fresh(ir::Type type) {
+          return ir::VirtReg{ .id = fn.nregs++, .type = type };
+        }
+
+        void transform(Plan& plan) {
+          uint lanes = width / plan.size;
+          Loop& loop = info.loops[plan.loop];
+
+          uint vheader = fn.blocks.size();
+          uint vbody = vheader + 1;
+          uint mid = vheader + 2;
+          fn.blocks.resize(fn.blocks.size() + 3);
+
+          auto vector_type = [&](ir::Type type) {
+            type.lanes = lanes;
+            return type;
+          };
+
+          // the preheader computes the bound of the vector loop and the
+          // vectors of everything invariant
+          std::vector<ir::Instruction> setup;
+          std::unordered_map<uint, ir::VirtReg> splats;
+          std::unordered_map<uint, ir::VirtReg> vectors;
+
+          auto vector = [&](const ir::Value& value, ir::Type type) -> ir::Value {
+            if (value.index() == 1) {
+              uint id = value.reg().id;
+              if (vectors.count(id))
+                return vectors[id];
+              if (splats.count(id))
+                return splats[id];
+            }
+
+            ir::VirtReg dst = fresh(vector_type(type));
+            setup.push_back(ir::Splat{ .value = value, .dst = dst });
+
+            if (value.index() == 1)
+              splats[value.reg().id] = dst;
+
+            return dst;
+          };
+
+          // `iv < bound - (lanes - 1)`: the whole vector is in range
+          ir::Value limit;
+          ir::Constant rest{ .type = plan.iv.type, .value = (int64_t)(lanes - 1) };
+
+          if (plan.bound.index() == 0) {
+            ir::Constant bound = fn.constant(plan.bound);
+            bound.type = plan.iv.type;
+            bound.value = std::get<0>(bound.value) - (int64_t)(lanes - 1);
+            limit = fn.intern(bound);
+          } else {
+            ir::VirtReg dst = fresh(plan.iv.type);
+            setup.push_back(ir::BinOp{ .op = ir::BinOp::Op::Sub, .lhs = plan.bound, .rhs = fn.intern(rest), .dst = dst });
+            limit = dst;
+          }
+
+          // vector header
+          ir::VirtReg vi = fresh(plan.iv.type);
+          ir::VirtReg vi_next = fresh(plan.iv.type);
+          std::vector<ir::VirtReg> sums;
+
+          ir::Block& vh = fn.blocks[vheader];
+          vh.body.push_back(ir::Phi{ .incoming = { { plan.pre, plan.init }, { vbody, vi_next } }, .dst = vi });
+
+          // every lane sums its own iterations, starting from zero
+          for (Reduction& reduction : plan.reductions) {
+            ir::Constant zero = (reduction.phi.type.kind == ir::Type::Kind::Float) ? make_constant(reduction.phi.type, 0.0)
+                                                                                   : make_constant(reduction.phi.type, (int64_t)0);
+            ir::Value start = vector(fn.intern(zero), reduction.phi.type);
+
+            sums.push_back(fresh(vector_type(reduction.phi.type)));
+            vectors[reduction.phi.id] = sums.back();
+            vh.body.push_back(ir::Phi{ .incoming = { { plan.pre, start } }, .dst = sums.back() });
+          }
+
+          ir::Type bool_type{ .kind = ir::Type::Kind::Int, .size = 1, .is_void = false };
+          ir::VirtReg test = fresh(bool_type);
+          vh.body.push_back(ir::Cmp{ .pred = ir::Cmp::Pred::Lt, .lhs = vi, .rhs = limit, .dst = test });
+          vh.terminator = ir::CondBranch{ .cond = test, .then_block = vbody, .else_block = mid };
+          vh.terminated = true;
+
+          // vector body, the scalar instructions with vector types
+          std::vector<ir::Instruction> body;
+          for (uint b : plan.body) {
+            for (ir::Instruction& inst : fn.blocks[b].body) {
+              switch (inst.index()) {
+                case 15: // ElemLoad
+                {
+                  ir::ElemLoad& load = std::get<15>(inst);
+                  ir::VirtReg dst = fresh(vector_type(load.dst.type));
+                  vectors[load.dst.id] = dst;
+                  body.push_back(ir::ElemLoad{ .array = load.array, .index = vi, .dst = dst });
+                  break;
+                }
+                case 16: // ElemStore
+                {
+                  ir::ElemStore& store = std::get<16>(inst);
+                  ir::Value src = vector(store.src, store.array.type);
+                  body.push_back(ir::ElemStore{ .src = src, .array = store.array, .index = vi });
+                  break;
+                }
+                case 2: // BinOp
+                {
+                  ir::BinOp& binop = std::get<2>(inst);
+                  if (binop.dst.id == plan.next.id)
+                    break;
+
+                  ir::Value lhs = vector(binop.lhs, binop.dst.type);
+                  ir::Value rhs = vector(binop.rhs, binop.dst.type);
+                  ir::VirtReg dst = fresh(vector_type(binop.dst.type));
+                  vectors[binop.dst.id] = dst;
+                  body.push_back(ir::BinOp{ .op = binop.op, .lhs = lhs, .rhs = rhs, .dst = dst });
+                  break;
+                }
+              }
+            }
+          }
+
+          ir::Constant step{ .type = plan.iv.type, .value = (int64_t)lanes };
+          body.push_back(ir::BinOp{ .op = ir::BinOp::Op::Add, .lhs = vi, .rhs = fn.intern(step), .dst = vi_next });
+
+          ir::Block& vb = fn.blocks[vbody];
+          vb.body = std::move(body);
+          vb.terminator = ir::Branch{ .target = vheader };
+          vb.terminated = true;
+
+          for (size_t r = 0; r < plan.reductions.size(); ++r)
+            std::get<13>(vh.body[1 + r]).incoming.push_back({ vbody, vectors[plan.reductions[r].next.id] });
+
+          // the scalar loop starts where the vector one stopped, with the
+          // lanes of each sum added together
+          ir::Block& m = fn.blocks[mid];
+          std::unordered_map<uint, ir::Value> starts = { { plan.iv.id, vi } };
+
+          for (size_t r = 0; r < plan.reductions.size(); ++r) {
+            Reduction& reduction = plan.reductions[r];
+            ir::VirtReg lanes_sum = fresh(reduction.phi.type);
+            ir::VirtReg start = fresh(reduction.phi.type);
+
+            m.body.push_back(ir::ReduceAdd{ .value = sums[r], .dst = lanes_sum });
+            m.body.push_back(ir::BinOp{ .op = ir::BinOp::Op::Add, .lhs = reduction.init, .rhs = lanes_sum, .dst = start });
+            starts[reduction.phi.id] = start;
+          }
+
+          m.terminator = ir::Branch{ .target = loop.header };
+          m.terminated = true;
+
+          for (ir::Instruction& inst : fn.blocks[loop.header].body) {
+            if (inst.index() != 13)
+              break;
+
+            ir::Phi& phi = std::get<13>(inst);
+            for (auto& [pred, value] : phi.incoming) {
+              if (pred == plan.pre) {
+                pred = mid;
+                value = starts[phi.dst.id];
+              }
+            }
+          }
+
+          // the preheader enters the vector loop instead
+          ir::Block& pre = fn.blocks[plan.pre];
+          pre.body.insert(pre.body.end(), setup.begin(), setup.end());
+          pre.terminator = ir::Branch{ .target = vheader };
+
+          rebuild_cfg(fn);
+        }
+
+        bool run() {
+          for (uint l = 0; l < info.loops.size(); ++l) {
+            Plan plan{};
+            plan.loop = l;
+            plan.pre = info.preheader(fn, l);
+
+            def_block.assign(fn.nregs, Loops::NONE);
+            for (uint b = 0; b < fn.blocks.size(); ++b)
+              for (ir::Instruction& inst : fn.blocks[b].body)
+                if (ir::VirtReg* reg = ir::defined_register(inst))
+                  def_block[reg->id] = b;
+
+            if (!shape(plan) || !reductions(plan) || !body(plan))
+              continue;
+
+            transform(plan);
+            vectorized++;
+
+            uint lanes = width / plan.size;
+            ctx.remarks.add("vectorize", "loop bb" + std::to_string(info.loops[l].header) + " in @" + fn.name +
+                                             " vectorized, " + std::to_string(lanes) + " lanes");
+          }
+
+          ctx.stats.add("vectorize", "loops vectorized", vectorized);
+          return vectorized != 0;
+        }
+      };
+    } // namespace
+
+    bool vectorize(ir::Function& fn, Context& ctx) {
+      Loops& info = ctx.analyses.get<Loops>(fn);
+      if (info.loops.empty())
+        return false;
+
+      // xmm registers with SSE2, ymm ones with AVX2
+      uint width = ctx.opts.avx2 ? 32 : 16;
+      return Vectorizer(fn, ctx, info, width).run();
+    }
+  } // namespace opt
+} // namespace phantom
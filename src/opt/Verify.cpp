@@ -0,0 +1,246 @@
+#include "irgen/Cfg.hpp"
+#include "opt/Passes.hpp"
+#include <algorithm>
+#include <unordered_set>
+
+namespace phantom {
+  namespace opt {
+    namespace {
+      struct Verifier {
+        ir::Function& fn;
+        Context& ctx;
+
+        Verifier(ir::Function& fn, Context& ctx)
+            : fn(fn), ctx(ctx) {}
+
+        std::unordered_set<uint> defined; // parameters, allocas and instruction results
+        std::unordered_set<uint> arrays;  // allocas of more than one element
+
+        [[noreturn]] void fail(const std::string& message) {
+          ctx.logger.log(Logger::Level::FATAL, "IR verification failed in @" + fn.name + ": " + message, true);
+          std::abort();
+        }
+
+        void use(ir::Value& value) {
+          if (value.index() == 1)
+            use(value.reg());
+          else if ((value.ref & ~ir::Value::CONSTANT) >= fn.constants.size())
+            fail("constant outside of the function's pool");
+        }
+        void use(const ir::VirtReg& reg) {
+          if (defined.find(reg.id) == defined.end())
+            fail("use of undefined register %" + std::to_string(reg.id));
+        }
+
+        void def(ir::VirtReg& reg) {
+          if (reg.id >= fn.nregs)
+            fail("register %" + std::to_string(reg.id) + " is out of the function's range");
+
+          if (!defined.insert(reg.id).second)
+            fail("register %" + std::to_string(reg.id) + " defined twice");
+        }
+        template <typename Cast>
+        void cast(Cast& cast) {
+          use(cast.value);
+        }
+        void compare(ir::Cmp& cmp) {
+          use(cmp.lhs);
+          use(cmp.rhs);
+          same_type(ir::type_of(cmp.lhs), ir::type_of(cmp.rhs), "comparison %" + std::to_string(cmp.dst.id));
+        }
+        // kind, width and lanes, whether it's signed isn't part of a type
+        void same_type(ir::Type a, ir::Type b, const std::string& what) {
+          if (a.kind != b.kind || a.size != b.size || a.lanes != b.lanes)
+            fail(what + " of mismatched types");
+        }
+        void array(ir::VirtReg& reg) {
+          use(reg);
+          if (arrays.find(reg.id) == arrays.end())
+            fail("%" + std::to_string(reg.id) + " is indexed but isn't an array");
+        }
+
+        // checks the operands, definitions are collected by `run()`
+        void instruction(ir::Instruction& inst) {
+          switch (inst.index()) {
+            case 0: // Alloca
+              break;
+            case 1: // Store
+            {
+              ir::Store& store = std::get<1>(inst);
+              use(store.src);
+              use(store.dst);
+              break;
+            }
+            case 2: // BinOp
+            {
+              ir::BinOp& binop = std::get<2>(inst);
+              use(binop.lhs);
+              use(binop.rhs);
+              same_type(ir::type_of(binop.lhs), binop.dst.type, "operation %" + std::to_string(binop.dst.id));
+              same_type(ir::type_of(binop.rhs), binop.dst.type, "operation %" + std::to_string(binop.dst.id));
+              break;
+            }
+            case 3: // UnOp
+            {
+              ir::UnOp& unop = std::get<3>(inst);
+              use(unop.operand);
+              break;
+            }
+            // clang-format off
+            case 4:  cast(std::get<4>(inst));  break; // Int2Float
+            case 5:  cast(std::get<5>(inst));  break; // Int2Double
+            case 6:  cast(std::get<6>(inst));  break; // Float2Int
+            case 7:  cast(std::get<7>(inst));  break; // Float2Double
+            case 8:  cast(std::get<8>(inst));  break; // Double2Int
+            case 9:  cast(std::get<9>(inst));  break; // Double2Float
+            case 10: cast(std::get<10>(inst)); break; // IntExtend
+            case 11: compare(std::get<11>(inst)); break; // Cmp
+            case 12: // Load
+              use(std::get<12>(inst).src);
+              break;
+            case 13: // Phi
+              for (auto& [pred, value] : std::get<13>(inst).incoming) {
+                use(value);
+                same_type(ir::type_of(value), std::get<13>(inst).dst.type, "phi %" + std::to_string(std::get<13>(inst).dst.id));
+              }
+              break;
+            case 14: // Call
+              for (ir::Value& arg : std::get<14>(inst).args)
+                use(arg);
+              break;
+            case 15: // ElemLoad
+              array(std::get<15>(inst).array);
+              use(std::get<15>(inst).index);
+              break;
+            case 16: // ElemStore
+              use(std::get<16>(inst).src);
+              array(std::get<16>(inst).array);
+              use(std::get<16>(inst).index);
+              break;
+            case 17: // Splat
+              use(std::get<17>(inst).value);
+              if (std::get<17>(inst).dst.type.lanes < 2)
+                fail("splat %" + std::to_string(std::get<17>(inst).dst.id) + " doesn't define a vector");
+              break;
+            case 18: // ReduceAdd
+              use(std::get<18>(inst).value);
+              if (ir::type_of(std::get<18>(inst).value).lanes < 2)
+                fail("reduction %" + std::to_string(std::get<18>(inst).dst.id) + " of a scalar");
+              break;
+            case 19: // Fma
+            {
+              ir::Fma& fma = std::get<19>(inst);
+              use(fma.a());
+              use(fma.b());
+              use(fma.c());
+              same_type(ir::type_of(fma.a()), fma.dst.type, "fma %" + std::to_string(fma.dst.id));
+              same_type(ir::type_of(fma.b()), fma.dst.type, "fma %" + std::to_string(fma.dst.id));
+              same_type(ir::type_of(fma.c()), fma.dst.type, "fma %" + std::to_string(fma.dst.id));
+              if (fma.dst.type.kind != ir::Type::Kind::Float)
+                fail("fma %" + std::to_string(fma.dst.id) + " of integers");
+              break;
+            }
+            case 20: // Count
+              break;
+            default: unreachable();
+              // clang-format on
+          }
+        }
+
+        void phi(ir::Phi& phi, uint index) {
+          std::vector<uint> blocks;
+          for (auto& [pred, value] : phi.incoming)
+            blocks.push_back(pred);
+
+          std::vector<uint> preds = fn.blocks[index].preds;
+          std::sort(blocks.begin(), blocks.end());
+          std::sort(preds.begin(), preds.end());
+
+          if (blocks != preds)
+            fail("phi %" + std::to_string(phi.dst.id) + " doesn't match the predecessors of bb" + std::to_string(index));
+        }
+
+        void run() {
+          if (fn.blocks.empty())
+            fail("defined function without an entry block");
+
+          for (ir::VirtReg& param : fn.params)
+            def(param);
+
+          // blocks aren't laid out in dominance order, collect every
+          // definition before checking the uses
+          for (ir::Block& block : fn.blocks)
+            for (ir::Instruction& inst : block.body) {
+              if (ir::VirtReg* reg = ir::defined_register(inst))
+                def(*reg);
+
+              if (inst.index() == 0 && std::get<0>(inst).count != 0)
+                arrays.insert(std::get<0>(inst).reg.id);
+            }
+
+          for (uint i = 0; i < fn.blocks.size(); ++i)
+            block(i);
+        }
+
+        void block(uint index) {
+          ir::Block& block = fn.blocks[index];
+          bool leading = true;
+
+          for (ir::Instruction& inst : block.body) {
+            if (inst.index() == 13) {
+              if (!leading)
+                fail("phi in the middle of bb" + std::to_string(index));
+
+              phi(std::get<13>(inst), index);
+            } else
+              leading = false;
+
+            instruction(inst);
+          }
+
+          if (!block.terminated) {
+            if (!block.succs.empty())
+              fail("unterminated block bb" + std::to_string(index) + " has successors");
+
+            return;
+          }
+
+          std::vector<uint> succs = ir::successors(block.terminator);
+          for (uint succ : succs) {
+            if (succ >= fn.blocks.size())
+              fail("bb" + std::to_string(index) + " branches to a block that doesn't exist");
+
+            std::vector<uint>& preds = fn.blocks[succ].preds;
+            if (std::find(preds.begin(), preds.end(), index) == preds.end())
+              fail("bb" + std::to_string(index) + " is missing from the predecessors of bb" + std::to_string(succ));
+          }
+
+          if (succs != block.succs)
+            fail("stale successor list in bb" + std::to_string(index));
+
+          switch (block.terminator.index()) {
+            case 0: // Return
+            {
+              ir::Return& ret = std::get<0>(block.terminator);
+              use(ret.value);
+
+              ir::Type type = ir::type_of(ret.value);
+              if (type.kind != fn.return_type.kind || (!fn.return_type.is_void && type.size != fn.return_type.size))
+                fail("return type mismatch");
+
+              break;
+            }
+            case 2: // CondBranch
+              use(std::get<2>(block.terminator).cond);
+              break;
+          }
+        }
+      };
+    } // namespace
+
+    bool verify(ir::Function& fn, Context& ctx) {
+      Verifier(fn, ctx).run();
+      return false;
+    }
+  } // namespace opt
+} // namespace phantom
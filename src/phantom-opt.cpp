@@ -0,0 +1,52 @@
+#include "Driver.hpp"
+#include "info.hpp"
+#include "irgen/Text.hpp"
+#include "opt/PassManager.hpp"
+
+using namespace phantom;
+
+// Runs a pass pipeline over textual IR and prints the result, the way to
+// look at (and measure) the optimizer without the front end:
+//
+//   phantom --emit ir -O0 file.ph > file.ir
+//   phantom-opt --passes=mem2reg,sccp file.ir
+//
+// takes the options of `phantom`, per-pass timings and instruction count
+// deltas always go to stderr.
+int main(int argc, char* argv[]) {
+  Logger logger;
+
+  Driver driver(std::vector<std::string>(argv + 0, argv + argc), logger);
+  Options opts = driver.parse_options();
+
+  if (opts.print == "passes") {
+    opt::PassManager::print_registry(stdout);
+    return 0;
+  }
+
+  FileInfo file = read_file(opts.source_file, logger);
+  Location::file = file;
+
+  ir::Program prog = ir::parse_program(file.content, logger);
+
+  {
+    opt::PassManager pm(prog, opts, logger);
+
+    // the parser only checks the syntax, the verifier what the passes
+    // take for granted (operand types and the like)
+    pm.add("verify");
+    for (const std::string& name : opt::PassManager::pipeline(opts))
+      pm.add(name);
+
+    pm.run();
+
+    pm.print_timings(stderr);
+    if (opts.print_stats)
+      pm.print_statistics(stderr);
+    if (opts.print_remarks)
+      pm.print_remarks(stderr);
+  }
+
+  ir::print_program(prog, stdout);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "utils/parallel.hpp"
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phantom {
+  namespace utils {
+    namespace {
+      // the indices a thread still has to run: [begin, end), its owner takes
+      // them from the front and thieves from the back
+      struct Queue {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+      };
+
+      bool pop(Queue& queue, size_t& index) {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.begin == queue.end)
+          return false;
+
+        index = queue.begin++;
+        return true;
+      }
+
+      // moves the back half of `victim` into `thief`
+      bool steal(Queue& victim, Queue& thief) {
+        size_t begin, end;
+        {
+          std::lock_guard<std::mutex> guard(victim.lock);
+          size_t left = victim.end - victim.begin;
+          if (left == 0)
+            return false;
+
+          end = victim.end;
+          begin = victim.end - (left + 1) / 2;
+          victim.end = begin;
+        }
+
+        std::lock_guard<std::mutex> guard(thief.lock);
+        thief.begin = begin;
+        thief.end = end;
+        return true;
+      }
+    } // namespace
+
+    unsigned thread_count(unsigned jobs) {
+      if (jobs != 0)
+        return jobs;
+
+      unsigned cores = std::thread::hardware_concurrency();
+      return (cores == 0) ? 1 : cores;
+    }
+
+    void parallel_for(size_t n, unsigned threads, const std::function<void(size_t)>& body) {
+      if (threads > n)
+        threads = n;
+
+      if (threads <= 1) {
+        for (size_t i = 0; i < n; ++i)
+          body(i);
+        return;
+      }
+
+      std::vector<std::unique_ptr<Queue>> queues;
+      for (unsigned t = 0; t < threads; ++t) {
+        queues.push_back(std::make_unique<Queue>());
+        queues[t]->begin = n * t / threads;
+        queues[t]->end = n * (t + 1) / threads;
+      }
+
+      auto work = [&](unsigned self) {
+        Queue& queue = *queues[self];
+        size_t index;
+
+        for (;;) {
+          while (pop(queue, index))
+            body(index);
+
+          // nothing left here, look for work from the next thread on
+          bool stolen = false;
+          for (unsigned k = 1; k < threads && !stolen; ++k)
+            stolen = steal(*queues[(self + k) % threads], queue);
+
+          if (!stolen)
+            return;
+        }
+      };
+
+      std::vector<std::thread> workers;
+      for (unsigned t = 1; t < threads; ++t)
+        workers.emplace_back(work, t);
+
+      work(0);
+      for (std::thread& worker : workers)
+        worker.join();
+    }
+  } // namespace utils
+} // namespace phantom